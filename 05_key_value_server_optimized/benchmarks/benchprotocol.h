@@ -0,0 +1,125 @@
+#ifndef BENCH_PROTOCOL_H
+#define BENCH_PROTOCOL_H
+
+#include <arpa/inet.h> // sockaddr_in, inet_pton, htons
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * Raw protocol helpers shared by the benchmarks that need pipelining. `SocketClient` does one blocking
+ * send/receive pair per call, which cannot keep several requests in flight.
+ */
+
+inline constexpr size_t LEN_FIELD_SIZE{ 4 };
+
+/**
+ * Same wire format as RedisSerializer, but appended straight into a send buffer so large values are copied once.
+ * +---------+------+------+------+-----+------+------+
+ * |  nbytes | nstr | len0 | cmd0 | ... | lenn | cmdn |
+ * +---------+------+------+------+-----+------+------+
+ */
+inline void append_request(std::vector<uint8_t>& out, std::initializer_list<std::string_view> args)
+{
+    auto append_u32 = [&out](uint32_t v)
+    {
+        auto const* p = reinterpret_cast<uint8_t const*>(&v);
+        out.insert(out.end(), p, p + LEN_FIELD_SIZE);
+    };
+
+    uint32_t nbytes = LEN_FIELD_SIZE;
+    for ( auto const& arg : args )
+        nbytes += LEN_FIELD_SIZE + arg.size();
+
+    append_u32(nbytes);
+    append_u32(static_cast<uint32_t>(args.size()));
+    for ( auto const& arg : args )
+    {
+        append_u32(static_cast<uint32_t>(arg.size()));
+        out.insert(out.end(), arg.begin(), arg.end());
+    }
+}
+
+/**
+ * Size of the complete response frame starting at `data`, 0 if fewer than a full frame is available.
+ * +-----------+-------------+------+
+ * | resp_size | resp_status | data |
+ * +-----------+-------------+------+
+ */
+inline size_t response_frame_size(uint8_t const* data, size_t available) noexcept
+{
+    if ( available < LEN_FIELD_SIZE )
+        return 0;
+
+    uint32_t resp_size{};
+    std::memcpy(&resp_size, data, LEN_FIELD_SIZE);
+    if ( available < LEN_FIELD_SIZE + resp_size )
+        return 0;
+    return LEN_FIELD_SIZE + resp_size;
+}
+
+inline int connect_tcp(std::string const& host, int const port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if ( fd < 0 )
+        throw std::runtime_error("Failed to create socket");
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if ( inet_pton(AF_INET, host.c_str(), &addr.sin_addr) <= 0 )
+    {
+        close(fd);
+        throw std::runtime_error("Invalid address " + host);
+    }
+
+    if ( connect(fd, (sockaddr const*)&addr, sizeof(addr)) < 0 )
+    {
+        close(fd);
+        throw std::runtime_error("Failed to connect to " + host + ":" + std::to_string(port) +
+                                 " err: " + std::strerror(errno));
+    }
+
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    return fd;
+}
+
+inline int connect_unix(std::string const& path)
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if ( path.size() >= sizeof(addr.sun_path) )
+        throw std::runtime_error("Unix socket path is too long: " + path);
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ( fd < 0 )
+        throw std::runtime_error("Failed to create socket");
+
+    if ( connect(fd, (sockaddr const*)&addr, sizeof(addr)) < 0 )
+    {
+        close(fd);
+        throw std::runtime_error("Failed to connect to " + path + " err: " + std::strerror(errno));
+    }
+    return fd;
+}
+
+// `host` containing a '/' is treated as the path of the server's unix socket, `port` is then ignored
+inline int connect_socket(std::string const& host, int const port)
+{
+    if ( host.find('/') != std::string::npos )
+        return connect_unix(host);
+    return connect_tcp(host, port);
+}
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+#include <vector>
+
+/**
+ * Log-linear latency histogram in the spirit of HdrHistogram.
+ *
+ * Values (nanoseconds) below 2^SUB_BUCKET_BITS are stored exactly. Above that every power of two is split into
+ * 2^(SUB_BUCKET_BITS - 1) linear buckets, so any recorded value is reported with a relative error below 0.1%.
+ * Recording is a couple of shifts and an increment, which keeps it cheap enough to call on every response.
+ */
+class LatencyHistogram
+{
+public:
+    static constexpr uint32_t SUB_BUCKET_BITS{ 11 };
+    static constexpr uint32_t MAX_VALUE_BITS{ 48 }; // ~78 hours in ns
+    static constexpr uint64_t MAX_TRACKABLE_VALUE{ (uint64_t{ 1 } << MAX_VALUE_BITS) - 1 };
+
+    LatencyHistogram() : counts_(bucket_index(MAX_TRACKABLE_VALUE) + 1, 0)
+    {
+    }
+
+    void record(uint64_t value, uint64_t count = 1) noexcept
+    {
+        value = std::min(value, MAX_TRACKABLE_VALUE);
+        counts_[bucket_index(value)] += count;
+        total_count_ += count;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+        sum_ += static_cast<double>(value) * count;
+    }
+
+    void merge(LatencyHistogram const& other) noexcept
+    {
+        for ( size_t i = 0; i < counts_.size(); i++ )
+            counts_[i] += other.counts_[i];
+
+        total_count_ += other.total_count_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+        sum_ += other.sum_;
+    }
+
+    void reset() noexcept
+    {
+        std::fill(counts_.begin(), counts_.end(), 0);
+        total_count_ = 0;
+        min_ = std::numeric_limits<uint64_t>::max();
+        max_ = 0;
+        sum_ = 0;
+    }
+
+    [[nodiscard]] uint64_t count() const noexcept
+    {
+        return total_count_;
+    }
+
+    [[nodiscard]] uint64_t min() const noexcept
+    {
+        return total_count_ ? min_ : 0;
+    }
+
+    [[nodiscard]] uint64_t max() const noexcept
+    {
+        return max_;
+    }
+
+    [[nodiscard]] double mean() const noexcept
+    {
+        return total_count_ ? sum_ / total_count_ : 0.0;
+    }
+
+    /**
+     * Smallest recorded value v such that `percentile` percent of all samples are <= v.
+     * Reported as the upper edge of the bucket (clamped to the observed max).
+     */
+    [[nodiscard]] uint64_t value_at_percentile(double percentile) const noexcept
+    {
+        if ( total_count_ == 0 )
+            return 0;
+
+        percentile = std::clamp(percentile, 0.0, 100.0);
+        auto target = static_cast<uint64_t>(percentile / 100.0 * static_cast<double>(total_count_) + 0.5);
+        target = std::clamp<uint64_t>(target, 1, total_count_);
+
+        uint64_t seen{ 0 };
+        for ( size_t i = 0; i < counts_.size(); i++ )
+        {
+            seen += counts_[i];
+            if ( seen >= target )
+                return std::min(highest_equivalent_value(i), max_);
+        }
+        return max_;
+    }
+
+    [[nodiscard]] double stddev() const noexcept
+    {
+        if ( total_count_ == 0 )
+            return 0.0;
+
+        double const avg = mean();
+        double sq_sum{ 0 };
+        for ( size_t i = 0; i < counts_.size(); i++ )
+        {
+            if ( counts_[i] == 0 )
+                continue;
+            double const dev = static_cast<double>(highest_equivalent_value(i)) - avg;
+            sq_sum += dev * dev * counts_[i];
+        }
+        return std::sqrt(sq_sum / total_count_);
+    }
+
+    /**
+     * Write the full percentile spectrum in HdrHistogram's text format (values scaled by `scale`, e.g. 1e6 for ms):
+     *       Value     Percentile TotalCount 1/(1-Percentile)
+     * Percentile levels halve the remaining distance to 100% every `ticks_per_half_distance` rows, so the tail up to
+     * p99.99 and beyond gets as many rows as the body.
+     */
+    void output_percentile_distribution(std::ostream& os, double scale, uint32_t ticks_per_half_distance = 5) const
+    {
+        os << std::setw(12) << "Value" << std::setw(15) << "Percentile" << std::setw(11) << "TotalCount"
+           << std::setw(17) << "1/(1-Percentile)" << "\n\n";
+
+        if ( total_count_ == 0 )
+            return;
+
+        auto row = [&](double percentile)
+        {
+            uint64_t const value = value_at_percentile(percentile);
+            uint64_t const below = count_at_or_below(value);
+            os << std::fixed << std::setprecision(3) << std::setw(12) << value / scale << std::setprecision(12)
+               << std::setw(15) << percentile / 100.0 << std::setw(11) << below;
+            if ( percentile < 100.0 )
+                os << std::setprecision(2) << std::setw(17) << 1.0 / (1.0 - percentile / 100.0);
+            os << "\n";
+        };
+
+        for ( uint32_t half = 0;; half++ )
+        {
+            double const lo = 100.0 * (1.0 - std::ldexp(1.0, -static_cast<int>(half)));
+            double const hi = 100.0 * (1.0 - std::ldexp(1.0, -static_cast<int>(half) - 1));
+            // Stop once the remaining distance is finer than one sample
+            if ( (100.0 - lo) / 100.0 * total_count_ < 1.0 )
+                break;
+            for ( uint32_t tick = 0; tick < ticks_per_half_distance; tick++ )
+                row(lo + (hi - lo) * tick / ticks_per_half_distance);
+        }
+        row(100.0);
+
+        os << std::fixed << std::setprecision(3) << "#[Mean    = " << std::setw(12) << mean() / scale
+           << ", StdDeviation   = " << std::setw(12) << stddev() / scale << "]\n"
+           << "#[Max     = " << std::setw(12) << max_ / scale << ", Total count    = " << std::setw(12) << total_count_
+           << "]\n";
+    }
+
+private:
+    static constexpr uint64_t SUB_BUCKET_COUNT{ uint64_t{ 1 } << SUB_BUCKET_BITS };
+    static constexpr uint64_t SUB_BUCKET_HALF{ SUB_BUCKET_COUNT >> 1 };
+
+    std::vector<uint64_t> counts_;
+    uint64_t total_count_{ 0 };
+    uint64_t min_{ std::numeric_limits<uint64_t>::max() };
+    uint64_t max_{ 0 };
+    double sum_{ 0 };
+
+    uint64_t count_at_or_below(uint64_t value) const noexcept
+    {
+        uint64_t seen{ 0 };
+        size_t const last = bucket_index(std::min(value, MAX_TRACKABLE_VALUE));
+        for ( size_t i = 0; i <= last; i++ )
+            seen += counts_[i];
+        return seen;
+    }
+
+    static size_t bucket_index(uint64_t value) noexcept
+    {
+        if ( value < SUB_BUCKET_COUNT )
+            return value;
+
+        // Keep the top SUB_BUCKET_BITS bits of the value, `shift` says how many low bits were dropped
+        uint32_t const msb = 63 - std::countl_zero(value);
+        uint32_t const shift = msb - (SUB_BUCKET_BITS - 1);
+        return shift * SUB_BUCKET_HALF + (value >> shift);
+    }
+
+    static uint64_t highest_equivalent_value(size_t index) noexcept
+    {
+        if ( index < SUB_BUCKET_COUNT )
+            return index;
+
+        uint64_t const shift = index / SUB_BUCKET_HALF - 1;
+        uint64_t const mantissa = index - shift * SUB_BUCKET_HALF;
+        return ((mantissa + 1) << shift) - 1;
+    }
+};
+
+#endif
@@ -1,10 +1,15 @@
+#include "benchprotocol.h"
 #include "client.h"
+#include "histogram.h"
 
+#include <atomic>
 #include <chrono>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <numeric>
+#include <random>
+#include <thread>
 /**
  * This method assumes no pipelining
  */
@@ -29,8 +34,8 @@ std::vector<std::vector<std::string>> generate_cmds(size_t num_cmds)
     return cmds;
 }
 
-void calc_latency(SocketClient<TcpTransport, RedisSerializer, RedisDeserializer>& client,
-                  std::vector<double>& latencies, std::vector<std::string>& cmd)
+template <class Client>
+void calc_latency(Client& client, std::vector<double>& latencies, std::vector<std::string>& cmd)
 {
     for ( size_t i = 0; i < latencies.size(); i++ )
     {
@@ -72,8 +77,8 @@ void calc_output(std::vector<double>& latencies)
     ofs << avg << '\n';
 }
 
-void run_benchmark(SocketClient<TcpTransport, RedisSerializer, RedisDeserializer>& client, RedisSerializer& serializer,
-                   size_t num_req, size_t num_iter)
+template <class Client>
+void run_benchmark(Client& client, RedisSerializer& serializer, size_t num_req, size_t num_iter)
 {
     std::vector<double> latencies(num_req);
 
@@ -88,29 +93,329 @@ void run_benchmark(SocketClient<TcpTransport, RedisSerializer, RedisDeserializer
     }
 }
 
-int main(int argc, char* argv[])
+template <class Transport>
+void run_closed_loop(std::string const& addr, int const port)
 {
-    if ( argc < 3 )
+    Transport transport;
+    RedisSerializer serializer;
+    RedisDeserializer deserializer;
+
+    SocketClient<Transport, RedisSerializer, RedisDeserializer> client(transport, serializer, deserializer);
+
+    client.connect(addr, port); // TODO: probably should return bool if connection was successful
+
+    constexpr size_t num_requests{ 1000 }; // Num of latencies to be averaged for one plot point
+    constexpr size_t num_iterations{ 20 }; // Num of plot points to see how server scales with a larger request
+
+    run_benchmark(client, serializer, num_requests, num_iterations);
+}
+
+/**
+ * Open-loop mode: requests are issued on a fixed schedule (request i is due at start + i / rate) regardless of how
+ * fast the server answers, and latency is measured from the *intended* send time. A server stall therefore shows up
+ * as latency for every request that should have been sent during the stall, instead of silently lowering the request
+ * rate as the closed-loop mode does (coordinated omission).
+ */
+struct OpenLoopConfig
+{
+    double rate{ 10000 };   // requests per second
+    double duration{ 10 };  // seconds
+    size_t value_size{ 32 };
+    size_t key_count{ 1000 };
+    std::string output_file{ "latency_hgrm.txt" };
+};
+
+void run_open_loop(std::string const& addr, int const port, OpenLoopConfig const& cfg)
+{
+    using Clock = std::chrono::steady_clock;
+
+    int const fd = connect_socket(addr, port);
+
+    auto const total_requests = static_cast<uint64_t>(cfg.rate * cfg.duration);
+    auto const interval = std::chrono::duration<double>(1.0 / cfg.rate);
+    auto const start = Clock::now() + std::chrono::milliseconds(10);
+
+    // Responses arrive in request order on a single connection, so request i's intended send time can be recomputed
+    // by the receiver from its index instead of being passed between threads.
+    auto intended_time = [&](uint64_t i)
+    { return start + std::chrono::duration_cast<Clock::duration>(interval * static_cast<double>(i)); };
+
+    std::atomic<bool> send_failed{ false };
+    std::thread sender(
+        [&]()
+        {
+            std::string const value(cfg.value_size, '*');
+            std::vector<uint8_t> buf;
+
+            for ( uint64_t next = 0; next < total_requests; )
+            {
+                std::this_thread::sleep_until(intended_time(next));
+
+                // Catch up on everything that is due, a late wakeup must not shift the schedule
+                buf.clear();
+                auto const now = Clock::now();
+                for ( ; next < total_requests && intended_time(next) <= now; next++ )
+                {
+                    std::string const key = "key:" + std::to_string(next % cfg.key_count);
+                    append_request(buf, { "set", key, value });
+                }
+
+                for ( size_t off = 0; off < buf.size(); )
+                {
+                    ssize_t sent = ::send(fd, buf.data() + off, buf.size() - off, MSG_NOSIGNAL);
+                    if ( sent < 0 )
+                    {
+                        send_failed = true;
+                        return;
+                    }
+                    off += sent;
+                }
+            }
+        });
+
+    LatencyHistogram histogram{};
+    std::vector<uint8_t> incoming;
+    size_t in_off{ 0 };
+    uint64_t received{ 0 };
+    uint8_t chunk[64 * 1024];
+
+    while ( received < total_requests && !send_failed )
     {
-        std::cout << "Input needs to be of the form: ./req_per_sec SERVER PORT";
-        return 1;
+        ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+        if ( n <= 0 )
+            break;
+        incoming.insert(incoming.end(), chunk, chunk + n);
+
+        auto const now = Clock::now();
+        for ( size_t frame; (frame = response_frame_size(incoming.data() + in_off, incoming.size() - in_off)) != 0;
+              in_off += frame )
+        {
+            auto const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - intended_time(received));
+            histogram.record(ns.count());
+            received++;
+        }
+        incoming.erase(incoming.begin(), incoming.begin() + in_off);
+        in_off = 0;
     }
 
-    TcpTransport transport;
+    sender.join();
+    ::close(fd);
+
+    if ( received < total_requests )
+        std::cout << "Connection closed after " << received << " of " << total_requests << " responses\n";
+
+    auto ms = [](uint64_t ns) { return ns / 1e6; };
+    std::cout << "\nOpen-loop Latency Metrics (milliseconds), target rate " << cfg.rate << " req/s:\n";
+    std::cout << " Average Latency : " << histogram.mean() / 1e6 << " ms\n";
+    std::cout << " Minimum Latency : " << ms(histogram.min()) << " ms\n";
+    std::cout << " Maximum Latency : " << ms(histogram.max()) << " ms\n";
+    std::cout << "Median Latency  : " << ms(histogram.value_at_percentile(50)) << " ms\n";
+    std::cout << "99th Percentile : " << ms(histogram.value_at_percentile(99)) << " ms\n";
+    std::cout << "99.9th Percentile : " << ms(histogram.value_at_percentile(99.9)) << " ms\n";
+    std::cout << "99.99th Percentile : " << ms(histogram.value_at_percentile(99.99)) << " ms\n";
+
+    std::ofstream hgrm(cfg.output_file);
+    histogram.output_percentile_distribution(hgrm, 1e6);
+    std::cout << "Percentile spectrum written to " << cfg.output_file << "\n";
+}
+
+/**
+ * Client-side caching mode: one connection reads keys with a skewed distribution (index = key_count * u^3, so half of
+ * the reads go to the hottest eighth of the keys) at read_rate while a second one overwrites keys of the same
+ * distribution at write_rate. Run once with tracking off and once with it on, reporting the hit rate of the in-process
+ * cache and the latency of every get() as the application sees it, hits included. Reads are paced like an application
+ * that does some work between them; a reader spinning on cache hits would otherwise starve the server on a small
+ * machine and turn every miss into a wait for the scheduler.
+ */
+struct CacheConfig
+{
+    size_t reads{ 200000 };
+    double read_rate{ 20000 }; // reads per second
+    size_t key_count{ 10000 };
+    double write_rate{ 1000 }; // writes per second
+    size_t value_size{ 32 };
+};
+
+template <class Transport>
+void run_client_cache(std::string const& addr, int const port, CacheConfig const& cfg, bool const tracking)
+{
+    using Clock = std::chrono::steady_clock;
     RedisSerializer serializer;
     RedisDeserializer deserializer;
 
-    SocketClient<TcpTransport, RedisSerializer, RedisDeserializer> client(transport, serializer, deserializer);
+    auto skewed_key = [&cfg](std::mt19937& rng)
+    {
+        double const u = std::uniform_real_distribution<double>(0, 1)(rng);
+        return "key:" + std::to_string(static_cast<size_t>(cfg.key_count * u * u * u));
+    };
+
+    Transport writer_transport;
+    SocketClient<Transport, RedisSerializer, RedisDeserializer> writer(writer_transport, serializer, deserializer);
+    writer.connect(addr, port);
+    std::string const value(cfg.value_size, '*');
+    for ( size_t i = 0; i < cfg.key_count; i++ )
+    {
+        std::vector<std::string> cmd{ "set", "key:" + std::to_string(i), value };
+        writer.send_message(cmd);
+        writer.receive_message();
+    }
+
+    std::atomic<bool> done{ false };
+    std::thread writer_thread(
+        [&]()
+        {
+            std::mt19937 rng{ 2 };
+            auto const interval = std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(1.0 / cfg.write_rate));
+            for ( auto next = Clock::now(); !done; next += interval )
+            {
+                std::this_thread::sleep_until(next);
+                std::vector<std::string> cmd{ "set", skewed_key(rng), value };
+                writer.send_message(cmd);
+                writer.receive_message();
+            }
+        });
+
+    Transport transport;
+    SocketClient<Transport, RedisSerializer, RedisDeserializer> client(transport, serializer, deserializer);
+    client.connect(addr, port);
+    if ( tracking && !client.enable_tracking() )
+        throw std::runtime_error("client tracking on was refused");
+
+    std::mt19937 rng{ 1 };
+    LatencyHistogram histogram{};
+    auto const read_interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / cfg.read_rate));
+    auto next_read = Clock::now();
+    for ( size_t i = 0; i < cfg.reads; i++, next_read += read_interval )
+    {
+        std::this_thread::sleep_until(next_read);
+        std::string const key = skewed_key(rng);
+        auto const start = Clock::now();
+        client.get(key);
+        histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+    }
+    done = true;
+    writer_thread.join();
+
+    size_t const lookups = client.cache_hits() + client.cache_misses();
+    auto us = [](uint64_t ns) { return ns / 1e3; };
+    std::cout << "\nClient cache, tracking " << (tracking ? "on" : "off") << ", " << cfg.read_rate << " reads/s, "
+              << cfg.write_rate << " writes/s (microseconds):\n";
+    std::cout << " Hit Rate        : " << (lookups ? 100.0 * client.cache_hits() / lookups : 0.0) << " %\n";
+    std::cout << " Average Latency : " << histogram.mean() / 1e3 << " us\n";
+    std::cout << "Median Latency  : " << us(histogram.value_at_percentile(50)) << " us\n";
+    std::cout << "99th Percentile : " << us(histogram.value_at_percentile(99)) << " us\n";
+    std::cout << "99.9th Percentile : " << us(histogram.value_at_percentile(99.9)) << " us\n";
+}
+
+template <class Transport>
+int run_client_cache_comparison(std::string const& addr, int const port, int argc, char* argv[])
+{
+    CacheConfig cfg{};
+    for ( int i = 4; i + 1 < argc; i += 2 )
+    {
+        std::string const arg = argv[i];
+        if ( arg == "--reads" )
+            cfg.reads = std::stoul(argv[i + 1]);
+        else if ( arg == "--key-count" )
+            cfg.key_count = std::stoul(argv[i + 1]);
+        else if ( arg == "--read-rate" )
+            cfg.read_rate = std::stod(argv[i + 1]);
+        else if ( arg == "--write-rate" )
+            cfg.write_rate = std::stod(argv[i + 1]);
+        else if ( arg == "--value-size" )
+            cfg.value_size = std::stoul(argv[i + 1]);
+        else
+        {
+            std::cout << "Unknown option " << arg << "\n";
+            return 1;
+        }
+    }
+
+    try
+    {
+        run_client_cache<Transport>(addr, port, cfg, false);
+        run_client_cache<Transport>(addr, port, cfg, true);
+    }
+    catch ( std::exception const& e )
+    {
+        std::cout << "Client cache benchmark failed: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if ( argc < 3 )
+    {
+        std::cout << "Input needs to be of the form: ./latency SERVER|UNIX_SOCKET_PATH|shm:UNIX_SOCKET_PATH PORT [--rate REQ_PER_SEC] [--duration SEC] "
+                     "[--value-size N] [--key-count N] [--output FILE]\n"
+                     "       ./latency SERVER|UNIX_SOCKET_PATH|shm:UNIX_SOCKET_PATH PORT --client-cache [--reads N] "
+                     "[--read-rate READS_PER_SEC] [--key-count N] [--write-rate WRITES_PER_SEC] [--value-size N]";
+        return 1;
+    }
 
     std::string const addr = argv[1];
-    size_t const port = std::stoi(argv[2]);
+    int const port = std::stoi(argv[2]);
 
-    client.connect(addr, port); // TODO: probably should return bool if connection was successful
+    if ( argc > 3 && std::string(argv[3]) == "--client-cache" )
+    {
+        if ( is_shm_address(addr) )
+            return run_client_cache_comparison<ShmTransport>(addr, port, argc, argv);
+        if ( is_unix_socket_address(addr) )
+            return run_client_cache_comparison<UnixTransport>(addr, port, argc, argv);
+        return run_client_cache_comparison<TcpTransport>(addr, port, argc, argv);
+    }
 
-    constexpr size_t num_requests{ 1000 }; // Num of latencies to be averaged for one plot point
-    constexpr size_t num_iterations{ 20 }; // Num of plot points to see how server scales with a larger request
+    if ( argc > 3 )
+    {
+        if ( is_shm_address(addr) )
+        {
+            std::cout << "Open-loop mode needs a socket, use the closed-loop mode for shm: addresses\n";
+            return 1;
+        }
 
-    run_benchmark(client, serializer, num_requests, num_iterations);
+        OpenLoopConfig cfg{};
+        for ( int i = 3; i + 1 < argc; i += 2 )
+        {
+            std::string const arg = argv[i];
+            if ( arg == "--rate" )
+                cfg.rate = std::stod(argv[i + 1]);
+            else if ( arg == "--duration" )
+                cfg.duration = std::stod(argv[i + 1]);
+            else if ( arg == "--value-size" )
+                cfg.value_size = std::stoul(argv[i + 1]);
+            else if ( arg == "--key-count" )
+                cfg.key_count = std::stoul(argv[i + 1]);
+            else if ( arg == "--output" )
+                cfg.output_file = argv[i + 1];
+            else
+            {
+                std::cout << "Unknown option " << arg << "\n";
+                return 1;
+            }
+        }
+
+        try
+        {
+            run_open_loop(addr, port, cfg);
+        }
+        catch ( std::exception const& e )
+        {
+            std::cout << "Open-loop benchmark failed: " << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    if ( is_shm_address(addr) )
+        run_closed_loop<ShmTransport>(addr, port);
+    else if ( is_unix_socket_address(addr) )
+        run_closed_loop<UnixTransport>(addr, port);
+    else
+        run_closed_loop<TcpTransport>(addr, port);
 
     return 0;
-}
\ No newline at end of file
+}
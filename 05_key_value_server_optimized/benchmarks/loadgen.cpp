@@ -0,0 +1,818 @@
+#include "benchprotocol.h"
+#include "histogram.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * memtier-style load generator.
+ *
+ * threads x connections sockets are opened up front, every connection keeps `pipeline` requests in flight and a new
+ * request is issued as soon as a response comes back (closed loop). Latency is measured per request from the moment it
+ * is queued on the socket until its response is parsed.
+ *
+ * ./loadgen --threads 4 --connections 8 --pipeline 16 --ratio 1:10 --key-pattern zipf --value-size 32:70,1024:30
+ *
+ * With `--replicas` the connections of each thread are spread round-robin over the primary and its replicas. Replica
+ * connections only issue gets, so running with an increasing number of replicas shows how read throughput scales.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+enum class KeyPattern
+{
+    UNIFORM,
+    ZIPF,
+    HOTSPOT,
+};
+
+enum class OpType : uint8_t
+{
+    GET,
+    SET,
+};
+
+struct LoadgenConfig
+{
+    std::string host{ "127.0.0.1" };
+    int port{ 1234 };
+    size_t threads{ 4 };
+    size_t connections{ 8 }; // per thread
+    size_t pipeline{ 1 };
+    size_t requests{ 10000 }; // per connection, ignored when test_time is set
+    double test_time{ 0 };    // seconds
+    uint32_t set_ratio{ 1 };
+    uint32_t get_ratio{ 10 };
+    uint64_t key_count{ 100000 };
+    std::string key_prefix{ "key:" };
+    KeyPattern key_pattern{ KeyPattern::UNIFORM };
+    double zipf_exponent{ 0.99 };
+    double hot_key_fraction{ 0.01 };
+    double hot_access_fraction{ 0.9 };
+    std::string value_size{ "32" };
+    bool prepopulate{ false };
+    uint64_t seed{ 42 };
+    std::string json_file{};
+    std::vector<std::pair<std::string, int>> replicas{}; // Read-only nodes, see --replicas
+};
+
+// ======================================== Distributions ========================================
+
+/**
+ * Zipfian generator from Gray et al. "Quickly Generating Billion-Record Synthetic Databases" (as used by YCSB).
+ * zeta(n) is computed once and shared by all threads, sampling is O(1).
+ */
+class ZipfDistribution
+{
+public:
+    ZipfDistribution(uint64_t n, double theta) : n_(n), theta_(theta)
+    {
+        if ( theta <= 0.0 || theta >= 1.0 )
+            throw std::invalid_argument("zipf exponent must be in (0, 1)");
+
+        for ( uint64_t i = 1; i <= n_; i++ )
+            zetan_ += 1.0 / std::pow(static_cast<double>(i), theta_);
+
+        double const zeta2 = 1.0 + std::pow(0.5, theta_);
+        alpha_ = 1.0 / (1.0 - theta_);
+        eta_ = (1.0 - std::pow(2.0 / n_, 1.0 - theta_)) / (1.0 - zeta2 / zetan_);
+        half_pow_theta_ = 1.0 + std::pow(0.5, theta_);
+    }
+
+    template <class Rng>
+    uint64_t operator()(Rng& rng) const
+    {
+        double const u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double const uz = u * zetan_;
+        if ( uz < 1.0 )
+            return 0;
+        if ( uz < half_pow_theta_ )
+            return 1;
+        return std::min<uint64_t>(n_ - 1, static_cast<uint64_t>(n_ * std::pow(eta_ * u - eta_ + 1.0, alpha_)));
+    }
+
+private:
+    uint64_t n_;
+    double theta_;
+    double zetan_{ 0 };
+    double alpha_{ 0 };
+    double eta_{ 0 };
+    double half_pow_theta_{ 0 };
+};
+
+class KeyGenerator
+{
+public:
+    KeyGenerator(LoadgenConfig const& cfg, ZipfDistribution const* zipf) : cfg_(cfg), zipf_(zipf)
+    {
+        hot_keys_ = std::max<uint64_t>(1, static_cast<uint64_t>(cfg.key_count * cfg.hot_key_fraction));
+    }
+
+    template <class Rng>
+    uint64_t operator()(Rng& rng) const
+    {
+        switch ( cfg_.key_pattern )
+        {
+        case KeyPattern::ZIPF:
+            return (*zipf_)(rng);
+        case KeyPattern::HOTSPOT:
+        {
+            bool const hot = std::bernoulli_distribution(cfg_.hot_access_fraction)(rng);
+            if ( hot || hot_keys_ >= cfg_.key_count )
+                return std::uniform_int_distribution<uint64_t>(0, hot_keys_ - 1)(rng);
+            return std::uniform_int_distribution<uint64_t>(hot_keys_, cfg_.key_count - 1)(rng);
+        }
+        case KeyPattern::UNIFORM:
+        default:
+            return std::uniform_int_distribution<uint64_t>(0, cfg_.key_count - 1)(rng);
+        }
+    }
+
+private:
+    LoadgenConfig const& cfg_;
+    ZipfDistribution const* zipf_;
+    uint64_t hot_keys_;
+};
+
+/**
+ * Value sizes are given as
+ *  - "N"                 every value is N bytes
+ *  - "MIN-MAX"           uniformly distributed in [MIN, MAX]
+ *  - "S0:W0,S1:W1,..."   size Si with relative weight Wi
+ */
+class ValueSizeGenerator
+{
+public:
+    explicit ValueSizeGenerator(std::string const& spec)
+    {
+        if ( spec.find(':') != std::string::npos )
+        {
+            std::vector<double> weights;
+            std::stringstream ss(spec);
+            std::string item;
+            while ( std::getline(ss, item, ',') )
+            {
+                auto const colon = item.find(':');
+                if ( colon == std::string::npos )
+                    throw std::invalid_argument("bad weighted value size: " + item);
+                sizes_.push_back(std::stoul(item.substr(0, colon)));
+                weights.push_back(std::stod(item.substr(colon + 1)));
+            }
+            weighted_ = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+            mode_ = Mode::WEIGHTED;
+        }
+        else if ( auto const dash = spec.find('-'); dash != std::string::npos )
+        {
+            min_ = std::stoul(spec.substr(0, dash));
+            max_ = std::stoul(spec.substr(dash + 1));
+            if ( min_ > max_ )
+                throw std::invalid_argument("bad value size range: " + spec);
+            mode_ = Mode::RANGE;
+        }
+        else
+        {
+            min_ = max_ = std::stoul(spec);
+        }
+    }
+
+    template <class Rng>
+    size_t operator()(Rng& rng)
+    {
+        switch ( mode_ )
+        {
+        case Mode::WEIGHTED:
+            return sizes_[weighted_(rng)];
+        case Mode::RANGE:
+            return std::uniform_int_distribution<size_t>(min_, max_)(rng);
+        case Mode::FIXED:
+        default:
+            return min_;
+        }
+    }
+
+    [[nodiscard]] size_t max_size() const noexcept
+    {
+        if ( mode_ == Mode::WEIGHTED )
+            return *std::max_element(sizes_.begin(), sizes_.end());
+        return max_;
+    }
+
+private:
+    enum class Mode
+    {
+        FIXED,
+        RANGE,
+        WEIGHTED,
+    };
+
+    Mode mode_{ Mode::FIXED };
+    size_t min_{ 0 };
+    size_t max_{ 0 };
+    std::vector<size_t> sizes_;
+    std::discrete_distribution<size_t> weighted_;
+};
+
+// ======================================== Worker ========================================
+
+struct WorkerStats
+{
+    LatencyHistogram get_latency{};
+    LatencyHistogram set_latency{};
+    uint64_t hits{ 0 };
+    uint64_t misses{ 0 };
+    uint64_t errors{ 0 };
+    uint64_t bytes_sent{ 0 };
+    uint64_t bytes_received{ 0 };
+};
+
+class Worker
+{
+public:
+    Worker(LoadgenConfig const& cfg, ZipfDistribution const* zipf, size_t id)
+        : cfg_(cfg), keys_(cfg, zipf), value_sizes_(cfg.value_size), rng_(cfg.seed + id), id_(id),
+          value_(value_sizes_.max_size(), 'x')
+    {
+        epoll_fd_ = epoll_create1(0);
+        if ( epoll_fd_ == -1 )
+            throw std::runtime_error("Failed to create epoll fd");
+
+        conns_.resize(cfg.connections);
+        for ( size_t i = 0; i < conns_.size(); i++ )
+        {
+            // Connection 0 always goes to the primary, prepopulate() relies on it
+            size_t const node = i % (cfg.replicas.size() + 1);
+            if ( node == 0 )
+                conns_[i].fd = connect_socket(cfg.host, cfg.port);
+            else
+            {
+                conns_[i].fd = connect_socket(cfg.replicas[node - 1].first, cfg.replicas[node - 1].second);
+                conns_[i].read_only = true;
+            }
+
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.u64 = i;
+            epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, conns_[i].fd, &ev);
+        }
+    }
+
+    ~Worker()
+    {
+        for ( auto& conn : conns_ )
+            close(conn.fd);
+        close(epoll_fd_);
+    }
+
+    Worker(Worker const&) = delete;
+    Worker& operator=(Worker const&) = delete;
+
+    /**
+     * Set every key this worker owns (keys are striped across workers) with a fixed pipeline depth so that get
+     * requests in the measured run hit.
+     */
+    void prepopulate(size_t num_workers)
+    {
+        auto& conn = conns_.front();
+        constexpr size_t BATCH{ 128 };
+
+        for ( uint64_t key = id_; key < cfg_.key_count; )
+        {
+            size_t batch{ 0 };
+            for ( ; batch < BATCH && key < cfg_.key_count; batch++, key += num_workers )
+            {
+                make_key(key);
+                append_request(conn.outgoing, { "set", key_buf_, value_view() });
+            }
+            flush_blocking(conn);
+
+            for ( size_t received = 0; received < batch; )
+            {
+                if ( !receive(conn) )
+                    throw std::runtime_error("Connection closed during prepopulate");
+                for ( size_t frame; (frame = next_frame(conn)) != 0; received++ )
+                    conn.in_off += frame;
+            }
+            compact(conn.incoming, conn.in_off);
+        }
+    }
+
+    void run()
+    {
+        deadline_ = cfg_.test_time > 0 ? Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                                            std::chrono::duration<double>(cfg_.test_time))
+                                       : Clock::time_point::max();
+
+        for ( size_t i = 0; i < conns_.size(); i++ )
+        {
+            for ( size_t p = 0; p < cfg_.pipeline && can_issue(conns_[i]); p++ )
+                issue(conns_[i]);
+            flush(i);
+        }
+
+        std::vector<epoll_event> events(conns_.size());
+        while ( active_ > 0 )
+        {
+            int const n = epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), 100);
+            for ( int e = 0; e < n; e++ )
+            {
+                size_t const idx = events[e].data.u64;
+                auto& conn = conns_[idx];
+
+                if ( events[e].events & EPOLLOUT )
+                    flush(idx);
+
+                if ( events[e].events & (EPOLLIN | EPOLLERR | EPOLLHUP) )
+                {
+                    if ( !receive(conn) )
+                    {
+                        retire(conn);
+                        continue;
+                    }
+                    drain_responses(conn);
+
+                    while ( conn.in_flight.size() < cfg_.pipeline && can_issue(conn) )
+                        issue(conn);
+                    flush(idx);
+
+                    if ( conn.in_flight.empty() && !can_issue(conn) )
+                        retire(conn);
+                }
+            }
+        }
+    }
+
+    [[nodiscard]] WorkerStats const& stats() const noexcept
+    {
+        return stats_;
+    }
+
+private:
+    struct InFlight
+    {
+        Clock::time_point sent;
+        OpType op;
+    };
+
+    struct LoadConnection
+    {
+        int fd{ -1 };
+        std::vector<uint8_t> outgoing{};
+        size_t out_off{ 0 };
+        std::vector<uint8_t> incoming{};
+        size_t in_off{ 0 };
+        std::deque<InFlight> in_flight{};
+        uint64_t issued{ 0 };
+        bool done{ false };
+        bool read_only{ false }; // Connected to a replica
+    };
+
+    static constexpr size_t RECV_CHUNK{ 64 * 1024 };
+
+    LoadgenConfig const& cfg_;
+    KeyGenerator keys_;
+    ValueSizeGenerator value_sizes_;
+    std::mt19937_64 rng_;
+    size_t id_;
+
+    int epoll_fd_{ -1 };
+    std::vector<LoadConnection> conns_;
+    size_t active_{ cfg_.connections };
+    Clock::time_point deadline_{};
+
+    std::string value_;
+    std::string key_buf_;
+    size_t value_len_{ 0 };
+
+    WorkerStats stats_{};
+
+    std::string_view value_view() const noexcept
+    {
+        return std::string_view(value_).substr(0, value_len_ ? value_len_ : value_.size());
+    }
+
+    void make_key(uint64_t key)
+    {
+        key_buf_.assign(cfg_.key_prefix);
+        key_buf_ += std::to_string(key);
+    }
+
+    bool can_issue(LoadConnection const& conn) const noexcept
+    {
+        if ( cfg_.test_time > 0 )
+            return Clock::now() < deadline_;
+        return conn.issued < cfg_.requests;
+    }
+
+    void issue(LoadConnection& conn)
+    {
+        make_key(keys_(rng_));
+
+        uint32_t const roll = std::uniform_int_distribution<uint32_t>(1, cfg_.set_ratio + cfg_.get_ratio)(rng_);
+        OpType const op = roll <= cfg_.set_ratio && !conn.read_only ? OpType::SET : OpType::GET;
+
+        if ( op == OpType::SET )
+        {
+            value_len_ = value_sizes_(rng_);
+            append_request(conn.outgoing, { "set", key_buf_, value_view() });
+        }
+        else
+        {
+            append_request(conn.outgoing, { "get", key_buf_ });
+        }
+
+        conn.in_flight.push_back({ Clock::now(), op });
+        conn.issued++;
+    }
+
+    void flush(size_t idx)
+    {
+        auto& conn = conns_[idx];
+        while ( conn.out_off < conn.outgoing.size() )
+        {
+            ssize_t sent = ::send(conn.fd, conn.outgoing.data() + conn.out_off, conn.outgoing.size() - conn.out_off,
+                                  MSG_NOSIGNAL | MSG_DONTWAIT);
+            if ( sent < 0 )
+            {
+                if ( errno == EAGAIN || errno == EWOULDBLOCK )
+                    break;
+                throw std::runtime_error(std::string("send failed: ") + std::strerror(errno));
+            }
+            conn.out_off += sent;
+            stats_.bytes_sent += sent;
+        }
+
+        bool const pending = conn.out_off < conn.outgoing.size();
+        if ( !pending )
+        {
+            conn.outgoing.clear();
+            conn.out_off = 0;
+        }
+
+        epoll_event ev{};
+        ev.events = EPOLLIN | (pending ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+        ev.data.u64 = idx;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn.fd, &ev);
+    }
+
+    void flush_blocking(LoadConnection& conn)
+    {
+        while ( conn.out_off < conn.outgoing.size() )
+        {
+            ssize_t sent =
+                ::send(conn.fd, conn.outgoing.data() + conn.out_off, conn.outgoing.size() - conn.out_off, MSG_NOSIGNAL);
+            if ( sent < 0 )
+                throw std::runtime_error(std::string("send failed: ") + std::strerror(errno));
+            conn.out_off += sent;
+        }
+        conn.outgoing.clear();
+        conn.out_off = 0;
+    }
+
+    bool receive(LoadConnection& conn)
+    {
+        size_t const old_size = conn.incoming.size();
+        conn.incoming.resize(old_size + RECV_CHUNK);
+
+        ssize_t received = ::recv(conn.fd, conn.incoming.data() + old_size, RECV_CHUNK, 0);
+        if ( received <= 0 )
+        {
+            conn.incoming.resize(old_size);
+            return received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+
+        conn.incoming.resize(old_size + received);
+        stats_.bytes_received += received;
+        return true;
+    }
+
+    static size_t next_frame(LoadConnection const& conn) noexcept
+    {
+        return response_frame_size(conn.incoming.data() + conn.in_off, conn.incoming.size() - conn.in_off);
+    }
+
+    static void compact(std::vector<uint8_t>& buf, size_t& off)
+    {
+        buf.erase(buf.begin(), buf.begin() + off);
+        off = 0;
+    }
+
+    void drain_responses(LoadConnection& conn)
+    {
+        auto const now = Clock::now();
+        for ( size_t frame; (frame = next_frame(conn)) != 0; conn.in_off += frame )
+        {
+            if ( conn.in_flight.empty() )
+                throw std::runtime_error("Received a response without an outstanding request");
+
+            auto const req = conn.in_flight.front();
+            conn.in_flight.pop_front();
+
+            uint8_t const status = conn.incoming[conn.in_off + LEN_FIELD_SIZE];
+            if ( status == 0 )
+                stats_.hits += req.op == OpType::GET;
+            else if ( status == 2 )
+                stats_.misses++;
+            else
+                stats_.errors++;
+
+            auto const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - req.sent).count();
+            (req.op == OpType::GET ? stats_.get_latency : stats_.set_latency).record(ns);
+        }
+        compact(conn.incoming, conn.in_off);
+    }
+
+    void retire(LoadConnection& conn)
+    {
+        if ( conn.done )
+            return;
+
+        stats_.errors += conn.in_flight.size();
+        conn.in_flight.clear();
+        conn.done = true;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn.fd, nullptr);
+        active_--;
+    }
+};
+
+// ======================================== Reporting ========================================
+
+void print_latency(std::ostream& os, std::string const& name, LatencyHistogram const& h)
+{
+    auto us = [](uint64_t ns) { return ns / 1000.0; };
+    os << std::left << std::setw(6) << name << std::right << std::fixed << std::setprecision(3) << std::setw(12)
+       << h.count() << std::setw(12) << h.mean() / 1000.0 << std::setw(12) << us(h.value_at_percentile(50))
+       << std::setw(12) << us(h.value_at_percentile(99)) << std::setw(12) << us(h.value_at_percentile(99.9))
+       << std::setw(12) << us(h.value_at_percentile(99.99)) << std::setw(12) << us(h.max()) << "\n";
+}
+
+void json_latency(std::ostream& os, LatencyHistogram const& h)
+{
+    auto us = [](uint64_t ns) { return ns / 1000.0; };
+    os << "{\"count\": " << h.count() << ", \"min\": " << us(h.min()) << ", \"mean\": " << h.mean() / 1000.0
+       << ", \"p50\": " << us(h.value_at_percentile(50)) << ", \"p90\": " << us(h.value_at_percentile(90))
+       << ", \"p99\": " << us(h.value_at_percentile(99)) << ", \"p99_9\": " << us(h.value_at_percentile(99.9))
+       << ", \"p99_99\": " << us(h.value_at_percentile(99.99)) << ", \"max\": " << us(h.max()) << "}";
+}
+
+std::string key_pattern_name(KeyPattern p)
+{
+    switch ( p )
+    {
+    case KeyPattern::ZIPF:
+        return "zipf";
+    case KeyPattern::HOTSPOT:
+        return "hotspot";
+    case KeyPattern::UNIFORM:
+    default:
+        return "uniform";
+    }
+}
+
+void write_json(LoadgenConfig const& cfg, WorkerStats const& total, LatencyHistogram const& all, double elapsed)
+{
+    std::ofstream ofs(cfg.json_file);
+    if ( !ofs )
+        throw std::runtime_error("Failed to open " + cfg.json_file);
+
+    ofs << std::fixed << std::setprecision(3);
+    ofs << "{\n  \"config\": {\"host\": \"" << cfg.host << "\", \"port\": " << cfg.port
+        << ", \"threads\": " << cfg.threads << ", \"connections\": " << cfg.connections
+        << ", \"pipeline\": " << cfg.pipeline << ", \"ratio\": \"" << cfg.set_ratio << ":" << cfg.get_ratio
+        << "\", \"key_count\": " << cfg.key_count << ", \"key_pattern\": \"" << key_pattern_name(cfg.key_pattern)
+        << "\", \"value_size\": \"" << cfg.value_size << "\", \"replicas\": " << cfg.replicas.size() << "},\n";
+    ofs << "  \"totals\": {\"ops\": " << all.count() << ", \"elapsed_sec\": " << elapsed
+        << ", \"ops_per_sec\": " << all.count() / elapsed << ", \"hits\": " << total.hits
+        << ", \"misses\": " << total.misses << ", \"errors\": " << total.errors
+        << ", \"bytes_sent\": " << total.bytes_sent << ", \"bytes_received\": " << total.bytes_received << "},\n";
+    ofs << "  \"latency_us\": {\n    \"all\": ";
+    json_latency(ofs, all);
+    ofs << ",\n    \"get\": ";
+    json_latency(ofs, total.get_latency);
+    ofs << ",\n    \"set\": ";
+    json_latency(ofs, total.set_latency);
+    ofs << "\n  }\n}\n";
+}
+
+// ======================================== CLI ========================================
+
+void usage()
+{
+    std::cout << "Usage: ./loadgen [options]\n"
+                 "  --host ADDR             server address, or unix socket path (127.0.0.1)\n"
+                 "  --port PORT             server port (1234)\n"
+                 "  --threads N             worker threads (4)\n"
+                 "  --connections N         connections per thread (8)\n"
+                 "  --pipeline N            requests in flight per connection (1)\n"
+                 "  --requests N            requests per connection (10000)\n"
+                 "  --test-time SEC         run for SEC seconds instead of a request count\n"
+                 "  --ratio SET:GET         set to get ratio (1:10)\n"
+                 "  --key-count N           size of the keyspace (100000)\n"
+                 "  --key-prefix STR        key prefix (key:)\n"
+                 "  --key-pattern P         uniform | zipf | hotspot (uniform)\n"
+                 "  --zipf-exp X            zipf exponent in (0, 1) (0.99)\n"
+                 "  --hot-keys F            hotspot: fraction of keys that are hot (0.01)\n"
+                 "  --hot-share F           hotspot: fraction of requests going to hot keys (0.9)\n"
+                 "  --value-size SPEC       N | MIN-MAX | S0:W0,S1:W1,... (32)\n"
+                 "  --prepopulate           set every key before the measured run\n"
+                 "  --seed N                random seed (42)\n"
+                 "  --json FILE             write machine-readable results to FILE\n"
+                 "  --replicas H:P,H:P,...  spread connections over these replicas too, they only get gets\n";
+}
+
+LoadgenConfig parse_args(int argc, char* argv[])
+{
+    LoadgenConfig cfg{};
+
+    for ( int i = 1; i < argc; i++ )
+    {
+        std::string const arg = argv[i];
+        auto value = [&]() -> std::string
+        {
+            if ( i + 1 >= argc )
+                throw std::invalid_argument("Missing value for " + arg);
+            return argv[++i];
+        };
+
+        if ( arg == "--host" )
+            cfg.host = value();
+        else if ( arg == "--port" )
+            cfg.port = std::stoi(value());
+        else if ( arg == "--threads" )
+            cfg.threads = std::stoul(value());
+        else if ( arg == "--connections" )
+            cfg.connections = std::stoul(value());
+        else if ( arg == "--pipeline" )
+            cfg.pipeline = std::stoul(value());
+        else if ( arg == "--requests" )
+            cfg.requests = std::stoul(value());
+        else if ( arg == "--test-time" )
+            cfg.test_time = std::stod(value());
+        else if ( arg == "--ratio" )
+        {
+            auto const ratio = value();
+            auto const colon = ratio.find(':');
+            if ( colon == std::string::npos )
+                throw std::invalid_argument("--ratio must look like SET:GET");
+            cfg.set_ratio = std::stoul(ratio.substr(0, colon));
+            cfg.get_ratio = std::stoul(ratio.substr(colon + 1));
+        }
+        else if ( arg == "--key-count" )
+            cfg.key_count = std::stoull(value());
+        else if ( arg == "--key-prefix" )
+            cfg.key_prefix = value();
+        else if ( arg == "--key-pattern" )
+        {
+            auto const p = value();
+            if ( p == "uniform" )
+                cfg.key_pattern = KeyPattern::UNIFORM;
+            else if ( p == "zipf" )
+                cfg.key_pattern = KeyPattern::ZIPF;
+            else if ( p == "hotspot" )
+                cfg.key_pattern = KeyPattern::HOTSPOT;
+            else
+                throw std::invalid_argument("Unknown key pattern " + p);
+        }
+        else if ( arg == "--zipf-exp" )
+            cfg.zipf_exponent = std::stod(value());
+        else if ( arg == "--hot-keys" )
+            cfg.hot_key_fraction = std::stod(value());
+        else if ( arg == "--hot-share" )
+            cfg.hot_access_fraction = std::stod(value());
+        else if ( arg == "--value-size" )
+            cfg.value_size = value();
+        else if ( arg == "--prepopulate" )
+            cfg.prepopulate = true;
+        else if ( arg == "--seed" )
+            cfg.seed = std::stoull(value());
+        else if ( arg == "--json" )
+            cfg.json_file = value();
+        else if ( arg == "--replicas" )
+        {
+            std::istringstream list(value());
+            for ( std::string node; std::getline(list, node, ','); )
+            {
+                auto const colon = node.rfind(':');
+                if ( colon == std::string::npos )
+                    throw std::invalid_argument("--replicas must look like HOST:PORT,HOST:PORT");
+                cfg.replicas.emplace_back(node.substr(0, colon), std::stoi(node.substr(colon + 1)));
+            }
+        }
+        else if ( arg == "--help" || arg == "-h" )
+        {
+            usage();
+            std::exit(0);
+        }
+        else
+            throw std::invalid_argument("Unknown option " + arg);
+    }
+
+    if ( cfg.threads == 0 || cfg.connections == 0 || cfg.pipeline == 0 || cfg.key_count == 0 )
+        throw std::invalid_argument("threads, connections, pipeline and key-count must be > 0");
+    if ( cfg.set_ratio + cfg.get_ratio == 0 )
+        throw std::invalid_argument("--ratio must not be 0:0");
+
+    return cfg;
+}
+
+int main(int argc, char* argv[])
+{
+    LoadgenConfig cfg{};
+    try
+    {
+        cfg = parse_args(argc, argv);
+    }
+    catch ( std::exception const& e )
+    {
+        std::cout << e.what() << "\n";
+        usage();
+        return 1;
+    }
+
+    try
+    {
+        std::unique_ptr<ZipfDistribution> zipf;
+        if ( cfg.key_pattern == KeyPattern::ZIPF )
+            zipf = std::make_unique<ZipfDistribution>(cfg.key_count, cfg.zipf_exponent);
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        for ( size_t t = 0; t < cfg.threads; t++ )
+            workers.push_back(std::make_unique<Worker>(cfg, zipf.get(), t));
+
+        if ( cfg.prepopulate )
+        {
+            std::vector<std::thread> threads;
+            for ( auto& w : workers )
+                threads.emplace_back([&w, &cfg]() { w->prepopulate(cfg.threads); });
+            for ( auto& t : threads )
+                t.join();
+            std::cout << "Prepopulated " << cfg.key_count << " keys\n";
+        }
+
+        auto const start_time = Clock::now();
+        std::vector<std::thread> threads;
+        for ( auto& w : workers )
+            threads.emplace_back([&w]() { w->run(); });
+        for ( auto& t : threads )
+            t.join();
+        double const elapsed = std::chrono::duration<double>(Clock::now() - start_time).count();
+
+        WorkerStats total{};
+        for ( auto const& w : workers )
+        {
+            auto const& s = w->stats();
+            total.get_latency.merge(s.get_latency);
+            total.set_latency.merge(s.set_latency);
+            total.hits += s.hits;
+            total.misses += s.misses;
+            total.errors += s.errors;
+            total.bytes_sent += s.bytes_sent;
+            total.bytes_received += s.bytes_received;
+        }
+
+        LatencyHistogram all{};
+        all.merge(total.get_latency);
+        all.merge(total.set_latency);
+
+        std::cout << "Threads: " << cfg.threads << ", Connections per thread: " << cfg.connections
+                  << ", Pipeline: " << cfg.pipeline << ", Replicas: " << cfg.replicas.size() << "\n";
+        std::cout << "Ops: " << all.count() << " in " << elapsed << " seconds\n";
+        std::cout << "Ops/sec: " << std::fixed << std::setprecision(1) << all.count() / elapsed << "\n";
+        std::cout << "Hits: " << total.hits << ", Misses: " << total.misses << ", Errors: " << total.errors << "\n\n";
+
+        std::cout << "Latency (microseconds):\n"
+                  << std::left << std::setw(6) << "Type" << std::right << std::setw(12) << "Ops" << std::setw(12)
+                  << "Avg" << std::setw(12) << "p50" << std::setw(12) << "p99" << std::setw(12) << "p99.9"
+                  << std::setw(12) << "p99.99" << std::setw(12) << "Max" << "\n";
+        print_latency(std::cout, "Gets", total.get_latency);
+        print_latency(std::cout, "Sets", total.set_latency);
+        print_latency(std::cout, "Total", all);
+
+        if ( !cfg.json_file.empty() )
+            write_json(cfg, total, all, elapsed);
+    }
+    catch ( std::exception const& e )
+    {
+        std::cout << "Load generator failed: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
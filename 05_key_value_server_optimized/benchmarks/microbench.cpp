@@ -0,0 +1,975 @@
+#include "benchprotocol.h"
+#include "mocks.h"
+#include "server.h"
+
+#include <array>
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * CPU-path microbenchmarks: parse_req, do_request and make_response are driven directly on a Server built from the
+ * mock wrappers, so there is no socket, syscall or network round trip in the measured loop.
+ *
+ * ./microbench --benchmark_filter=DoRequest
+ */
+
+using BenchServer = Server<MockSocketWrapper, MockEpollWrapper>;
+
+// ======================================== Util ========================================
+
+struct ServerHarness
+{
+    MockSocketWrapper sock;
+    MockEpollWrapper epoll;
+    BenchServer server{ 1234, sock, epoll };
+};
+
+std::string make_key(size_t i)
+{
+    return "key:" + std::to_string(i);
+}
+
+// Request body as seen by parse_req, i.e. without the leading nbytes field
+std::vector<uint8_t> make_body(std::vector<std::string> const& args)
+{
+    std::vector<uint8_t> frame;
+    auto append_u32 = [&frame](uint32_t v)
+    {
+        auto const* p = reinterpret_cast<uint8_t const*>(&v);
+        frame.insert(frame.end(), p, p + LEN_FIELD_SIZE);
+    };
+    append_u32(static_cast<uint32_t>(args.size()));
+    for ( auto const& arg : args )
+    {
+        append_u32(static_cast<uint32_t>(arg.size()));
+        frame.insert(frame.end(), arg.begin(), arg.end());
+    }
+    return frame;
+}
+
+void populate(BenchServer& server, size_t num_keys, size_t value_size)
+{
+    std::string const value(value_size, 'v');
+    for ( size_t i = 0; i < num_keys; i++ )
+    {
+        Response resp{};
+        server.do_request({ "set", make_key(i), value }, resp);
+    }
+}
+
+// Pre-built commands cycling over the keyspace in a random order, so the measured loop does not allocate them
+std::vector<std::vector<std::string>> make_cmds(std::string const& op, size_t num_keys, size_t count,
+                                                std::string const& value = {})
+{
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<size_t> dist(0, num_keys - 1);
+
+    std::vector<std::vector<std::string>> cmds(count);
+    for ( auto& cmd : cmds )
+    {
+        cmd = { op, make_key(dist(rng)) };
+        if ( !value.empty() )
+            cmd.push_back(value);
+    }
+    return cmds;
+}
+
+// ======================================== Parser ========================================
+
+static void BM_ParseReq(benchmark::State& state)
+{
+    size_t const num_args = state.range(0);
+    size_t const arg_size = state.range(1);
+
+    ServerHarness h;
+    std::vector<std::string> args(num_args, std::string(arg_size, 'a'));
+    auto const body = make_body(args);
+
+    for ( auto _ : state )
+    {
+        std::vector<std::string> parsed;
+        bool ok = h.server.parse_req(body.data(), body.size(), parsed);
+        benchmark::DoNotOptimize(ok);
+        benchmark::DoNotOptimize(parsed.data());
+    }
+
+    state.SetBytesProcessed(state.iterations() * body.size());
+}
+BENCHMARK(BM_ParseReq)->ArgsProduct({ { 1, 3, 16, 128 }, { 8, 256, 16 << 10 } });
+
+// ======================================== Dispatcher ========================================
+
+static void BM_DoRequestGet(benchmark::State& state)
+{
+    size_t const num_keys = state.range(0);
+
+    ServerHarness h;
+    populate(h.server, num_keys, 32);
+    auto const cmds = make_cmds("get", num_keys, 4096);
+
+    size_t i{ 0 };
+    for ( auto _ : state )
+    {
+        Response resp{};
+        h.server.do_request(cmds[i++ & 4095], resp);
+        benchmark::DoNotOptimize(resp.data.data());
+    }
+}
+BENCHMARK(BM_DoRequestGet)->RangeMultiplier(16)->Range(1 << 10, 1 << 20);
+
+static void BM_DoRequestGetMiss(benchmark::State& state)
+{
+    size_t const num_keys = state.range(0);
+
+    ServerHarness h;
+    populate(h.server, num_keys, 32);
+    auto cmds = make_cmds("get", num_keys, 4096);
+    for ( auto& cmd : cmds )
+        cmd[1] += ":missing";
+
+    size_t i{ 0 };
+    for ( auto _ : state )
+    {
+        Response resp{};
+        h.server.do_request(cmds[i++ & 4095], resp);
+        benchmark::DoNotOptimize(resp.status);
+    }
+}
+BENCHMARK(BM_DoRequestGetMiss)->RangeMultiplier(16)->Range(1 << 10, 1 << 20);
+
+static void BM_DoRequestSet(benchmark::State& state)
+{
+    size_t const num_keys = state.range(0);
+    size_t const value_size = state.range(1);
+
+    ServerHarness h;
+    populate(h.server, num_keys, value_size);
+    auto const cmds = make_cmds("set", num_keys, 4096, std::string(value_size, 'w'));
+
+    size_t i{ 0 };
+    for ( auto _ : state )
+    {
+        Response resp{};
+        h.server.do_request(cmds[i++ & 4095], resp);
+        benchmark::DoNotOptimize(resp.data.data());
+    }
+}
+BENCHMARK(BM_DoRequestSet)->ArgsProduct({ { 1 << 10, 1 << 16, 1 << 20 }, { 32, 4096 } });
+
+static void BM_DoRequestDel(benchmark::State& state)
+{
+    size_t const num_keys = state.range(0);
+
+    ServerHarness h;
+    populate(h.server, num_keys, 32);
+
+    std::vector<std::vector<std::string>> cmds(num_keys);
+    for ( size_t k = 0; k < num_keys; k++ )
+        cmds[k] = { "del", make_key(k) };
+
+    size_t i{ 0 };
+    for ( auto _ : state )
+    {
+        if ( i == num_keys )
+        {
+            // Keyspace drained, refill it outside of the measurement
+            state.PauseTiming();
+            populate(h.server, num_keys, 32);
+            i = 0;
+            state.ResumeTiming();
+        }
+
+        Response resp{};
+        h.server.do_request(cmds[i++], resp);
+        benchmark::DoNotOptimize(resp.status);
+    }
+}
+BENCHMARK(BM_DoRequestDel)->RangeMultiplier(16)->Range(1 << 10, 1 << 20);
+
+// ======================================== Sorted Sets ========================================
+
+// One sorted set with `num_members` members, scores 0..num_members-1
+void populate_zset(BenchServer& server, size_t num_members)
+{
+    std::vector<std::string> cmd{ "zadd", "zset" };
+    for ( size_t i = 0; i < num_members; i++ )
+    {
+        cmd.push_back(std::to_string(i));
+        cmd.push_back("member:" + std::to_string(i));
+    }
+    Response resp{};
+    server.do_request(cmd, resp);
+}
+
+// Whole set by rank, the range queries leaderboards run
+static void BM_DoRequestZRange(benchmark::State& state)
+{
+    size_t const num_members = state.range(0);
+
+    ServerHarness h;
+    populate_zset(h.server, num_members);
+    std::vector<std::string> const cmd{ "zrange", "zset", "0", "-1", "withscores" };
+
+    for ( auto _ : state )
+    {
+        Response resp{};
+        h.server.do_request(cmd, resp);
+        benchmark::DoNotOptimize(resp.data.data());
+    }
+
+    state.SetItemsProcessed(state.iterations() * num_members);
+}
+BENCHMARK(BM_DoRequestZRange)->RangeMultiplier(10)->Range(100, 100000)->Unit(benchmark::kMicrosecond);
+
+// 100 members from the middle of the set by score
+static void BM_DoRequestZRangeByScore(benchmark::State& state)
+{
+    size_t const num_members = state.range(0);
+
+    ServerHarness h;
+    populate_zset(h.server, num_members);
+    std::vector<std::string> const cmd{ "zrangebyscore", "zset", std::to_string(num_members / 2),
+                                        std::to_string(num_members / 2 + 99) };
+
+    for ( auto _ : state )
+    {
+        Response resp{};
+        h.server.do_request(cmd, resp);
+        benchmark::DoNotOptimize(resp.data.data());
+    }
+}
+BENCHMARK(BM_DoRequestZRangeByScore)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMicrosecond);
+
+static void BM_DoRequestZRank(benchmark::State& state)
+{
+    size_t const num_members = state.range(0);
+
+    ServerHarness h;
+    populate_zset(h.server, num_members);
+    std::mt19937_64 rng(42);
+    std::vector<std::vector<std::string>> cmds(4096);
+    for ( auto& cmd : cmds )
+        cmd = { "zrank", "zset", "member:" + std::to_string(rng() % num_members) };
+
+    size_t i{ 0 };
+    for ( auto _ : state )
+    {
+        Response resp{};
+        h.server.do_request(cmds[i++ & 4095], resp);
+        benchmark::DoNotOptimize(resp.data.data());
+    }
+}
+BENCHMARK(BM_DoRequestZRank)->RangeMultiplier(10)->Range(1000, 1000000);
+
+// ======================================== Hashes ========================================
+
+// hget on one hash with `num_fields` fields, packed up to HASH_MAX_PACKED_ENTRIES and a hash table beyond
+static void BM_DoRequestHGet(benchmark::State& state)
+{
+    size_t const num_fields = state.range(0);
+
+    ServerHarness h;
+    std::vector<std::string> hset{ "hset", "hash" };
+    for ( size_t i = 0; i < num_fields; i++ )
+    {
+        hset.push_back("field:" + std::to_string(i));
+        hset.push_back("value:" + std::to_string(i));
+    }
+    Response created{};
+    h.server.do_request(hset, created);
+
+    std::mt19937_64 rng(42);
+    std::vector<std::vector<std::string>> cmds(4096);
+    for ( auto& cmd : cmds )
+        cmd = { "hget", "hash", "field:" + std::to_string(rng() % num_fields) };
+
+    size_t i{ 0 };
+    for ( auto _ : state )
+    {
+        Response resp{};
+        h.server.do_request(cmds[i++ & 4095], resp);
+        benchmark::DoNotOptimize(resp.data.data());
+    }
+}
+BENCHMARK(BM_DoRequestHGet)->Arg(4)->Arg(16)->Arg(32)->Arg(64)->Arg(65)->Arg(1024);
+
+// ======================================== Counters ========================================
+
+// incr on an integer-encoded value
+static void BM_DoRequestIncr(benchmark::State& state)
+{
+    ServerHarness h;
+    std::vector<std::string> const incr{ "incr", "counter" };
+
+    for ( auto _ : state )
+    {
+        Response resp{};
+        h.server.do_request(incr, resp);
+        benchmark::DoNotOptimize(resp.data.data());
+    }
+}
+BENCHMARK(BM_DoRequestIncr);
+
+// The string path a client had before incr: get, parse, format and set, without the second round trip
+static void BM_DoRequestGetParseSet(benchmark::State& state)
+{
+    ServerHarness h;
+    std::vector<std::string> const get{ "get", "counter" };
+    std::vector<std::string> set{ "set", "counter", "0" };
+    Response seeded{};
+    h.server.do_request(set, seeded);
+
+    for ( auto _ : state )
+    {
+        Response read{};
+        h.server.do_request(get, read);
+        int64_t n{};
+        std::from_chars(reinterpret_cast<char const*>(read.data.data()),
+                        reinterpret_cast<char const*>(read.data.data() + read.data.size()), n);
+        set[2] = std::to_string(n + 1);
+        Response written{};
+        h.server.do_request(set, written);
+        benchmark::DoNotOptimize(written.data.data());
+    }
+}
+BENCHMARK(BM_DoRequestGetParseSet);
+
+// ======================================== Scan ========================================
+
+// One scan call resuming mid-keyspace, the walk restarts once it is done. Arg 2: 1 if the pattern matches nothing.
+static void BM_DoRequestScan(benchmark::State& state)
+{
+    size_t const num_keys = state.range(0);
+    std::string const count = std::to_string(state.range(1));
+    std::string const pattern = state.range(2) ? "nomatch:*" : "*";
+
+    ServerHarness h;
+    populate(h.server, num_keys, 32);
+    std::vector<std::string> scan{ "scan", "0", "match", pattern, "count", count };
+
+    for ( auto _ : state )
+    {
+        Response resp{};
+        h.server.do_request(scan, resp);
+
+        // The cursor is the first element: count | len | cursor
+        uint32_t len{};
+        std::memcpy(&len, resp.data.data() + sizeof(uint32_t), sizeof(len));
+        scan[1].assign(reinterpret_cast<char const*>(resp.data.data()) + 2 * sizeof(uint32_t), len);
+        benchmark::DoNotOptimize(resp.data.data());
+    }
+}
+BENCHMARK(BM_DoRequestScan)->ArgsProduct({ { 1 << 10, 1 << 20 }, { 10, 100, 1000 }, { 0, 1 } });
+
+// ======================================== Prefix Index ========================================
+
+// `tenant:<t>:object:<i>` for `num_keys` keys over 1000 tenants, so one prefix query selects ~num_keys / 1000 keys
+std::string make_tenant_key(size_t i)
+{
+    return "tenant:" + std::to_string(i % 1000) + ":object:" + std::to_string(i / 1000);
+}
+
+// Point lookups in the ordered map (index 0) or the radix tree (index 1). Reports the tree's bytes per key.
+static void BM_KeyspaceFind(benchmark::State& state)
+{
+    size_t const num_keys = state.range(0);
+    bool const indexed = state.range(1);
+
+    Keyspace keys;
+    for ( size_t i = 0; i < num_keys; i++ )
+        keys.try_emplace(make_tenant_key(i), std::string{});
+    keys.enable_prefix_index();
+    auto const* index = keys.prefix_index();
+
+    std::mt19937_64 rng(42);
+    std::vector<std::string> lookups(4096);
+    for ( auto& key : lookups )
+        key = make_tenant_key(rng() % num_keys);
+
+    size_t i{ 0 };
+    for ( auto _ : state )
+    {
+        std::string const& key = lookups[i++ % lookups.size()];
+        if ( indexed )
+            benchmark::DoNotOptimize(index->find(key));
+        else
+            benchmark::DoNotOptimize(keys.find(key));
+    }
+    state.counters["index_bytes_per_key"] = static_cast<double>(index->memory_usage()) / num_keys;
+}
+BENCHMARK(BM_KeyspaceFind)->ArgsProduct({ { 1 << 10, 1 << 20 }, { 0, 1 } });
+
+// `prefix tenant:<t>: limit <limit>` through do_request, served by the ordered map (index 0) or the radix tree
+static void BM_DoRequestPrefix(benchmark::State& state)
+{
+    size_t const num_keys = state.range(0);
+    std::string const limit = std::to_string(state.range(1));
+
+    ServerHarness h;
+    std::string const value(32, 'v');
+    for ( size_t i = 0; i < num_keys; i++ )
+    {
+        Response resp{};
+        h.server.do_request({ "set", make_tenant_key(i), value }, resp);
+    }
+    if ( state.range(2) )
+        h.server.configure({ .prefix_index = true });
+
+    std::mt19937_64 rng(42);
+    std::vector<std::vector<std::string>> cmds(1024);
+    for ( auto& cmd : cmds )
+        cmd = { "prefix", "tenant:" + std::to_string(rng() % 1000) + ":", "limit", limit };
+
+    size_t i{ 0 };
+    for ( auto _ : state )
+    {
+        Response resp{};
+        h.server.do_request(cmds[i++ % cmds.size()], resp);
+        benchmark::DoNotOptimize(resp.data.data());
+    }
+}
+BENCHMARK(BM_DoRequestPrefix)->ArgsProduct({ { 1 << 20 }, { 10, 1000 }, { 0, 1 } });
+
+// ======================================== Bloom Filters ========================================
+
+// Membership tests of absent items against a filter sized for and filled with `capacity` items, at error rate 1%
+// (arg 1 = 100) or 0.1% (arg 1 = 1000). Reports the filter's own false positive estimate and its bytes per item.
+static void BM_BloomContainsMiss(benchmark::State& state)
+{
+    size_t const capacity = state.range(0);
+    BloomFilter bloom{ capacity, 1.0 / state.range(1) };
+    for ( size_t i = 0; i < capacity; i++ )
+        bloom.add(make_key(i));
+
+    std::vector<std::string> probes(4096);
+    for ( size_t i = 0; i < probes.size(); i++ )
+        probes[i] = make_key(i * 7919) + ":missing";
+
+    size_t i{ 0 };
+    for ( auto _ : state )
+        benchmark::DoNotOptimize(bloom.contains(probes[i++ & 4095]));
+    state.counters["estimated_fpr"] = bloom.estimated_fpr();
+    state.counters["bytes_per_item"] = static_cast<double>(bloom.bytes()) / capacity;
+}
+BENCHMARK(BM_BloomContainsMiss)->ArgsProduct({ { 1 << 10, 1 << 20, 1 << 24 }, { 100, 1000 } });
+
+// The same question through do_request: `bf.exists` on a filter of `num_keys` items vs a `get` miss on as many keys
+static void BM_DoRequestBloomExists(benchmark::State& state)
+{
+    size_t const num_keys = state.range(0);
+
+    ServerHarness h;
+    Response reserve{};
+    h.server.do_request({ "bf.reserve", "seen", "0.01", std::to_string(num_keys) }, reserve);
+    for ( size_t i = 0; i < num_keys; i++ )
+    {
+        Response resp{};
+        h.server.do_request({ "bf.add", "seen", make_key(i) }, resp);
+    }
+    auto cmds = make_cmds("bf.exists", num_keys, 4096);
+    for ( auto& cmd : cmds )
+        cmd = { "bf.exists", "seen", cmd[1] + ":missing" };
+
+    size_t i{ 0 };
+    for ( auto _ : state )
+    {
+        Response resp{};
+        h.server.do_request(cmds[i++ & 4095], resp);
+        benchmark::DoNotOptimize(resp.data.data());
+    }
+}
+BENCHMARK(BM_DoRequestBloomExists)->RangeMultiplier(16)->Range(1 << 10, 1 << 20);
+
+// ======================================== HyperLogLog ========================================
+
+// A sketch that saw `items` distinct items: sparse up to HLL_SPARSE_MAX_ENTRIES, dense past it
+HyperLogLog make_hll(size_t items, size_t seed = 0)
+{
+    HyperLogLog hll;
+    for ( size_t i = 0; i < items; i++ )
+        hll.add("visitor:" + std::to_string(seed) + ":" + std::to_string(i));
+    return hll;
+}
+
+// pfadd to a dense sketch, mostly of items that no longer raise a register
+static void BM_HllAdd(benchmark::State& state)
+{
+    HyperLogLog hll = make_hll(state.range(0));
+    std::vector<std::string> adds(4096);
+    for ( size_t i = 0; i < adds.size(); i++ )
+        adds[i] = "new:" + std::to_string(i);
+
+    size_t i{ 0 };
+    for ( auto _ : state )
+        benchmark::DoNotOptimize(hll.add(adds[i++ & 4095]));
+}
+BENCHMARK(BM_HllAdd)->Arg(100000);
+
+// pfcount of a sketch that changed since the last one, i.e. without the cached estimate
+static void BM_HllCount(benchmark::State& state)
+{
+    HyperLogLog::Registers regs{};
+    make_hll(state.range(0)).max_into(regs);
+    HyperLogLog hll;
+    for ( auto _ : state )
+    {
+        state.PauseTiming();
+        hll.assign(regs);
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(hll.count());
+    }
+}
+BENCHMARK(BM_HllCount)->Arg(100)->Arg(2000)->Arg(1000000);
+
+// pfcount over `sources` dense sketches: merge into scratch registers, then estimate
+static void BM_HllMerge(benchmark::State& state)
+{
+    std::vector<HyperLogLog> sources;
+    for ( int64_t s = 0; s < state.range(0); s++ )
+        sources.push_back(make_hll(10000, s));
+
+    HyperLogLog::Registers regs;
+    for ( auto _ : state )
+    {
+        regs.fill(0);
+        for ( auto const& source : sources )
+            source.max_into(regs);
+        benchmark::DoNotOptimize(HyperLogLog::count(regs));
+    }
+    state.counters["sketches_per_s"] =
+        benchmark::Counter(static_cast<double>(state.range(0)), benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_HllMerge)->Arg(2)->Arg(30)->Unit(benchmark::kMicrosecond);
+
+// ======================================== Compression ========================================
+
+// `size` bytes of JSON records, the field names repeat and the values mostly don't
+std::string make_json(size_t size)
+{
+    static constexpr std::array<std::string_view, 5> CITIES{ "Berlin", "Lisbon", "Osaka", "Toronto", "Nairobi" };
+    std::mt19937_64 rng(42);
+    std::string json{ "[" };
+    while ( json.size() < size )
+    {
+        json += R"({"id":)" + std::to_string(rng() % 100000000) + R"(,"user":"user)" + std::to_string(rng() % 100000) +
+                R"(","city":")" + std::string(CITIES[rng() % CITIES.size()]) + R"(","score":)" +
+                std::to_string(rng() % 1000) + "." + std::to_string(rng() % 100) + R"(,"active":)" +
+                (rng() & 1 ? "true" : "false") + "},";
+    }
+    json.resize(size);
+    return json;
+}
+
+static void BM_Lz4Compress(benchmark::State& state)
+{
+    std::string const json = make_json(state.range(0));
+    std::string block(lz4_compress_bound(json.size()), '\0');
+    size_t size{ 0 };
+    for ( auto _ : state )
+        benchmark::DoNotOptimize(size = lz4_compress(json, block.data()));
+    state.SetBytesProcessed(state.iterations() * json.size());
+    state.counters["ratio"] = static_cast<double>(json.size()) / size;
+}
+BENCHMARK(BM_Lz4Compress)->RangeMultiplier(16)->Range(4 << 10, 1 << 20);
+
+static void BM_Lz4Decompress(benchmark::State& state)
+{
+    auto const packed = compress_string(make_json(state.range(0)));
+    std::string out(packed->raw_size(), '\0');
+    for ( auto _ : state )
+        benchmark::DoNotOptimize(packed->inflate(out.data()));
+    state.SetBytesProcessed(state.iterations() * out.size());
+}
+BENCHMARK(BM_Lz4Decompress)->RangeMultiplier(16)->Range(4 << 10, 1 << 20);
+
+// `get` of a JSON document stored raw (mode 0), stored compressed and inflated into the reply (1), or stored compressed
+// and sent as it is to a client that negotiated it (2)
+static void BM_TryRequestGetCompressed(benchmark::State& state)
+{
+    size_t const size = state.range(0);
+    int64_t const mode = state.range(1);
+
+    ServerHarness h;
+    h.server.configure({ .compress_threshold = mode == 0 ? 0u : 1024u });
+    Response set{}, usage{};
+    h.server.do_request({ "set", "doc", make_json(size) }, set);
+    h.server.do_request({ "memory", "usage", "doc" }, usage);
+
+    std::vector<uint8_t> frame;
+    append_request(frame, { "get", "doc" });
+    Connection conn{};
+    conn.compressed_replies = mode == 2;
+    for ( auto _ : state )
+    {
+        conn.incoming.assign(frame.begin(), frame.end());
+        conn.outgoing.clear();
+        bool ok = h.server.try_request(conn);
+        benchmark::DoNotOptimize(ok);
+    }
+    state.SetBytesProcessed(state.iterations() * size);
+    state.counters["stored_bytes"] = std::stod(std::string(usage.data.begin(), usage.data.end()));
+    state.counters["reply_bytes"] = static_cast<double>(conn.outgoing.size());
+}
+BENCHMARK(BM_TryRequestGetCompressed)->ArgsProduct({ { 4 << 10, 64 << 10, 1 << 20 }, { 0, 1, 2 } });
+
+// ======================================== Lazy Free ========================================
+
+// How long `del` (mode 0) or `unlink` (1) holds the event loop for a 32 MiB string (kind 0) or a zset of 100k members
+static void BM_DoRequestDelLarge(benchmark::State& state)
+{
+    bool const unlink = state.range(0) == 1;
+    bool const zset = state.range(1) == 1;
+
+    ServerHarness h;
+    std::string const big(32 << 20, 'v');
+    std::string payload;
+    if ( zset )
+    {
+        auto members = std::make_unique<SortedSet>();
+        for ( int i = 0; i < 100000; i++ )
+            members->add(i, make_key(i));
+        payload = encode_value(Value{ std::move(members) });
+    }
+
+    std::vector<std::string> const del{ unlink ? "unlink" : "del", "big" };
+    for ( auto _ : state )
+    {
+        Response set{};
+        if ( zset )
+            h.server.do_request({ "restore", "big", payload }, set);
+        else
+            h.server.do_request({ "set", "big", big }, set);
+
+        // Only the request is timed, by hand: with PauseTiming() the lazy-free thread's work shows up in it
+        Response resp{};
+        auto const start = std::chrono::steady_clock::now();
+        h.server.do_request(del, resp);
+        state.SetIterationTime(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        benchmark::DoNotOptimize(resp.data.data());
+    }
+}
+BENCHMARK(BM_DoRequestDelLarge)
+    ->ArgsProduct({ { 0, 1 }, { 0, 1 } })
+    ->Iterations(20)
+    ->UseManualTime()
+    ->Unit(benchmark::kMicrosecond);
+
+// ======================================== Transactions ========================================
+
+// 10 `incr`s of one connection pipelined (mode 0), inside multi/exec (1) or watch + multi/exec (2), while another
+// connection watches `watchers` other keys
+static void BM_TryRequestTransaction(benchmark::State& state)
+{
+    int64_t const mode = state.range(0);
+    size_t const watchers = state.range(1);
+
+    ServerHarness h;
+    Connection watcher{};
+    watcher.fd = 2;
+    for ( size_t i = 0; i < watchers; i++ )
+        append_request(watcher.incoming, { "watch", make_key(i) });
+    while ( h.server.try_request(watcher) )
+    {
+    }
+
+    std::vector<uint8_t> batch;
+    if ( mode == 2 )
+        append_request(batch, { "watch", "counter" });
+    if ( mode >= 1 )
+        append_request(batch, { "multi" });
+    for ( int i = 0; i < 10; i++ )
+        append_request(batch, { "incr", "counter" });
+    if ( mode >= 1 )
+        append_request(batch, { "exec" });
+
+    Connection conn{};
+    conn.fd = 1;
+    for ( auto _ : state )
+    {
+        conn.incoming.assign(batch.begin(), batch.end());
+        conn.outgoing.clear();
+        while ( h.server.try_request(conn) )
+        {
+        }
+        benchmark::DoNotOptimize(conn.outgoing.data());
+    }
+}
+BENCHMARK(BM_TryRequestTransaction)->ArgsProduct({ { 0, 1, 2 }, { 0, 1000 } });
+
+// ======================================== Scripting ========================================
+
+// A capped counter as a cached script (mode 1) against the bare `incrby` it wraps (0)
+static void BM_DoRequestEvalsha(benchmark::State& state)
+{
+    ServerHarness h;
+    Response loaded{};
+    h.server.do_request({ "script", "load",
+                          "local n = tonumber(call('get', KEYS[1])) or 0\n"
+                          "if n + ARGV[1] > tonumber(ARGV[2]) then return nil end\n"
+                          "return call('incrby', KEYS[1], ARGV[1])" },
+                        loaded);
+    std::string const sha(loaded.data.begin(), loaded.data.end());
+
+    Connection conn{};
+    std::vector<uint8_t> frame;
+    if ( state.range(0) == 1 )
+        append_request(frame, { "evalsha", sha, "1", "hits", "1", "9223372036854775807" });
+    else
+        append_request(frame, { "incrby", "hits", "1" });
+    for ( auto _ : state )
+    {
+        conn.incoming.assign(frame.begin(), frame.end());
+        conn.outgoing.clear();
+        bool ok = h.server.try_request(conn);
+        benchmark::DoNotOptimize(ok);
+    }
+}
+BENCHMARK(BM_DoRequestEvalsha)->Arg(0)->Arg(1);
+
+// Raw interpreter speed: a loop of arithmetic and comparisons, 9 instructions per iteration
+static void BM_ScriptLoop(benchmark::State& state)
+{
+    std::string err;
+    auto const script = compile_script("local i = 0 while i < 100000 do i = i + 1 end return i", err);
+    std::vector<std::string> const none;
+    for ( auto _ : state )
+    {
+        auto result = run_script(*script, none, none, std::chrono::steady_clock::time_point::max(),
+                                 [](auto const&, ScriptValue&, std::string&) { return true; });
+        benchmark::DoNotOptimize(result);
+    }
+    state.SetItemsProcessed(state.iterations() * 100000 * 9);
+}
+BENCHMARK(BM_ScriptLoop)->Unit(benchmark::kMicrosecond);
+
+// ======================================== Lists ========================================
+
+// A queue `depth` elements deep: every iteration pushes one `size` byte element at the tail and pops the head
+template <class Queue>
+static void run_queue(benchmark::State& state, Queue& queue)
+{
+    size_t const depth = state.range(0);
+    std::string const value(state.range(1), 'v');
+    for ( size_t i = 0; i < depth; i++ )
+        queue.push_back(value);
+
+    for ( auto _ : state )
+    {
+        queue.push_back(value);
+        benchmark::DoNotOptimize(queue.pop_front());
+    }
+}
+
+static void BM_ListQueue(benchmark::State& state)
+{
+    List list;
+    run_queue(state, list);
+}
+BENCHMARK(BM_ListQueue)->ArgsProduct({ { 0, 1000, 100000 }, { 16, 100 } });
+
+// Baseline, one node and (past 15 bytes) one string allocation per element
+static void BM_StdListQueue(benchmark::State& state)
+{
+    struct StdList
+    {
+        std::list<std::string> list;
+
+        void push_back(std::string const& value)
+        {
+            list.push_back(value);
+        }
+
+        std::string pop_front()
+        {
+            std::string value{ std::move(list.front()) };
+            list.pop_front();
+            return value;
+        }
+    } queue;
+    run_queue(state, queue);
+}
+BENCHMARK(BM_StdListQueue)->ArgsProduct({ { 0, 1000, 100000 }, { 16, 100 } });
+
+// rpush + lpop through the request path
+static void BM_DoRequestListQueue(benchmark::State& state)
+{
+    ServerHarness h;
+    std::vector<std::string> const push{ "rpush", "queue", std::string(state.range(0), 'v') };
+    std::vector<std::string> const pop{ "lpop", "queue" };
+    Response seed{};
+    h.server.do_request(push, seed);
+
+    for ( auto _ : state )
+    {
+        Response pushed{};
+        h.server.do_request(push, pushed);
+        Response popped{};
+        h.server.do_request(pop, popped);
+        benchmark::DoNotOptimize(popped.data.data());
+    }
+}
+BENCHMARK(BM_DoRequestListQueue)->Arg(16)->Arg(100);
+
+// ======================================== Pub/Sub ========================================
+
+// publish to `num_subscribers` idle subscribers, each behind its own socketpair on a real epoll instance. The
+// subscribers' ends are drained outside the timed region.
+static void BM_PublishFanOut(benchmark::State& state)
+{
+    size_t const num_subscribers = state.range(0);
+    SocketWrapper sock;
+    EpollWrapper epoll(16);
+    Server<SocketWrapper, EpollWrapper> server(0, sock, epoll);
+
+    std::vector<std::pair<int, int>> pairs;
+    for ( size_t i = 0; i < num_subscribers; i++ )
+    {
+        int fds[2];
+        if ( socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == -1 )
+        {
+            state.SkipWithError("socketpair failed, raise the open file limit");
+            break;
+        }
+        pairs.emplace_back(fds[0], fds[1]);
+        epoll.add_conn(fds[0]);
+        auto& conn = epoll.get_connection(fds[0]);
+        append_request_frame(conn.incoming, { "subscribe", "invalidations" });
+        server.try_request(conn);
+        conn.outgoing.clear();
+    }
+
+    std::vector<std::string> const publish{ "publish", "invalidations", std::string(state.range(1), 'x') };
+    std::vector<uint8_t> drain(64 << 10);
+    for ( auto _ : state )
+    {
+        Response resp{};
+        server.do_request(publish, resp);
+        benchmark::DoNotOptimize(resp.data.data());
+
+        state.PauseTiming();
+        for ( auto const& [_, peer] : pairs )
+        {
+            while ( ::recv(peer, drain.data(), drain.size(), MSG_DONTWAIT) > 0 )
+            {
+            }
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * num_subscribers);
+
+    // EpollWrapper's destructor does not cope with connections that are still registered
+    for ( auto const& [fd, peer] : pairs )
+    {
+        epoll.remove_conn(fd);
+        close(fd);
+        close(peer);
+    }
+}
+BENCHMARK(BM_PublishFanOut)->ArgsProduct({ { 100, 1000, 4000 }, { 64, 1024 } })->Unit(benchmark::kMicrosecond);
+
+// The floor for the fan-out above: one send() of an already encoded frame per subscriber socket
+static void BM_SendFanOut(benchmark::State& state)
+{
+    size_t const num_subscribers = state.range(0);
+    std::vector<std::pair<int, int>> pairs;
+    for ( size_t i = 0; i < num_subscribers; i++ )
+    {
+        int fds[2];
+        if ( socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == -1 )
+        {
+            state.SkipWithError("socketpair failed, raise the open file limit");
+            break;
+        }
+        pairs.emplace_back(fds[0], fds[1]);
+    }
+
+    std::vector<uint8_t> const frame(state.range(1) + 48, 'x');
+    std::vector<uint8_t> drain(64 << 10);
+    for ( auto _ : state )
+    {
+        for ( auto const& [fd, _] : pairs )
+            ::send(fd, frame.data(), frame.size(), MSG_NOSIGNAL);
+
+        state.PauseTiming();
+        for ( auto const& [_, peer] : pairs )
+        {
+            while ( ::recv(peer, drain.data(), drain.size(), MSG_DONTWAIT) > 0 )
+            {
+            }
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * num_subscribers);
+
+    for ( auto const& [fd, peer] : pairs )
+    {
+        close(fd);
+        close(peer);
+    }
+}
+BENCHMARK(BM_SendFanOut)->ArgsProduct({ { 100, 1000, 4000 }, { 64, 1024 } })->Unit(benchmark::kMicrosecond);
+
+// ======================================== Response Encoder ========================================
+
+static void BM_MakeResponse(benchmark::State& state)
+{
+    size_t const data_size = state.range(0);
+
+    ServerHarness h;
+    std::vector<uint8_t> const payload(data_size, 'r');
+    std::vector<uint8_t> out;
+
+    for ( auto _ : state )
+    {
+        Response resp{ ResponseStatus::RES_OK, payload };
+        out.clear();
+        h.server.make_response(resp, out);
+        benchmark::DoNotOptimize(out.data());
+    }
+
+    state.SetBytesProcessed(state.iterations() * (data_size + LEN_FIELD_SIZE + 1));
+}
+BENCHMARK(BM_MakeResponse)->Arg(0)->Arg(64)->Arg(4 << 10)->Arg(256 << 10);
+
+// ======================================== Full Request ========================================
+
+static void BM_TryRequestGet(benchmark::State& state)
+{
+    size_t const num_keys = state.range(0);
+
+    ServerHarness h;
+    populate(h.server, num_keys, 32);
+
+    std::vector<uint8_t> frame;
+    append_request(frame, { "get", make_key(num_keys / 2) });
+
+    Connection conn{};
+    for ( auto _ : state )
+    {
+        // Includes a small copy of the frame into `incoming`, as a socket read would do
+        conn.incoming.assign(frame.begin(), frame.end());
+        conn.outgoing.clear();
+        bool ok = h.server.try_request(conn);
+        benchmark::DoNotOptimize(ok);
+    }
+}
+BENCHMARK(BM_TryRequestGet)->RangeMultiplier(16)->Range(1 << 10, 1 << 20);
+
+int main(int argc, char** argv)
+{
+    // Match the release server, where logging below warn is compiled out of the hot path
+    spdlog::set_level(spdlog::level::warn);
+
+    benchmark::Initialize(&argc, argv);
+    if ( benchmark::ReportUnrecognizedArguments(argc, argv) )
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -1,3 +1,5 @@
+import sys
+
 import matplotlib.pyplot as plt
 
 
@@ -19,6 +21,35 @@ def read_data(file_name):
     return x_values, y_values
 
 
+def read_percentile_distribution(file_name):
+    """
+    Parse the HdrHistogram style output written by `./latency ... --rate N`:
+           Value     Percentile TotalCount 1/(1-Percentile)
+    Returns (1/(1-percentile), value) pairs, the p100 row has no last column and is skipped.
+    """
+    x_values = []
+    y_values = []
+
+    with open(file_name, 'r') as file:
+        for line in file:
+            fields = line.split()
+            if len(fields) != 4:
+                continue
+            try:
+                value, _, _, inverse = (float(f) for f in fields)
+            except ValueError:
+                continue
+            x_values.append(inverse)
+            y_values.append(value)
+
+    return x_values, y_values
+
+
+def is_percentile_distribution(file_name):
+    with open(file_name, 'r') as file:
+        return file.readline().split()[:2] == ["Value", "Percentile"]
+
+
 def plot_data(x_values, y_values):
     plt.plot(x_values, y_values, label="Data")
     plt.xlabel("Index")
@@ -28,11 +59,30 @@ def plot_data(x_values, y_values):
     plt.show()
 
 
-# File name containing only y values
-file_name = "output.txt"
+def plot_percentile_distributions(file_names):
+    for file_name in file_names:
+        x_values, y_values = read_percentile_distribution(file_name)
+        plt.plot(x_values, y_values, label=file_name)
+
+    ticks = [1, 10, 100, 1000, 10000]
+    plt.xscale("log")
+    plt.xticks(ticks, ["0%", "90%", "99%", "99.9%", "99.99%"])
+    plt.xlabel("Percentile")
+    plt.ylabel("Latency (ms)")
+    plt.title("Latency by Percentile Distribution")
+    plt.grid(True, which="both", alpha=0.3)
+    plt.legend()
+    plt.show()
+
+
+# File name containing only y values, or one or more percentile distribution files
+file_names = sys.argv[1:] or ["output.txt"]
 
-# Read the data
-x_values, y_values = read_data(file_name)
+if is_percentile_distribution(file_names[0]):
+    plot_percentile_distributions(file_names)
+else:
+    # Read the data
+    x_values, y_values = read_data(file_names[0])
 
-# Plot the data
-plot_data(x_values, y_values)
+    # Plot the data
+    plot_data(x_values, y_values)
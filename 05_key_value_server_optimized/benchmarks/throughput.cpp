@@ -5,8 +5,8 @@
 #include <iomanip>
 #include <iostream>
 
-void run_benchmark(SocketClient<TcpTransport, RedisSerializer, RedisDeserializer>& client, size_t num_requests,
-                   RedisSerializer& serializer)
+template <class Client>
+void run_benchmark(Client& client, size_t num_requests, RedisSerializer& serializer)
 {
     size_t req_sent{ 0 };
     size_t resp_recv{ 0 };
@@ -34,7 +34,12 @@ void run_benchmark(SocketClient<TcpTransport, RedisSerializer, RedisDeserializer
     {
         send_req_log(cmd);
     }
-    resp_recv_log();
+
+    // Transports return one response per receive, so the clock stops once every request has been answered
+    for ( size_t i = 0; i < num_requests; i++ )
+    {
+        resp_recv_log();
+    }
 
     // End time
     auto end_time = std::chrono::high_resolution_clock::now();
@@ -48,28 +53,39 @@ void run_benchmark(SocketClient<TcpTransport, RedisSerializer, RedisDeserializer
     std::cout << "Requests Per Second (RPS): " << rps << "\n";
 }
 
+template <class Transport>
+void run(std::string const& addr, size_t const port, size_t num_requests)
+{
+    Transport transport;
+    RedisSerializer serializer;
+    RedisDeserializer deserializer;
+
+    SocketClient<Transport, RedisSerializer, RedisDeserializer> client(transport, serializer, deserializer);
+
+    client.connect(addr, port); // probably should return bool if connection was successful
+
+    run_benchmark(client, num_requests, serializer);
+}
+
 int main(int argc, char* argv[])
 {
     if ( argc < 3 )
     {
-        std::cout << "Input needs to be of the form: ./req_per_sec SERVER PORT";
+        std::cout << "Input needs to be of the form: ./req_per_sec SERVER|UNIX_SOCKET_PATH|shm:UNIX_SOCKET_PATH PORT";
         return 1;
     }
 
-    TcpTransport transport;
-    RedisSerializer serializer;
-    RedisDeserializer deserializer;
-
-    SocketClient<TcpTransport, RedisSerializer, RedisDeserializer> client(transport, serializer, deserializer);
-
     std::string const addr = argv[1];
     size_t const port = std::stoi(argv[2]);
 
-    client.connect(addr, port); // probably should return bool if connection was successful
-
     size_t num_requests{ 10000 };
 
-    run_benchmark(client, num_requests, serializer);
+    if ( is_shm_address(addr) )
+        run<ShmTransport>(addr, port, num_requests);
+    else if ( is_unix_socket_address(addr) )
+        run<UnixTransport>(addr, port, num_requests);
+    else
+        run<TcpTransport>(addr, port, num_requests);
 
     return 0;
 }
\ No newline at end of file
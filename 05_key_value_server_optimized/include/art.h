@@ -0,0 +1,710 @@
+#ifndef ART_H
+#define ART_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+/**
+ * Adaptive radix tree (Leis et al., "The Adaptive Radix Tree: ARTful Indexing for Main-Memory Databases"), an ordered
+ * index of byte-string keys for prefix and range queries.
+ *
+ * Inner nodes change layout as children come and go: Node4 and Node16 keep sorted key bytes next to their child
+ * pointers, Node48 maps a byte to one of 48 slots and Node256 is a plain array. Chains of single-child nodes are
+ * collapsed into a prefix kept in the node. Only its first MAX_PREFIX bytes are stored, longer prefixes are read back
+ * from a leaf below (optimistic path compression). A key that ends at an inner node, i.e. is a prefix of other keys,
+ * hangs off the node's `terminal` slot, so keys may contain any byte including 0.
+ *
+ * The tree does not own keys or elements. A leaf is a pointer to an element T that lives elsewhere (a node of the
+ * keyspace's map) and KeyOf gives its key, which must not change while the element is in the tree. Child references
+ * tag leaves with their low bit.
+ */
+
+template <class T, class KeyOf>
+class AdaptiveRadixTree
+{
+public:
+    AdaptiveRadixTree() = default;
+    AdaptiveRadixTree(AdaptiveRadixTree const& other) = delete;
+    AdaptiveRadixTree& operator=(AdaptiveRadixTree const& other) = delete;
+
+    ~AdaptiveRadixTree()
+    {
+        clear();
+    }
+
+    // Adds `elem`, or points the existing key at it
+    void insert(T* elem)
+    {
+        size_ += insert(root_, key_of(*elem), 0, to_ref(elem));
+    }
+
+    bool erase(std::string_view key)
+    {
+        bool const erased = erase(root_, key, 0);
+        size_ -= erased;
+        return erased;
+    }
+
+    [[nodiscard]] T* find(std::string_view key) const
+    {
+        Ref ref = root_;
+        size_t depth{ 0 };
+        while ( ref != 0 && !is_leaf(ref) )
+        {
+            Node const* n = as_node(ref);
+            std::string_view const prefix = prefix_of(n, depth);
+            if ( key.substr(depth, prefix.size()) != prefix )
+                return nullptr;
+            depth += prefix.size();
+            if ( depth == key.size() )
+                return n->terminal ? as_leaf(n->terminal) : nullptr;
+
+            Ref const* child = find_child(n, key[depth]);
+            ref = child ? *child : 0;
+            depth++;
+        }
+        return ref != 0 && key_of(*as_leaf(ref)) == key ? as_leaf(ref) : nullptr;
+    }
+
+    // Calls fn(T&) for every element with a key >= `lower`, in key order, until fn returns false
+    template <class Fn>
+    void for_each_from(std::string_view lower, Fn&& fn) const
+    {
+        if ( root_ != 0 )
+            walk(root_, 0, lower, !lower.empty(), fn);
+    }
+
+    void clear()
+    {
+        free_subtree(root_);
+        root_ = 0;
+        size_ = 0;
+    }
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    // Bytes of the inner nodes, the leaves are the elements themselves
+    [[nodiscard]] size_t memory_usage() const noexcept
+    {
+        return sizeof(*this) + node_bytes_;
+    }
+
+private:
+    using Ref = uintptr_t; // 0 for none, a T* with the low bit set for a leaf, a Node* otherwise
+
+    static constexpr size_t MAX_PREFIX{ 8 };
+
+    enum class Type : uint8_t
+    {
+        N4,
+        N16,
+        N48,
+        N256,
+    };
+
+    struct Node
+    {
+        explicit Node(Type t) : type(t)
+        {
+        }
+
+        Type type;
+        uint16_t count{ 0 };      // Children, the terminal not included
+        uint32_t prefix_len{ 0 }; // May exceed MAX_PREFIX, the rest is read from a leaf
+        std::array<uint8_t, MAX_PREFIX> prefix{};
+        Ref terminal{ 0 }; // The leaf whose key ends at this node
+    };
+
+    struct Node4 : Node
+    {
+        Node4() : Node(Type::N4)
+        {
+        }
+
+        std::array<uint8_t, 4> keys{};
+        std::array<Ref, 4> children{};
+    };
+
+    struct Node16 : Node
+    {
+        Node16() : Node(Type::N16)
+        {
+        }
+
+        std::array<uint8_t, 16> keys{};
+        std::array<Ref, 16> children{};
+    };
+
+    struct Node48 : Node
+    {
+        Node48() : Node(Type::N48)
+        {
+        }
+
+        std::array<uint8_t, 256> index{}; // Slot + 1, 0 for none
+        std::array<Ref, 48> children{};
+    };
+
+    struct Node256 : Node
+    {
+        Node256() : Node(Type::N256)
+        {
+        }
+
+        std::array<Ref, 256> children{};
+    };
+
+    Ref root_{ 0 };
+    size_t size_{ 0 };
+    size_t node_bytes_{ 0 };
+
+    static bool is_leaf(Ref ref) noexcept
+    {
+        return ref & 1;
+    }
+
+    static T* as_leaf(Ref ref) noexcept
+    {
+        return reinterpret_cast<T*>(ref & ~Ref{ 1 });
+    }
+
+    static Node* as_node(Ref ref) noexcept
+    {
+        return reinterpret_cast<Node*>(ref);
+    }
+
+    static Ref to_ref(T* elem) noexcept
+    {
+        return reinterpret_cast<Ref>(elem) | 1;
+    }
+
+    static Ref to_ref(Node* node) noexcept
+    {
+        return reinterpret_cast<Ref>(node);
+    }
+
+    static std::string_view key_of(T const& elem) noexcept
+    {
+        return KeyOf{}(elem);
+    }
+
+    static size_t common_prefix(std::string_view a, std::string_view b) noexcept
+    {
+        size_t const n = std::min(a.size(), b.size());
+        return std::mismatch(a.begin(), a.begin() + n, b.begin()).first - a.begin();
+    }
+
+    template <class N>
+    N* new_node()
+    {
+        node_bytes_ += sizeof(N);
+        return new N();
+    }
+
+    void delete_node(Node* n)
+    {
+        switch ( n->type )
+        {
+        case Type::N4:
+            node_bytes_ -= sizeof(Node4);
+            delete static_cast<Node4*>(n);
+            break;
+        case Type::N16:
+            node_bytes_ -= sizeof(Node16);
+            delete static_cast<Node16*>(n);
+            break;
+        case Type::N48:
+            node_bytes_ -= sizeof(Node48);
+            delete static_cast<Node48*>(n);
+            break;
+        case Type::N256:
+            node_bytes_ -= sizeof(Node256);
+            delete static_cast<Node256*>(n);
+            break;
+        }
+    }
+
+    void free_subtree(Ref ref)
+    {
+        if ( ref == 0 || is_leaf(ref) )
+            return;
+        Node* n = as_node(ref);
+        for_each_child(n, 0,
+                       [this](uint8_t, Ref child)
+                       {
+                           free_subtree(child);
+                           return true;
+                       });
+        delete_node(n);
+    }
+
+    static void set_prefix(Node* n, std::string_view prefix) noexcept
+    {
+        n->prefix_len = static_cast<uint32_t>(prefix.size());
+        std::memcpy(n->prefix.data(), prefix.data(), std::min(prefix.size(), MAX_PREFIX));
+    }
+
+    static void copy_header(Node* to, Node const* from) noexcept
+    {
+        to->count = from->count;
+        to->prefix_len = from->prefix_len;
+        to->prefix = from->prefix;
+        to->terminal = from->terminal;
+    }
+
+    // The leaf with the smallest key below `n`
+    static T* minimum(Node const* n) noexcept
+    {
+        while ( true )
+        {
+            if ( n->terminal )
+                return as_leaf(n->terminal);
+
+            Ref first{ 0 };
+            for_each_child(n, 0,
+                           [&first](uint8_t, Ref child)
+                           {
+                               first = child;
+                               return false;
+                           });
+            if ( is_leaf(first) )
+                return as_leaf(first);
+            n = as_node(first);
+        }
+    }
+
+    // The node's whole compressed path, which starts at `depth` in every key below it
+    static std::string_view prefix_of(Node const* n, size_t depth) noexcept
+    {
+        if ( n->prefix_len <= MAX_PREFIX )
+            return { reinterpret_cast<char const*>(n->prefix.data()), n->prefix_len };
+        return key_of(*minimum(n)).substr(depth, n->prefix_len);
+    }
+
+    static Ref const* find_child(Node const* n, char c) noexcept
+    {
+        return find_child(const_cast<Node*>(n), c);
+    }
+
+    static Ref* find_child(Node* n, char c) noexcept
+    {
+        auto const byte = static_cast<uint8_t>(c);
+        switch ( n->type )
+        {
+        case Type::N4:
+            return find_sorted(static_cast<Node4*>(n), byte);
+        case Type::N16:
+            return find_sorted(static_cast<Node16*>(n), byte);
+        case Type::N48:
+        {
+            auto* n48 = static_cast<Node48*>(n);
+            return n48->index[byte] ? &n48->children[n48->index[byte] - 1] : nullptr;
+        }
+        case Type::N256:
+        {
+            auto* n256 = static_cast<Node256*>(n);
+            return n256->children[byte] ? &n256->children[byte] : nullptr;
+        }
+        }
+        return nullptr;
+    }
+
+    template <class N>
+    static Ref* find_sorted(N* n, uint8_t byte) noexcept
+    {
+        for ( size_t i = 0; i < n->count; i++ )
+        {
+            if ( n->keys[i] == byte )
+                return &n->children[i];
+        }
+        return nullptr;
+    }
+
+    // Calls fn(byte, child) for the children with a byte >= `from` in ascending order, false if fn stopped early
+    template <class Fn>
+    static bool for_each_child(Node const* n, uint8_t from, Fn&& fn)
+    {
+        auto sorted = [&](auto const* node)
+        {
+            for ( size_t i = 0; i < node->count; i++ )
+            {
+                if ( node->keys[i] >= from && !fn(node->keys[i], node->children[i]) )
+                    return false;
+            }
+            return true;
+        };
+
+        switch ( n->type )
+        {
+        case Type::N4:
+            return sorted(static_cast<Node4 const*>(n));
+        case Type::N16:
+            return sorted(static_cast<Node16 const*>(n));
+        case Type::N48:
+        {
+            auto const* n48 = static_cast<Node48 const*>(n);
+            for ( size_t b = from; b < 256; b++ )
+            {
+                if ( n48->index[b] && !fn(static_cast<uint8_t>(b), n48->children[n48->index[b] - 1]) )
+                    return false;
+            }
+            return true;
+        }
+        case Type::N256:
+        {
+            auto const* n256 = static_cast<Node256 const*>(n);
+            for ( size_t b = from; b < 256; b++ )
+            {
+                if ( n256->children[b] && !fn(static_cast<uint8_t>(b), n256->children[b]) )
+                    return false;
+            }
+            return true;
+        }
+        }
+        return true;
+    }
+
+    template <class N>
+    static void insert_sorted(N* n, uint8_t byte, Ref child) noexcept
+    {
+        size_t pos{ 0 };
+        while ( pos < n->count && n->keys[pos] < byte )
+            pos++;
+        std::copy_backward(n->keys.begin() + pos, n->keys.begin() + n->count, n->keys.begin() + n->count + 1);
+        std::copy_backward(n->children.begin() + pos, n->children.begin() + n->count,
+                           n->children.begin() + n->count + 1);
+        n->keys[pos] = byte;
+        n->children[pos] = child;
+        n->count++;
+    }
+
+    template <class N>
+    static void remove_sorted(N* n, uint8_t byte) noexcept
+    {
+        size_t pos{ 0 };
+        while ( n->keys[pos] != byte )
+            pos++;
+        std::copy(n->keys.begin() + pos + 1, n->keys.begin() + n->count, n->keys.begin() + pos);
+        std::copy(n->children.begin() + pos + 1, n->children.begin() + n->count, n->children.begin() + pos);
+        n->count--;
+    }
+
+    // Adds a child to the node at `ref`, moving it to the next larger layout when it is full
+    void add_child(Ref& ref, char c, Ref child)
+    {
+        auto const byte = static_cast<uint8_t>(c);
+        Node* n = as_node(ref);
+        switch ( n->type )
+        {
+        case Type::N4:
+        {
+            auto* n4 = static_cast<Node4*>(n);
+            if ( n4->count < 4 )
+                return insert_sorted(n4, byte, child);
+
+            auto* n16 = new_node<Node16>();
+            copy_header(n16, n4);
+            std::copy(n4->keys.begin(), n4->keys.end(), n16->keys.begin());
+            std::copy(n4->children.begin(), n4->children.end(), n16->children.begin());
+            replace(ref, n16);
+            return insert_sorted(n16, byte, child);
+        }
+        case Type::N16:
+        {
+            auto* n16 = static_cast<Node16*>(n);
+            if ( n16->count < 16 )
+                return insert_sorted(n16, byte, child);
+
+            auto* n48 = new_node<Node48>();
+            copy_header(n48, n16);
+            for ( size_t i = 0; i < 16; i++ )
+            {
+                n48->index[n16->keys[i]] = static_cast<uint8_t>(i + 1);
+                n48->children[i] = n16->children[i];
+            }
+            replace(ref, n48);
+            return add_child(ref, c, child);
+        }
+        case Type::N48:
+        {
+            auto* n48 = static_cast<Node48*>(n);
+            if ( n48->count < 48 )
+            {
+                size_t slot{ 0 };
+                while ( n48->children[slot] )
+                    slot++;
+                n48->index[byte] = static_cast<uint8_t>(slot + 1);
+                n48->children[slot] = child;
+                n48->count++;
+                return;
+            }
+
+            auto* n256 = new_node<Node256>();
+            copy_header(n256, n48);
+            for ( size_t b = 0; b < 256; b++ )
+            {
+                if ( n48->index[b] )
+                    n256->children[b] = n48->children[n48->index[b] - 1];
+            }
+            replace(ref, n256);
+            return add_child(ref, c, child);
+        }
+        case Type::N256:
+        {
+            auto* n256 = static_cast<Node256*>(n);
+            n256->children[byte] = child;
+            n256->count++;
+            return;
+        }
+        }
+    }
+
+    // Removes a child from the node at `ref`, moving it to the next smaller layout once it has room to spare there
+    void remove_child(Ref& ref, char c)
+    {
+        auto const byte = static_cast<uint8_t>(c);
+        Node* n = as_node(ref);
+        switch ( n->type )
+        {
+        case Type::N4:
+            return remove_sorted(static_cast<Node4*>(n), byte);
+        case Type::N16:
+        {
+            auto* n16 = static_cast<Node16*>(n);
+            remove_sorted(n16, byte);
+            if ( n16->count > 3 )
+                return;
+
+            auto* n4 = new_node<Node4>();
+            copy_header(n4, n16);
+            std::copy(n16->keys.begin(), n16->keys.begin() + n16->count, n4->keys.begin());
+            std::copy(n16->children.begin(), n16->children.begin() + n16->count, n4->children.begin());
+            return replace(ref, n4);
+        }
+        case Type::N48:
+        {
+            auto* n48 = static_cast<Node48*>(n);
+            n48->children[n48->index[byte] - 1] = 0;
+            n48->index[byte] = 0;
+            n48->count--;
+            if ( n48->count > 12 )
+                return;
+
+            auto* n16 = new_node<Node16>();
+            copy_header(n16, n48);
+            n16->count = 0;
+            for ( size_t b = 0; b < 256; b++ )
+            {
+                if ( n48->index[b] )
+                    insert_sorted(n16, static_cast<uint8_t>(b), n48->children[n48->index[b] - 1]);
+            }
+            return replace(ref, n16);
+        }
+        case Type::N256:
+        {
+            auto* n256 = static_cast<Node256*>(n);
+            n256->children[byte] = 0;
+            n256->count--;
+            if ( n256->count > 40 )
+                return;
+
+            auto* n48 = new_node<Node48>();
+            copy_header(n48, n256);
+            n48->count = 0;
+            for ( size_t b = 0; b < 256; b++ )
+            {
+                if ( n256->children[b] )
+                {
+                    n48->index[b] = static_cast<uint8_t>(n48->count + 1);
+                    n48->children[n48->count++] = n256->children[b];
+                }
+            }
+            return replace(ref, n48);
+        }
+        }
+    }
+
+    void replace(Ref& ref, Node* with)
+    {
+        delete_node(as_node(ref));
+        ref = to_ref(with);
+    }
+
+    // Hangs `child` off the node at `ref` under the byte of `key` at `depth`, or as its terminal if the key ends there
+    void attach(Ref& ref, std::string_view key, size_t depth, Ref child)
+    {
+        if ( depth == key.size() )
+            as_node(ref)->terminal = child;
+        else
+            add_child(ref, key[depth], child);
+    }
+
+    // True if the key is new
+    bool insert(Ref& ref, std::string_view key, size_t depth, Ref leaf)
+    {
+        if ( ref == 0 )
+        {
+            ref = leaf;
+            return true;
+        }
+
+        if ( is_leaf(ref) )
+        {
+            std::string_view const other = key_of(*as_leaf(ref));
+            if ( other == key )
+            {
+                ref = leaf;
+                return false;
+            }
+
+            // Two keys where there was one: a node for the bytes they share, each hanging off where they differ
+            size_t const common = common_prefix(key.substr(depth), other.substr(depth));
+            Ref split = to_ref(new_node<Node4>());
+            set_prefix(as_node(split), key.substr(depth, common));
+            attach(split, other, depth + common, ref);
+            attach(split, key, depth + common, leaf);
+            ref = split;
+            return true;
+        }
+
+        Node* n = as_node(ref);
+        std::string_view const prefix = prefix_of(n, depth);
+        size_t const common = common_prefix(prefix, key.substr(depth));
+        if ( common < prefix.size() )
+        {
+            // The key leaves the compressed path: split it, the node keeps what follows the differing byte
+            std::string const path(prefix);
+            Ref split = to_ref(new_node<Node4>());
+            set_prefix(as_node(split), std::string_view(path).substr(0, common));
+            set_prefix(n, std::string_view(path).substr(common + 1));
+            add_child(split, path[common], ref);
+            attach(split, key, depth + common, leaf);
+            ref = split;
+            return true;
+        }
+
+        depth += prefix.size();
+        if ( depth == key.size() )
+        {
+            bool const added = n->terminal == 0;
+            n->terminal = leaf;
+            return added;
+        }
+        if ( Ref* child = find_child(n, key[depth]) )
+            return insert(*child, key, depth + 1, leaf);
+        add_child(ref, key[depth], leaf);
+        return true;
+    }
+
+    bool erase(Ref& ref, std::string_view key, size_t depth)
+    {
+        if ( ref == 0 )
+            return false;
+        if ( is_leaf(ref) )
+        {
+            if ( key_of(*as_leaf(ref)) != key )
+                return false;
+            ref = 0;
+            return true;
+        }
+
+        Node* n = as_node(ref);
+        size_t const node_depth = depth;
+        std::string_view const prefix = prefix_of(n, depth);
+        if ( key.substr(depth, prefix.size()) != prefix )
+            return false;
+        depth += prefix.size();
+
+        if ( depth == key.size() )
+        {
+            if ( n->terminal == 0 )
+                return false;
+            n->terminal = 0;
+        }
+        else
+        {
+            Ref* child = find_child(n, key[depth]);
+            if ( !child || !erase(*child, key, depth + 1) )
+                return false;
+            if ( *child == 0 )
+                remove_child(ref, key[depth]);
+        }
+
+        collapse(ref, node_depth);
+        return true;
+    }
+
+    // A node left with a single leaf or a single child folds into it, an empty one disappears
+    void collapse(Ref& ref, size_t depth)
+    {
+        Node* n = as_node(ref);
+        if ( n->count == 0 )
+        {
+            Ref const terminal = n->terminal;
+            delete_node(n);
+            ref = terminal;
+            return;
+        }
+        if ( n->count > 1 || n->terminal != 0 )
+            return;
+
+        uint8_t byte{};
+        Ref child{ 0 };
+        for_each_child(n, 0,
+                       [&](uint8_t b, Ref c)
+                       {
+                           byte = b;
+                           child = c;
+                           return false;
+                       });
+
+        if ( !is_leaf(child) )
+        {
+            // The child's path becomes ours, the byte between and its own
+            std::string path(prefix_of(n, depth));
+            path += static_cast<char>(byte);
+            path += prefix_of(as_node(child), depth + path.size());
+            set_prefix(as_node(child), path);
+        }
+        delete_node(n);
+        ref = child;
+    }
+
+    template <class Fn>
+    static bool walk(Ref ref, size_t depth, std::string_view lower, bool bounded, Fn& fn)
+    {
+        if ( is_leaf(ref) )
+            return (bounded && key_of(*as_leaf(ref)) < lower) || fn(*as_leaf(ref));
+
+        // While `bounded` the path so far equals `lower`, everything off that path is either all below or all above it
+        Node const* n = as_node(ref);
+        std::string_view const prefix = prefix_of(n, depth);
+        if ( bounded )
+        {
+            int const cmp = prefix.compare(lower.substr(depth, prefix.size()));
+            if ( cmp < 0 )
+                return true;
+            bounded = cmp == 0;
+        }
+
+        depth += prefix.size();
+        bounded &= depth < lower.size();
+
+        // A key that ends here sorts before every key below it, and below `lower` if we are still on its path
+        if ( n->terminal && !bounded && !fn(*as_leaf(n->terminal)) )
+            return false;
+
+        uint8_t const from = bounded ? static_cast<uint8_t>(lower[depth]) : 0;
+        return for_each_child(n, from, [&](uint8_t byte, Ref child)
+                              { return walk(child, depth + 1, lower, bounded && byte == from, fn); });
+    }
+};
+
+#endif
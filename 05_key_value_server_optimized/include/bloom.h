@@ -0,0 +1,209 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include "murmurhash.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+/**
+ * Bloom filter: a set that answers "possibly present" or "definitely absent" in a fixed number of bits per item.
+ *
+ * It is a split block Bloom filter (Putze et al., "Cache-, Hash- and Space-Efficient Bloom Filters", in the layout
+ * Parquet and Impala use). The bit array is cut into 32-byte blocks of eight 32-bit words. An item's hash picks one
+ * block, then sets or tests one bit in each of its words, so a membership test reads a single block (never more than
+ * one cache line) and its eight independent bit positions come from eight multiplications that the compiler turns
+ * into a couple of vector instructions.
+ *
+ * Filling whole blocks costs some accuracy against a classic filter with the same number of bits, so the block count
+ * is chosen from the false positive rate of this layout (see blocks_for()), not from the textbook formula. Adding more
+ * than `capacity` items keeps working but the false positive rate climbs, estimated_fpr() reports the current one.
+ */
+
+inline constexpr uint64_t BLOOM_DEFAULT_CAPACITY{ 100 };
+inline constexpr double BLOOM_DEFAULT_ERROR_RATE{ 0.01 };
+inline constexpr uint64_t BLOOM_MAX_BYTES{ uint64_t{ 1 } << 32 };
+
+class BloomFilter
+{
+public:
+    static constexpr size_t WORDS_PER_BLOCK{ 8 };
+    static constexpr size_t BLOCK_BYTES{ WORDS_PER_BLOCK * sizeof(uint32_t) };
+
+    // Parameters must pass valid_params(). An error rate below what 128 bytes per item reach gets 128.
+    BloomFilter(uint64_t capacity, double error_rate)
+        : capacity_(capacity), error_rate_(error_rate), blocks_(blocks_for(capacity, error_rate))
+    {
+    }
+
+    static bool valid_params(uint64_t capacity, double error_rate) noexcept
+    {
+        return capacity > 0 && capacity <= BLOOM_MAX_BYTES && error_rate > 0 && error_rate < 1 &&
+               bytes_for(capacity, error_rate) <= BLOOM_MAX_BYTES;
+    }
+
+    // Size of the bit array a filter with these parameters gets, known before allocating it
+    static uint64_t bytes_for(uint64_t capacity, double error_rate) noexcept
+    {
+        return uint64_t{ blocks_for(capacity, error_rate) } * BLOCK_BYTES;
+    }
+
+    // True if the item was not in the filter yet (at least one of its bits was clear)
+    bool add(std::string_view item) noexcept
+    {
+        uint64_t const h = murmur_hash64a(item);
+        Block& block = blocks_[block_of(h)];
+        auto const mask = mask_of(static_cast<uint32_t>(h));
+
+        uint32_t missing{ 0 };
+        for ( size_t i = 0; i < WORDS_PER_BLOCK; i++ )
+        {
+            missing |= mask[i] & ~block.words[i];
+            block.words[i] |= mask[i];
+        }
+        items_ += missing != 0;
+        return missing != 0;
+    }
+
+    [[nodiscard]] bool contains(std::string_view item) const noexcept
+    {
+        uint64_t const h = murmur_hash64a(item);
+        Block const& block = blocks_[block_of(h)];
+        auto const mask = mask_of(static_cast<uint32_t>(h));
+
+        uint32_t missing{ 0 };
+        for ( size_t i = 0; i < WORDS_PER_BLOCK; i++ )
+            missing |= mask[i] & ~block.words[i];
+        return missing == 0;
+    }
+
+    [[nodiscard]] uint64_t capacity() const noexcept
+    {
+        return capacity_;
+    }
+
+    [[nodiscard]] double error_rate() const noexcept
+    {
+        return error_rate_;
+    }
+
+    // Items added, an add that found all its bits already set (a duplicate or a false positive) is not counted
+    [[nodiscard]] uint64_t items() const noexcept
+    {
+        return items_;
+    }
+
+    [[nodiscard]] size_t bytes() const noexcept
+    {
+        return blocks_.size() * BLOCK_BYTES;
+    }
+
+    [[nodiscard]] size_t memory_usage() const noexcept
+    {
+        return sizeof(BloomFilter) + bytes();
+    }
+
+    /**
+     * The chance that an item never added tests positive, from the bits actually set: a test hits one block and
+     * passes if the bit it checks in each word is set, i.e. with the product of the words' fill ratios.
+     */
+    [[nodiscard]] double estimated_fpr() const noexcept
+    {
+        double sum{ 0 };
+        for ( Block const& block : blocks_ )
+        {
+            double p{ 1 };
+            for ( uint32_t const word : block.words )
+                p *= std::popcount(word) / 32.0;
+            sum += p;
+        }
+        return sum / blocks_.size();
+    }
+
+    // Raw block bytes, for encode_value()/decode_value()
+    [[nodiscard]] std::string_view raw() const noexcept
+    {
+        return { reinterpret_cast<char const*>(blocks_.data()), bytes() };
+    }
+
+    // Restores an encoded filter, false if `raw` is not the size its parameters give
+    bool load(std::string_view raw, uint64_t items) noexcept
+    {
+        if ( raw.size() != bytes() )
+            return false;
+        std::memcpy(blocks_.data(), raw.data(), raw.size());
+        items_ = items;
+        return true;
+    }
+
+private:
+    struct alignas(BLOCK_BYTES) Block
+    {
+        std::array<uint32_t, WORDS_PER_BLOCK> words{};
+    };
+
+    // One odd multiplier per word, the top 5 bits of (h * salt) pick the word's bit
+    static constexpr std::array<uint32_t, WORDS_PER_BLOCK> SALT{ 0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+                                                                 0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U };
+
+    uint64_t capacity_;
+    double error_rate_;
+    uint64_t items_{ 0 };
+    std::vector<Block> blocks_;
+
+    static std::array<uint32_t, WORDS_PER_BLOCK> mask_of(uint32_t h) noexcept
+    {
+        std::array<uint32_t, WORDS_PER_BLOCK> mask;
+        for ( size_t i = 0; i < WORDS_PER_BLOCK; i++ )
+            mask[i] = uint32_t{ 1 } << ((h * SALT[i]) >> 27);
+        return mask;
+    }
+
+    // The high half of the hash scaled to [0, blocks), the low half is left for the bits
+    [[nodiscard]] size_t block_of(uint64_t h) const noexcept
+    {
+        return static_cast<size_t>(((h >> 32) * blocks_.size()) >> 32);
+    }
+
+    /**
+     * False positive rate of a block filter holding `load` items per block on average. The items of a block follow a
+     * Poisson distribution, a block with j items has each word bit set with probability 1 - (31/32)^j and all eight
+     * tested bits set with that to the 8th.
+     */
+    static double fpr_at_load(double load) noexcept
+    {
+        if ( load > 1000 )
+            return 1;
+        double const spread = 10 * std::sqrt(load) + 10;
+        double fpr{ 0 };
+        for ( double j = std::max(0.0, std::floor(load - spread)); j <= load + spread; j++ )
+        {
+            double const p_j = std::exp(j * std::log(load) - load - std::lgamma(j + 1));
+            fpr += p_j * std::pow(1 - std::pow(31.0 / 32.0, j), WORDS_PER_BLOCK);
+        }
+        return fpr;
+    }
+
+    // Fewest blocks that keep `capacity` items under `error_rate`
+    static size_t blocks_for(uint64_t capacity, double error_rate) noexcept
+    {
+        uint64_t lo{ 1 }, hi{ std::max<uint64_t>(capacity, 1) * 4 };
+        while ( lo < hi )
+        {
+            uint64_t const mid = lo + (hi - lo) / 2;
+            if ( fpr_at_load(static_cast<double>(capacity) / mid) <= error_rate )
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        return lo;
+    }
+};
+
+#endif
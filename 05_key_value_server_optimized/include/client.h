@@ -1,15 +1,26 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 
+#include "compression.h"
+#include "protocol.h"
+#include "shmring.h"
 #include "spdlog/spdlog.h"
 
-#include <arpa/inet.h>  // sockaddr_in, inet_pton, htons
-#include <cstdint>      // uint8_t, uint32_t
-#include <cstring>      // std::memcpy
-#include <string>       // std::string, std::to_string, std::stoi
-#include <sys/socket.h> // socket, connect, send, recv
-#include <unistd.h>     // close
-#include <vector>       // std::vector
+#include <algorithm>     // std::max
+#include <arpa/inet.h>   // sockaddr_in, inet_pton, htons
+#include <cstdint>       // uint8_t, uint32_t
+#include <cstring>       // std::memcpy
+#include <deque>         // std::deque
+#include <iterator>      // std::input_iterator_tag
+#include <poll.h>        // poll
+#include <stdexcept>     // std::runtime_error
+#include <string>        // std::string, std::to_string, std::stoi
+#include <string_view>   // std::string_view
+#include <sys/socket.h>  // socket, connect, send, recv
+#include <sys/un.h>      // sockaddr_un
+#include <unistd.h>      // close
+#include <unordered_map> // std::unordered_map
+#include <vector>        // std::vector
 
 template <typename T>
 concept Serializable = requires(T t, std::vector<std::string>& input) {
@@ -21,18 +32,103 @@ concept Deserializable = requires(T t, std::vector<uint8_t> const& input) {
     { t.deserialize(input) } -> std::same_as<std::string>;
 };
 
-class TcpTransport
+template <typename T>
+concept Transportable = requires(T t, std::string const& address, int const port, std::vector<uint8_t> const& data) {
+    t.connect(address, port);
+    t.send(data);
+    { t.receive() } -> std::same_as<std::vector<uint8_t>>;
+};
+
+// send()/receive() over an already created stream socket, shared by the TCP and Unix domain transports
+class StreamTransport
 {
 public:
-    TcpTransport()
+    StreamTransport(StreamTransport const& other) = delete;
+    StreamTransport& operator=(StreamTransport const& other) = delete;
+
+    void send(std::vector<uint8_t> const& data, int const flags = 0)
+    {
+        ::send(client_fd_, data.data(), data.size(), flags);
+    }
+
+    /**
+     * Returns exactly one response frame (length prefix included), bytes of the following frames are kept for the
+     * next call. Returns an empty vector if the connection is closed mid-frame.
+     */
+    std::vector<uint8_t> receive(size_t chunk_size = 64 << 10, int const flags = 0)
+    {
+        while ( true )
+        {
+            size_t const available = pending_.size() - pending_off_;
+            if ( available >= sizeof(uint32_t) )
+            {
+                uint32_t resp_size{};
+                std::memcpy(&resp_size, pending_.data() + pending_off_, sizeof(resp_size));
+                size_t const frame_size = sizeof(resp_size) + resp_size;
+                if ( available >= frame_size )
+                {
+                    auto const begin = pending_.begin() + pending_off_;
+                    std::vector<uint8_t> frame(begin, begin + frame_size);
+                    pending_off_ += frame_size;
+                    if ( pending_off_ == pending_.size() )
+                    {
+                        pending_.clear();
+                        pending_off_ = 0;
+                    }
+                    return frame;
+                }
+            }
+
+            size_t const old_size = pending_.size();
+            pending_.resize(old_size + chunk_size);
+            ssize_t num_received = ::recv(client_fd_, pending_.data() + old_size, chunk_size, flags);
+            pending_.resize(old_size + std::max<ssize_t>(num_received, 0));
+            if ( num_received <= 0 )
+            {
+                // Handle error
+                return {};
+            }
+        }
+    }
+
+    // True if receive() has a frame, or the start of one, to return without waiting for the server
+    bool readable() const
+    {
+        if ( pending_off_ < pending_.size() )
+            return true;
+        pollfd pfd{ client_fd_, POLLIN, 0 };
+        return ::poll(&pfd, 1, 0) > 0;
+    }
+
+    ~StreamTransport()
+    {
+        ::close(client_fd_);
+    }
+
+protected:
+    explicit StreamTransport(int const domain)
     {
-        client_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        client_fd_ = socket(domain, SOCK_STREAM, 0);
         if ( client_fd_ < 0 )
         {
             // Handle error
         }
     }
 
+    int client_fd_{ -1 };
+
+private:
+    std::vector<uint8_t> pending_{};
+    size_t pending_off_{ 0 };
+};
+
+class TcpTransport : public StreamTransport
+{
+public:
+    TcpTransport() : StreamTransport(AF_INET)
+    {
+    }
+
     void connect(std::string const& address, int const port)
     {
         sockaddr_in addr{};
@@ -51,33 +147,220 @@ public:
             return;
         }
     }
+};
 
-    void send(std::vector<uint8_t> const& data, int const flags = 0)
+// For clients on the same host as the server, skips the loopback TCP stack entirely
+class UnixTransport : public StreamTransport
+{
+public:
+    UnixTransport() : StreamTransport(AF_UNIX)
     {
-        ::send(client_fd_, data.data(), data.size(), flags);
     }
 
-    std::vector<uint8_t> receive(size_t buffer_size = 32 << 20, int const flags = 0)
+    // `port` is unused, it only keeps the signature interchangeable with TcpTransport
+    void connect(std::string const& path, int const /* port */ = 0)
     {
-        std::vector<uint8_t> buf(buffer_size);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if ( path.size() >= sizeof(addr.sun_path) )
+        {
+            // Handle error
+            return;
+        }
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
 
-        ssize_t num_received = ::recv(client_fd_, buf.data(), buf.size(), flags);
-        if ( num_received < 0 )
+        if ( ::connect(client_fd_, (sockaddr const*)&addr, sizeof(addr)) < 0 )
         {
             // Handle error
+            return;
         }
-        return buf;
+    }
+};
+
+/**
+ * Talks to the server through a pair of shared-memory rings (see shmring.h). The rings are set up over the server's
+ * unix socket with a `shmattach` request, after which every send/receive is a memcpy plus, only when the other side
+ * is asleep, one eventfd write. The socket stays open to detect a server shutdown and to detach on close.
+ */
+class ShmTransport
+{
+public:
+    // Busy-poll iterations before sleeping on the eventfd, trades CPU for latency on a dedicated core
+    static constexpr size_t DEFAULT_SPIN_COUNT{ 4096 };
+
+    explicit ShmTransport(size_t spin_count = DEFAULT_SPIN_COUNT) : spin_count_(spin_count)
+    {
     }
 
-    ~TcpTransport()
+    ShmTransport(ShmTransport const& other) = delete;
+    ShmTransport& operator=(ShmTransport const& other) = delete;
+
+    ~ShmTransport()
     {
-        ::close(client_fd_);
+        ::close(server_efd_);
+        ::close(client_efd_);
+        ::close(sock_fd_);
+    }
+
+    // Accepts "shm:/path/to/unix.sock" or "/path/to/unix.sock", `port` is unused
+    void connect(std::string const& address, int const /* port */ = 0)
+    {
+        std::string const path = address.starts_with(SHM_PREFIX) ? address.substr(SHM_PREFIX.size()) : address;
+
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if ( path.size() >= sizeof(addr.sun_path) )
+            throw std::runtime_error("Unix socket path is too long: " + path);
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+        sock_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        if ( sock_fd_ < 0 || ::connect(sock_fd_, (sockaddr const*)&addr, sizeof(addr)) < 0 )
+            throw std::runtime_error("Failed to connect to " + path + " err: " + std::strerror(errno));
+
+        // ["shmattach"] in the regular request format
+        std::string const cmd{ "shmattach" };
+        uint32_t const header[3]{ static_cast<uint32_t>(2 * sizeof(uint32_t) + cmd.size()), 1,
+                                  static_cast<uint32_t>(cmd.size()) };
+        std::vector<uint8_t> req(reinterpret_cast<uint8_t const*>(header),
+                                 reinterpret_cast<uint8_t const*>(header) + sizeof(header));
+        req.insert(req.end(), cmd.begin(), cmd.end());
+        if ( ::send(sock_fd_, req.data(), req.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(req.size()) )
+            throw std::runtime_error("Failed to send shmattach");
+
+        receive_descriptors();
+    }
+
+    void send(std::vector<uint8_t> const& data)
+    {
+        auto& ring = segment_.requests();
+        size_t off{ 0 };
+
+        while ( true )
+        {
+            off += ring.write(data.data() + off, data.size() - off);
+            if ( ring.take_parked_reader() )
+                eventfd_notify(server_efd_);
+            if ( off == data.size() )
+                return;
+
+            wait_until([&ring]() { return ring.writable() > 0; }, [&ring]() { ring.park_writer(); },
+                       [&ring]() { ring.unpark_writer(); });
+        }
+    }
+
+    // Returns exactly one response frame
+    std::vector<uint8_t> receive()
+    {
+        auto& ring = segment_.responses();
+
+        uint32_t resp_size{};
+        read_exact(ring, reinterpret_cast<uint8_t*>(&resp_size), sizeof(resp_size));
+
+        std::vector<uint8_t> frame(sizeof(resp_size) + resp_size);
+        std::memcpy(frame.data(), &resp_size, sizeof(resp_size));
+        read_exact(ring, frame.data() + sizeof(resp_size), resp_size);
+        return frame;
+    }
+
+    bool readable()
+    {
+        return segment_.responses().readable() > 0;
     }
 
 private:
-    int client_fd_{ -1 };
+    static constexpr std::string_view SHM_PREFIX{ "shm:" };
+
+    size_t spin_count_;
+    int sock_fd_{ -1 };
+    int server_efd_{ -1 };
+    int client_efd_{ -1 };
+    ShmSegment segment_{};
+
+    void receive_descriptors()
+    {
+        uint8_t buf[64]{};
+        iovec iov{ buf, sizeof(buf) };
+        alignas(cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))]{};
+
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n = recvmsg(sock_fd_, &msg, MSG_CMSG_CLOEXEC);
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        if ( n < 5 || buf[4] != 0 || !cmsg || cmsg->cmsg_type != SCM_RIGHTS ||
+             cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)) )
+            throw std::runtime_error("Server refused shmattach");
+
+        int fds[3]{};
+        std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        client_efd_ = fds[1];
+        server_efd_ = fds[2];
+
+        ShmSegment::attach(segment_, fds[0]);
+        ::close(fds[0]);
+    }
+
+    void read_exact(SpscByteRing& ring, uint8_t* dst, size_t len)
+    {
+        size_t off{ 0 };
+        while ( true )
+        {
+            size_t const n = ring.read(dst + off, len - off);
+            off += n;
+            if ( n > 0 && ring.take_parked_writer() )
+                eventfd_notify(server_efd_);
+            if ( off == len )
+                return;
+
+            wait_until([&ring]() { return ring.readable() > 0; }, [&ring]() { ring.park_reader(); },
+                       [&ring]() { ring.unpark_reader(); });
+        }
+    }
+
+    // Spin for a while, then park and sleep on the eventfd until `ready()` holds
+    template <class Ready, class Park, class Unpark>
+    void wait_until(Ready ready, Park park, Unpark unpark)
+    {
+        for ( size_t i = 0; i < spin_count_; i++ )
+        {
+            if ( ready() )
+                return;
+        }
+
+        while ( true )
+        {
+            park();
+            if ( ready() )
+            {
+                unpark();
+                return;
+            }
+
+            pollfd fds[2]{ { client_efd_, POLLIN, 0 }, { sock_fd_, POLLIN, 0 } };
+            if ( poll(fds, 2, -1) < 0 && errno != EINTR )
+                throw std::runtime_error("poll failed");
+            if ( fds[1].revents )
+                throw std::runtime_error("Server closed the shared-memory channel");
+            if ( fds[0].revents & POLLIN )
+                eventfd_drain(client_efd_);
+        }
+    }
 };
 
+inline bool is_shm_address(std::string const& address)
+{
+    return address.starts_with("shm:");
+}
+
+// Addresses that look like a filesystem path are served over a Unix domain socket
+inline bool is_unix_socket_address(std::string const& address)
+{
+    return !is_shm_address(address) && address.find('/') != std::string::npos;
+}
+
 class RedisSerializer
 {
 public:
@@ -149,10 +432,11 @@ public:
 
         // Parse data
         resp += ", Response: ";
-        if ( data_len > 1 && message.size() >= sizeof(data_len) + sizeof(status) + data_len )
+        // data_len counts the status byte too
+        if ( data_len > 1 && message.size() >= sizeof(data_len) + data_len )
         {
             auto data_begin = status_begin + sizeof(status);
-            resp += std::string(data_begin, data_begin + data_len);
+            resp += std::string(data_begin, data_begin + data_len - sizeof(status));
         }
 
         return resp;
@@ -162,11 +446,19 @@ private:
     size_t MAX_MSG_FIELD_SIZE{ 32 << 20 };
 };
 
+/**
+ * SocketClient::enable_tracking() turns on client-side caching: the server remembers which keys the connection reads
+ * and pushes `[invalidate, key]` when one of them changes (see the server's tracking.h), and get() answers the keys it
+ * has read before from memory. Invalidations that already arrived are applied before every cache lookup, which costs a
+ * poll() instead of a round trip. `[invalidate, nil]` (the server forgot which keys we read) empties the cache.
+ */
 template <class Transport, class Serializer, class Deserializer>
-    requires Serializable<Serializer> && Deserializable<Deserializer>
+    requires Transportable<Transport> && Serializable<Serializer> && Deserializable<Deserializer>
 class SocketClient
 {
 public:
+    static constexpr size_t DEFAULT_CACHE_ENTRIES{ 1 << 16 };
+
     SocketClient(Transport& transport, Serializer& serializer, Deserializer& deserializer)
         : transport_(transport), serializer_(serializer), deserializer_(deserializer)
     {
@@ -185,20 +477,289 @@ public:
 
     std::string receive_message()
     {
-        auto data = transport_.receive();
+        auto data = receive_reply();
+        if ( is_compressed(data) )
+            inflate_reply(data);
         return deserializer_.deserialize(data);
     }
 
+    // `get` replies of values the server stores compressed then arrive compressed and are inflated here
+    bool enable_compression()
+    {
+        std::vector<std::string> cmd{ "client", "compression", "on" };
+        send_message(cmd);
+        return receive_message().starts_with("Status: 0");
+    }
+
+    // At most `max_entries` replies are cached, a full cache is emptied
+    bool enable_tracking(size_t max_entries = DEFAULT_CACHE_ENTRIES)
+        requires requires(Transport& t) { t.readable(); }
+    {
+        std::vector<std::string> cmd{ "client", "tracking", "on" };
+        send_message(cmd);
+        tracking_ = receive_message().starts_with("Status: 0");
+        cache_max_entries_ = std::max<size_t>(max_entries, 1);
+        return tracking_;
+    }
+
+    // `get <key>`, from the cache if tracking is on and the key was read before and has not changed since
+    std::string get(std::string const& key)
+    {
+        if ( tracking_ )
+        {
+            apply_invalidations();
+            if ( auto it = cache_.find(key); it != cache_.end() )
+            {
+                cache_hits_++;
+                return it->second;
+            }
+            cache_misses_++;
+        }
+
+        std::vector<std::string> cmd{ "get", key };
+        send_message(cmd);
+        std::string reply = receive_message();
+
+        // Values and misses are cached, errors (a redirect, WRONGTYPE) are not
+        if ( tracking_ && (reply.starts_with("Status: 0") || reply.starts_with("Status: 2")) )
+        {
+            if ( cache_.size() >= cache_max_entries_ )
+                cache_.clear();
+            cache_.insert_or_assign(key, reply);
+        }
+        return reply;
+    }
+
+    [[nodiscard]] size_t cache_hits() const noexcept
+    {
+        return cache_hits_;
+    }
+
+    [[nodiscard]] size_t cache_misses() const noexcept
+    {
+        return cache_misses_;
+    }
+
+    /**
+     * The keys matching `match`, walked with `scan` calls of `count` keys each as the loop advances:
+     *   for ( auto const& key : client.scan("user:*") ) ...
+     * Throws std::runtime_error if the server refuses a call.
+     */
+    class ScanRange
+    {
+    public:
+        class iterator
+        {
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = std::string;
+            using difference_type = std::ptrdiff_t;
+            using pointer = std::string const*;
+            using reference = std::string const&;
+
+            iterator() = default;
+
+            explicit iterator(ScanRange* range) : range_(range)
+            {
+                skip_empty_batches();
+            }
+
+            reference operator*() const
+            {
+                return range_->batch_[pos_];
+            }
+
+            pointer operator->() const
+            {
+                return &range_->batch_[pos_];
+            }
+
+            iterator& operator++()
+            {
+                pos_++;
+                skip_empty_batches();
+                return *this;
+            }
+
+            void operator++(int)
+            {
+                ++*this;
+            }
+
+            bool operator==(iterator const& other) const noexcept
+            {
+                return range_ == other.range_;
+            }
+
+        private:
+            ScanRange* range_{ nullptr }; // nullptr once the scan is done
+            size_t pos_{ 0 };
+
+            void skip_empty_batches()
+            {
+                while ( pos_ == range_->batch_.size() )
+                {
+                    if ( !range_->fetch() )
+                    {
+                        range_ = nullptr;
+                        return;
+                    }
+                    pos_ = 0;
+                }
+            }
+        };
+
+        ScanRange(SocketClient& client, std::string match, size_t count)
+            : client_(client), match_(std::move(match)), count_(count)
+        {
+        }
+
+        iterator begin()
+        {
+            return iterator(this);
+        }
+
+        iterator end()
+        {
+            return {};
+        }
+
+    private:
+        SocketClient& client_;
+        std::string match_;
+        size_t count_;
+        std::string cursor_{ "0" };
+        bool done_{ false };
+        std::vector<std::string> batch_{};
+
+        // The next batch, which may be empty, false once the server returned cursor 0
+        bool fetch()
+        {
+            if ( done_ )
+                return false;
+
+            std::vector<std::string> cmd{ "scan", cursor_, "match", match_, "count", std::to_string(count_) };
+            client_.send_message(cmd);
+            auto const frame = client_.receive_reply();
+            std::vector<std::optional<std::string>> reply;
+            if ( frame.size() < HEADER_SIZE || frame[sizeof(uint32_t)] != 0 ||
+                 !parse_array(frame.data() + HEADER_SIZE, frame.size() - HEADER_SIZE, reply) || reply.empty() ||
+                 !reply[0] )
+                throw std::runtime_error("scan failed: " + client_.deserializer_.deserialize(frame));
+
+            cursor_ = *reply[0];
+            done_ = cursor_ == "0";
+            batch_.clear();
+            for ( size_t i = 1; i < reply.size(); i++ )
+                batch_.push_back(reply[i].value_or(std::string()));
+            return true;
+        }
+    };
+
+    ScanRange scan(std::string match = "*", size_t count = 100)
+    {
+        return ScanRange(*this, std::move(match), count);
+    }
+
 private:
+    // Mirror the server's ResponseStatus::RES_PUSH and RES_COMPRESSED, client.h does not depend on server.h
+    static constexpr uint8_t PUSH_STATUS{ 5 };
+    static constexpr uint8_t COMPRESSED_STATUS{ 6 };
+    static constexpr size_t HEADER_SIZE{ sizeof(uint32_t) + 1 };
+
     Transport& transport_;
     Serializer& serializer_;
     Deserializer& deserializer_;
+
+    bool tracking_{ false };
+    size_t cache_max_entries_{ DEFAULT_CACHE_ENTRIES };
+    std::unordered_map<std::string, std::string> cache_{}; // key -> deserialized `get` reply
+    size_t cache_hits_{ 0 };
+    size_t cache_misses_{ 0 };
+    std::deque<std::vector<uint8_t>> replies_{}; // Received while looking for invalidations
+
+    static bool is_push(std::vector<uint8_t> const& frame) noexcept
+    {
+        return frame.size() >= HEADER_SIZE && frame[sizeof(uint32_t)] == PUSH_STATUS;
+    }
+
+    static bool is_compressed(std::vector<uint8_t> const& frame) noexcept
+    {
+        return frame.size() >= HEADER_SIZE + sizeof(uint32_t) && frame[sizeof(uint32_t)] == COMPRESSED_STATUS;
+    }
+
+    // raw size u32 | LZ4 block -> the plain RES_OK reply
+    void inflate_reply(std::vector<uint8_t>& frame)
+    {
+        uint32_t raw_size{};
+        std::memcpy(&raw_size, frame.data() + HEADER_SIZE, sizeof(raw_size));
+        size_t const block_offset = HEADER_SIZE + sizeof(raw_size);
+        std::string_view const block(reinterpret_cast<char const*>(frame.data()) + block_offset,
+                                     frame.size() - block_offset);
+
+        std::vector<uint8_t> plain(HEADER_SIZE + raw_size);
+        uint32_t const resp_size = 1 + raw_size;
+        std::memcpy(plain.data(), &resp_size, sizeof(resp_size));
+        plain[sizeof(uint32_t)] = 0;
+        if ( !lz4_decompress(block, reinterpret_cast<char*>(plain.data()) + HEADER_SIZE, raw_size) )
+            throw std::runtime_error("Corrupt compressed reply");
+        frame = std::move(plain);
+    }
+
+    // The next frame that is not a push, pushes received on the way are applied
+    std::vector<uint8_t> receive_reply()
+    {
+        if ( !replies_.empty() )
+        {
+            auto frame = std::move(replies_.front());
+            replies_.pop_front();
+            return frame;
+        }
+
+        while ( true )
+        {
+            auto frame = transport_.receive();
+            if ( !is_push(frame) )
+                return frame;
+            apply_push(frame);
+        }
+    }
+
+    void apply_invalidations()
+    {
+        if constexpr ( requires { transport_.readable(); } )
+        {
+            while ( transport_.readable() )
+            {
+                auto frame = transport_.receive();
+                if ( frame.empty() )
+                    return;
+                if ( is_push(frame) )
+                    apply_push(frame);
+                else
+                    replies_.push_back(std::move(frame));
+            }
+        }
+    }
+
+    void apply_push(std::vector<uint8_t> const& frame)
+    {
+        std::vector<std::optional<std::string>> msg;
+        if ( !parse_array(frame.data() + HEADER_SIZE, frame.size() - HEADER_SIZE, msg) || msg.size() != 2 ||
+             msg[0] != "invalidate" )
+            return;
+        if ( msg[1] )
+            cache_.erase(*msg[1]);
+        else
+            cache_.clear();
+    }
 };
 
+template <class Client>
 class CLIHandler
 {
 public:
-    CLIHandler(SocketClient<TcpTransport, RedisSerializer, RedisDeserializer>& client) : client_(client)
+    CLIHandler(Client& client) : client_(client)
     {
     }
 
@@ -223,10 +784,17 @@ public:
         client_.send_message(cmds);
         auto msg = client_.receive_message();
         spdlog::info(msg);
+
+        // A subscriber keeps printing the messages published to it until the server closes the connection
+        if ( cmds[0] == "subscribe" || cmds[0] == "psubscribe" )
+        {
+            while ( (msg = client_.receive_message()).starts_with("Status: ") )
+                spdlog::info(msg);
+        }
     }
 
 private:
-    SocketClient<TcpTransport, RedisSerializer, RedisDeserializer>& client_;
+    Client& client_;
 };
 
 #endif
\ No newline at end of file
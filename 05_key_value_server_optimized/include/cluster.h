@@ -0,0 +1,210 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Hash-slot cluster.
+ *
+ * The keyspace is split into CLUSTER_SLOTS slots, slot = CRC16(key) % CLUSTER_SLOTS. If the key contains a non-empty
+ * `{tag}` only the tag is hashed, so related keys can be forced into one slot for multi-key commands. Every node holds
+ * the full slot -> node map and answers requests for slots it does not own with RES_MOVED and `<slot> <host:port>`.
+ *
+ * The map is loaded from a file of `<first>-<last> <host:port>` lines and can be changed with `cluster setslot`.
+ *
+ * Online migration (`cluster migrate <slot> <host:port>`) moves a slot while both nodes keep serving it:
+ *   1. The source tells the target `cluster importing <slot> <source>`.
+ *   2. The source walks its keyspace in steps bounded by a time budget. Every step ships the keys of the slot it found
+ *      as one `cluster restore` batch, and only deletes them locally once the target acknowledged the batch. Keys
+ *      written to while their batch is in flight are sent again with the next batch.
+ *   3. Meanwhile the source answers requests for keys of the slot it no longer has with RES_ASK. The client then sends
+ *      `asking` followed by the request to the target, which serves an importing slot only right after `asking`.
+ *   4. Once the walk is done the source hands the slot over with `cluster setslot` on the target and starts sending
+ *      RES_MOVED for it.
+ */
+
+inline constexpr uint16_t CLUSTER_SLOTS{ 16384 };
+inline constexpr std::chrono::microseconds DEFAULT_MIGRATION_STEP_BUDGET{ 200 };
+inline constexpr size_t DEFAULT_MIGRATION_BATCH_BYTES{ 64 << 10 };
+
+// CRC16/XMODEM (poly 0x1021), the same variant Redis Cluster uses
+inline constexpr std::array<uint16_t, 256> CRC16_TABLE = []()
+{
+    std::array<uint16_t, 256> table{};
+    for ( uint16_t i = 0; i < 256; i++ )
+    {
+        uint16_t crc = i << 8;
+        for ( int bit = 0; bit < 8; bit++ )
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        table[i] = crc;
+    }
+    return table;
+}();
+
+inline uint16_t crc16(std::string_view data) noexcept
+{
+    uint16_t crc{ 0 };
+    for ( unsigned char c : data )
+        crc = (crc << 8) ^ CRC16_TABLE[((crc >> 8) ^ c) & 0xFF];
+    return crc;
+}
+
+inline uint16_t key_hash_slot(std::string_view key) noexcept
+{
+    if ( auto const open = key.find('{'); open != std::string_view::npos )
+    {
+        auto const close = key.find('}', open + 1);
+        if ( close != std::string_view::npos && close != open + 1 )
+            key = key.substr(open + 1, close - open - 1);
+    }
+    return crc16(key) & (CLUSTER_SLOTS - 1);
+}
+
+class ClusterState
+{
+public:
+    static constexpr uint16_t UNASSIGNED{ UINT16_MAX };
+
+    // `self` is the host:port other nodes and clients know this node by
+    void enable(std::string self)
+    {
+        self_ = node_index(self);
+        enabled_ = true;
+    }
+
+    [[nodiscard]] bool enabled() const noexcept
+    {
+        return enabled_;
+    }
+
+    // Also ends any import of these slots, the caller is now the authority on who serves them
+    void assign(uint16_t first, uint16_t last, std::string const& node)
+    {
+        if ( first > last || last >= CLUSTER_SLOTS )
+            throw std::invalid_argument("Invalid slot range");
+        uint16_t const idx = node_index(node);
+        for ( uint32_t slot = first; slot <= last; slot++ )
+        {
+            owner_[slot] = idx;
+            importing_[slot] = false;
+        }
+    }
+
+    void set_importing(uint16_t slot) noexcept
+    {
+        importing_[slot] = true;
+    }
+
+    [[nodiscard]] bool importing(uint16_t slot) const noexcept
+    {
+        return importing_[slot];
+    }
+
+    // Reads `<first>-<last> <host:port>` lines, blank lines and lines starting with # are skipped
+    void load(std::istream& in)
+    {
+        for ( std::string line; std::getline(in, line); )
+        {
+            if ( line.empty() || line[0] == '#' )
+                continue;
+
+            std::istringstream fields(line);
+            std::string range, node;
+            fields >> range >> node;
+            auto const dash = range.find('-');
+            if ( dash == std::string::npos || node.empty() )
+                throw std::invalid_argument("Malformed cluster config line: " + line);
+            assign(std::stoi(range.substr(0, dash)), std::stoi(range.substr(dash + 1)), node);
+        }
+    }
+
+    [[nodiscard]] std::string const& self() const
+    {
+        return nodes_.at(self_);
+    }
+
+    [[nodiscard]] bool owns(uint16_t slot) const noexcept
+    {
+        return owner_[slot] == self_;
+    }
+
+    [[nodiscard]] bool assigned(uint16_t slot) const noexcept
+    {
+        return owner_[slot] != UNASSIGNED;
+    }
+
+    [[nodiscard]] std::string const& owner(uint16_t slot) const
+    {
+        return nodes_.at(owner_[slot]);
+    }
+
+    // Contiguous ranges as (first, last, node), in slot order
+    template <class Fn>
+    void for_each_range(Fn&& fn) const
+    {
+        for ( uint32_t first = 0; first < CLUSTER_SLOTS; )
+        {
+            uint32_t last = first;
+            while ( last + 1 < CLUSTER_SLOTS && owner_[last + 1] == owner_[first] )
+                last++;
+            if ( owner_[first] != UNASSIGNED )
+                fn(static_cast<uint16_t>(first), static_cast<uint16_t>(last), nodes_[owner_[first]]);
+            first = last + 1;
+        }
+    }
+
+private:
+    bool enabled_{ false };
+    uint16_t self_{ UNASSIGNED };
+    std::vector<std::string> nodes_{};
+    std::vector<uint16_t> owner_ = std::vector<uint16_t>(CLUSTER_SLOTS, UNASSIGNED);
+    std::vector<bool> importing_ = std::vector<bool>(CLUSTER_SLOTS, false);
+
+    uint16_t node_index(std::string const& node)
+    {
+        for ( size_t i = 0; i < nodes_.size(); i++ )
+        {
+            if ( nodes_[i] == node )
+                return static_cast<uint16_t>(i);
+        }
+        nodes_.push_back(node);
+        return static_cast<uint16_t>(nodes_.size() - 1);
+    }
+};
+
+// Source side state of an online slot migration
+struct SlotMigration
+{
+    uint16_t slot{ 0 };
+    std::string target{};  // host:port
+    int fd{ -1 };          // Connection to the target, its replies acknowledge our batches
+    int wake_fd{ -1 };     // eventfd to come back to a walk that found nothing within its budget
+    std::chrono::microseconds step_budget{ DEFAULT_MIGRATION_STEP_BUDGET };
+    size_t batch_bytes{ DEFAULT_MIGRATION_BATCH_BYTES };
+
+    std::string cursor{};  // Last key walked, the next step resumes after it
+    bool started{ false }; // The walk has taken its first step
+    bool walk_done{ false };
+    bool awaiting_reply{ false };
+    bool finalizing{ false }; // The final setslot has been sent
+
+    std::unordered_set<std::string> in_flight{}; // Keys of the unacknowledged batch, still served by us
+    std::unordered_set<std::string> dirty{};     // In-flight keys written to after they were sent
+    std::unordered_set<std::string> resend{};    // Dirty keys of an acknowledged batch, go out with the next one
+
+    uint64_t keys_moved{ 0 };
+    uint64_t keys_walked{ 0 };
+    uint64_t batches{ 0 };
+    std::chrono::steady_clock::time_point start_time{};
+};
+
+#endif
@@ -0,0 +1,281 @@
+#ifndef CLUSTER_CLIENT_H
+#define CLUSTER_CLIENT_H
+
+#include "client.h"
+#include "cluster.h"
+#include "protocol.h"
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Client for a hash-slot cluster (see cluster.h). It caches the slot -> node map from `cluster slots` and sends each
+ * request straight to the node owning its key. A RES_MOVED reply means the cache is stale: the map is reloaded from the
+ * node that redirected us and the request is retried there. RES_ASK comes from a slot that is being migrated: the
+ * request is retried once on the target, prefixed with `asking`, and the map is left alone.
+ *
+ * mget/mset are split into one request per slot. All sub-requests are written to their nodes before any reply is read,
+ * so the nodes work on them in parallel.
+ */
+
+template <class Transport, class Serializer, class Deserializer>
+    requires Transportable<Transport> && Serializable<Serializer> && Deserializable<Deserializer>
+class ClusterClient
+{
+public:
+    static constexpr int MAX_REDIRECTS{ 5 };
+
+    ClusterClient(Serializer& serializer, Deserializer& deserializer)
+        : serializer_(serializer), deserializer_(deserializer)
+    {
+    }
+
+    void connect(std::string const& address, int const port)
+    {
+        seed_ = address + ":" + std::to_string(port);
+        refresh_slots(seed_);
+    }
+
+    // Single-key commands (and commands without a key, which go to the seed node)
+    std::string send_request(std::vector<std::string>& message)
+    {
+        std::string addr = message.size() >= 2 ? owner_of(message[1]) : seed_;
+        auto const data = serializer_.serialize(message);
+
+        return deserializer_.deserialize(request(addr, data));
+    }
+
+    std::vector<std::optional<std::string>> mget(std::vector<std::string> const& keys)
+    {
+        std::vector<std::optional<std::string>> values(keys.size());
+        run_split(keys, 1, "mget",
+                  [&values](std::vector<size_t> const& positions, std::vector<uint8_t> const& frame)
+                  {
+                      std::vector<std::optional<std::string>> part;
+                      if ( status_of(frame) != ResponseStatus::RES_OK ||
+                           !parse_array(frame.data() + HEADER_SIZE, frame.size() - HEADER_SIZE, part) ||
+                           part.size() != positions.size() )
+                          return false;
+                      for ( size_t i = 0; i < positions.size(); i++ )
+                          values[positions[i]] = std::move(part[i]);
+                      return true;
+                  });
+        return values;
+    }
+
+    // `kvs` is key0, value0, key1, value1, ...; false if any part failed
+    bool mset(std::vector<std::string> const& kvs)
+    {
+        bool ok{ true };
+        run_split(kvs, 2, "mset",
+                  [&ok](std::vector<size_t> const&, std::vector<uint8_t> const& frame)
+                  {
+                      ok &= status_of(frame) == ResponseStatus::RES_OK;
+                      return true;
+                  });
+        return ok;
+    }
+
+    void refresh_slots(std::string const& from)
+    {
+        std::vector<std::string> cmd{ "cluster", "slots" };
+        auto const frame = roundtrip(node(from), serializer_.serialize(cmd));
+
+        std::vector<std::optional<std::string>> ranges;
+        if ( status_of(frame) != ResponseStatus::RES_OK ||
+             !parse_array(frame.data() + HEADER_SIZE, frame.size() - HEADER_SIZE, ranges) )
+        {
+            spdlog::error("Failed to load the slot map from {}", from);
+            return;
+        }
+
+        // "<first>-<last> <host:port>"
+        for ( auto const& range : ranges )
+        {
+            auto const dash = range->find('-');
+            auto const space = range->find(' ');
+            if ( dash == std::string::npos || space == std::string::npos )
+                continue;
+            int const first = std::stoi(range->substr(0, dash));
+            int const last = std::stoi(range->substr(dash + 1, space - dash - 1));
+            std::string const owner = range->substr(space + 1);
+            for ( int slot = first; slot <= last && slot < CLUSTER_SLOTS; slot++ )
+                slot_owner_[slot] = owner;
+        }
+    }
+
+    [[nodiscard]] uint64_t redirects() const noexcept
+    {
+        return redirects_;
+    }
+
+private:
+    // Mirrors the server's ResponseStatus, client.h does not depend on server.h
+    enum class ResponseStatus : uint8_t
+    {
+        RES_OK = 0,
+        RES_ERR,
+        RES_NX,
+        RES_MOVED,
+        RES_ASK,
+        RES_PUSH,
+        RES_COMPRESSED,
+    };
+
+    static constexpr size_t HEADER_SIZE{ sizeof(uint32_t) + 1 };
+
+    struct NodeConnection
+    {
+        Transport transport{};
+    };
+
+    Serializer& serializer_;
+    Deserializer& deserializer_;
+    std::string seed_{};
+    std::unordered_map<std::string, std::unique_ptr<NodeConnection>> nodes_{};
+    std::vector<std::string> slot_owner_ = std::vector<std::string>(CLUSTER_SLOTS);
+    uint64_t redirects_{ 0 };
+
+    static ResponseStatus status_of(std::vector<uint8_t> const& frame)
+    {
+        return frame.size() >= HEADER_SIZE ? static_cast<ResponseStatus>(frame[sizeof(uint32_t)])
+                                           : ResponseStatus::RES_ERR;
+    }
+
+    std::string const& owner_of(std::string const& key) const
+    {
+        auto const& owner = slot_owner_[key_hash_slot(key)];
+        return owner.empty() ? seed_ : owner;
+    }
+
+    NodeConnection& node(std::string const& addr)
+    {
+        auto& conn = nodes_[addr];
+        if ( !conn )
+        {
+            auto const colon = addr.rfind(':');
+            conn = std::make_unique<NodeConnection>();
+            conn->transport.connect(addr.substr(0, colon), std::stoi(addr.substr(colon + 1)));
+        }
+        return *conn;
+    }
+
+    static std::vector<uint8_t> roundtrip(NodeConnection& conn, std::vector<uint8_t> const& data)
+    {
+        conn.transport.send(data);
+        return conn.transport.receive();
+    }
+
+    // On RES_MOVED points `addr` at the new owner, reloads the slot map from it and returns true
+    bool follow_redirect(std::vector<uint8_t> const& frame, std::string& addr)
+    {
+        if ( status_of(frame) != ResponseStatus::RES_MOVED )
+            return false;
+
+        std::string const moved(frame.begin() + HEADER_SIZE, frame.end());
+        auto const space = moved.find(' ');
+        if ( space == std::string::npos )
+            return false;
+
+        redirects_++;
+        addr = moved.substr(space + 1);
+        slot_owner_[std::stoi(moved.substr(0, space))] = addr;
+        refresh_slots(addr);
+        return true;
+    }
+
+    // Sends `data` to `addr` and follows redirects until a node answers it for real
+    std::vector<uint8_t> request(std::string addr, std::vector<uint8_t> const& data)
+    {
+        for ( int attempt = 0;; attempt++ )
+        {
+            auto frame = roundtrip(node(addr), data);
+            if ( attempt < MAX_REDIRECTS && status_of(frame) == ResponseStatus::RES_ASK )
+                frame = ask(frame, data);
+            if ( attempt == MAX_REDIRECTS || !follow_redirect(frame, addr) )
+                return frame;
+        }
+    }
+
+    // Retries a request answered with RES_ASK on the migration target, `asking` and the request go out in one write
+    std::vector<uint8_t> ask(std::vector<uint8_t> const& frame, std::vector<uint8_t> const& data)
+    {
+        std::string const target(frame.begin() + HEADER_SIZE, frame.end());
+        auto const space = target.find(' ');
+        if ( space == std::string::npos )
+            return frame;
+
+        redirects_++;
+        std::vector<std::string> asking{ "asking" };
+        auto batch = serializer_.serialize(asking);
+        batch.insert(batch.end(), data.begin(), data.end());
+
+        auto& conn = node(target.substr(space + 1));
+        conn.transport.send(batch);
+        conn.transport.receive();
+        return conn.transport.receive();
+    }
+
+    /**
+     * Splits `args` (groups of `stride` arguments starting with a key) into one `cmd` request per slot, pipelines them
+     * to their nodes and hands every reply to `on_reply` with the group positions it covers. Sub-requests that come
+     * back redirected or rejected by `on_reply` are retried one by one through the redirect-following path.
+     */
+    template <class OnReply>
+    void run_split(std::vector<std::string> const& args, size_t stride, std::string const& cmd, OnReply&& on_reply)
+    {
+        struct SubRequest
+        {
+            std::vector<std::string> message{};
+            std::vector<size_t> positions{};
+        };
+
+        std::unordered_map<uint16_t, SubRequest> by_slot;
+        for ( size_t i = 0; i + stride <= args.size(); i += stride )
+        {
+            auto& sub = by_slot[key_hash_slot(args[i])];
+            if ( sub.message.empty() )
+                sub.message.push_back(cmd);
+            sub.message.insert(sub.message.end(), args.begin() + i, args.begin() + i + stride);
+            sub.positions.push_back(i / stride);
+        }
+
+        // Write everything first, one batch per node, then collect the replies in the same order
+        std::unordered_map<std::string, std::vector<SubRequest*>> by_node;
+        for ( auto& [slot, sub] : by_slot )
+            by_node[owner_of(args[sub.positions.front() * stride])].push_back(&sub);
+
+        for ( auto& [addr, subs] : by_node )
+        {
+            std::vector<uint8_t> batch;
+            for ( auto* sub : subs )
+            {
+                auto const data = serializer_.serialize(sub->message);
+                batch.insert(batch.end(), data.begin(), data.end());
+            }
+            node(addr).transport.send(batch);
+        }
+
+        std::vector<SubRequest*> retry;
+        for ( auto& [addr, subs] : by_node )
+        {
+            for ( auto* sub : subs )
+            {
+                auto const frame = node(addr).transport.receive();
+                if ( status_of(frame) == ResponseStatus::RES_MOVED || status_of(frame) == ResponseStatus::RES_ASK ||
+                     !on_reply(sub->positions, frame) )
+                    retry.push_back(sub);
+            }
+        }
+
+        for ( auto* sub : retry )
+            on_reply(sub->positions,
+                     request(owner_of(args[sub->positions.front() * stride]), serializer_.serialize(sub->message)));
+    }
+};
+
+#endif
@@ -0,0 +1,393 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+/**
+ * Transparent compression of large string values.
+ *
+ * The codec writes the LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md), so any LZ4
+ * library reads what it writes and the other way around: a client that negotiated compressed replies can inflate them
+ * with liblz4's LZ4_decompress_safe(). It is LZ4's single-pass greedy parser with a direct-mapped hash table of the
+ * last position each 4-byte sequence was seen at, which compresses JSON and other text 2-5x at a few hundred MB/s and
+ * decompresses at 1-2 GB/s, cheap enough to run in the request path.
+ *
+ * The block format does not record the uncompressed size, CompressedString keeps it so `get` can size its reply
+ * before inflating straight into it.
+ */
+
+inline constexpr size_t LZ4_MIN_MATCH{ 4 };
+inline constexpr size_t LZ4_LAST_LITERALS{ 5 };  // A block ends with at least this many literals
+inline constexpr size_t LZ4_MF_LIMIT{ 12 };      // and its last match starts at least this far from the end
+inline constexpr size_t LZ4_MAX_OFFSET{ 65535 };
+inline constexpr unsigned LZ4_HASH_LOG{ 14 };    // 64 KiB of table, fits L2 next to the data
+inline constexpr unsigned LZ4_SKIP_TRIGGER{ 6 }; // Misses before the search starts skipping ahead
+
+// Size of the buffer lz4_compress() may need for `size` bytes: incompressible data grows a little
+constexpr size_t lz4_compress_bound(size_t size) noexcept
+{
+    return size + size / 255 + 16;
+}
+
+namespace lz4_detail
+{
+inline uint32_t read32(uint8_t const* p) noexcept
+{
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t read64(uint8_t const* p) noexcept
+{
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// A length that did not fit its 4-bit token field: 255s and a last byte below 255
+inline uint8_t* write_length(uint8_t* op, size_t len) noexcept
+{
+    for ( ; len >= 255; len -= 255 )
+        *op++ = 255;
+    *op++ = static_cast<uint8_t>(len);
+    return op;
+}
+
+// Bytes src[pos, limit) has in common with src[ref, ...), compared a word at a time
+inline size_t common_length(uint8_t const* src, size_t pos, size_t ref, size_t limit) noexcept
+{
+    size_t const start = pos;
+    while ( pos + sizeof(uint64_t) <= limit )
+    {
+        uint64_t const diff = read64(src + pos) ^ read64(src + ref);
+        if ( diff != 0 )
+            return pos - start + static_cast<size_t>(std::countr_zero(diff)) / 8;
+        pos += sizeof(uint64_t);
+        ref += sizeof(uint64_t);
+    }
+    while ( pos < limit && src[pos] == src[ref] )
+    {
+        pos++;
+        ref++;
+    }
+    return pos - start;
+}
+} // namespace lz4_detail
+
+/**
+ * Compresses `in` into `out`, which must hold lz4_compress_bound(in.size()) bytes, and returns the compressed size.
+ * `in` must be under 4 GiB, positions are kept as 32 bits.
+ */
+inline size_t lz4_compress(std::string_view in, char* out) noexcept
+{
+    using namespace lz4_detail;
+    auto const* src = reinterpret_cast<uint8_t const*>(in.data());
+    size_t const size = in.size();
+    auto* op = reinterpret_cast<uint8_t*>(out);
+
+    // Token: literal count in the high nibble, match length - 4 in the low one, 15 means more length bytes follow
+    auto emit_literals = [&](size_t from, size_t to) -> uint8_t*
+    {
+        size_t const count = to - from;
+        uint8_t* token = op++;
+        *token = static_cast<uint8_t>(std::min<size_t>(count, 15) << 4);
+        if ( count >= 15 )
+            op = write_length(op, count - 15);
+        std::memcpy(op, src + from, count);
+        op += count;
+        return token;
+    };
+
+    size_t anchor{ 0 }; // First byte not emitted yet
+    if ( size > LZ4_MF_LIMIT )
+    {
+        // Small inputs use a small part of the table, clearing 64 KiB would cost more than compressing them
+        unsigned const hash_log = std::clamp<unsigned>(std::bit_width(size) - 1, 8, LZ4_HASH_LOG);
+        std::array<uint32_t, size_t{ 1 } << LZ4_HASH_LOG> table;
+        std::fill_n(table.begin(), size_t{ 1 } << hash_log, 0);
+        auto const slot_of = [&](size_t pos) -> uint32_t&
+        { return table[(read32(src + pos) * 2654435761U) >> (32 - hash_log)]; };
+
+        size_t const match_limit = size - LZ4_MF_LIMIT;   // A match starts at or before this
+        size_t const end_limit = size - LZ4_LAST_LITERALS; // and ends at or before this
+        size_t pos{ 1 };
+        slot_of(0) = 0;
+
+        while ( true )
+        {
+            // The next position whose 4 bytes were seen within the window. Each miss in a row moves further ahead.
+            size_t ref{ 0 };
+            bool found{ false };
+            for ( size_t attempts = size_t{ 1 } << LZ4_SKIP_TRIGGER; pos <= match_limit;
+                  pos += attempts++ >> LZ4_SKIP_TRIGGER )
+            {
+                uint32_t& slot = slot_of(pos);
+                ref = slot;
+                slot = static_cast<uint32_t>(pos);
+                if ( pos - ref <= LZ4_MAX_OFFSET && read32(src + ref) == read32(src + pos) )
+                {
+                    found = true;
+                    break;
+                }
+            }
+            if ( !found )
+                break;
+
+            // The match may also extend backwards into the pending literals
+            while ( pos > anchor && ref > 0 && src[pos - 1] == src[ref - 1] )
+            {
+                pos--;
+                ref--;
+            }
+            size_t const len =
+                LZ4_MIN_MATCH + common_length(src, pos + LZ4_MIN_MATCH, ref + LZ4_MIN_MATCH, end_limit);
+
+            uint8_t* token = emit_literals(anchor, pos);
+            size_t const offset = pos - ref;
+            *op++ = static_cast<uint8_t>(offset);
+            *op++ = static_cast<uint8_t>(offset >> 8);
+            *token |= static_cast<uint8_t>(std::min<size_t>(len - LZ4_MIN_MATCH, 15));
+            if ( len - LZ4_MIN_MATCH >= 15 )
+                op = write_length(op, len - LZ4_MIN_MATCH - 15);
+
+            pos += len;
+            anchor = pos;
+            if ( pos > match_limit )
+                break;
+            slot_of(pos - 2) = static_cast<uint32_t>(pos - 2);
+        }
+    }
+
+    emit_literals(anchor, size);
+    return static_cast<size_t>(op - reinterpret_cast<uint8_t*>(out));
+}
+
+/**
+ * Inflates the block `in` into `out`, false unless it is a well-formed block that decompresses to exactly `out_size`
+ * bytes. Never reads or writes outside the two buffers, whatever `in` holds.
+ */
+inline bool lz4_decompress(std::string_view in, char* out, size_t out_size) noexcept
+{
+    auto const* ip = reinterpret_cast<uint8_t const*>(in.data());
+    auto const* const iend = ip + in.size();
+    char* op = out;
+    char* const oend = out + out_size;
+
+    constexpr size_t WILD_COPY{ 16 };
+    auto wild_copy = [](char* dst, void const* src, size_t len)
+    {
+        auto const* from = static_cast<char const*>(src);
+        for ( size_t i = 0; i < len; i += WILD_COPY )
+            std::memcpy(dst + i, from + i, WILD_COPY);
+    };
+    auto read_length = [&](size_t& len)
+    {
+        uint8_t byte{};
+        do
+        {
+            if ( ip == iend )
+                return false;
+            byte = *ip++;
+            len += byte;
+        } while ( byte == 255 );
+        return true;
+    };
+
+    while ( ip != iend )
+    {
+        uint8_t const token = *ip++;
+        size_t literals = token >> 4;
+        if ( literals == 15 && !read_length(literals) )
+            return false;
+        if ( static_cast<size_t>(iend - ip) < literals || static_cast<size_t>(oend - op) < literals )
+            return false;
+        // Away from the ends, copy in fixed 16-byte steps that may run past the literals: faster than an exact
+        // memcpy() of a small variable size, and the extra bytes are overwritten by what comes next
+        if ( static_cast<size_t>(iend - ip) >= literals + WILD_COPY &&
+             static_cast<size_t>(oend - op) >= literals + WILD_COPY )
+            wild_copy(op, ip, literals);
+        else
+            std::memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+
+        // The last sequence has no match
+        if ( ip == iend )
+            return op == oend;
+
+        if ( iend - ip < 2 )
+            return false;
+        size_t const offset = ip[0] | (size_t{ ip[1] } << 8);
+        ip += 2;
+        size_t len = token & 15;
+        if ( len == 15 && !read_length(len) )
+            return false;
+        len += LZ4_MIN_MATCH;
+        if ( offset == 0 || offset > static_cast<size_t>(op - out) || static_cast<size_t>(oend - op) < len )
+            return false;
+
+        if ( offset >= WILD_COPY && static_cast<size_t>(oend - op) >= len + WILD_COPY )
+        {
+            wild_copy(op, op - offset, len);
+            op += len;
+            continue;
+        }
+
+        // A match closer than its length repeats a pattern: every copy of the pattern doubles the distance that can
+        // be copied without overlap, so runs of one byte take log2(len) copies instead of len
+        size_t distance = offset;
+        for ( ; len > distance; distance *= 2 )
+        {
+            std::memcpy(op, op - distance, distance);
+            op += distance;
+            len -= distance;
+        }
+        std::memcpy(op, op - distance, len);
+        op += len;
+    }
+    // An empty block is not valid LZ4, the empty string is a single zero token
+    return false;
+}
+
+/**
+ * True if `in` is a well-formed block that decompresses to exactly `out_size` bytes, what lz4_decompress() accepts. It
+ * only walks the sequences and adds up their lengths, so checking an untrusted block needs no output buffer.
+ */
+inline bool lz4_validate(std::string_view in, size_t out_size) noexcept
+{
+    auto const* ip = reinterpret_cast<uint8_t const*>(in.data());
+    auto const* const iend = ip + in.size();
+    size_t produced{ 0 };
+
+    auto read_length = [&](size_t& len)
+    {
+        uint8_t byte{};
+        do
+        {
+            if ( ip == iend )
+                return false;
+            byte = *ip++;
+            len += byte;
+        } while ( byte == 255 );
+        return true;
+    };
+
+    while ( ip != iend )
+    {
+        uint8_t const token = *ip++;
+        size_t literals = token >> 4;
+        if ( literals == 15 && !read_length(literals) )
+            return false;
+        if ( static_cast<size_t>(iend - ip) < literals || out_size - produced < literals )
+            return false;
+        produced += literals;
+        ip += literals;
+
+        if ( ip == iend )
+            return produced == out_size;
+
+        if ( iend - ip < 2 )
+            return false;
+        size_t const offset = ip[0] | (size_t{ ip[1] } << 8);
+        ip += 2;
+        size_t len = token & 15;
+        if ( len == 15 && !read_length(len) )
+            return false;
+        len += LZ4_MIN_MATCH;
+        if ( offset == 0 || offset > produced || out_size - produced < len )
+            return false;
+        produced += len;
+    }
+    return false;
+}
+
+/**
+ * A string value stored LZ4-compressed, see compress_string(). Type "string", encoding "lz4": every string command
+ * reads it inflated, so clients never see the difference unless they negotiated compressed replies.
+ */
+class CompressedString
+{
+public:
+    CompressedString(uint32_t raw_size, std::string block) : raw_size_(raw_size), block_(std::move(block))
+    {
+    }
+
+    [[nodiscard]] uint32_t raw_size() const noexcept
+    {
+        return raw_size_;
+    }
+
+    // The LZ4 block
+    [[nodiscard]] std::string_view block() const noexcept
+    {
+        return block_;
+    }
+
+    // Writes the raw_size() bytes of the string to `out`
+    bool inflate(char* out) const noexcept
+    {
+        return lz4_decompress(block_, out, raw_size_);
+    }
+
+    [[nodiscard]] std::string inflate() const
+    {
+        std::string out(raw_size_, '\0');
+        inflate(out.data());
+        return out;
+    }
+
+    [[nodiscard]] size_t memory_usage() const noexcept
+    {
+        return sizeof(CompressedString) + block_.capacity() + 1;
+    }
+
+private:
+    uint32_t raw_size_;
+    std::string block_;
+};
+
+/**
+ * `raw` compressed, or nullptr if that saves less than 1/8 of its size: inflating on every read is not worth a few
+ * percent. Strings of 4 GiB or more are never compressed.
+ */
+inline std::unique_ptr<CompressedString> compress_string(std::string_view raw)
+{
+    if ( raw.size() > UINT32_MAX )
+        return nullptr;
+
+    std::string block(lz4_compress_bound(raw.size()), '\0');
+    size_t const size = lz4_compress(raw, block.data());
+    if ( size > raw.size() - raw.size() / 8 )
+        return nullptr;
+    block.resize(size);
+    block.shrink_to_fit();
+    return std::make_unique<CompressedString>(static_cast<uint32_t>(raw.size()), std::move(block));
+}
+
+// What compression gained and cost since the server started, for `info compression`
+struct CompressionStats
+{
+    uint64_t compressed{ 0 };       // Writes stored compressed
+    uint64_t incompressible{ 0 };   // Writes over the threshold stored raw, compressing saved too little
+    uint64_t attempted_bytes{ 0 };  // Raw bytes of both
+    uint64_t raw_bytes{ 0 };        // Raw bytes of the values stored compressed
+    uint64_t compressed_bytes{ 0 }; // and what they took compressed
+    uint64_t compress_ns{ 0 };      // Spent compressing, successfully or not
+
+    uint64_t inflated{ 0 }; // Reads that inflated a value
+    uint64_t inflated_bytes{ 0 };
+    uint64_t inflate_ns{ 0 };
+
+    uint64_t compressed_replies{ 0 }; // `get` replies sent compressed to clients that negotiated it
+    uint64_t reply_bytes_saved{ 0 };
+};
+
+#endif
@@ -0,0 +1,351 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "pubsub.h"      // PubSubLimits
+#include "replication.h" // DEFAULT_REPL_BACKLOG_SIZE
+#include "script.h"      // DEFAULT_SCRIPT_TIME_LIMIT
+#include "spdlog/spdlog.h"
+#include "tracking.h" // DEFAULT_TRACKING_MAX_KEYS
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+/**
+ * Server configuration. Every tunable has a name and is read from a config file of `name value` lines (`#` starts a
+ * comment), then from `--name value` flags, which override the file. Those marked runtime can also be changed on a
+ * live server with `config set <name> <value>`, and take effect from the next request on. `config get <pattern>` lists
+ * the current values of the parameters matching a glob. The rest (listeners, replication, cluster, indexes) only take
+ * effect at startup.
+ *
+ * Sizes are in bytes with an optional k/kb, m/mb or g/gb suffix (powers of 1024), booleans are yes/no.
+ */
+
+inline constexpr uint16_t DEFAULT_PORT{ 1234 };
+inline constexpr uint8_t DEFAULT_MAX_CLIENTS{ 100 };
+inline constexpr size_t DEFAULT_READ_BUFFER_SIZE{ 64 << 10 };
+inline constexpr size_t DEFAULT_MAX_MSG_SIZE{ 32 << 20 };
+inline constexpr size_t DEFAULT_MAX_CMD_ARGS{ 200 * 1000 };
+// Ceiling of max-msg-size, also what tells a corrupt replication stream from a large frame whatever either side's
+// max-msg-size is
+inline constexpr size_t MAX_MSG_SIZE_LIMIT{ 1 << 30 };
+inline constexpr std::chrono::milliseconds DEFAULT_SHUTDOWN_TIMEOUT{ 5000 };
+
+struct ServerConfig
+{
+    // Startup only
+    uint16_t port{ DEFAULT_PORT }; // 0 serves the unix socket only
+    std::string unix_socket{};
+    uint8_t max_clients{ DEFAULT_MAX_CLIENTS }; // Listen backlog and epoll events per wait
+    std::string replica_of{};                   // HOST:PORT
+    size_t repl_backlog_size{ DEFAULT_REPL_BACKLOG_SIZE };
+    std::string cluster_self{}; // HOST:PORT, 127.0.0.1:port when empty
+    std::string cluster_config{};
+    bool prefix_index{ false };
+    bool takeover{ false };      // Hot restart, take the listeners and keyspace of the server on `unix_socket`
+    std::string snapshot_file{}; // Saved at shutdown and loaded at startup, no persistence when empty
+
+    // Runtime
+    size_t read_buffer_size{ DEFAULT_READ_BUFFER_SIZE }; // Bytes read per read() call of a connection
+    size_t max_msg_size{ DEFAULT_MAX_MSG_SIZE };         // Larger request frames close the connection
+    size_t max_cmd_args{ DEFAULT_MAX_CMD_ARGS };
+    PubSubLimits pubsub_limits{};
+    size_t tracking_max_keys{ DEFAULT_TRACKING_MAX_KEYS };
+    size_t compress_threshold{ 0 };
+    bool lazy_free{ false };
+    std::chrono::milliseconds script_time_limit{ DEFAULT_SCRIPT_TIME_LIMIT };
+    spdlog::level::level_enum log_level{ spdlog::get_level() };
+    std::chrono::milliseconds shutdown_timeout{ DEFAULT_SHUTDOWN_TIMEOUT }; // For clients to read their replies
+};
+
+struct ConfigParam
+{
+    std::string_view name;
+    bool runtime; // `config set` may change it
+    // Parses `value` into the config, false (config untouched) with the reason in `err` if it is not valid
+    bool (*set)(ServerConfig& config, std::string_view value, std::string& err);
+    std::string (*get)(ServerConfig const& config);
+};
+
+namespace config_detail
+{
+inline bool parse_number(std::string_view str, uint64_t& out) noexcept
+{
+    auto const [end, ec] = std::from_chars(str.data(), str.data() + str.size(), out);
+    return ec == std::errc{} && end == str.data() + str.size();
+}
+
+inline bool parse_size(std::string_view str, uint64_t& out) noexcept
+{
+    size_t const digits = std::min(str.find_first_not_of("0123456789"), str.size());
+    std::string suffix{ str.substr(digits) };
+    std::ranges::transform(suffix, suffix.begin(), [](unsigned char c) { return std::tolower(c); });
+
+    unsigned shift{ 0 };
+    if ( suffix == "k" || suffix == "kb" )
+        shift = 10;
+    else if ( suffix == "m" || suffix == "mb" )
+        shift = 20;
+    else if ( suffix == "g" || suffix == "gb" )
+        shift = 30;
+    else if ( !suffix.empty() )
+        return false;
+
+    uint64_t value{};
+    if ( !parse_number(str.substr(0, digits), value) || value > (UINT64_MAX >> shift) )
+        return false;
+    out = value << shift;
+    return true;
+}
+
+template <auto Member, uint64_t Min, uint64_t Max, bool Bytes>
+bool set_number(ServerConfig& config, std::string_view value, std::string& err)
+{
+    uint64_t n{};
+    if ( !(Bytes ? parse_size(value, n) : parse_number(value, n)) || n < Min || n > Max )
+    {
+        err = "expects " + std::string(Bytes ? "a size" : "a number") + " between " + std::to_string(Min) + " and " +
+              std::to_string(Max);
+        return false;
+    }
+    config.*Member = static_cast<std::remove_reference_t<decltype(config.*Member)>>(n);
+    return true;
+}
+
+template <auto Member>
+std::string get_number(ServerConfig const& config)
+{
+    return std::to_string(config.*Member);
+}
+
+template <auto Member>
+bool set_bool(ServerConfig& config, std::string_view value, std::string& err)
+{
+    if ( value != "yes" && value != "no" )
+    {
+        err = "expects yes or no";
+        return false;
+    }
+    config.*Member = value == "yes";
+    return true;
+}
+
+template <auto Member>
+std::string get_bool(ServerConfig const& config)
+{
+    return config.*Member ? "yes" : "no";
+}
+
+template <auto Member>
+bool set_string(ServerConfig& config, std::string_view value, std::string&)
+{
+    config.*Member = std::string(value);
+    return true;
+}
+
+template <auto Member>
+std::string get_string(ServerConfig const& config)
+{
+    return config.*Member;
+}
+
+// HOST:PORT, empty for none
+template <auto Member>
+bool set_address(ServerConfig& config, std::string_view value, std::string& err)
+{
+    uint64_t port{};
+    auto const colon = value.rfind(':');
+    if ( !value.empty() &&
+         (colon == std::string_view::npos || !parse_number(value.substr(colon + 1), port) || port > UINT16_MAX) )
+    {
+        err = "expects HOST:PORT";
+        return false;
+    }
+    config.*Member = std::string(value);
+    return true;
+}
+
+// HARD:SOFT:SECONDS
+inline bool set_pubsub_limits(ServerConfig& config, std::string_view value, std::string& err)
+{
+    auto const first = value.find(':');
+    auto const second = value.find(':', first == std::string_view::npos ? first : first + 1);
+    PubSubLimits limits{};
+    uint64_t seconds{};
+    if ( second == std::string_view::npos || !parse_size(value.substr(0, first), limits.hard) ||
+         !parse_size(value.substr(first + 1, second - first - 1), limits.soft) ||
+         !parse_number(value.substr(second + 1), seconds) )
+    {
+        err = "expects HARD:SOFT:SECONDS";
+        return false;
+    }
+    limits.soft_seconds = std::chrono::seconds(seconds);
+    config.pubsub_limits = limits;
+    return true;
+}
+
+inline bool set_log_level(ServerConfig& config, std::string_view value, std::string& err)
+{
+    auto const level = spdlog::level::from_str(std::string(value));
+    if ( level == spdlog::level::off && value != "off" )
+    {
+        err = "expects trace, debug, info, warning, error, critical or off";
+        return false;
+    }
+    config.log_level = level;
+    return true;
+}
+} // namespace config_detail
+
+inline constexpr std::array CONFIG_PARAMS{
+    ConfigParam{ "port", false, config_detail::set_number<&ServerConfig::port, 0, UINT16_MAX, false>,
+                 config_detail::get_number<&ServerConfig::port> },
+    ConfigParam{ "unixsocket", false, config_detail::set_string<&ServerConfig::unix_socket>,
+                 config_detail::get_string<&ServerConfig::unix_socket> },
+    ConfigParam{ "max-clients", false, config_detail::set_number<&ServerConfig::max_clients, 1, UINT8_MAX, false>,
+                 config_detail::get_number<&ServerConfig::max_clients> },
+    ConfigParam{ "replicaof", false, config_detail::set_address<&ServerConfig::replica_of>,
+                 config_detail::get_string<&ServerConfig::replica_of> },
+    ConfigParam{ "repl-backlog-size", false,
+                 config_detail::set_number<&ServerConfig::repl_backlog_size, 1, MAX_MSG_SIZE_LIMIT, true>,
+                 config_detail::get_number<&ServerConfig::repl_backlog_size> },
+    ConfigParam{ "cluster-self", false, config_detail::set_address<&ServerConfig::cluster_self>,
+                 config_detail::get_string<&ServerConfig::cluster_self> },
+    ConfigParam{ "cluster-config", false, config_detail::set_string<&ServerConfig::cluster_config>,
+                 config_detail::get_string<&ServerConfig::cluster_config> },
+    ConfigParam{ "prefix-index", false, config_detail::set_bool<&ServerConfig::prefix_index>,
+                 config_detail::get_bool<&ServerConfig::prefix_index> },
+    ConfigParam{ "takeover", false, config_detail::set_bool<&ServerConfig::takeover>,
+                 config_detail::get_bool<&ServerConfig::takeover> },
+    ConfigParam{ "snapshot-file", false, config_detail::set_string<&ServerConfig::snapshot_file>,
+                 config_detail::get_string<&ServerConfig::snapshot_file> },
+    ConfigParam{ "read-buffer-size", true,
+                 config_detail::set_number<&ServerConfig::read_buffer_size, 512, MAX_MSG_SIZE_LIMIT, true>,
+                 config_detail::get_number<&ServerConfig::read_buffer_size> },
+    ConfigParam{ "max-msg-size", true,
+                 config_detail::set_number<&ServerConfig::max_msg_size, 64, MAX_MSG_SIZE_LIMIT, true>,
+                 config_detail::get_number<&ServerConfig::max_msg_size> },
+    ConfigParam{ "max-cmd-args", true,
+                 config_detail::set_number<&ServerConfig::max_cmd_args, 1, UINT32_MAX, false>,
+                 config_detail::get_number<&ServerConfig::max_cmd_args> },
+    ConfigParam{ "pubsub-output-limit", true, config_detail::set_pubsub_limits,
+                 [](ServerConfig const& config)
+                 {
+                     return std::to_string(config.pubsub_limits.hard) + ":" +
+                            std::to_string(config.pubsub_limits.soft) + ":" +
+                            std::to_string(config.pubsub_limits.soft_seconds.count());
+                 } },
+    ConfigParam{ "tracking-table-max-keys", true,
+                 config_detail::set_number<&ServerConfig::tracking_max_keys, 1, UINT32_MAX, false>,
+                 config_detail::get_number<&ServerConfig::tracking_max_keys> },
+    ConfigParam{ "compress-threshold", true,
+                 config_detail::set_number<&ServerConfig::compress_threshold, 0, MAX_MSG_SIZE_LIMIT, true>,
+                 config_detail::get_number<&ServerConfig::compress_threshold> },
+    ConfigParam{ "lazyfree", true, config_detail::set_bool<&ServerConfig::lazy_free>,
+                 config_detail::get_bool<&ServerConfig::lazy_free> },
+    ConfigParam{ "script-time-limit", true,
+                 [](ServerConfig& config, std::string_view value, std::string& err)
+                 {
+                     uint64_t ms{};
+                     if ( !config_detail::parse_number(value, ms) || ms == 0 )
+                     {
+                         err = "expects a number of milliseconds";
+                         return false;
+                     }
+                     config.script_time_limit = std::chrono::milliseconds(ms);
+                     return true;
+                 },
+                 [](ServerConfig const& config) { return std::to_string(config.script_time_limit.count()); } },
+    ConfigParam{ "loglevel", true, config_detail::set_log_level,
+                 [](ServerConfig const& config)
+                 { return std::string(spdlog::level::to_string_view(config.log_level).data()); } },
+    ConfigParam{ "shutdown-timeout", true,
+                 [](ServerConfig& config, std::string_view value, std::string& err)
+                 {
+                     uint64_t ms{};
+                     if ( !config_detail::parse_number(value, ms) )
+                     {
+                         err = "expects a number of milliseconds";
+                         return false;
+                     }
+                     config.shutdown_timeout = std::chrono::milliseconds(ms);
+                     return true;
+                 },
+                 [](ServerConfig const& config) { return std::to_string(config.shutdown_timeout.count()); } },
+};
+
+inline ConfigParam const* find_config_param(std::string_view name) noexcept
+{
+    auto const it = std::ranges::find(CONFIG_PARAMS, name, &ConfigParam::name);
+    return it == CONFIG_PARAMS.end() ? nullptr : &*it;
+}
+
+// Sets `name` in `config`, throws std::invalid_argument saying why if it can't
+inline void set_config_param(ServerConfig& config, std::string_view name, std::string_view value,
+                             std::string_view source)
+{
+    ConfigParam const* param = find_config_param(name);
+    if ( param == nullptr )
+        throw std::invalid_argument(std::string(source) + ": unknown parameter " + std::string(name));
+    if ( std::string err; !param->set(config, value, err) )
+        throw std::invalid_argument(std::string(source) + ": " + std::string(name) + " " + err);
+}
+
+inline void load_config_file(std::string const& path, ServerConfig& config)
+{
+    std::ifstream in(path);
+    if ( !in )
+        throw std::invalid_argument("Cannot open config file " + path);
+
+    size_t line_no{ 0 };
+    for ( std::string line; std::getline(in, line); )
+    {
+        line_no++;
+        std::string_view rest{ line };
+        rest = rest.substr(0, rest.find('#'));
+        auto const begin = rest.find_first_not_of(" \t\r");
+        if ( begin == std::string_view::npos )
+            continue;
+        rest = rest.substr(begin, rest.find_last_not_of(" \t\r") + 1 - begin);
+
+        auto const space = rest.find_first_of(" \t");
+        std::string_view const name = rest.substr(0, space);
+        std::string_view value{};
+        if ( space != std::string_view::npos )
+            value = rest.substr(rest.find_first_not_of(" \t", space));
+        set_config_param(config, name, value, path + ":" + std::to_string(line_no));
+    }
+}
+
+// ./server [--config FILE] [--NAME VALUE ...], the flags override the file whatever their position
+inline ServerConfig parse_config_args(int argc, char const* const* argv)
+{
+    ServerConfig config{};
+    if ( argc % 2 == 0 )
+        throw std::invalid_argument(std::string("Missing value for ") + argv[argc - 1]);
+
+    for ( int i = 1; i + 1 < argc; i += 2 )
+    {
+        if ( std::string_view(argv[i]) == "--config" )
+            load_config_file(argv[i + 1], config);
+    }
+    for ( int i = 1; i + 1 < argc; i += 2 )
+    {
+        std::string_view const flag{ argv[i] };
+        if ( !flag.starts_with("--") )
+            throw std::invalid_argument("Expected --NAME VALUE, got " + std::string(flag));
+        if ( flag != "--config" )
+            set_config_param(config, flag.substr(2), argv[i + 1], "Command line");
+    }
+    return config;
+}
+
+#endif
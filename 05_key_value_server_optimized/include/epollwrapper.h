@@ -3,18 +3,94 @@
 
 #include "spdlog/spdlog.h"
 
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <stdexcept>
 #include <sys/epoll.h> // for epoll_create1(), epoll_ctl(), struct epoll_event
 #include <unistd.h>    // for close(), read()
 #include <unordered_map>
 #include <vector>
 
+// A response frame queued on several connections at once (pub/sub), sent after the first `at` bytes ever queued on
+// `Connection::outgoing`, so it stays in order with the replies around it
+struct SharedOutput
+{
+    std::shared_ptr<std::vector<uint8_t> const> data{};
+    uint64_t at{ 0 };
+};
+
+// FIFO of shared frames. Unlike std::deque it allocates nothing until the first push, most connections never get one.
+class SharedOutputQueue
+{
+public:
+    [[nodiscard]] bool empty() const noexcept
+    {
+        return head_ == items_.size();
+    }
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return items_.size() - head_;
+    }
+
+    SharedOutput const& front() const noexcept
+    {
+        return items_[head_];
+    }
+
+    auto begin() const noexcept
+    {
+        return items_.begin() + head_;
+    }
+
+    auto end() const noexcept
+    {
+        return items_.end();
+    }
+
+    void push_back(SharedOutput item)
+    {
+        items_.push_back(std::move(item));
+    }
+
+    void pop_front() noexcept
+    {
+        items_[head_++].data.reset();
+        if ( empty() )
+            clear();
+        else if ( head_ * 2 >= items_.size() )
+        {
+            // A subscriber that never drains fully would otherwise grow `items_` forever, drop the sent half
+            items_.erase(items_.begin(), items_.begin() + static_cast<std::ptrdiff_t>(head_));
+            head_ = 0;
+        }
+    }
+
+    void clear() noexcept
+    {
+        items_.clear();
+        head_ = 0;
+    }
+
+private:
+    std::vector<SharedOutput> items_{};
+    size_t head_{ 0 };
+};
+
 struct Connection
 {
     int fd{ -1 };
     std::vector<uint8_t> incoming{};
     std::vector<uint8_t> outgoing{};
+    bool want_close{ false };         // Protocol error, close once the current read has been handled
+    bool asking{ false };             // Cluster mode, the next request may touch a slot this node is importing
+    bool compressed_replies{ false }; // Sent `client compression on`, gets compressed values as they are stored
+
+    SharedOutputQueue shared{};
+    size_t shared_offset{ 0 };   // Bytes of `shared.front()` already sent
+    size_t shared_bytes{ 0 };    // Bytes queued in `shared`, for output limits
+    uint64_t outgoing_sent{ 0 }; // Bytes of `outgoing` sent since the connection opened
 };
 
 // ========================== CTRP BASE ==========================
@@ -0,0 +1,250 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * Hash: field -> value map with two encodings.
+ *
+ * Small hashes are packed into one contiguous buffer of `varint(len) | bytes` elements, alternating field and value,
+ * and every lookup is a linear scan. For a handful of short fields the scan stays within a few cache lines and costs
+ * less than hashing, and the whole hash is a single allocation instead of one node (plus up to two strings) per field.
+ * Once the hash grows past HASH_MAX_PACKED_ENTRIES fields or is given a field or value longer than
+ * HASH_MAX_PACKED_VALUE bytes it is converted to an unordered_map for good.
+ */
+
+inline constexpr size_t HASH_MAX_PACKED_ENTRIES{ 64 };
+inline constexpr size_t HASH_MAX_PACKED_VALUE{ 64 };
+
+class Hash
+{
+public:
+    [[nodiscard]] std::optional<std::string_view> get(std::string_view field) const
+    {
+        if ( table_ )
+        {
+            auto it = table_->find(field);
+            if ( it == table_->end() )
+                return std::nullopt;
+            return std::string_view(it->second);
+        }
+
+        std::optional<std::string_view> found;
+        scan(
+            [&](std::string_view f, std::string_view v, size_t, size_t)
+            {
+                if ( f != field )
+                    return false;
+                found = v;
+                return true;
+            });
+        return found;
+    }
+
+    // True if `field` is new
+    bool set(std::string_view field, std::string_view value)
+    {
+        if ( !table_ && (field.size() > HASH_MAX_PACKED_VALUE || value.size() > HASH_MAX_PACKED_VALUE ||
+                         (size_ >= HASH_MAX_PACKED_ENTRIES && !get(field))) )
+            convert_to_table();
+
+        if ( table_ )
+        {
+            auto [it, inserted] = table_->insert_or_assign(std::string(field), std::string(value));
+            size_ = table_->size();
+            return inserted;
+        }
+
+        // Replace the value in place, the buffer only moves if its encoded length changed
+        bool replaced{ false };
+        scan(
+            [&](std::string_view f, std::string_view, size_t value_pos, size_t value_end)
+            {
+                if ( f != field )
+                    return false;
+                std::string encoded;
+                append_element(encoded, value);
+                buf_.replace(value_pos, value_end - value_pos, encoded);
+                replaced = true;
+                return true;
+            });
+        if ( replaced )
+            return false;
+
+        // Grow to the exact size, like listpack does on every insert. Doubling the capacity would leave a packed hash
+        // up to half empty, and copying a buffer this small costs about as much as the scan above.
+        size_t const needed = buf_.size() + 2 * MAX_VARINT_SIZE + field.size() + value.size();
+        if ( needed > buf_.capacity() )
+        {
+            std::string grown;
+            grown.reserve(needed);
+            grown += buf_;
+            buf_ = std::move(grown);
+        }
+        append_element(buf_, field);
+        append_element(buf_, value);
+        size_++;
+        return true;
+    }
+
+    bool remove(std::string_view field)
+    {
+        if ( table_ )
+        {
+            auto it = table_->find(field);
+            bool const erased = it != table_->end();
+            if ( erased )
+                table_->erase(it);
+            size_ = table_->size();
+            return erased;
+        }
+
+        bool erased{ false };
+        size_t field_pos{ 0 };
+        scan(
+            [&](std::string_view f, std::string_view, size_t, size_t value_end)
+            {
+                if ( f == field )
+                {
+                    buf_.erase(field_pos, value_end - field_pos);
+                    erased = true;
+                    return true;
+                }
+                field_pos = value_end;
+                return false;
+            });
+        size_ -= erased;
+        return erased;
+    }
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    [[nodiscard]] bool packed() const noexcept
+    {
+        return !table_;
+    }
+
+    // Calls fn(field, value) for every field, packed hashes in insertion order
+    template <class Fn>
+    void for_each(Fn&& fn) const
+    {
+        if ( table_ )
+        {
+            for ( auto const& [field, value] : *table_ )
+                fn(std::string_view(field), std::string_view(value));
+            return;
+        }
+        scan(
+            [&](std::string_view f, std::string_view v, size_t, size_t)
+            {
+                fn(f, v);
+                return false;
+            });
+    }
+
+    // Heap bytes owned by the hash plus the object itself, node sizes of the table are libstdc++'s
+    [[nodiscard]] size_t memory_usage() const noexcept
+    {
+        if ( !table_ )
+            return sizeof(Hash) + (buf_.capacity() > SSO_CAPACITY ? buf_.capacity() + 1 : 0);
+
+        // Node: next pointer, the pair and the cached hash
+        size_t bytes = sizeof(Hash) + sizeof(Table) + table_->bucket_count() * sizeof(void*);
+        for ( auto const& [field, value] : *table_ )
+        {
+            bytes += sizeof(void*) + sizeof(std::pair<std::string const, std::string>) + sizeof(size_t);
+            bytes += field.capacity() > SSO_CAPACITY ? field.capacity() + 1 : 0;
+            bytes += value.capacity() > SSO_CAPACITY ? value.capacity() + 1 : 0;
+        }
+        return bytes;
+    }
+
+private:
+    static constexpr size_t SSO_CAPACITY{ std::string().capacity() };
+    static constexpr size_t MAX_VARINT_SIZE{ 2 }; // Packed elements are at most HASH_MAX_PACKED_VALUE bytes
+
+    // Lets the table be searched with a string_view without building a std::string first
+    struct FieldHash
+    {
+        using is_transparent = void;
+
+        size_t operator()(std::string_view field) const noexcept
+        {
+            return std::hash<std::string_view>{}(field);
+        }
+    };
+
+    using Table = std::unordered_map<std::string, std::string, FieldHash, std::equal_to<>>;
+
+    size_t size_{ 0 };
+    std::string buf_{};             // Packed encoding
+    std::unique_ptr<Table> table_{}; // Table encoding once converted, a packed hash does not carry an empty table
+
+    static void append_element(std::string& out, std::string_view str)
+    {
+        // LEB128 length, one byte for anything up to 127
+        size_t len = str.size();
+        do
+        {
+            uint8_t byte = len & 0x7F;
+            len >>= 7;
+            out += static_cast<char>(len ? byte | 0x80 : byte);
+        } while ( len );
+        out += str;
+    }
+
+    static std::string_view read_element(std::string_view buf, size_t& pos)
+    {
+        size_t len{ 0 };
+        for ( int shift = 0;; shift += 7 )
+        {
+            uint8_t const byte = buf[pos++];
+            len |= static_cast<size_t>(byte & 0x7F) << shift;
+            if ( !(byte & 0x80) )
+                break;
+        }
+        std::string_view const str = buf.substr(pos, len);
+        pos += len;
+        return str;
+    }
+
+    // Calls fn(field, value, value_pos, value_end) per entry until it returns true
+    template <class Fn>
+    void scan(Fn&& fn) const
+    {
+        for ( size_t pos = 0; pos < buf_.size(); )
+        {
+            std::string_view const field = read_element(buf_, pos);
+            size_t const value_pos = pos;
+            std::string_view const value = read_element(buf_, pos);
+            if ( fn(field, value, value_pos, pos) )
+                return;
+        }
+    }
+
+    void convert_to_table()
+    {
+        auto table = std::make_unique<Table>();
+        table->reserve(size_ + 1);
+        scan(
+            [&table](std::string_view f, std::string_view v, size_t, size_t)
+            {
+                table->emplace(f, v);
+                return false;
+            });
+        buf_ = std::string();
+        table_ = std::move(table);
+    }
+};
+
+#endif
@@ -0,0 +1,602 @@
+#ifndef KEYSPACE_H
+#define KEYSPACE_H
+
+#include "art.h"
+#include "bloom.h"
+#include "compression.h"
+#include "config.h" // MAX_MSG_SIZE_LIMIT
+#include "hash.h"
+#include "hyperloglog.h"
+#include "lazyfree.h"
+#include "list.h"
+#include "sortedset.h"
+
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+/**
+ * Values of the keyspace. Every key holds exactly one type, commands of another type answer with WRONGTYPE_ERR.
+ * `set`/`mset`/`restore` replace whatever a key held before, like Redis.
+ *
+ * Strings that are the canonical decimal form of a 64-bit integer are stored as an int64_t, so `incr` and friends
+ * never parse or format, and are only formatted when they are read back (string_of()). Both encodings are type
+ * "string" and are interchangeable for every string command. So is a third one, a large string stored LZ4-compressed
+ * (compression.h) when the server runs with a compression threshold: string_of() inflates it.
+ *
+ * encode_value()/decode_value() turn a value of any type into a type-tagged byte string. Slot migration and the
+ * replication snapshot use it to move non-string values (`restore <key> <payload>`):
+ *   string: 's' | bytes (integers in decimal)
+ *           'c' | raw size u32 | LZ4 block (compressed strings stay compressed)
+ *   zset:   'z' | count u32 | (score f64 | len u32 | member) ...
+ *   hash:   'h' | count u32 | (len u32 | field | len u32 | value) ...
+ *   list:   'l' | count u32 | (len u32 | element) ...
+ *   bloom:  'b' | capacity u64 | error rate f64 | items u64 | blocks
+ *   hll:    'p' | dense u8 | (index << 8 | rank) u32 ... or the packed dense registers
+ *
+ * value_memory_usage() estimates the bytes a value occupies, including the allocations it owns, for `memory usage`.
+ * free_effort() estimates what destroying it costs, to decide whether that is done in the background (lazyfree.h).
+ */
+
+// Aggregates are boxed, so the variant stays a std::string plus its index and string keys don't pay for larger types
+using Value = std::variant<std::string, std::unique_ptr<SortedSet>, std::unique_ptr<Hash>, std::unique_ptr<List>,
+                           int64_t, std::unique_ptr<BloomFilter>, std::unique_ptr<HyperLogLog>,
+                           std::unique_ptr<CompressedString>>;
+
+inline constexpr std::string_view WRONGTYPE_ERR{ "WRONGTYPE Operation against a key holding the wrong kind of value" };
+inline constexpr std::array<std::string_view, std::variant_size_v<Value>> VALUE_TYPE_NAMES{
+    "string", "zset", "hash", "list", "string", "bloom", "hyperloglog", "string"
+};
+inline constexpr size_t MAX_INT_STR_SIZE{ 20 }; // "-9223372036854775808"
+
+// The value as a T, nullptr if it holds another type
+template <class T>
+T* value_as(Value& value) noexcept
+{
+    if constexpr ( std::is_same_v<T, std::string> || std::is_same_v<T, int64_t> )
+        return std::get_if<T>(&value);
+    else
+    {
+        auto* box = std::get_if<std::unique_ptr<T>>(&value);
+        return box ? box->get() : nullptr;
+    }
+}
+
+template <class T>
+T const* value_as(Value const& value) noexcept
+{
+    return value_as<T>(const_cast<Value&>(value));
+}
+
+inline std::string_view type_name(Value const& value) noexcept
+{
+    return VALUE_TYPE_NAMES[value.index()];
+}
+
+// `str` as an integer if formatting the integer gives back exactly `str`: no sign, spaces or leading zeros
+inline std::optional<int64_t> parse_canonical_int(std::string_view str) noexcept
+{
+    if ( str.empty() || str.size() > MAX_INT_STR_SIZE || (str[0] == '0' && str.size() > 1) || str.starts_with("-0") )
+        return std::nullopt;
+
+    int64_t n{};
+    auto const [p, ec] = std::from_chars(str.data(), str.data() + str.size(), n);
+    if ( ec != std::errc{} || p != str.data() + str.size() )
+        return std::nullopt;
+    return n;
+}
+
+// A string value in the cheapest encoding that reads back as `str`
+inline Value make_string_value(std::string_view str)
+{
+    if ( auto const n = parse_canonical_int(str) )
+        return *n;
+    return std::string(str);
+}
+
+// Where string_of() puts the bytes of a string value that are not stored as they read
+struct StringBuffer
+{
+    std::array<char, MAX_INT_STR_SIZE> digits;
+    std::string inflated{};
+};
+
+// A string value's bytes, integers are formatted into `buf` and compressed strings inflated into it. nullopt for other
+// types.
+inline std::optional<std::string_view> string_of(Value const& value, StringBuffer& buf)
+{
+    if ( auto const* str = value_as<std::string>(value) )
+        return std::string_view(*str);
+    if ( auto const* n = value_as<int64_t>(value) )
+    {
+        auto& digits = buf.digits;
+        return std::string_view(digits.data(), std::to_chars(digits.data(), digits.data() + digits.size(), *n).ptr -
+                                                   digits.data());
+    }
+    if ( auto const* packed = value_as<CompressedString>(value) )
+    {
+        buf.inflated.resize(packed->raw_size());
+        packed->inflate(buf.inflated.data());
+        return std::string_view(buf.inflated);
+    }
+    return std::nullopt;
+}
+
+// Internal representation, as reported by `object encoding`
+inline std::string_view value_encoding(Value const& value) noexcept
+{
+    if ( auto const* str = value_as<std::string>(value) )
+        return str->size() <= std::string().capacity() ? "embstr" : "raw";
+    if ( value_as<int64_t>(value) )
+        return "int";
+    if ( value_as<CompressedString>(value) )
+        return "lz4";
+    if ( auto const* hash = value_as<Hash>(value) )
+        return hash->packed() ? "packed" : "hashtable";
+    if ( value_as<List>(value) )
+        return "quicklist";
+    if ( value_as<BloomFilter>(value) )
+        return "blocked";
+    if ( auto const* hll = value_as<HyperLogLog>(value) )
+        return hll->dense() ? "dense" : "sparse";
+    return "skiplist";
+}
+
+inline size_t value_memory_usage(Value const& value) noexcept
+{
+    if ( auto const* str = value_as<std::string>(value) )
+        return sizeof(Value) + (str->capacity() > std::string().capacity() ? str->capacity() + 1 : 0);
+    if ( value_as<int64_t>(value) )
+        return sizeof(Value);
+    if ( auto const* packed = value_as<CompressedString>(value) )
+        return sizeof(Value) + packed->memory_usage();
+    if ( auto const* hash = value_as<Hash>(value) )
+        return sizeof(Value) + hash->memory_usage();
+    if ( auto const* list = value_as<List>(value) )
+        return sizeof(Value) + list->memory_usage();
+    if ( auto const* bloom = value_as<BloomFilter>(value) )
+        return sizeof(Value) + bloom->memory_usage();
+    if ( auto const* hll = value_as<HyperLogLog>(value) )
+        return sizeof(Value) + hll->memory_usage();
+    return sizeof(Value) + value_as<SortedSet>(value)->memory_usage();
+}
+
+/**
+ * Roughly what destroying a value costs, in allocations to release. Flat buffers count a unit per 4 KiB page: large
+ * ones are mmap()ed and go back to the OS page by page. Values above LAZYFREE_THRESHOLD (~256 KiB of string, 64
+ * members) are worth freeing in the background.
+ */
+inline size_t free_effort(Value const& value) noexcept
+{
+    constexpr size_t PAGE_SIZE{ 4096 };
+    if ( auto const* str = value_as<std::string>(value) )
+        return str->capacity() / PAGE_SIZE;
+    if ( auto const* packed = value_as<CompressedString>(value) )
+        return packed->memory_usage() / PAGE_SIZE;
+    if ( auto const* zset = value_as<SortedSet>(value) )
+        return zset->size();
+    if ( auto const* hash = value_as<Hash>(value) )
+        return hash->packed() ? 1 : hash->size();
+    if ( auto const* list = value_as<List>(value) )
+        return list->num_chunks();
+    if ( auto const* bloom = value_as<BloomFilter>(value) )
+        return bloom->bytes() / PAGE_SIZE;
+    return 1;
+}
+
+inline std::string encode_value(Value const& value)
+{
+    std::string out;
+    auto append_raw = [&out](auto v) { out.append(reinterpret_cast<char const*>(&v), sizeof(v)); };
+
+    StringBuffer buf;
+    if ( auto const* packed = value_as<CompressedString>(value) )
+    {
+        out += 'c';
+        append_raw(packed->raw_size());
+        out += packed->block();
+    }
+    else if ( auto const str = string_of(value, buf) )
+    {
+        out.reserve(1 + str->size());
+        out += 's';
+        out += *str;
+    }
+    else if ( auto const* zset = value_as<SortedSet>(value) )
+    {
+        out += 'z';
+        append_raw(static_cast<uint32_t>(zset->size()));
+        zset->for_each(
+            [&](std::string_view member, double score)
+            {
+                append_raw(score);
+                append_raw(static_cast<uint32_t>(member.size()));
+                out += member;
+            });
+    }
+    else if ( auto const* hash = value_as<Hash>(value) )
+    {
+        out += 'h';
+        append_raw(static_cast<uint32_t>(hash->size()));
+        hash->for_each(
+            [&](std::string_view field, std::string_view val)
+            {
+                append_raw(static_cast<uint32_t>(field.size()));
+                out += field;
+                append_raw(static_cast<uint32_t>(val.size()));
+                out += val;
+            });
+    }
+    else if ( auto const* list = value_as<List>(value) )
+    {
+        out += 'l';
+        append_raw(static_cast<uint32_t>(list->size()));
+        list->for_each(
+            [&](std::string_view element)
+            {
+                append_raw(static_cast<uint32_t>(element.size()));
+                out += element;
+            });
+    }
+    else if ( auto const* bloom = value_as<BloomFilter>(value) )
+    {
+        out += 'b';
+        append_raw(bloom->capacity());
+        append_raw(bloom->error_rate());
+        append_raw(bloom->items());
+        out += bloom->raw();
+    }
+    else if ( auto const* hll = value_as<HyperLogLog>(value) )
+    {
+        out += 'p';
+        out += static_cast<char>(hll->dense());
+        out += hll->raw();
+    }
+    return out;
+}
+
+inline bool decode_value(std::string_view in, Value& out)
+{
+    if ( in.empty() )
+        return false;
+
+    char const type = in[0];
+    in.remove_prefix(1);
+    auto read_raw = [&in](auto& v)
+    {
+        if ( in.size() < sizeof(v) )
+            return false;
+        std::memcpy(&v, in.data(), sizeof(v));
+        in.remove_prefix(sizeof(v));
+        return true;
+    };
+
+    if ( type == 's' )
+    {
+        out = make_string_value(in);
+        return true;
+    }
+    if ( type == 'c' )
+    {
+        // A block byte expands to at most 255 bytes, and no value could have been written larger than a request. The
+        // block is validated without inflating it, a corrupt one must not cost a buffer of its claimed size.
+        uint32_t raw_size{};
+        if ( !read_raw(raw_size) || raw_size > in.size() * 255 || raw_size > MAX_MSG_SIZE_LIMIT ||
+             !lz4_validate(in, raw_size) )
+            return false;
+        out = std::make_unique<CompressedString>(raw_size, std::string(in));
+        return true;
+    }
+    if ( type == 'z' )
+    {
+        auto zset = std::make_unique<SortedSet>();
+        uint32_t count{};
+        if ( !read_raw(count) )
+            return false;
+        for ( uint32_t i = 0; i < count; i++ )
+        {
+            double score{};
+            uint32_t len{};
+            // NaN has no place in the score order, zadd refuses it too
+            if ( !read_raw(score) || std::isnan(score) || !read_raw(len) || in.size() < len )
+                return false;
+            zset->add(score, in.substr(0, len));
+            in.remove_prefix(len);
+        }
+        out = std::move(zset);
+        return true;
+    }
+    if ( type == 'h' )
+    {
+        auto hash = std::make_unique<Hash>();
+        uint32_t count{};
+        if ( !read_raw(count) )
+            return false;
+        for ( uint32_t i = 0; i < count; i++ )
+        {
+            uint32_t len{};
+            if ( !read_raw(len) || in.size() < len )
+                return false;
+            std::string_view const field = in.substr(0, len);
+            in.remove_prefix(len);
+            if ( !read_raw(len) || in.size() < len )
+                return false;
+            hash->set(field, in.substr(0, len));
+            in.remove_prefix(len);
+        }
+        out = std::move(hash);
+        return true;
+    }
+    if ( type == 'l' )
+    {
+        auto list = std::make_unique<List>();
+        uint32_t count{};
+        if ( !read_raw(count) )
+            return false;
+        for ( uint32_t i = 0; i < count; i++ )
+        {
+            uint32_t len{};
+            if ( !read_raw(len) || in.size() < len )
+                return false;
+            list->push_back(in.substr(0, len));
+            in.remove_prefix(len);
+        }
+        out = std::move(list);
+        return true;
+    }
+    if ( type == 'b' )
+    {
+        uint64_t capacity{}, items{};
+        double error_rate{};
+        if ( !read_raw(capacity) || !read_raw(error_rate) || !read_raw(items) ||
+             !BloomFilter::valid_params(capacity, error_rate) )
+            return false;
+        // Checked before allocating, a short payload must not reserve a filter of up to BLOOM_MAX_BYTES
+        if ( in.size() != BloomFilter::bytes_for(capacity, error_rate) )
+            return false;
+        auto bloom = std::make_unique<BloomFilter>(capacity, error_rate);
+        if ( !bloom->load(in, items) )
+            return false;
+        out = std::move(bloom);
+        return true;
+    }
+    if ( type == 'p' )
+    {
+        auto hll = std::make_unique<HyperLogLog>();
+        if ( in.empty() || in[0] > 1 || !hll->load(in[0] == 1, in.substr(1)) )
+            return false;
+        out = std::move(hll);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * The keyspace: key -> Value in an ordered map, optionally mirrored by an adaptive radix tree (art.h) for `prefix` and
+ * `range` queries. It exposes the part of the std::map interface the server uses, so every insert and erase goes
+ * through here and the index cannot miss one. The index leaves point at the map's nodes, which std::map never moves.
+ *
+ * For the same reason it is where values die. unlink() hands a large value to the lazy-free thread (lazyfree.h), and
+ * with set_lazy_free(true) so do erase(), overwrites and clear(). The thread is started on the first hand-off.
+ */
+class Keyspace
+{
+public:
+    using Map = std::map<std::string, Value>;
+    using iterator = Map::iterator;
+    using const_iterator = Map::const_iterator;
+
+    struct KeyOf
+    {
+        std::string_view operator()(Map::value_type const& entry) const noexcept
+        {
+            return entry.first;
+        }
+    };
+    using PrefixIndex = AdaptiveRadixTree<Map::value_type, KeyOf>;
+
+    // Builds the index from the current keys, it is kept up to date from then on
+    void enable_prefix_index()
+    {
+        if ( index_ )
+            return;
+        index_ = std::make_unique<PrefixIndex>();
+        for ( auto& entry : map_ )
+            index_->insert(&entry);
+    }
+
+    // nullptr unless enable_prefix_index() was called
+    [[nodiscard]] PrefixIndex const* prefix_index() const noexcept
+    {
+        return index_.get();
+    }
+
+    iterator begin() noexcept
+    {
+        return map_.begin();
+    }
+
+    iterator end() noexcept
+    {
+        return map_.end();
+    }
+
+    const_iterator begin() const noexcept
+    {
+        return map_.begin();
+    }
+
+    const_iterator end() const noexcept
+    {
+        return map_.end();
+    }
+
+    iterator find(std::string const& key)
+    {
+        return map_.find(key);
+    }
+
+    const_iterator find(std::string const& key) const
+    {
+        return map_.find(key);
+    }
+
+    [[nodiscard]] bool contains(std::string const& key) const
+    {
+        return map_.contains(key);
+    }
+
+    iterator lower_bound(std::string const& key)
+    {
+        return map_.lower_bound(key);
+    }
+
+    iterator upper_bound(std::string const& key)
+    {
+        return map_.upper_bound(key);
+    }
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return map_.size();
+    }
+
+    template <class V>
+    std::pair<iterator, bool> insert_or_assign(std::string const& key, V&& value)
+    {
+        if ( !lazy_ )
+            return indexed(map_.insert_or_assign(key, std::forward<V>(value)));
+
+        // try_emplace() leaves `value` alone if the key exists
+        auto result = indexed(map_.try_emplace(key, std::forward<V>(value)));
+        if ( !result.second )
+            dispose(std::exchange(result.first->second, Value{ std::forward<V>(value) }), true);
+        return result;
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> emplace(std::string const& key, Args&&... args)
+    {
+        return indexed(map_.emplace(key, std::forward<Args>(args)...));
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(std::string const& key, Args&&... args)
+    {
+        return indexed(map_.try_emplace(key, std::forward<Args>(args)...));
+    }
+
+    size_t erase(std::string const& key)
+    {
+        return remove(key, lazy_);
+    }
+
+    iterator erase(iterator it)
+    {
+        if ( index_ )
+            index_->erase(it->first);
+        dispose(std::move(it->second), lazy_);
+        return map_.erase(it);
+    }
+
+    // erase() that frees a large value in the background whatever set_lazy_free() said
+    size_t unlink(std::string const& key)
+    {
+        return remove(key, true);
+    }
+
+    void clear()
+    {
+        if ( index_ )
+            index_->clear();
+        if ( !lazy_ || map_.size() <= LAZYFREE_THRESHOLD )
+        {
+            map_.clear();
+            return;
+        }
+        auto garbage = std::make_unique<Map>(std::move(map_));
+        map_.clear();
+        if ( Garbage item{ std::move(garbage) }; !lazy_free().push(item) )
+            lazy_free_inline_++;
+    }
+
+    // Frees large values removed by erase(), overwrites and clear() in the background too
+    void set_lazy_free(bool lazy) noexcept
+    {
+        lazy_ = lazy;
+    }
+
+    // Values handed to the thread and not freed yet
+    [[nodiscard]] size_t lazy_free_pending() const noexcept
+    {
+        return lazy_free_ ? lazy_free_->pending() : 0;
+    }
+
+    [[nodiscard]] uint64_t lazy_freed() const noexcept
+    {
+        return lazy_free_ ? lazy_free_->freed() : 0;
+    }
+
+    // Large values freed inline because the queue was full
+    [[nodiscard]] uint64_t lazy_free_inline() const noexcept
+    {
+        return lazy_free_inline_;
+    }
+
+private:
+    // A value, or the whole map on a lazy clear()
+    using Garbage = std::variant<Value, std::unique_ptr<Map>>;
+
+    Map map_{};
+    std::unique_ptr<PrefixIndex> index_{};
+    bool lazy_{ false };
+    uint64_t lazy_free_inline_{ 0 };
+    std::unique_ptr<LazyFree<Garbage>> lazy_free_{}; // Destroyed first, waits for the queued values to be freed
+
+    size_t remove(std::string const& key, bool lazy)
+    {
+        auto it = map_.find(key);
+        if ( it == map_.end() )
+            return 0;
+        if ( index_ )
+            index_->erase(key);
+        dispose(std::move(it->second), lazy);
+        map_.erase(it);
+        return 1;
+    }
+
+    // Destroys `value` here, or on the lazy-free thread if it is large and `lazy`
+    void dispose(Value value, bool lazy)
+    {
+        if ( !lazy || free_effort(value) <= LAZYFREE_THRESHOLD )
+            return;
+        if ( Garbage item{ std::move(value) }; !lazy_free().push(item) )
+            lazy_free_inline_++;
+    }
+
+    LazyFree<Garbage>& lazy_free()
+    {
+        if ( !lazy_free_ )
+            lazy_free_ = std::make_unique<LazyFree<Garbage>>();
+        return *lazy_free_;
+    }
+
+    std::pair<iterator, bool> indexed(std::pair<iterator, bool> result)
+    {
+        if ( index_ && result.second )
+            index_->insert(&*result.first);
+        return result;
+    }
+};
+
+#endif
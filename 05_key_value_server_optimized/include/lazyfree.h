@@ -0,0 +1,116 @@
+#ifndef LAZYFREE_H
+#define LAZYFREE_H
+
+#include "shmring.h" // CACHE_LINE_SIZE
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <pthread.h> // pthread_setschedparam()
+#include <sched.h>   // SCHED_IDLE
+#include <thread>
+#include <utility>
+
+/**
+ * Lazy free: large values removed from the keyspace are destroyed on a background thread, so releasing a 32 MiB string
+ * or a million-member sorted set does not stall the event loop (`unlink`, and `del`/overwrites with `--lazyfree yes`).
+ *
+ * The event loop hands the values over through a bounded single-producer/single-consumer ring: a push is a move into
+ * a slot and a release store, without locks or allocation. The thread sleeps on a futex (std::atomic::wait) while the
+ * ring is empty and a push only makes a syscall when it is actually asleep. A full ring makes push() fail and the
+ * caller frees the value inline, so memory is never held back by a backlog the thread cannot keep up with.
+ *
+ * Only values whose destruction costs more than LAZYFREE_THRESHOLD units of free_effort() (keyspace.h) are worth the
+ * hand-off, smaller ones are freed inline: the push and the cache misses of touching the value on another core cost
+ * more than the free.
+ */
+
+inline constexpr size_t LAZYFREE_THRESHOLD{ 64 };
+inline constexpr size_t LAZYFREE_QUEUE_SIZE{ 1024 };
+
+template <class T>
+class LazyFree
+{
+public:
+    LazyFree() : slots_(std::make_unique<std::optional<T>[]>(LAZYFREE_QUEUE_SIZE)), thread_([this] { run(); })
+    {
+    }
+
+    LazyFree(LazyFree const& other) = delete;
+    LazyFree& operator=(LazyFree const& other) = delete;
+
+    // Frees whatever is still queued, then stops the thread
+    ~LazyFree()
+    {
+        stop_.store(true, std::memory_order_release);
+        wake();
+        thread_.join();
+    }
+
+    // Moves `item` to the thread, false (and `item` untouched) if the ring is full
+    bool push(T& item)
+    {
+        uint64_t const head = head_.load(std::memory_order_relaxed);
+        if ( head - tail_.load(std::memory_order_acquire) == LAZYFREE_QUEUE_SIZE )
+            return false;
+        slots_[head % LAZYFREE_QUEUE_SIZE].emplace(std::move(item));
+        head_.store(head + 1, std::memory_order_release);
+        wake();
+        return true;
+    }
+
+    // Queued and not freed yet
+    [[nodiscard]] size_t pending() const noexcept
+    {
+        return head_.load(std::memory_order_relaxed) - tail_.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] uint64_t freed() const noexcept
+    {
+        return tail_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::unique_ptr<std::optional<T>[]> slots_;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head_{ 0 };   // Items ever pushed, owned by the event loop
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail_{ 0 };   // Items ever freed, owned by the thread
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> signal_{ 0 }; // Bumped on every push and on stop
+    std::atomic<bool> stop_{ false };
+    std::thread thread_; // Last, it starts once the ring exists
+
+    void wake()
+    {
+        // libstdc++ only makes the futex call if a waiter is registered
+        signal_.fetch_add(1, std::memory_order_release);
+        signal_.notify_one();
+    }
+
+    void run()
+    {
+        // Only run when the CPU is otherwise idle: at normal priority the wakeup preempts the event loop whenever both
+        // share a core, and it waits for the free it meant to avoid. A saturated loop starves the thread, the ring
+        // fills up and values are freed inline again, which is what they cost anyway.
+        sched_param const param{};
+        pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+        while ( true )
+        {
+            // Read before draining: a push after the drain bumps it, so the wait below returns at once
+            uint32_t const seen = signal_.load(std::memory_order_acquire);
+
+            uint64_t tail = tail_.load(std::memory_order_relaxed);
+            for ( uint64_t const head = head_.load(std::memory_order_acquire); tail != head; tail++ )
+            {
+                slots_[tail % LAZYFREE_QUEUE_SIZE].reset();
+                tail_.store(tail + 1, std::memory_order_release);
+            }
+
+            if ( stop_.load(std::memory_order_acquire) && tail == head_.load(std::memory_order_acquire) )
+                return;
+            signal_.wait(seen, std::memory_order_acquire);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,263 @@
+#ifndef LIST_H
+#define LIST_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * List: a doubly linked list of chunks, each chunk a contiguous buffer of packed elements (quicklist style).
+ *
+ * An element is `varint(len) | bytes | backlen`, where backlen is the same length written so that it can be read
+ * from its last byte backwards. Elements can therefore be pushed and popped at both ends of a chunk without touching
+ * the others. A chunk keeps free space on both sides and grows by doubling up to LIST_CHUNK_BYTES, after which pushes
+ * open a new chunk. Short elements cost their length plus two bytes, and a push or pop only allocates when a chunk
+ * grows or is opened.
+ */
+
+inline constexpr size_t LIST_CHUNK_BYTES{ 8 << 10 };
+inline constexpr size_t LIST_MIN_CHUNK_BYTES{ 64 };
+
+class List
+{
+public:
+    void push_front(std::string_view value)
+    {
+        size_t const size = encoded_size(value);
+        if ( chunks_.empty() || !chunks_.front().fits(size) )
+            chunks_.emplace_front();
+        chunks_.front().push_front(value, size);
+        size_++;
+    }
+
+    void push_back(std::string_view value)
+    {
+        size_t const size = encoded_size(value);
+        if ( chunks_.empty() || !chunks_.back().fits(size) )
+            chunks_.emplace_back();
+        chunks_.back().push_back(value, size);
+        size_++;
+    }
+
+    std::optional<std::string> pop_front()
+    {
+        if ( chunks_.empty() )
+            return std::nullopt;
+
+        std::string value{ chunks_.front().pop_front() };
+        if ( chunks_.front().count == 0 )
+            chunks_.pop_front();
+        size_--;
+        return value;
+    }
+
+    std::optional<std::string> pop_back()
+    {
+        if ( chunks_.empty() )
+            return std::nullopt;
+
+        std::string value{ chunks_.back().pop_back() };
+        if ( chunks_.back().count == 0 )
+            chunks_.pop_back();
+        size_--;
+        return value;
+    }
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    // Calls fn(value) for positions start..stop (inclusive, 0-based, clamped), whole chunks before start are skipped
+    template <class Fn>
+    void range(size_t start, size_t stop, Fn&& fn) const
+    {
+        if ( start >= size_ || start > stop )
+            return;
+        stop = std::min(stop, size_ - 1);
+
+        size_t pos{ 0 };
+        for ( auto const& chunk : chunks_ )
+        {
+            if ( pos + chunk.count <= start )
+            {
+                pos += chunk.count;
+                continue;
+            }
+            for ( uint32_t off = chunk.begin; off < chunk.end && pos <= stop; pos++ )
+            {
+                std::string_view const value = chunk.read(off);
+                if ( pos >= start )
+                    fn(value);
+            }
+            if ( pos > stop )
+                return;
+        }
+    }
+
+    template <class Fn>
+    void for_each(Fn&& fn) const
+    {
+        if ( size_ > 0 )
+            range(0, size_ - 1, fn);
+    }
+
+    [[nodiscard]] size_t memory_usage() const noexcept
+    {
+        // std::list node: two pointers plus the chunk
+        size_t bytes = sizeof(List);
+        for ( auto const& chunk : chunks_ )
+            bytes += 2 * sizeof(void*) + sizeof(Chunk) + chunk.capacity;
+        return bytes;
+    }
+
+    [[nodiscard]] size_t num_chunks() const noexcept
+    {
+        return chunks_.size();
+    }
+
+private:
+    struct Chunk
+    {
+        std::unique_ptr<char[]> data{};
+        uint32_t capacity{ 0 };
+        uint32_t begin{ 0 }; // Offset of the first element
+        uint32_t end{ 0 };   // One past the last element
+        uint32_t count{ 0 };
+
+        // A chunk always takes its first element, however large
+        [[nodiscard]] bool fits(size_t size) const noexcept
+        {
+            return count == 0 || (end - begin) + size <= LIST_CHUNK_BYTES;
+        }
+
+        void push_front(std::string_view value, size_t size)
+        {
+            if ( begin < size )
+                make_room(size, true);
+            begin -= size;
+            write(begin, value);
+            count++;
+        }
+
+        void push_back(std::string_view value, size_t size)
+        {
+            if ( capacity - end < size )
+                make_room(size, false);
+            write(end, value);
+            end += size;
+            count++;
+        }
+
+        std::string_view pop_front()
+        {
+            uint32_t off = begin;
+            std::string_view const value = read(off);
+            begin = off;
+            count--;
+            return value;
+        }
+
+        std::string_view pop_back()
+        {
+            // backlen: the least significant 7 bits come last, a set high bit means more bits precede
+            uint32_t pos = end - 1;
+            size_t len = static_cast<uint8_t>(data[pos]) & 0x7F;
+            for ( int shift = 7; static_cast<uint8_t>(data[pos]) & 0x80; shift += 7 )
+                len |= static_cast<size_t>(static_cast<uint8_t>(data[--pos]) & 0x7F) << shift;
+
+            uint32_t const value_pos = pos - len;
+            std::string_view const value(data.get() + value_pos, len);
+            end = value_pos - varint_size(len);
+            count--;
+            return value;
+        }
+
+        // Reads the element at `off` and advances `off` past it
+        std::string_view read(uint32_t& off) const
+        {
+            size_t len{ 0 };
+            for ( int shift = 0;; shift += 7 )
+            {
+                uint8_t const byte = data[off++];
+                len |= static_cast<size_t>(byte & 0x7F) << shift;
+                if ( !(byte & 0x80) )
+                    break;
+            }
+            std::string_view const value(data.get() + off, len);
+            off += len + varint_size(len);
+            return value;
+        }
+
+        void write(uint32_t off, std::string_view value)
+        {
+            size_t len = value.size();
+            do
+            {
+                uint8_t const byte = len & 0x7F;
+                len >>= 7;
+                data[off++] = static_cast<char>(len ? byte | 0x80 : byte);
+            } while ( len );
+
+            std::memcpy(data.get() + off, value.data(), value.size());
+            off += value.size();
+
+            // backlen, most significant group first
+            size_t const n = varint_size(value.size());
+            for ( size_t i = 0; i < n; i++ )
+            {
+                uint8_t const byte = (value.size() >> (7 * (n - 1 - i))) & 0x7F;
+                data[off++] = static_cast<char>(i == 0 ? byte : byte | 0x80);
+            }
+        }
+
+        // Grows (or recenters) the buffer so `size` more bytes fit on the front or back
+        void make_room(size_t size, bool front)
+        {
+            size_t const used = end - begin;
+            size_t new_capacity = std::max<size_t>(capacity, LIST_MIN_CHUNK_BYTES);
+            while ( new_capacity < used + size )
+                new_capacity *= 2;
+            if ( new_capacity == capacity && used + size > capacity / 2 && used + size <= LIST_CHUNK_BYTES )
+                new_capacity *= 2;
+
+            // Leave the free space where the push happens, a queue keeps pushing on the same side
+            uint32_t const new_begin = front ? new_capacity - used : 0;
+            if ( new_capacity == capacity )
+                std::memmove(data.get() + new_begin, data.get() + begin, used);
+            else
+            {
+                auto grown = std::make_unique<char[]>(new_capacity);
+                if ( used > 0 )
+                    std::memcpy(grown.get() + new_begin, data.get() + begin, used);
+                data = std::move(grown);
+                capacity = new_capacity;
+            }
+            begin = new_begin;
+            end = new_begin + used;
+        }
+    };
+
+    std::list<Chunk> chunks_{};
+    size_t size_{ 0 };
+
+    static size_t varint_size(size_t len) noexcept
+    {
+        size_t n{ 1 };
+        while ( len >>= 7 )
+            n++;
+        return n;
+    }
+
+    static size_t encoded_size(std::string_view value) noexcept
+    {
+        return value.size() + 2 * varint_size(value.size());
+    }
+};
+
+#endif
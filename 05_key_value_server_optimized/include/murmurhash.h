@@ -0,0 +1,46 @@
+#ifndef MURMURHASH_H
+#define MURMURHASH_H
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+/**
+ * MurmurHash64A (Austin Appleby, public domain). Probabilistic values (bloom.h, hyperloglog.h) hash their items with
+ * it rather than std::hash, whose result is up to the standard library: they are copied between nodes by restore,
+ * migration and replication, and a copy must hash the same item to the same bits.
+ */
+inline uint64_t murmur_hash64a(std::string_view data, uint64_t seed = 0x5bd1e995ULL) noexcept
+{
+    constexpr uint64_t m{ 0xc6a4a7935bd1e995ULL };
+    constexpr int r{ 47 };
+    uint64_t h = seed ^ (data.size() * m);
+
+    size_t const whole = data.size() / 8 * 8;
+    for ( size_t i = 0; i < whole; i += 8 )
+    {
+        uint64_t k;
+        std::memcpy(&k, data.data() + i, sizeof(k));
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    uint64_t tail{ 0 };
+    for ( size_t i = data.size(); i > whole; i-- )
+        tail = (tail << 8) | static_cast<uint8_t>(data[i - 1]);
+    if ( data.size() > whole )
+    {
+        h ^= tail;
+        h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+#endif
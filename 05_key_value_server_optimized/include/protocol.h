@@ -0,0 +1,104 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Wire format helpers shared by the server and the client libraries.
+ *
+ * Multi-value responses (mget, cluster slots, ...) carry an array in the data of a regular response:
+ * +-------+------+------+------+------+-----+
+ * | count | len0 | str0 | len1 | str1 | ... |
+ * +-------+------+------+------+------+-----+
+ * A length of NIL_LEN marks a missing element and has no string after it.
+ */
+
+inline constexpr uint32_t NIL_LEN{ UINT32_MAX };
+
+inline void append_u32(std::vector<uint8_t>& out, uint32_t v)
+{
+    auto const* p = reinterpret_cast<uint8_t const*>(&v);
+    out.insert(out.end(), p, p + sizeof(v));
+}
+
+// Encodes a request frame exactly as a client would send it: nbytes | nstr | len0 | arg0 | ...
+inline void append_request_frame(std::vector<uint8_t>& out, std::vector<std::string_view> const& args)
+{
+    uint32_t nbytes = sizeof(uint32_t);
+    for ( auto const& arg : args )
+        nbytes += sizeof(uint32_t) + arg.size();
+
+    append_u32(out, nbytes);
+    append_u32(out, static_cast<uint32_t>(args.size()));
+    for ( auto const& arg : args )
+    {
+        append_u32(out, static_cast<uint32_t>(arg.size()));
+        out.insert(out.end(), arg.begin(), arg.end());
+    }
+}
+
+inline void append_request_frame(std::vector<uint8_t>& out, std::initializer_list<std::string_view> args)
+{
+    append_request_frame(out, std::vector<std::string_view>(args));
+}
+
+inline void append_array_header(std::vector<uint8_t>& out, uint32_t count)
+{
+    append_u32(out, count);
+}
+
+// Overwrites the count of a header appended at `pos`, for arrays whose size is only known once they are written
+inline void patch_array_header(std::vector<uint8_t>& out, size_t pos, uint32_t count)
+{
+    std::memcpy(out.data() + pos, &count, sizeof(count));
+}
+
+inline void append_array_element(std::vector<uint8_t>& out, std::string_view str)
+{
+    append_u32(out, static_cast<uint32_t>(str.size()));
+    out.insert(out.end(), str.begin(), str.end());
+}
+
+inline void append_array_nil(std::vector<uint8_t>& out)
+{
+    append_u32(out, NIL_LEN);
+}
+
+// Decodes an array written with the helpers above, false if `data` is not a well-formed array
+inline bool parse_array(uint8_t const* data, size_t size, std::vector<std::optional<std::string>>& out)
+{
+    uint8_t const* const end = data + size;
+    uint32_t count{};
+    if ( size < sizeof(count) )
+        return false;
+    std::memcpy(&count, data, sizeof(count));
+    data += sizeof(count);
+
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        uint32_t len{};
+        if ( end - data < static_cast<ptrdiff_t>(sizeof(len)) )
+            return false;
+        std::memcpy(&len, data, sizeof(len));
+        data += sizeof(len);
+
+        if ( len == NIL_LEN )
+        {
+            out.emplace_back(std::nullopt);
+            continue;
+        }
+        if ( static_cast<size_t>(end - data) < len )
+            return false;
+        out.emplace_back(std::string(data, data + len));
+        data += len;
+    }
+    return data == end;
+}
+
+#endif
@@ -0,0 +1,218 @@
+#ifndef PUBSUB_H
+#define PUBSUB_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Publish/subscribe.
+ *
+ * `subscribe <channel> ...` and `psubscribe <pattern> ...` register a connection, `publish <channel> <message>`
+ * delivers `[message, channel, payload]` to every subscriber of the channel and `[pmessage, pattern, channel, payload]`
+ * to every subscriber of a matching glob pattern. Each of those is encoded once per publish into a reference counted
+ * buffer that all receiving connections share (Connection::shared), so fanning out to N subscribers costs one encode
+ * plus one write per subscriber.
+ *
+ * A subscriber that does not read its messages is disconnected once its pending output passes the hard limit, or has
+ * stayed above the soft limit for soft_seconds, like Redis' `client-output-buffer-limit pubsub`.
+ */
+
+inline constexpr size_t DEFAULT_PUBSUB_HARD_LIMIT{ 32 << 20 };
+inline constexpr size_t DEFAULT_PUBSUB_SOFT_LIMIT{ 8 << 20 };
+inline constexpr std::chrono::seconds DEFAULT_PUBSUB_SOFT_SECONDS{ 60 };
+
+struct PubSubLimits
+{
+    size_t hard{ DEFAULT_PUBSUB_HARD_LIMIT };
+    size_t soft{ DEFAULT_PUBSUB_SOFT_LIMIT };
+    std::chrono::seconds soft_seconds{ DEFAULT_PUBSUB_SOFT_SECONDS };
+};
+
+// Redis glob: `*`, `?`, `[abc]`, `[^a-z]` and `\` escapes
+inline bool glob_match(std::string_view pattern, std::string_view str) noexcept
+{
+    size_t p{ 0 }, s{ 0 };
+    size_t star_p{ std::string_view::npos }, star_s{ 0 }; // Last `*` and where it started matching, for backtracking
+    while ( s < str.size() )
+    {
+        if ( p < pattern.size() && pattern[p] == '*' )
+        {
+            star_p = p++;
+            star_s = s;
+            continue;
+        }
+
+        bool matched{ false };
+        size_t next{ p + 1 };
+        if ( p < pattern.size() && pattern[p] == '?' )
+            matched = true;
+        else if ( p < pattern.size() && pattern[p] == '[' )
+        {
+            size_t i{ p + 1 };
+            bool const negate = i < pattern.size() && pattern[i] == '^';
+            i += negate;
+            bool in_set{ false };
+            for ( ; i < pattern.size() && pattern[i] != ']'; i++ )
+            {
+                if ( pattern[i] == '\\' && i + 1 < pattern.size() )
+                    in_set |= pattern[++i] == str[s];
+                else if ( i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']' )
+                {
+                    auto const [lo, hi] = std::minmax(pattern[i], pattern[i + 2]);
+                    in_set |= str[s] >= lo && str[s] <= hi;
+                    i += 2;
+                }
+                else
+                    in_set |= pattern[i] == str[s];
+            }
+            matched = in_set != negate;
+            next = std::min(i + 1, pattern.size());
+        }
+        else if ( p < pattern.size() )
+        {
+            size_t const literal = pattern[p] == '\\' && p + 1 < pattern.size() ? p + 1 : p;
+            matched = pattern[literal] == str[s];
+            next = literal + 1;
+        }
+
+        if ( matched )
+        {
+            p = next;
+            s++;
+        }
+        else if ( star_p != std::string_view::npos )
+        {
+            p = star_p + 1;
+            s = ++star_s;
+        }
+        else
+            return false;
+    }
+
+    while ( p < pattern.size() && pattern[p] == '*' )
+        p++;
+    return p == pattern.size();
+}
+
+// Who is subscribed to what, the server does the encoding and the writes
+class PubSub
+{
+public:
+    struct Subscriber
+    {
+        std::set<std::string> channels{};
+        std::set<std::string> patterns{};
+    };
+
+    // Subscriptions of `fd` (channels plus patterns) after the call
+    size_t subscribe(int fd, std::string const& channel)
+    {
+        if ( subscribers_[fd].channels.insert(channel).second )
+            channels_[channel].push_back(fd);
+        return count(fd);
+    }
+
+    size_t unsubscribe(int fd, std::string const& channel)
+    {
+        auto it = subscribers_.find(fd);
+        if ( it != subscribers_.end() && it->second.channels.erase(channel) )
+            remove_fd(channels_, channel, fd);
+        return forget_if_unsubscribed(fd);
+    }
+
+    size_t psubscribe(int fd, std::string const& pattern)
+    {
+        if ( subscribers_[fd].patterns.insert(pattern).second )
+            patterns_[pattern].push_back(fd);
+        return count(fd);
+    }
+
+    size_t punsubscribe(int fd, std::string const& pattern)
+    {
+        auto it = subscribers_.find(fd);
+        if ( it != subscribers_.end() && it->second.patterns.erase(pattern) )
+            remove_fd(patterns_, pattern, fd);
+        return forget_if_unsubscribed(fd);
+    }
+
+    // Drops every subscription of a closed connection
+    void remove(int fd)
+    {
+        auto it = subscribers_.find(fd);
+        if ( it == subscribers_.end() )
+            return;
+        for ( auto const& channel : it->second.channels )
+            remove_fd(channels_, channel, fd);
+        for ( auto const& pattern : it->second.patterns )
+            remove_fd(patterns_, pattern, fd);
+        subscribers_.erase(it);
+    }
+
+    [[nodiscard]] size_t count(int fd) const
+    {
+        auto it = subscribers_.find(fd);
+        return it == subscribers_.end() ? 0 : it->second.channels.size() + it->second.patterns.size();
+    }
+
+    // nullptr if `fd` has no subscriptions
+    Subscriber const* find(int fd) const
+    {
+        auto it = subscribers_.find(fd);
+        return it == subscribers_.end() ? nullptr : &it->second;
+    }
+
+    /**
+     * Calls fn(pattern, fds) once for the subscribers of `channel` (pattern nullptr) and once per pattern matching it.
+     * The receivers of one call get the same message, `fds` must not be modified while it runs.
+     */
+    template <class Fn>
+    void for_each_receiver_group(std::string const& channel, Fn&& fn) const
+    {
+        if ( auto it = channels_.find(channel); it != channels_.end() )
+            fn(static_cast<std::string const*>(nullptr), it->second);
+        for ( auto const& [pattern, fds] : patterns_ )
+        {
+            if ( glob_match(pattern, channel) )
+                fn(&pattern, fds);
+        }
+    }
+
+private:
+    // Subscriber lists are unordered, removal swaps the last fd into the hole
+    std::unordered_map<std::string, std::vector<int>> channels_{};
+    std::map<std::string, std::vector<int>> patterns_{};
+    std::unordered_map<int, Subscriber> subscribers_{};
+
+    template <class Map>
+    static void remove_fd(Map& map, std::string const& name, int fd)
+    {
+        auto it = map.find(name);
+        if ( it == map.end() )
+            return;
+        auto& fds = it->second;
+        if ( auto pos = std::find(fds.begin(), fds.end(), fd); pos != fds.end() )
+        {
+            *pos = fds.back();
+            fds.pop_back();
+        }
+        if ( fds.empty() )
+            map.erase(it);
+    }
+
+    size_t forget_if_unsubscribed(int fd)
+    {
+        size_t const n = count(fd);
+        if ( n == 0 )
+            subscribers_.erase(fd);
+        return n;
+    }
+};
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include "protocol.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * Primary-replica replication.
+ *
+ * A replica connects to its primary and sends `psync <replid> <offset>`. The primary answers with either
+ *   - `continue <replid>` followed by the bytes the replica missed, taken from the backlog, or
+ *   - `fullresync <replid> <offset> <snapshot bytes>` followed by a snapshot of the keyspace.
+ * From then on every successful write is forwarded as the exact request frame the client sent, so the replication
+ * stream is a sequence of regular requests. The replica reports how far it got with `replconf ack <offset>`, which
+ * the primary uses to compute the lag of each replica. Right after psync it also announces the port it serves clients
+ * on with `replconf listening-port <port>`, which lets topology-aware clients find it through `info replication`.
+ *
+ * Offsets count stream bytes since the backlog was created, the snapshot is not part of the stream.
+ */
+
+inline constexpr size_t DEFAULT_REPL_BACKLOG_SIZE{ 1 << 20 };
+inline constexpr size_t REPL_ID_SIZE{ 40 };
+inline constexpr size_t REPL_MAX_WRITE_TIMES{ 1 << 16 };
+inline constexpr int REPL_TIMER_INTERVAL_MS{ 100 };
+
+using ReplClock = std::chrono::steady_clock;
+
+// Fixed-size ring holding the tail of the replication stream, so a replica that briefly lost its link can resume
+class ReplicationBacklog
+{
+public:
+    explicit ReplicationBacklog(size_t size = DEFAULT_REPL_BACKLOG_SIZE) : buf_(size)
+    {
+    }
+
+    void append(uint8_t const* data, size_t len)
+    {
+        // Only the last `size` bytes can survive, skip whatever would be overwritten in this same call
+        if ( len > buf_.size() )
+        {
+            data += len - buf_.size();
+            offset_ += len - buf_.size();
+            len = buf_.size();
+        }
+
+        size_t const pos = offset_ % buf_.size();
+        size_t const first = std::min(len, buf_.size() - pos);
+        std::memcpy(buf_.data() + pos, data, first);
+        std::memcpy(buf_.data(), data + first, len - first);
+        offset_ += len;
+    }
+
+    // Appends the stream from `offset` up to the current offset to `out`, false if those bytes are gone
+    bool copy_from(uint64_t offset, std::vector<uint8_t>& out) const
+    {
+        if ( offset > offset_ || offset_ - offset > std::min<uint64_t>(offset_, buf_.size()) )
+            return false;
+
+        size_t const len = offset_ - offset;
+        size_t const pos = offset % buf_.size();
+        size_t const first = std::min(len, buf_.size() - pos);
+        out.insert(out.end(), buf_.begin() + pos, buf_.begin() + pos + first);
+        out.insert(out.end(), buf_.begin(), buf_.begin() + (len - first));
+        return true;
+    }
+
+    [[nodiscard]] uint64_t offset() const noexcept
+    {
+        return offset_;
+    }
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return buf_.size();
+    }
+
+private:
+    std::vector<uint8_t> buf_;
+    uint64_t offset_{ 0 }; // Total bytes ever appended, i.e. the offset of the next byte
+};
+
+// Primary side view of a connected replica
+struct ReplicaInfo
+{
+    std::string ip{};             // Peer address of the replication link
+    uint16_t listening_port{ 0 }; // Where the replica serves clients, announced with `replconf listening-port`
+    uint64_t ack_offset{ 0 };
+    ReplClock::time_point ack_time{};
+};
+
+// Replica side state of the link to the primary
+enum class ReplLinkState : uint8_t
+{
+    DISCONNECTED = 0,
+    WAIT_PSYNC_REPLY, // psync sent, the reply is a response frame
+    STREAMING,        // Everything from now on is request frames
+};
+
+struct MasterLink
+{
+    std::string host{};
+    uint16_t port{ 0 };
+    int fd{ -1 };
+    ReplLinkState state{ ReplLinkState::DISCONNECTED };
+    std::string replid{ "?" };
+    uint64_t offset{ 0 };             // Stream bytes applied so far
+    uint64_t snapshot_remaining{ 0 }; // Snapshot bytes still to apply after a full resync
+    ReplClock::time_point last_io{};
+};
+
+inline std::string make_repl_id()
+{
+    static constexpr char hex[]{ "0123456789abcdef" };
+    std::random_device rd;
+    std::mt19937_64 rng(rd());
+    std::string id(REPL_ID_SIZE, '0');
+    for ( auto& c : id )
+        c = hex[rng() & 0xF];
+    return id;
+}
+
+// Write times of the stream, used to turn a replica's byte lag into a time lag
+class ReplicationWriteTimes
+{
+public:
+    void record(uint64_t end_offset, ReplClock::time_point now)
+    {
+        // Millisecond resolution is all lag_ms() reports, so writes within the same millisecond share an entry
+        if ( !times_.empty() && now - times_.back().second < std::chrono::milliseconds(1) )
+            times_.back().first = end_offset;
+        else
+            times_.emplace_back(end_offset, now);
+
+        if ( times_.size() > REPL_MAX_WRITE_TIMES )
+            times_.pop_front();
+    }
+
+    // Forget writes every replica has already acknowledged
+    void trim(uint64_t min_ack_offset)
+    {
+        while ( !times_.empty() && times_.front().first <= min_ack_offset )
+            times_.pop_front();
+    }
+
+    // Age of the oldest write past `ack_offset`, 0 if the replica is caught up
+    [[nodiscard]] int64_t lag_ms(uint64_t ack_offset, uint64_t current_offset, ReplClock::time_point now) const
+    {
+        if ( ack_offset >= current_offset )
+            return 0;
+
+        auto it = std::upper_bound(times_.begin(), times_.end(), ack_offset,
+                                   [](uint64_t off, auto const& entry) { return off < entry.first; });
+        if ( it == times_.end() )
+            return 0;
+        return std::chrono::duration_cast<std::chrono::milliseconds>(now - it->second).count();
+    }
+
+private:
+    std::deque<std::pair<uint64_t, ReplClock::time_point>> times_; // (stream offset after the write, time)
+};
+
+#endif
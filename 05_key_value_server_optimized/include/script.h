@@ -0,0 +1,926 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+/**
+ * Server-side scripts (`eval`, `evalsha`, `script load`): a read-compute-write sequence that runs as one request,
+ * nothing else is served while it runs. Scripts are written in a small Lua-like language and compiled once into
+ * bytecode for a stack machine, the server caches the compiled script by the SHA-1 of its source like Redis does.
+ *
+ *     local current = tonumber(call("get", KEYS[1])) or 0
+ *     if current + ARGV[1] > tonumber(ARGV[2]) then
+ *         return nil
+ *     end
+ *     return call("incrby", KEYS[1], ARGV[1])
+ *
+ * Values are nil, booleans, 64-bit integers and strings. Only nil and false are false. Arithmetic takes integers and
+ * strings holding one, `..` concatenates strings and integers, `==` compares type and value, `<` and co. compare two
+ * integers or two strings. `local` variables live until the end of their block and there are no globals.
+ *
+ * Statements: local name [= expr], name = expr, if/elseif/else/end, while/do/end, break, return [expr] and function
+ * calls. Builtins: call(cmd, ...) runs a request and returns its data, nil for RES_NX, and stops the script with the
+ * error of a failed request. tonumber(v) is nil for anything but an integer or a string holding one, tostring(v).
+ * KEYS[i] and ARGV[i] (from 1, nil past the end), #KEYS, #ARGV and #string.
+ *
+ * A script runs until its deadline at most. The machine looks at the clock every SCRIPT_CLOCK_INTERVAL instructions
+ * and after each call(), and a script that overran stops with an error. Its writes so far stay applied.
+ */
+
+inline constexpr size_t SCRIPT_MAX_LOCALS{ 200 };
+inline constexpr size_t SCRIPT_MAX_DEPTH{ 100 };          // Nesting of expressions and blocks
+inline constexpr size_t SCRIPT_MAX_STRING{ 32 << 20 };    // Longest string `..` builds
+inline constexpr uint32_t SCRIPT_CLOCK_INTERVAL{ 1024 };  // Instructions between two looks at the clock
+inline constexpr std::chrono::milliseconds DEFAULT_SCRIPT_TIME_LIMIT{ 1000 };
+
+using ScriptValue = std::variant<std::monostate, bool, int64_t, std::string>;
+
+enum class ScriptOp : uint8_t
+{
+    PUSH_CONST, // constants[arg]
+    PUSH_NIL,
+    LOAD,  // locals[arg]
+    STORE, // Pops into locals[arg]
+    POP,
+    KEY, // Pops i, pushes KEYS[i]
+    ARG, // Pops i, pushes ARGV[i]
+    NUM_KEYS,
+    NUM_ARGS,
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    MOD,
+    NEG,
+    CONCAT,
+    EQ,
+    NE,
+    LT,
+    LE,
+    GT,
+    GE,
+    NOT,
+    LEN,
+    JUMP,               // To code[arg]
+    JUMP_IF_FALSE,      // Pops the condition
+    JUMP_IF_FALSE_KEEP, // `and`: keeps a false left side as the result, pops a true one
+    JUMP_IF_TRUE_KEEP,  // `or`
+    CALL,               // Pops arg arguments, pushes the reply
+    TONUMBER,
+    TOSTRING,
+    RETURN, // Pops the result
+};
+
+struct ScriptInstruction
+{
+    ScriptOp op{};
+    uint32_t arg{ 0 };
+};
+
+struct Script
+{
+    std::vector<ScriptInstruction> code{};
+    std::vector<ScriptValue> constants{};
+    uint32_t num_locals{ 0 };
+};
+
+namespace script_detail
+{
+inline bool is_truthy(ScriptValue const& v) noexcept
+{
+    return !std::holds_alternative<std::monostate>(v) && !(std::holds_alternative<bool>(v) && !std::get<bool>(v));
+}
+
+inline bool parse_int(std::string_view str, int64_t& out) noexcept
+{
+    auto const [end, ec] = std::from_chars(str.data(), str.data() + str.size(), out);
+    return !str.empty() && ec == std::errc{} && end == str.data() + str.size();
+}
+
+// Integers and strings holding one, for arithmetic
+inline bool to_int(ScriptValue const& v, int64_t& out) noexcept
+{
+    if ( auto const* i = std::get_if<int64_t>(&v) )
+    {
+        out = *i;
+        return true;
+    }
+    auto const* s = std::get_if<std::string>(&v);
+    return s && parse_int(*s, out);
+}
+
+inline std::string to_string(ScriptValue const& v)
+{
+    if ( auto const* s = std::get_if<std::string>(&v) )
+        return *s;
+    if ( auto const* i = std::get_if<int64_t>(&v) )
+        return std::to_string(*i);
+    if ( auto const* b = std::get_if<bool>(&v) )
+        return *b ? "true" : "false";
+    return "nil";
+}
+
+class Compiler
+{
+public:
+    explicit Compiler(std::string_view source) : src_(source)
+    {
+    }
+
+    // nullptr and `err` set if the source does not compile
+    std::unique_ptr<Script> compile(std::string& err)
+    {
+        script_ = std::make_unique<Script>();
+        next();
+        block();
+        if ( error_.empty() && tok_ != Tok::END_OF_INPUT )
+            fail("unexpected '" + std::string(text_) + "'");
+        emit(ScriptOp::PUSH_NIL);
+        emit(ScriptOp::RETURN);
+
+        if ( !error_.empty() )
+        {
+            err = "ERR script line " + std::to_string(line_) + ": " + error_;
+            return nullptr;
+        }
+        return std::move(script_);
+    }
+
+private:
+    enum class Tok : uint8_t
+    {
+        END_OF_INPUT,
+        NAME,
+        INT,
+        STRING,
+        SYMBOL, // Operators and punctuation, in text_
+    };
+
+    std::string_view src_;
+    size_t pos_{ 0 };
+    size_t line_{ 1 };
+    Tok tok_{};
+    std::string_view text_{};
+    ScriptValue literal_{}; // Of an INT or STRING token
+
+    std::unique_ptr<Script> script_{};
+    std::vector<std::string_view> locals_{}; // In scope, a local's slot is its index
+    std::vector<std::vector<size_t>> breaks_{}; // Jumps of the `break`s of each enclosing loop
+    size_t depth_{ 0 };
+    std::string error_{};
+
+    void fail(std::string msg)
+    {
+        if ( error_.empty() )
+            error_ = std::move(msg);
+        tok_ = Tok::END_OF_INPUT; // Stops the parse
+    }
+
+    size_t emit(ScriptOp op, uint32_t arg = 0)
+    {
+        script_->code.push_back({ op, arg });
+        return script_->code.size() - 1;
+    }
+
+    // Points the jump at `at` to the next instruction
+    void patch(size_t at)
+    {
+        script_->code[at].arg = static_cast<uint32_t>(script_->code.size());
+    }
+
+    void emit_const(ScriptValue value)
+    {
+        script_->constants.push_back(std::move(value));
+        emit(ScriptOp::PUSH_CONST, static_cast<uint32_t>(script_->constants.size() - 1));
+    }
+
+    /* ------------------------------------------ Lexer ------------------------------------------ */
+
+    void next()
+    {
+        if ( !error_.empty() )
+            return;
+
+        while ( pos_ < src_.size() )
+        {
+            if ( src_[pos_] == '\n' )
+                line_++;
+            if ( std::isspace(static_cast<unsigned char>(src_[pos_])) )
+                pos_++;
+            else if ( src_.substr(pos_, 2) == "--" )
+            {
+                while ( pos_ < src_.size() && src_[pos_] != '\n' )
+                    pos_++;
+            }
+            else
+                break;
+        }
+        if ( pos_ == src_.size() )
+        {
+            tok_ = Tok::END_OF_INPUT;
+            text_ = "<eof>";
+            return;
+        }
+
+        size_t const start = pos_;
+        char const c = src_[pos_];
+        if ( std::isalpha(static_cast<unsigned char>(c)) || c == '_' )
+        {
+            while ( pos_ < src_.size() && (std::isalnum(static_cast<unsigned char>(src_[pos_])) || src_[pos_] == '_') )
+                pos_++;
+            tok_ = Tok::NAME;
+            text_ = src_.substr(start, pos_ - start);
+        }
+        else if ( std::isdigit(static_cast<unsigned char>(c)) )
+        {
+            while ( pos_ < src_.size() && std::isdigit(static_cast<unsigned char>(src_[pos_])) )
+                pos_++;
+            tok_ = Tok::INT;
+            text_ = src_.substr(start, pos_ - start);
+            int64_t value{};
+            if ( !parse_int(text_, value) )
+                fail("integer out of range");
+            literal_ = value;
+        }
+        else if ( c == '"' || c == '\'' )
+            lex_string(c);
+        else
+        {
+            static constexpr std::array<std::string_view, 5> two_chars{ "==", "~=", "<=", ">=", ".." };
+            tok_ = Tok::SYMBOL;
+            text_ = src_.substr(start, 2);
+            if ( std::ranges::find(two_chars, text_) == two_chars.end() )
+            {
+                text_ = src_.substr(start, 1);
+                if ( std::string_view("=<>+-*/%()[],#").find(c) == std::string_view::npos )
+                    return fail("unexpected character '" + std::string(text_) + "'");
+            }
+            pos_ += text_.size();
+        }
+    }
+
+    void lex_string(char const quote)
+    {
+        std::string value;
+        pos_++;
+        while ( true )
+        {
+            if ( pos_ == src_.size() || src_[pos_] == '\n' )
+            {
+                fail("unfinished string");
+                return;
+            }
+            char c = src_[pos_++];
+            if ( c == quote )
+                break;
+            if ( c == '\\' && pos_ < src_.size() )
+            {
+                c = src_[pos_++];
+                c = c == 'n' ? '\n' : c == 't' ? '\t' : c == 'r' ? '\r' : c == '0' ? '\0' : c;
+            }
+            value.push_back(c);
+        }
+        tok_ = Tok::STRING;
+        text_ = "<string>";
+        literal_ = std::move(value);
+    }
+
+    [[nodiscard]] bool is(std::string_view sym) const noexcept
+    {
+        return (tok_ == Tok::SYMBOL || tok_ == Tok::NAME) && text_ == sym;
+    }
+
+    bool accept(std::string_view sym)
+    {
+        if ( !is(sym) )
+            return false;
+        next();
+        return true;
+    }
+
+    void expect(std::string_view sym)
+    {
+        if ( !accept(sym) )
+            fail("'" + std::string(sym) + "' expected near '" + std::string(text_) + "'");
+    }
+
+    [[nodiscard]] static bool is_keyword(std::string_view name) noexcept
+    {
+        static constexpr std::array<std::string_view, 17> keywords{ "and",    "break", "do",   "else",  "elseif",
+                                                                     "end",    "false", "if",   "local", "nil",
+                                                                     "not",    "or",    "return", "then", "true",
+                                                                     "while",  "function" };
+        return std::ranges::find(keywords, name) != keywords.end();
+    }
+
+    /* ------------------------------------------ Statements ------------------------------------------ */
+
+    [[nodiscard]] bool block_ends() const noexcept
+    {
+        return tok_ == Tok::END_OF_INPUT || is("end") || is("else") || is("elseif");
+    }
+
+    void block()
+    {
+        if ( ++depth_ > SCRIPT_MAX_DEPTH )
+            return fail("blocks nested too deep");
+        size_t const scope = locals_.size();
+        while ( !block_ends() )
+            statement();
+        locals_.resize(scope);
+        depth_--;
+    }
+
+    void statement()
+    {
+        if ( accept("local") )
+        {
+            if ( tok_ != Tok::NAME || is_keyword(text_) )
+                return fail("name expected after 'local'");
+            std::string_view const name = text_;
+            next();
+            if ( accept("=") )
+                expression();
+            else
+                emit(ScriptOp::PUSH_NIL);
+            // Declared after its initializer, which still sees an outer variable of the same name
+            if ( locals_.size() == SCRIPT_MAX_LOCALS )
+                return fail("too many local variables");
+            locals_.push_back(name);
+            script_->num_locals = std::max<uint32_t>(script_->num_locals, locals_.size());
+            emit(ScriptOp::STORE, static_cast<uint32_t>(locals_.size() - 1));
+        }
+        else if ( accept("if") )
+        {
+            std::vector<size_t> to_end;
+            do
+            {
+                expression();
+                expect("then");
+                size_t const skip = emit(ScriptOp::JUMP_IF_FALSE);
+                block();
+                to_end.push_back(emit(ScriptOp::JUMP));
+                patch(skip);
+            } while ( accept("elseif") );
+            if ( accept("else") )
+                block();
+            expect("end");
+            for ( size_t const at : to_end )
+                patch(at);
+        }
+        else if ( accept("while") )
+        {
+            auto const top = static_cast<uint32_t>(script_->code.size());
+            expression();
+            expect("do");
+            size_t const exit = emit(ScriptOp::JUMP_IF_FALSE);
+            breaks_.emplace_back();
+            block();
+            expect("end");
+            emit(ScriptOp::JUMP, top);
+            patch(exit);
+            for ( size_t const at : breaks_.back() )
+                patch(at);
+            breaks_.pop_back();
+        }
+        else if ( accept("break") )
+        {
+            if ( breaks_.empty() )
+                return fail("'break' outside a loop");
+            breaks_.back().push_back(emit(ScriptOp::JUMP));
+        }
+        else if ( accept("return") )
+        {
+            if ( block_ends() )
+                emit(ScriptOp::PUSH_NIL);
+            else
+                expression();
+            emit(ScriptOp::RETURN);
+        }
+        else if ( tok_ == Tok::NAME && !is_keyword(text_) )
+        {
+            std::string_view const name = text_;
+            next();
+            if ( accept("=") )
+            {
+                int const slot = local_slot(name);
+                if ( slot < 0 )
+                    return fail("assignment to undeclared variable '" + std::string(name) + "'");
+                expression();
+                emit(ScriptOp::STORE, static_cast<uint32_t>(slot));
+            }
+            else if ( is("(") )
+            {
+                call(name);
+                emit(ScriptOp::POP);
+            }
+            else
+                fail("syntax error near '" + std::string(text_) + "'");
+        }
+        else
+            fail("syntax error near '" + std::string(text_) + "'");
+    }
+
+    [[nodiscard]] int local_slot(std::string_view name) const noexcept
+    {
+        for ( size_t i = locals_.size(); i-- > 0; )
+        {
+            if ( locals_[i] == name )
+                return static_cast<int>(i);
+        }
+        return -1;
+    }
+
+    /* ------------------------------------------ Expressions ------------------------------------------ */
+
+    void expression()
+    {
+        if ( ++depth_ > SCRIPT_MAX_DEPTH )
+            return fail("expression nested too deep");
+        or_expression();
+        depth_--;
+    }
+
+    void or_expression()
+    {
+        and_expression();
+        while ( accept("or") )
+        {
+            size_t const skip = emit(ScriptOp::JUMP_IF_TRUE_KEEP);
+            and_expression();
+            patch(skip);
+        }
+    }
+
+    void and_expression()
+    {
+        comparison();
+        while ( accept("and") )
+        {
+            size_t const skip = emit(ScriptOp::JUMP_IF_FALSE_KEEP);
+            comparison();
+            patch(skip);
+        }
+    }
+
+    void comparison()
+    {
+        concatenation();
+        static constexpr std::array<std::pair<std::string_view, ScriptOp>, 6> ops{
+            { { "==", ScriptOp::EQ }, { "~=", ScriptOp::NE }, { "<", ScriptOp::LT }, { "<=", ScriptOp::LE },
+              { ">", ScriptOp::GT }, { ">=", ScriptOp::GE } }
+        };
+        for ( auto const& [sym, op] : ops )
+        {
+            if ( tok_ == Tok::SYMBOL && accept(sym) )
+            {
+                concatenation();
+                emit(op);
+                return;
+            }
+        }
+    }
+
+    void concatenation()
+    {
+        additive();
+        while ( tok_ == Tok::SYMBOL && accept("..") )
+        {
+            additive();
+            emit(ScriptOp::CONCAT);
+        }
+    }
+
+    void additive()
+    {
+        multiplicative();
+        while ( tok_ == Tok::SYMBOL && (is("+") || is("-")) )
+        {
+            ScriptOp const op = is("+") ? ScriptOp::ADD : ScriptOp::SUB;
+            next();
+            multiplicative();
+            emit(op);
+        }
+    }
+
+    void multiplicative()
+    {
+        unary();
+        while ( tok_ == Tok::SYMBOL && (is("*") || is("/") || is("%")) )
+        {
+            ScriptOp const op = is("*") ? ScriptOp::MUL : is("/") ? ScriptOp::DIV : ScriptOp::MOD;
+            next();
+            unary();
+            emit(op);
+        }
+    }
+
+    void unary()
+    {
+        if ( ++depth_ > SCRIPT_MAX_DEPTH )
+            return fail("expression nested too deep");
+        if ( accept("not") )
+        {
+            unary();
+            emit(ScriptOp::NOT);
+        }
+        else if ( tok_ == Tok::SYMBOL && accept("-") )
+        {
+            unary();
+            emit(ScriptOp::NEG);
+        }
+        else if ( tok_ == Tok::SYMBOL && accept("#") )
+        {
+            // #KEYS is the number of keys, #KEYS[i] the length of a key
+            if ( is("KEYS") || is("ARGV") )
+            {
+                ScriptOp const count = is("KEYS") ? ScriptOp::NUM_KEYS : ScriptOp::NUM_ARGS;
+                std::string_view const name = text_;
+                next();
+                if ( !is("[") )
+                    emit(count);
+                else
+                {
+                    index(name);
+                    emit(ScriptOp::LEN);
+                }
+            }
+            else
+            {
+                unary();
+                emit(ScriptOp::LEN);
+            }
+        }
+        else
+            primary();
+        depth_--;
+    }
+
+    void primary()
+    {
+        if ( tok_ == Tok::INT || tok_ == Tok::STRING )
+        {
+            emit_const(std::move(literal_));
+            next();
+        }
+        else if ( accept("nil") )
+            emit(ScriptOp::PUSH_NIL);
+        else if ( is("true") || is("false") )
+        {
+            emit_const(is("true"));
+            next();
+        }
+        else if ( tok_ == Tok::SYMBOL && accept("(") )
+        {
+            expression();
+            expect(")");
+        }
+        else if ( is("KEYS") || is("ARGV") )
+        {
+            std::string_view const name = text_;
+            next();
+            index(name);
+        }
+        else if ( tok_ == Tok::NAME && !is_keyword(text_) )
+        {
+            std::string_view const name = text_;
+            next();
+            if ( is("(") )
+                return call(name);
+            int const slot = local_slot(name);
+            if ( slot < 0 )
+                return fail("undeclared variable '" + std::string(name) + "'");
+            emit(ScriptOp::LOAD, static_cast<uint32_t>(slot));
+        }
+        else
+            fail("unexpected '" + std::string(text_) + "'");
+    }
+
+    // KEYS[i] or ARGV[i], `[` is the current token
+    void index(std::string_view name)
+    {
+        expect("[");
+        expression();
+        expect("]");
+        emit(name == "KEYS" ? ScriptOp::KEY : ScriptOp::ARG);
+    }
+
+    // name(args), `(` is the current token
+    void call(std::string_view name)
+    {
+        next();
+        uint32_t argc{ 0 };
+        if ( !accept(")") )
+        {
+            do
+            {
+                expression();
+                argc++;
+            } while ( accept(",") );
+            expect(")");
+        }
+
+        if ( name == "call" && argc >= 1 )
+            emit(ScriptOp::CALL, argc);
+        else if ( (name == "tonumber" || name == "tostring") && argc == 1 )
+            emit(name == "tonumber" ? ScriptOp::TONUMBER : ScriptOp::TOSTRING);
+        else if ( name == "call" || name == "tonumber" || name == "tostring" )
+            fail("wrong number of arguments to '" + std::string(name) + "'");
+        else
+            fail("unknown function '" + std::string(name) + "'");
+    }
+};
+} // namespace script_detail
+
+// The compiled script, nullptr and `err` set on a syntax error
+inline std::unique_ptr<Script> compile_script(std::string_view source, std::string& err)
+{
+    return script_detail::Compiler(source).compile(err);
+}
+
+struct ScriptResult
+{
+    bool ok{ true };
+    ScriptValue value{};
+    std::string error{}; // Unless ok
+};
+
+/**
+ * Runs `script` with KEYS = `keys` and ARGV = `args` until it returns or `deadline` passes.
+ * call(std::vector<std::string> const& cmd, ScriptValue& reply, std::string& err) runs a request, false stops the
+ * script with `err`.
+ */
+template <class Call>
+ScriptResult run_script(Script const& script, std::span<std::string const> keys, std::span<std::string const> args,
+                        std::chrono::steady_clock::time_point deadline, Call&& call)
+{
+    using namespace script_detail;
+    std::vector<ScriptValue> stack;
+    stack.reserve(16);
+    std::vector<ScriptValue> locals(script.num_locals);
+    std::vector<std::string> cmd;
+
+    auto pop = [&stack]()
+    {
+        ScriptValue v{ std::move(stack.back()) };
+        stack.pop_back();
+        return v;
+    };
+    auto failure = [](std::string msg) { return ScriptResult{ false, {}, "ERR " + std::move(msg) }; };
+    auto timed_out = [&deadline]() { return std::chrono::steady_clock::now() > deadline; };
+
+    uint32_t until_clock{ SCRIPT_CLOCK_INTERVAL };
+    for ( size_t pc = 0;; )
+    {
+        if ( --until_clock == 0 )
+        {
+            if ( timed_out() )
+                return failure("script exceeded its time limit");
+            until_clock = SCRIPT_CLOCK_INTERVAL;
+        }
+
+        auto const [op, arg] = script.code[pc++];
+        switch ( op )
+        {
+        case ScriptOp::PUSH_CONST:
+            stack.push_back(script.constants[arg]);
+            break;
+        case ScriptOp::PUSH_NIL:
+            stack.emplace_back();
+            break;
+        case ScriptOp::LOAD:
+            stack.push_back(locals[arg]);
+            break;
+        case ScriptOp::STORE:
+            locals[arg] = pop();
+            break;
+        case ScriptOp::POP:
+            stack.pop_back();
+            break;
+        case ScriptOp::KEY:
+        case ScriptOp::ARG:
+        {
+            auto const list = op == ScriptOp::KEY ? keys : args;
+            int64_t i{};
+            if ( !to_int(stack.back(), i) )
+                return failure("KEYS and ARGV take an integer index");
+            if ( i >= 1 && static_cast<uint64_t>(i) <= list.size() )
+                stack.back() = list[i - 1];
+            else
+                stack.back() = std::monostate{};
+            break;
+        }
+        case ScriptOp::NUM_KEYS:
+            stack.emplace_back(static_cast<int64_t>(keys.size()));
+            break;
+        case ScriptOp::NUM_ARGS:
+            stack.emplace_back(static_cast<int64_t>(args.size()));
+            break;
+        case ScriptOp::ADD:
+        case ScriptOp::SUB:
+        case ScriptOp::MUL:
+        case ScriptOp::DIV:
+        case ScriptOp::MOD:
+        {
+            int64_t a{}, b{}, r{};
+            ScriptValue const rhs{ pop() };
+            if ( !to_int(stack.back(), a) || !to_int(rhs, b) )
+                return failure("arithmetic on a value that is not an integer");
+            bool overflow{ false };
+            if ( op == ScriptOp::ADD )
+                overflow = __builtin_add_overflow(a, b, &r);
+            else if ( op == ScriptOp::SUB )
+                overflow = __builtin_sub_overflow(a, b, &r);
+            else if ( op == ScriptOp::MUL )
+                overflow = __builtin_mul_overflow(a, b, &r);
+            else if ( b == 0 )
+                return failure("division by zero");
+            else if ( a == INT64_MIN && b == -1 )
+                overflow = true;
+            else
+                r = op == ScriptOp::DIV ? a / b : a % b;
+            if ( overflow )
+                return failure("integer overflow");
+            stack.back() = r;
+            break;
+        }
+        case ScriptOp::NEG:
+        {
+            int64_t a{};
+            if ( !to_int(stack.back(), a) || a == INT64_MIN )
+                return failure("arithmetic on a value that is not an integer");
+            stack.back() = -a;
+            break;
+        }
+        case ScriptOp::CONCAT:
+        {
+            ScriptValue const rhs{ pop() };
+            auto const is_text = [](ScriptValue const& v)
+            { return std::holds_alternative<std::string>(v) || std::holds_alternative<int64_t>(v); };
+            if ( !is_text(stack.back()) || !is_text(rhs) )
+                return failure("concatenation of a value that is neither a string nor an integer");
+            std::string joined{ to_string(stack.back()) };
+            std::string const tail{ to_string(rhs) };
+            if ( joined.size() + tail.size() > SCRIPT_MAX_STRING )
+                return failure("string too long");
+            joined += tail;
+            stack.back() = std::move(joined);
+            break;
+        }
+        case ScriptOp::EQ:
+        case ScriptOp::NE:
+        {
+            ScriptValue const rhs{ pop() };
+            bool const equal = stack.back() == rhs;
+            stack.back() = op == ScriptOp::EQ ? equal : !equal;
+            break;
+        }
+        case ScriptOp::LT:
+        case ScriptOp::LE:
+        case ScriptOp::GT:
+        case ScriptOp::GE:
+        {
+            ScriptValue const rhs{ pop() };
+            ScriptValue& lhs = stack.back();
+            if ( lhs.index() != rhs.index() ||
+                 !(std::holds_alternative<int64_t>(rhs) || std::holds_alternative<std::string>(rhs)) )
+                return failure("comparison of two values that are not both integers or both strings");
+            auto const order = lhs <=> rhs;
+            lhs = op == ScriptOp::LT ? order < 0 : op == ScriptOp::LE ? order <= 0 : op == ScriptOp::GT ? order > 0
+                                                                                                       : order >= 0;
+            break;
+        }
+        case ScriptOp::NOT:
+            stack.back() = !is_truthy(stack.back());
+            break;
+        case ScriptOp::LEN:
+        {
+            auto const* s = std::get_if<std::string>(&stack.back());
+            if ( !s )
+                return failure("length of a value that is not a string");
+            stack.back() = static_cast<int64_t>(s->size());
+            break;
+        }
+        case ScriptOp::JUMP:
+            pc = arg;
+            break;
+        case ScriptOp::JUMP_IF_FALSE:
+            if ( !is_truthy(pop()) )
+                pc = arg;
+            break;
+        case ScriptOp::JUMP_IF_FALSE_KEEP:
+        case ScriptOp::JUMP_IF_TRUE_KEEP:
+            if ( is_truthy(stack.back()) == (op == ScriptOp::JUMP_IF_TRUE_KEEP) )
+                pc = arg;
+            else
+                stack.pop_back();
+            break;
+        case ScriptOp::CALL:
+        {
+            cmd.clear();
+            for ( size_t i = stack.size() - arg; i < stack.size(); i++ )
+            {
+                if ( !std::holds_alternative<std::string>(stack[i]) && !std::holds_alternative<int64_t>(stack[i]) )
+                    return failure("call() takes strings and integers");
+                cmd.push_back(to_string(stack[i]));
+            }
+            stack.resize(stack.size() - arg);
+
+            ScriptValue reply{};
+            std::string err;
+            if ( !call(std::as_const(cmd), reply, err) )
+                return ScriptResult{ false, {}, std::move(err) };
+            stack.push_back(std::move(reply));
+            if ( timed_out() )
+                return failure("script exceeded its time limit");
+            break;
+        }
+        case ScriptOp::TONUMBER:
+        {
+            int64_t i{};
+            stack.back() = to_int(stack.back(), i) ? ScriptValue{ i } : ScriptValue{};
+            break;
+        }
+        case ScriptOp::TOSTRING:
+            stack.back() = to_string(stack.back());
+            break;
+        case ScriptOp::RETURN:
+            return ScriptResult{ true, pop(), {} };
+        }
+    }
+}
+
+// SHA-1 of `data` in lowercase hex, the name `evalsha` knows a script by
+inline std::string sha1_hex(std::string_view data)
+{
+    std::array<uint32_t, 5> h{ 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+    // The message, a 1 bit, zeros up to 56 mod 64 bytes and the length in bits as a big-endian u64
+    std::string msg(data);
+    msg.push_back('\x80');
+    msg.resize((msg.size() + 8 + 63) / 64 * 64 - 8, '\0');
+    uint64_t const bits = static_cast<uint64_t>(data.size()) * 8;
+    for ( int shift = 56; shift >= 0; shift -= 8 )
+        msg.push_back(static_cast<char>(bits >> shift));
+
+    for ( size_t chunk = 0; chunk < msg.size(); chunk += 64 )
+    {
+        std::array<uint32_t, 80> w;
+        for ( size_t i = 0; i < 16; i++ )
+        {
+            auto const* p = reinterpret_cast<uint8_t const*>(msg.data() + chunk + i * 4);
+            w[i] = uint32_t{ p[0] } << 24 | uint32_t{ p[1] } << 16 | uint32_t{ p[2] } << 8 | p[3];
+        }
+        for ( size_t i = 16; i < 80; i++ )
+            w[i] = std::rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        auto [a, b, c, d, e] = h;
+        for ( size_t i = 0; i < 80; i++ )
+        {
+            static constexpr std::array<uint32_t, 4> k{ 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+            uint32_t f{};
+            if ( i < 20 )
+                f = (b & c) | (~b & d);
+            else if ( i >= 40 && i < 60 )
+                f = (b & c) | (b & d) | (c & d);
+            else
+                f = b ^ c ^ d;
+            uint32_t const t = std::rotl(a, 5) + f + e + k[i / 20] + w[i];
+            e = d;
+            d = c;
+            c = std::rotl(b, 30);
+            b = a;
+            a = t;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    static constexpr char digits[]{ "0123456789abcdef" };
+    std::string hex;
+    for ( uint32_t const word : h )
+    {
+        for ( int shift = 28; shift >= 0; shift -= 4 )
+            hex.push_back(digits[(word >> shift) & 0xF]);
+    }
+    return hex;
+}
+
+#endif
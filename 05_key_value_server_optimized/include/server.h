@@ -1,27 +1,59 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include "cluster.h"
+#include "config.h"
 #include "epollwrapper.h"
+#include "keyspace.h"
+#include "pubsub.h"
+#include "replication.h"
+#include "script.h"
+#include "shmring.h"
 #include "socketwrapper.h"
 #include "spdlog/spdlog.h"
+#include "tracking.h"
+#include "transaction.h"
 
 #include <arpa/inet.h> // ntohs(), ntohl()
+#include <charconv>
+#include <chrono>
+#include <csignal> // SIGTERM, SIGINT
 #include <cstdint>
 #include <cstring>
+#include <deque>
 #include <fcntl.h> // F_GETFL, F_SETFL, O_NONBLOCK
+#include <fstream>
 #include <iostream>
 #include <map>
+#include <set>
 #include <memory>
+#include <netdb.h>      // getaddrinfo()
 #include <netinet/ip.h> // sockaddr_in
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <sstream>
 #include <stdexcept>
-#include <sys/socket.h> // socket(), setsockopt(), bind(), listen(), accept()
-#include <unistd.h>     // close(), read(), write()
+#include <string>
+#include <sys/mman.h>     // memfd_create(), mmap()
+#include <sys/signalfd.h> // signalfd()
+#include <sys/socket.h>  // socket(), setsockopt(), bind(), listen(), accept()
+#include <sys/stat.h>     // fstat()
+#include <sys/timerfd.h> // timerfd_create(), timerfd_settime()
+#include <sys/uio.h>     // iovec
+#include <sys/un.h>      // sockaddr_un
+#include <type_traits>
+#include <unistd.h>     // close(), read(), write(), unlink()
+#include <unordered_map>
+#include <unordered_set>
 
 enum class ResponseStatus : uint8_t
 {
     RES_OK = 0,
     RES_ERR, // Err
-    RES_NX,  // Key not found
+    RES_NX,    // Key not found
+    RES_MOVED, // Cluster mode, the key's slot lives on another node: "<slot> <host:port>"
+    RES_ASK,   // Cluster mode, the key was already migrated: retry once on "<slot> <host:port>" after `asking`
+    RES_PUSH,  // Not a reply, sent unasked to a tracking client: `[invalidate, key]`, see tracking.h
+    RES_COMPRESSED, // `get` of a compressed value, for clients that negotiated it: raw size u32 | LZ4 block
 };
 
 struct Response
@@ -30,62 +62,279 @@ struct Response
     std::vector<uint8_t> data{};
 };
 
+// Shared-memory rings attached by a client over the unix socket, see shmring.h
+struct ShmChannel
+{
+    ShmSegment segment{};
+    int server_efd{ -1 }; // Signalled by the client, monitored by epoll
+    int client_efd{ -1 }; // Signalled by us when the client sleeps
+    int owner_fd{ -1 };   // Unix socket the channel was attached over, closing it detaches the channel
+};
+
+// A connection parked by `blpop`/`brpop` until one of its keys gets an element or its deadline passes
+struct BlockedClient
+{
+    std::vector<std::string> keys{};
+    bool front{ true }; // blpop pops the head, brpop the tail
+    std::chrono::steady_clock::time_point deadline{}; // Epoch for no timeout
+};
+
 template <class ISocketWrapperBase, class IEpollWrapperBase>
 class Server final
 {
 private:
-    static constexpr uint8_t DEFAULT_MAX_CLIENTS{ 100 };
     static constexpr uint8_t LEN_FIELD_SIZE{ 4 };
-    static constexpr size_t MAX_MSG_FIELD_SIZE{ 32 << 20 };
-    static constexpr size_t READ_BUFFER_SIZE{ 64 * 1024 };
-    static constexpr size_t MAX_CMD_ARGS = 200 * 1000;
+    static constexpr size_t SHM_MAX_ROUNDS_PER_EVENT{ 16 };
+    static constexpr size_t MAX_IOVECS_PER_WRITE{ 64 };
+    static constexpr size_t SCAN_DEFAULT_COUNT{ 10 };
+    static constexpr size_t SCAN_MAX_COUNT{ 10000 }; // Keys examined per call, whatever `count` asks for
+    static constexpr std::string_view SCAN_CURSOR_PREFIX{ ">" };
+    static constexpr size_t RANGE_DEFAULT_LIMIT{ 100 };
+    static constexpr size_t TAKEOVER_MAX_FDS{ 3 }; // TCP listener, unix listener, snapshot
+    // The old process answers `takeover` once drained, we wait for our own shutdown-timeout plus this
+    static constexpr std::chrono::seconds TAKEOVER_REPLY_MARGIN{ 10 };
 
 public:
     Server(uint16_t port, ISocketWrapperBase& socket_wrapper, IEpollWrapperBase& epoll_wrapper,
            uint8_t max_clients = DEFAULT_MAX_CLIENTS)
-        : server_fd_(-1), port_(port), sockwrapper_(socket_wrapper), epoll_(epoll_wrapper), max_clients_(max_clients)
+        : server_fd_(-1), sockwrapper_(socket_wrapper), epoll_(epoll_wrapper)
     {
+        config_.port = port;
+        config_.max_clients = max_clients;
     }
 
-    ~Server() = default;
+    ~Server()
+    {
+        if ( unix_fd_ != -1 )
+        {
+            sockwrapper_.close(unix_fd_);
+            ::unlink(config_.unix_socket.c_str());
+        }
+        if ( repl_timer_fd_ != -1 )
+            close(repl_timer_fd_);
+        if ( block_timer_fd_ != -1 )
+            close(block_timer_fd_);
+        if ( signal_fd_ != -1 )
+        {
+            epoll_.remove_conn(signal_fd_);
+            close(signal_fd_);
+        }
+        if ( shutdown_timer_fd_ != -1 )
+        {
+            epoll_.remove_conn(shutdown_timer_fd_);
+            close(shutdown_timer_fd_);
+        }
+    }
     Server(Server const& other) = delete;
     Server(Server&& other) = delete;
     Server& operator=(Server const& other) = delete;
     Server& operator=(Server&& other) = delete;
 
+    // Applies every parameter of `config` apart from the port and max-clients given to the constructor, see config.h
+    void configure(ServerConfig const& config);
+
     void start();
+    // Leaves start() after the current events, connections are dropped as they are
     void stop() noexcept;
 
+    /**
+     * Graceful shutdown: stop accepting and reading requests, give clients up to shutdown-timeout to read the replies
+     * already queued for them, save the keyspace to snapshot-file if one is configured, then leave start().
+     * Connections arriving meanwhile wait in the listen backlog.
+     *
+     * Hot restart: a new process started with `--takeover yes` connects to our unix socket and sends `takeover`. The
+     * same drain runs, then the listening sockets and a memfd holding a keyspace snapshot are passed to it over
+     * SCM_RIGHTS instead, and it starts serving where we stopped. No connection is refused during the switch.
+     */
+    void shutdown();
+
+    // Block SIGTERM and SIGINT and shut down gracefully when one arrives, a second one cuts the drain short. Call
+    // before start() and before any other thread is created, threads inherit the signal mask.
+    void shutdown_on_signals();
+
+    // Request pipeline, public so it can be driven without sockets (see benchmarks/microbench.cpp)
+    bool try_request(Connection& conn) noexcept;
+    bool parse_req(uint8_t const* data, size_t size, std::vector<std::string>& parsed_cmds);
+    void do_request(std::vector<std::string> const& cmd, Response& resp);
+    void make_response(Response& resp, std::vector<uint8_t>& out);
+
 private:
     int server_fd_;
-    uint16_t const port_;
-    uint8_t const max_clients_;
+    int unix_fd_{ -1 };
+    ServerConfig config_{}; // Read by `config get`, written by configure() and `config set`
 
     bool running_{ true };
 
     ISocketWrapperBase& sockwrapper_;
     IEpollWrapperBase& epoll_;
 
-    std::map<std::string, std::string> g_data;
+    Keyspace g_data;
+
+    std::unordered_set<int> client_fds_{}; // Accepted connections, drained on shutdown
+
+    std::unordered_map<int, ShmChannel> shm_channels_; // server_efd -> channel
+    std::unordered_map<int, int> shm_owners_;          // owner_fd -> server_efd
+
+    // Primary side, the backlog is created when the first replica attaches
+    std::string const replid_{ make_repl_id() };
+    std::unique_ptr<ReplicationBacklog> backlog_{};
+    std::unordered_map<int, ReplicaInfo> replicas_; // fd -> replica
+    ReplicationWriteTimes repl_write_times_{};
+
+    // Replica side
+    MasterLink master_{};
+    int repl_timer_fd_{ -1 };
+
+    ClusterState cluster_{};
+    std::unique_ptr<SlotMigration> migration_{};
+
+    // Blocking pops, waiters of a key are served in the order they blocked
+    std::unordered_map<std::string, std::deque<int>> blocked_keys_; // key -> fds
+    std::unordered_map<int, BlockedClient> blocked_clients_;         // fd -> client
+    std::set<std::pair<std::chrono::steady_clock::time_point, int>> block_deadlines_{};
+    std::vector<std::string> ready_keys_{}; // Pushed to while someone is blocked on them
+    bool serving_blocked_{ false };
+    int block_timer_fd_{ -1 };
+
+    PubSub pubsub_{};
+    std::unordered_map<int, std::chrono::steady_clock::time_point> pubsub_over_soft_limit_{}; // fd -> since
+
+    TrackingTable tracking_{};
+    std::unordered_map<int, uint32_t> tracking_clients_{}; // fd -> generation
+    uint32_t tracking_generation_{ 0 };
+
+    std::unordered_map<int, Transaction> transactions_{}; // fd -> transaction, see transaction.h
+    WatchedKeys watched_keys_{};
+
+    std::unordered_map<std::string, std::unique_ptr<Script const>> scripts_{}; // SHA-1 of the source -> script
+
+    CompressionStats compression_stats_{};
+
+    int signal_fd_{ -1 };
+    int shutdown_timer_fd_{ -1 };
+    bool draining_{ false };
+    int takeover_fd_{ -1 }; // Connection of the process taking over, gets the listeners once clients are drained
 
     void create_server_socket();
     void set_socket_options() const noexcept;
     void bind_socket() const;
+    void setup_unix_socket();
     bool set_nonblocking(int const fd) const noexcept;
     void setup_server();
+    bool is_listener(int const fd) const noexcept;
 
-    void handle_new_connections() noexcept;
-    void handle_read_event(Connection& conn);
+    void handle_new_connections(int const listen_fd) noexcept;
+    bool handle_read_event(Connection& conn);
+    void after_request(Connection const& conn, std::vector<std::string> const& cmd, Response const& resp);
 
-    bool try_request(Connection& conn) noexcept;
-    bool parse_req(uint8_t const* data, size_t size, std::vector<std::string>& parsed_cmds);
     bool read_cmd_length(uint8_t const*& data, uint8_t const* const end, uint32_t& out);
     bool read_cmd_data(uint8_t const*& data, uint8_t const* const end, size_t bytes_to_read, std::string& out);
-    void do_request(std::vector<std::string> const& cmd, Response& resp);
-    void make_response(Response& resp, std::vector<uint8_t>& out);
+    // Integer argument of a request, false unless all of `str` is a number that fits `T`
+    template <class T>
+    [[nodiscard]] static bool parse_int(std::string_view str, T& out) noexcept;
 
-    void handle_write_event(Connection& conn);
+    bool handle_write_event(Connection& conn);
+    ssize_t send_output(Connection& conn);
     void handle_close_event(Connection& conn);
+
+    bool attach_shm_channel(Connection& conn);
+    void handle_shm_event(ShmChannel& channel, Connection& conn);
+    void close_shm_channel(int const server_efd);
+
+    [[nodiscard]] bool is_replica() const noexcept;
+    [[nodiscard]] static bool is_write_command(std::vector<std::string> const& cmd) noexcept;
+    void propagate(uint8_t const* frame, size_t len);
+    void propagate_request(std::vector<std::string_view> const& args);
+    void handle_psync(Connection& conn, std::vector<std::string> const& cmd);
+    void handle_replconf(Connection& conn, std::vector<std::string> const& cmd);
+    void append_snapshot(std::vector<uint8_t>& out) const;
+    void setup_replica();
+    int connect_to_peer(std::string const& host, uint16_t const port);
+    void connect_to_master();
+    void handle_repl_timer();
+    bool apply_replication_stream(Connection& conn);
+    bool handle_psync_reply(Connection& conn);
+    static bool has_exec_frame(std::vector<uint8_t> const& stream, size_t pos);
+    [[nodiscard]] std::string replication_info() const;
+
+    template <class Fn>
+    static void for_each_key(std::vector<std::string> const& cmd, Fn&& fn);
+    bool route_to_slot(std::vector<std::string> const& cmd, Response& resp, bool const asking) const;
+    void do_cluster_command(std::vector<std::string> const& cmd, Response& resp);
+    bool start_migration(std::vector<std::string> const& cmd, std::string& err);
+    void migration_step();
+    void send_to_migration_target(std::vector<std::string_view> const& args);
+    bool handle_migration_reply(Connection& conn);
+    void end_migration();
+    [[nodiscard]] std::string migration_info() const;
+
+    template <class T>
+    T* find_value(std::string const& key, Response& resp);
+    void do_zset_command(std::vector<std::string> const& cmd, Response& resp);
+    void do_hash_command(std::vector<std::string> const& cmd, Response& resp);
+    void do_list_command(std::vector<std::string> const& cmd, Response& resp);
+    void do_counter_command(std::vector<std::string> const& cmd, Response& resp);
+    void do_bloom_command(std::vector<std::string> const& cmd, Response& resp);
+    void do_hll_command(std::vector<std::string> const& cmd, Response& resp);
+
+    [[nodiscard]] static bool is_blocking_pop(std::vector<std::string> const& cmd) noexcept;
+    bool blocking_pop(Connection& conn, std::vector<std::string> const& cmd, Response& resp);
+    void pop_to_waiter(std::string const& key, bool front, Response& resp);
+    void signal_list_ready(std::string const& key);
+    void serve_blocked_clients();
+    void unblock_client(int const fd);
+    void resume_client(Connection& conn);
+    void handle_block_timer();
+    void arm_block_timer();
+
+    [[nodiscard]] static bool is_subscription_command(std::vector<std::string> const& cmd) noexcept;
+    void do_subscription_command(Connection& conn, std::vector<std::string> const& cmd, Response& resp);
+    size_t publish(std::string const& channel, std::string const& payload);
+    void push_frame(int const fd, std::shared_ptr<std::vector<uint8_t> const> const& frame,
+                    std::vector<int>& over_limit);
+    void disconnect_slow_client(int const fd);
+
+    void do_scan_command(std::vector<std::string> const& cmd, Response& resp);
+    void do_prefix_command(std::vector<std::string> const& cmd, Response& resp);
+
+    void do_get(std::string const& key, Response& resp, bool const compressed_reply);
+    Value make_stored_string(std::string const& str);
+    std::optional<std::string_view> read_string(Value const& value, StringBuffer& buf);
+    void inflate(CompressedString const& packed, char* out);
+    [[nodiscard]] std::string compression_info() const;
+
+    [[nodiscard]] static bool is_transaction_command(std::vector<std::string> const& cmd) noexcept;
+    [[nodiscard]] bool is_queuing(int const fd) const noexcept;
+    void do_transaction_command(Connection& conn, std::vector<std::string>&& cmd, Response& resp);
+    void exec_transaction(Connection& conn, Response& resp);
+    void end_transaction(int const fd);
+
+    [[nodiscard]] static bool is_script_command(std::vector<std::string> const& cmd) noexcept;
+    void do_script_command(Connection& conn, std::vector<std::string> const& cmd, Response& resp);
+    void eval_script(Connection& conn, Script const& script, std::vector<std::string> const& cmd, size_t num_keys,
+                     Response& resp);
+
+    void do_config_command(std::vector<std::string> const& cmd, Response& resp);
+    void apply_runtime_config();
+
+    void begin_shutdown();
+    void finish_shutdown_if_drained();
+    void cut_clients() noexcept;
+    void handle_signal();
+    void handle_shutdown_timer();
+    bool start_takeover(Connection& conn);
+    void cancel_takeover();
+    bool hand_over();
+    bool take_over();
+    void save_snapshot(std::string const& path) const;
+    void load_snapshot(int const fd, std::string const& source);
+    static bool write_all(int const fd, uint8_t const* data, size_t size) noexcept;
+
+    void do_client_command(Connection& conn, std::vector<std::string> const& cmd, Response& resp);
+    void track_reads(int const fd, std::vector<std::string> const& cmd);
+    void invalidate_keys(std::vector<std::string> const& cmd);
+    void invalidate_key(std::string const& key);
+    void send_invalidation(std::vector<TrackedReader> const& readers, std::string const* key);
 };
 
 #include "server.tpp"
@@ -20,12 +20,42 @@ void Server<ISocketWrapperBase, IEpollWrapperBase>::bind_socket() const
     struct sockaddr_in addr{};
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = ntohl(0);
-    addr.sin_port = ntohs(port_);
+    addr.sin_port = ntohs(config_.port);
 
     if ( sockwrapper_.bind(server_fd_, (const sockaddr*)&addr, sizeof(addr)) == -1 )
         throw std::runtime_error("Failed to bind a sockaddr to server_fd");
 }
 
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::setup_unix_socket()
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if ( config_.unix_socket.size() >= sizeof(addr.sun_path) )
+        throw std::runtime_error("Unix socket path is too long: " + config_.unix_socket);
+    std::memcpy(addr.sun_path, config_.unix_socket.c_str(), config_.unix_socket.size() + 1);
+
+    unix_fd_ = sockwrapper_.socket(AF_UNIX, SOCK_STREAM, 0);
+    if ( unix_fd_ == -1 )
+        throw std::runtime_error("Failed to create unix socket");
+
+    // A stale socket file from a previous run would make bind fail with EADDRINUSE
+    ::unlink(config_.unix_socket.c_str());
+
+    if ( sockwrapper_.bind(unix_fd_, (const sockaddr*)&addr, sizeof(addr)) == -1 )
+        throw std::runtime_error("Failed to bind unix socket to " + config_.unix_socket);
+    if ( !set_nonblocking(unix_fd_) )
+        throw std::runtime_error("Failed to set unix socket as nonblocking");
+    if ( sockwrapper_.listen(unix_fd_, config_.max_clients) == -1 )
+        throw std::runtime_error("Failed to listen on unix socket");
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::is_listener(int const fd) const noexcept
+{
+    return fd == server_fd_ || fd == unix_fd_;
+}
+
 template <class ISocketWrapperBase, class IEpollWrapperBase>
 bool Server<ISocketWrapperBase, IEpollWrapperBase>::set_nonblocking(int const fd) const noexcept
 {
@@ -47,19 +77,29 @@ bool Server<ISocketWrapperBase, IEpollWrapperBase>::set_nonblocking(int const fd
 template <class ISocketWrapperBase, class IEpollWrapperBase>
 void Server<ISocketWrapperBase, IEpollWrapperBase>::setup_server()
 {
+    if ( config_.port == 0 && config_.unix_socket.empty() )
+        throw std::runtime_error("Neither a TCP port nor a unix socket path is configured");
+
     try
     {
-        create_server_socket();
-        set_socket_options();
-        bind_socket();
-        if ( !set_nonblocking(server_fd_) )
-            throw std::runtime_error("Failed to set server socket as nonblocking");
-        listen(server_fd_, max_clients_);
+        if ( config_.port != 0 )
+        {
+            create_server_socket();
+            set_socket_options();
+            bind_socket();
+            if ( !set_nonblocking(server_fd_) )
+                throw std::runtime_error("Failed to set server socket as nonblocking");
+            sockwrapper_.listen(server_fd_, config_.max_clients);
+        }
+
+        if ( !config_.unix_socket.empty() )
+            setup_unix_socket();
     }
     catch ( std::runtime_error const& e )
     {
         spdlog::error("Runtime exception while setting up server! {}", e.what());
-        sockwrapper_.close(server_fd_);
+        if ( server_fd_ != -1 )
+            sockwrapper_.close(server_fd_);
         throw;
     }
 }
@@ -67,39 +107,99 @@ void Server<ISocketWrapperBase, IEpollWrapperBase>::setup_server()
 template <class ISocketWrapperBase, class IEpollWrapperBase>
 void Server<ISocketWrapperBase, IEpollWrapperBase>::start()
 {
-    setup_server();
+    // A hot restart inherits the listeners and keyspace of the running server, otherwise both start here
+    if ( !config_.takeover || !take_over() )
+    {
+        setup_server();
+        if ( !config_.snapshot_file.empty() )
+        {
+            int const fd = ::open(config_.snapshot_file.c_str(), O_RDONLY | O_CLOEXEC);
+            if ( fd != -1 )
+                load_snapshot(fd, config_.snapshot_file);
+            else if ( errno != ENOENT )
+                throw std::runtime_error("Cannot open snapshot file " + config_.snapshot_file);
+        }
+    }
+    if ( is_replica() )
+        setup_replica();
 
-    // Add server sock to epoll_
-    epoll_.add_conn(server_fd_);
-    spdlog::info("Created Server, now listening on port: {}", port_);
+    // Add server socks to epoll_
+    if ( server_fd_ != -1 )
+    {
+        epoll_.add_conn(server_fd_);
+        spdlog::info("Created Server, now listening on port: {}", config_.port);
+    }
+    if ( unix_fd_ != -1 )
+    {
+        epoll_.add_conn(unix_fd_);
+        spdlog::info("Created Server, now listening on unix socket: {}", config_.unix_socket);
+    }
+    if ( signal_fd_ != -1 )
+        epoll_.add_conn(signal_fd_);
 
     while ( running_ )
     {
         int num_events = epoll_.wait();
         spdlog::info("Number of ready events: {}", num_events);
 
-        for ( int i = 0; i < num_events; i++ )
+        for ( int i = 0; i < num_events && running_; i++ )
         {
             auto& event = epoll_.get_event(i);
 
-            if ( event.data.fd == server_fd_ )
-                handle_new_connections();
+            if ( is_listener(event.data.fd) )
+            {
+                // Accepts already reported when the shutdown started are left to the backlog
+                if ( !draining_ )
+                    handle_new_connections(event.data.fd);
+            }
+            else if ( event.data.fd == signal_fd_ )
+                handle_signal();
+            else if ( event.data.fd == shutdown_timer_fd_ )
+                handle_shutdown_timer();
+            else if ( event.data.fd == repl_timer_fd_ )
+                handle_repl_timer();
+            else if ( event.data.fd == block_timer_fd_ )
+                handle_block_timer();
+            else if ( migration_ && event.data.fd == migration_->wake_fd )
+            {
+                eventfd_drain(migration_->wake_fd);
+                migration_step();
+            }
             else
             {
                 auto& conn = epoll_.get_connection(event.data.fd);
+                bool open{ true };
 
-                if ( event.events & EPOLLIN )
-                    handle_read_event(conn);
+                if ( auto it = shm_channels_.find(event.data.fd); it != shm_channels_.end() )
+                {
+                    if ( !draining_ )
+                        handle_shm_event(it->second, conn);
+                    continue;
+                }
 
-                if ( event.events & EPOLLOUT )
-                    handle_write_event(conn);
+                // While shutting down clients are only written to, and disconnected once they got all their replies
+                bool const drained_client = draining_ && client_fds_.contains(conn.fd);
 
-                if ( event.events & EPOLLERR || event.events & EPOLLHUP )
+                // `conn` is destroyed once a handler closes it, so stop dispatching to it
+                if ( event.events & EPOLLIN && !drained_client )
+                    open = handle_read_event(conn);
+
+                if ( open && event.events & EPOLLOUT )
+                    open = handle_write_event(conn);
+
+                if ( open && (event.events & EPOLLERR || event.events & EPOLLHUP) )
+                {
+                    handle_close_event(conn);
+                    open = false;
+                }
+
+                if ( open && drained_client && conn.outgoing.empty() && conn.shared.empty() )
                     handle_close_event(conn);
             }
 
             spdlog::info("=========================================================");
         }
+        finish_shutdown_if_drained();
     }
 }
 
@@ -111,11 +211,11 @@ void Server<ISocketWrapperBase, IEpollWrapperBase>::stop() noexcept
 
 /* ============================================== New Conn ============================================== */
 template <class ISocketWrapperBase, class IEpollWrapperBase>
-void Server<ISocketWrapperBase, IEpollWrapperBase>::handle_new_connections() noexcept
+void Server<ISocketWrapperBase, IEpollWrapperBase>::handle_new_connections(int const listen_fd) noexcept
 {
-    sockaddr_in client_addr{};
+    sockaddr_storage client_addr{};
     socklen_t socklen{ sizeof(client_addr) };
-    int client_fd = sockwrapper_.accept(server_fd_, (sockaddr*)&client_addr, &socklen);
+    int client_fd = sockwrapper_.accept(listen_fd, (sockaddr*)&client_addr, &socklen);
 
     if ( client_fd == -1 )
     {
@@ -131,22 +231,31 @@ void Server<ISocketWrapperBase, IEpollWrapperBase>::handle_new_connections() noe
         close(client_fd);
         return;
     }
+
+    // Pushes (pub/sub messages, invalidations) go out unasked between replies, Nagle would hold the reply behind them
+    // until the client's delayed ACK
+    if ( listen_fd == server_fd_ )
+    {
+        int const nodelay{ 1 };
+        ::setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    }
     epoll_.add_conn(client_fd);
+    client_fds_.insert(client_fd);
 }
 
 /* ============================================== READ ============================================== */
 template <class ISocketWrapperBase, class IEpollWrapperBase>
-void Server<ISocketWrapperBase, IEpollWrapperBase>::handle_read_event(Connection& conn)
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::handle_read_event(Connection& conn)
 {
     // 1. Do a non-blocking read
-    std::vector<uint8_t> buf(READ_BUFFER_SIZE);
+    std::vector<uint8_t> buf(config_.read_buffer_size);
     ssize_t bytes_read = read(conn.fd, buf.data(), buf.size());
 
     if ( bytes_read == 0 )
     {
         spdlog::info("[DISCONNECT] Client {} disconnected", conn.fd);
         handle_close_event(conn);
-        return;
+        return false;
     }
 
     if ( bytes_read < 0 )
@@ -155,30 +264,47 @@ void Server<ISocketWrapperBase, IEpollWrapperBase>::handle_read_event(Connection
             spdlog::error("[READ] Client {} -> No data available (non-blocking read). err: {}", conn.fd,
                           std::strerror(errno));
 
-        return;
+        return true;
     }
 
     // 2. Add new data to the `Conn::incoming` buffer
     conn.incoming.insert(conn.incoming.end(), buf.begin(), buf.begin() + bytes_read);
     spdlog::info("[READ] Client: {} -> Reading {} bytes", conn.fd, bytes_read);
 
-    // 3. Parse requests and generate responses
+    // 3. Parse requests and generate responses, the link to our primary carries its replication stream instead
+    if ( conn.fd == master_.fd )
+        return apply_replication_stream(conn);
+    if ( migration_ && conn.fd == migration_->fd )
+        return handle_migration_reply(conn);
+
     while ( try_request(conn) )
     {
     }
 
-    // 4. Remove the message from `Conn::incoming` by calling write
+    if ( conn.want_close )
+    {
+        handle_close_event(conn);
+        return false;
+    }
+
+    // 4. Remove the message from `Conn::incoming` by calling write. Keep reading while the responses drain, a
+    // pipelining client that only reads after it has sent everything would otherwise deadlock against us.
     if ( !conn.outgoing.empty() )
     {
         spdlog::info("[MODIFY] Client {} -> Outgoing buffer has data, enabling EPOLLOUT", conn.fd);
-        epoll_.modify_conn(conn.fd, EPOLLOUT);
+        epoll_.modify_conn(conn.fd, EPOLLIN | EPOLLOUT);
     }
+    return true;
 }
 
 /* ============================================== Handle Request ============================================== */
 template <class ISocketWrapperBase, class IEpollWrapperBase>
 bool Server<ISocketWrapperBase, IEpollWrapperBase>::try_request(Connection& conn) noexcept
 {
+    // A parked client's pipelined requests wait until its blocking pop is answered
+    if ( !blocked_clients_.empty() && blocked_clients_.contains(conn.fd) )
+        return false;
+
     if ( conn.incoming.size() < LEN_FIELD_SIZE )
     {
         spdlog::info("[ERROR] Client {} -> No more bytes to be read", conn.fd);
@@ -190,12 +316,11 @@ bool Server<ISocketWrapperBase, IEpollWrapperBase>::try_request(Connection& conn
 
     spdlog::info("[READ] Client {} -> Request is comprised of {} bytes", conn.fd, data_len);
 
-    if ( data_len > MAX_MSG_FIELD_SIZE )
+    if ( data_len > config_.max_msg_size )
     {
-        spdlog::error("[ERROR] Client {} -> given data_length greater than MAX_MSG_FIELD_SIZE, closing connection",
-                      conn.fd);
+        spdlog::error("[ERROR] Client {} -> given data_length greater than max-msg-size, closing connection", conn.fd);
 
-        handle_close_event(conn); // TODO: NEED TO HANDLE SEGFAULT WHEN FUNCTION RETURNS and we try to access conn.fd
+        conn.want_close = true; // Closed by the caller, `conn` must stay valid until then
         return false;
     }
 
@@ -220,16 +345,159 @@ bool Server<ISocketWrapperBase, IEpollWrapperBase>::try_request(Connection& conn
         return false;
     }
 
+    // Every dispatch below looks at cmd[0]
+    if ( cmd.empty() )
+    {
+        conn.incoming.erase(conn.incoming.begin(), conn.incoming.begin() + LEN_FIELD_SIZE + data_len);
+        std::string_view const err{ "ERR empty command" };
+        Response resp{ ResponseStatus::RES_ERR };
+        resp.data.assign(err.begin(), err.end());
+        make_response(resp, conn.outgoing);
+        return true;
+    }
+
+    // Connection level command, the response carries file descriptors and bypasses `conn.outgoing`
+    if ( cmd.size() == 1 && cmd[0] == "shmattach" )
+    {
+        conn.incoming.erase(conn.incoming.begin(), conn.incoming.begin() + LEN_FIELD_SIZE + data_len);
+        if ( !attach_shm_channel(conn) )
+        {
+            Response resp{ ResponseStatus::RES_ERR };
+            make_response(resp, conn.outgoing);
+        }
+        return true;
+    }
+
+    // Hot restart, answered once our clients are drained, with the listeners attached (see shutdown())
+    if ( cmd.size() == 1 && cmd[0] == "takeover" )
+    {
+        conn.incoming.erase(conn.incoming.begin(), conn.incoming.begin() + LEN_FIELD_SIZE + data_len);
+        if ( !start_takeover(conn) )
+        {
+            Response resp{ ResponseStatus::RES_ERR };
+            make_response(resp, conn.outgoing);
+        }
+        return true;
+    }
+
+    if ( cmd.size() == 3 && cmd[0] == "psync" )
+    {
+        conn.incoming.erase(conn.incoming.begin(), conn.incoming.begin() + LEN_FIELD_SIZE + data_len);
+        handle_psync(conn, cmd);
+        return true;
+    }
+
+    // Acks from a replica are not answered, the replica's side of the link only carries requests
+    if ( cmd.size() == 3 && cmd[0] == "replconf" && replicas_.contains(conn.fd) )
+    {
+        conn.incoming.erase(conn.incoming.begin(), conn.incoming.begin() + LEN_FIELD_SIZE + data_len);
+        handle_replconf(conn, cmd);
+        return true;
+    }
+
+    if ( cmd.size() == 1 && cmd[0] == "asking" )
+    {
+        conn.incoming.erase(conn.incoming.begin(), conn.incoming.begin() + LEN_FIELD_SIZE + data_len);
+        conn.asking = true;
+        Response resp{ ResponseStatus::RES_OK };
+        make_response(resp, conn.outgoing);
+        return true;
+    }
+
+    // Between `multi` and `exec` requests are queued instead of run, see transaction.h
+    if ( is_transaction_command(cmd) || (!transactions_.empty() && is_queuing(conn.fd)) )
+    {
+        conn.incoming.erase(conn.incoming.begin(), conn.incoming.begin() + LEN_FIELD_SIZE + data_len);
+        Response resp{};
+        do_transaction_command(conn, std::move(cmd), resp);
+        conn.asking = false;
+        make_response(resp, conn.outgoing);
+        if ( !ready_keys_.empty() )
+            serve_blocked_clients();
+        return true;
+    }
+
     Response resp{};
-    do_request(cmd, resp);
+    if ( is_replica() && is_write_command(cmd) )
+    {
+        std::string const err{ "READONLY writes must go to the primary" };
+        resp.status = ResponseStatus::RES_ERR;
+        resp.data.assign(err.begin(), err.end());
+    }
+    else if ( route_to_slot(cmd, resp, conn.asking) )
+    {
+        if ( is_subscription_command(cmd) )
+            do_subscription_command(conn, cmd, resp);
+        else if ( cmd[0] == "client" )
+            do_client_command(conn, cmd, resp);
+        else if ( is_script_command(cmd) )
+            do_script_command(conn, cmd, resp);
+        else if ( conn.compressed_replies && cmd.size() == 2 && cmd[0] == "get" )
+            do_get(cmd[1], resp, true);
+        else if ( !is_blocking_pop(cmd) )
+            do_request(cmd, resp);
+        else if ( !blocking_pop(conn, cmd, resp) )
+        {
+            // Parked, the response is written once an element arrives or the timeout fires
+            conn.asking = false;
+            conn.incoming.erase(conn.incoming.begin(), conn.incoming.begin() + LEN_FIELD_SIZE + data_len);
+            return false;
+        }
+    }
+    conn.asking = false;
+    after_request(conn, cmd, resp);
+
+    // Forward the request frame untouched, so replicas apply exactly what we applied. Blocking pops propagate the
+    // plain pop they turned into instead.
+    if ( backlog_ && resp.status == ResponseStatus::RES_OK && is_write_command(cmd) && !is_blocking_pop(cmd) )
+        propagate(conn.incoming.data(), LEN_FIELD_SIZE + data_len);
 
     conn.incoming.erase(conn.incoming.begin(), conn.incoming.begin() + LEN_FIELD_SIZE + data_len);
 
     make_response(resp, conn.outgoing);
 
+    if ( !ready_keys_.empty() )
+        serve_blocked_clients();
+
     return true;
 }
 
+// Bookkeeping after `cmd` ran on behalf of `conn`, anything but forwarding it to replicas
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::after_request(Connection const& conn,
+                                                                  std::vector<std::string> const& cmd,
+                                                                  Response const& resp)
+{
+    bool const applied = resp.status == ResponseStatus::RES_OK && is_write_command(cmd);
+
+    // Keys of an unacknowledged migration batch must be shipped again once they change
+    if ( migration_ && applied )
+    {
+        for_each_key(cmd,
+                     [this](std::string const& key)
+                     {
+                         if ( migration_->in_flight.contains(key) )
+                             migration_->dirty.insert(key);
+                     });
+    }
+
+    // Transactions watching a written key fail their `exec`
+    if ( !watched_keys_.empty() && applied )
+        for_each_key(cmd, [this](std::string const& key) { watched_keys_.touch(key); });
+
+    // Client-side caching: remember what tracking clients read, tell them once it changes
+    if ( resp.status == ResponseStatus::RES_OK || resp.status == ResponseStatus::RES_NX )
+    {
+        if ( is_write_command(cmd) )
+        {
+            if ( !tracking_.empty() && resp.status == ResponseStatus::RES_OK )
+                invalidate_keys(cmd);
+        }
+        else if ( !tracking_clients_.empty() && tracking_clients_.contains(conn.fd) )
+            track_reads(conn.fd, cmd);
+    }
+}
+
 template <class ISocketWrapperBase, class IEpollWrapperBase>
 bool Server<ISocketWrapperBase, IEpollWrapperBase>::read_cmd_data(uint8_t const*& data, uint8_t const* const end,
                                                                   size_t bytes_to_read, std::string& out)
@@ -246,6 +514,14 @@ bool Server<ISocketWrapperBase, IEpollWrapperBase>::read_cmd_data(uint8_t const*
     return true;
 }
 
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+template <class T>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::parse_int(std::string_view str, T& out) noexcept
+{
+    auto const [end, ec] = std::from_chars(str.data(), str.data() + str.size(), out);
+    return ec == std::errc{} && end == str.data() + str.size();
+}
+
 template <class ISocketWrapperBase, class IEpollWrapperBase>
 bool Server<ISocketWrapperBase, IEpollWrapperBase>::read_cmd_length(uint8_t const*& data, uint8_t const* const end,
                                                                     uint32_t& out)
@@ -276,9 +552,9 @@ bool Server<ISocketWrapperBase, IEpollWrapperBase>::parse_req(uint8_t const* dat
         return false;
     }
 
-    if ( nstr > MAX_CMD_ARGS )
+    if ( nstr > config_.max_cmd_args )
     {
-        spdlog::error("[ERROR] Given number of cmds is greater than MAX CMD ARGS");
+        spdlog::error("[ERROR] Given number of cmds is greater than max-cmd-args");
         return false;
     }
 
@@ -308,27 +584,128 @@ void Server<ISocketWrapperBase, IEpollWrapperBase>::do_request(std::vector<std::
 {
 
     if ( cmd.size() == 2 && cmd[0] == "get" )
+        do_get(cmd[1], resp, false);
+    else if ( cmd.size() == 3 && cmd[0] == "set" )
+    {
+        g_data.insert_or_assign(cmd[1], make_stored_string(cmd[2]));
+        std::string const& resp_str{ cmd[1] + " set to " + cmd[2] };
+        resp.data.assign(resp_str.begin(), resp_str.end());
+        resp.status = ResponseStatus::RES_OK;
+    }
+    else if ( cmd.size() == 2 && cmd[0] == "del" )
+    {
+        g_data.erase(cmd[1]);
+        resp.status = ResponseStatus::RES_OK;
+    }
+    else if ( cmd.size() >= 2 && cmd[0] == "unlink" )
+    {
+        // Like `del`, but a large value is freed in the background (see lazyfree.h)
+        size_t removed{ 0 };
+        for ( size_t i = 1; i < cmd.size(); i++ )
+            removed += g_data.unlink(cmd[i]);
+        std::string const count{ std::to_string(removed) };
+        resp.data.assign(count.begin(), count.end());
+        resp.status = ResponseStatus::RES_OK;
+    }
+    else if ( cmd.size() >= 2 && cmd[0] == "mget" )
+    {
+        append_array_header(resp.data, cmd.size() - 1);
+        StringBuffer buf;
+        for ( size_t i = 1; i < cmd.size(); i++ )
+        {
+            auto it = g_data.find(cmd[i]);
+            if ( auto const val = it != g_data.end() ? read_string(it->second, buf) : std::nullopt )
+                append_array_element(resp.data, *val);
+            else
+                append_array_nil(resp.data);
+        }
+        resp.status = ResponseStatus::RES_OK;
+    }
+    else if ( cmd.size() >= 3 && cmd.size() % 2 == 1 && cmd[0] == "mset" )
+    {
+        for ( size_t i = 1; i < cmd.size(); i += 2 )
+            g_data.insert_or_assign(cmd[i], make_stored_string(cmd[i + 1]));
+        resp.status = ResponseStatus::RES_OK;
+    }
+    else if ( (cmd.size() == 2 && (cmd[0] == "incr" || cmd[0] == "decr")) ||
+              (cmd.size() == 3 && (cmd[0] == "incrby" || cmd[0] == "decrby")) )
+        do_counter_command(cmd, resp);
+    else if ( cmd.size() == 3 && cmd[0] == "publish" )
+    {
+        std::string const receivers{ std::to_string(publish(cmd[1], cmd[2])) };
+        resp.data.assign(receivers.begin(), receivers.end());
+        resp.status = ResponseStatus::RES_OK;
+    }
+    else if ( cmd.size() == 2 && cmd[0] == "type" )
     {
         auto it = g_data.find(cmd[1]);
+        std::string_view const type{ it == g_data.end() ? "none" : type_name(it->second) };
+        resp.data.assign(type.begin(), type.end());
+        resp.status = ResponseStatus::RES_OK;
+    }
+    else if ( cmd.size() == 3 && cmd[0] == "restore" )
+    {
+        Value value;
+        resp.status = decode_value(cmd[2], value) ? ResponseStatus::RES_OK : ResponseStatus::RES_ERR;
+        if ( resp.status == ResponseStatus::RES_OK )
+        {
+            bool const is_list = value_as<List>(value);
+            g_data.insert_or_assign(cmd[1], std::move(value));
+            if ( is_list )
+                signal_list_ready(cmd[1]);
+        }
+    }
+    else if ( cmd.size() == 3 && ((cmd[0] == "object" && cmd[1] == "encoding") ||
+                                  (cmd[0] == "memory" && cmd[1] == "usage")) )
+    {
+        auto it = g_data.find(cmd[2]);
         if ( it == g_data.end() )
         {
             resp.status = ResponseStatus::RES_NX;
             return;
         }
-        std::string const& val{ it->second };
-        resp.data.assign(val.begin(), val.end());
+        std::string const info{ cmd[0] == "object" ? std::string(value_encoding(it->second))
+                                                   : std::to_string(value_memory_usage(it->second)) };
+        resp.data.assign(info.begin(), info.end());
         resp.status = ResponseStatus::RES_OK;
     }
-    else if ( cmd.size() == 3 && cmd[0] == "set" )
+    else if ( cmd.size() >= 2 && cmd[0].starts_with("bf.") )
+        do_bloom_command(cmd, resp);
+    else if ( cmd.size() >= 2 && (cmd[0] == "pfadd" || cmd[0] == "pfcount" || cmd[0] == "pfmerge") )
+        do_hll_command(cmd, resp);
+    // All sorted set commands start with z, all hash commands with h, list commands with l apart from rpush/rpop
+    else if ( cmd.size() >= 2 && cmd[0].starts_with('z') )
+        do_zset_command(cmd, resp);
+    else if ( cmd.size() >= 2 && cmd[0].starts_with('h') )
+        do_hash_command(cmd, resp);
+    else if ( cmd.size() >= 2 && (cmd[0].starts_with('l') || cmd[0] == "rpush" || cmd[0] == "rpop") )
+        do_list_command(cmd, resp);
+    else if ( cmd.size() >= 2 && cmd[0] == "cluster" )
+        do_cluster_command(cmd, resp);
+    else if ( cmd.size() >= 2 && cmd[0] == "config" )
+        do_config_command(cmd, resp);
+    else if ( cmd.size() >= 2 && cmd[0] == "scan" )
+        do_scan_command(cmd, resp);
+    else if ( (cmd.size() >= 2 && cmd[0] == "prefix") || (cmd.size() >= 3 && cmd[0] == "range") )
+        do_prefix_command(cmd, resp);
+    else if ( cmd.size() == 2 && cmd[0] == "info" && cmd[1] == "replication" )
     {
-        g_data[cmd[1]] = cmd[2];
-        std::string const& resp_str{ cmd[1] + " set to " + cmd[2] };
-        resp.data.assign(resp_str.begin(), resp_str.end());
+        std::string const info{ replication_info() };
+        resp.data.assign(info.begin(), info.end());
         resp.status = ResponseStatus::RES_OK;
     }
-    else if ( cmd.size() == 2 && cmd[0] == "del" )
+    else if ( cmd.size() == 2 && cmd[0] == "info" && cmd[1] == "compression" )
     {
-        g_data.erase(cmd[1]);
+        std::string const info{ compression_info() };
+        resp.data.assign(info.begin(), info.end());
+        resp.status = ResponseStatus::RES_OK;
+    }
+    else if ( cmd.size() == 2 && cmd[0] == "info" && cmd[1] == "lazyfree" )
+    {
+        std::string const info{ "lazyfree_pending_objects:" + std::to_string(g_data.lazy_free_pending()) +
+                                "\nlazyfreed_objects:" + std::to_string(g_data.lazy_freed()) +
+                                "\nlazyfree_inline_objects:" + std::to_string(g_data.lazy_free_inline()) + "\n" };
+        resp.data.assign(info.begin(), info.end());
         resp.status = ResponseStatus::RES_OK;
     }
     else
@@ -360,30 +737,29 @@ void Server<ISocketWrapperBase, IEpollWrapperBase>::make_response(Response& resp
 
 /* ============================================== Write ============================================== */
 template <class ISocketWrapperBase, class IEpollWrapperBase>
-void Server<ISocketWrapperBase, IEpollWrapperBase>::handle_write_event(Connection& conn)
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::handle_write_event(Connection& conn)
 {
-    if ( conn.outgoing.empty() )
+    if ( conn.outgoing.empty() && conn.shared.empty() )
     {
         spdlog::info("[WRITE] Client {} -> No data to send, switching to EPOLLIN", conn.fd);
         epoll_.modify_conn(conn.fd, EPOLLIN);
-        return;
+        return true;
     }
 
-    ssize_t bytes_written = write(conn.fd, conn.outgoing.data(), conn.outgoing.size());
+    ssize_t bytes_written = send_output(conn);
 
     if ( bytes_written < 0 )
     {
         spdlog::error("[ERROR] Write error to client {} -> err: {}", conn.fd, std::strerror(errno));
         if ( errno == EAGAIN || errno == EWOULDBLOCK )
-            return;
+            return true;
         handle_close_event(conn);
-        return;
+        return false;
     }
 
     spdlog::info("[WRITE] Client {} -> Wrote {} bytes", conn.fd, bytes_written);
-    conn.outgoing.erase(conn.outgoing.begin(), conn.outgoing.begin() + bytes_written);
 
-    if ( conn.outgoing.empty() )
+    if ( conn.outgoing.empty() && conn.shared.empty() )
     {
         spdlog::info("[MODIFY] Client {} -> No more data to read, switching to EPOLLIN", conn.fd);
         epoll_.modify_conn(conn.fd, EPOLLIN);
@@ -392,6 +768,83 @@ void Server<ISocketWrapperBase, IEpollWrapperBase>::handle_write_event(Connectio
     {
         spdlog::info("[MODIFY] Client {} -> Still have data to send, keeping EPOLLOUT", conn.fd);
     }
+    return true;
+}
+
+// Sends `outgoing` and the shared frames queued between its bytes with one sendmsg, and drops whatever was sent
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+ssize_t Server<ISocketWrapperBase, IEpollWrapperBase>::send_output(Connection& conn)
+{
+    if ( conn.shared.empty() )
+    {
+        ssize_t const sent = ::send(conn.fd, conn.outgoing.data(), conn.outgoing.size(), MSG_NOSIGNAL);
+        if ( sent > 0 )
+        {
+            conn.outgoing.erase(conn.outgoing.begin(), conn.outgoing.begin() + sent);
+            conn.outgoing_sent += sent;
+        }
+        return sent;
+    }
+
+    std::array<iovec, MAX_IOVECS_PER_WRITE> iov;
+    size_t num_iov{ 0 };
+    size_t out_pos{ 0 }; // Bytes of `outgoing` covered so far
+    bool all_shared{ true };
+    for ( auto const& frame : conn.shared )
+    {
+        if ( num_iov + 2 > iov.size() )
+        {
+            all_shared = false;
+            break;
+        }
+        if ( size_t const at = frame.at - conn.outgoing_sent; at > out_pos )
+        {
+            iov[num_iov++] = { conn.outgoing.data() + out_pos, at - out_pos };
+            out_pos = at;
+        }
+        size_t const skip = num_iov == 0 ? conn.shared_offset : 0;
+        iov[num_iov++] = { const_cast<uint8_t*>(frame.data->data()) + skip, frame.data->size() - skip };
+    }
+    if ( all_shared && out_pos < conn.outgoing.size() )
+        iov[num_iov++] = { conn.outgoing.data() + out_pos, conn.outgoing.size() - out_pos };
+
+    msghdr msg{};
+    msg.msg_iov = iov.data();
+    msg.msg_iovlen = num_iov;
+    ssize_t const sent = ::sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+    if ( sent <= 0 )
+        return sent;
+
+    // Consume in the same order: `outgoing` bytes up to the next shared frame, then the frame itself
+    size_t left = sent;
+    size_t out_sent{ 0 };
+    while ( left > 0 )
+    {
+        size_t const before_next = conn.shared.empty()
+                                       ? conn.outgoing.size() - out_sent
+                                       : conn.shared.front().at - conn.outgoing_sent - out_sent;
+        if ( before_next > 0 )
+        {
+            size_t const n = std::min(before_next, left);
+            out_sent += n;
+            left -= n;
+            continue;
+        }
+
+        auto const& front = conn.shared.front();
+        size_t const n = std::min(front.data->size() - conn.shared_offset, left);
+        conn.shared_offset += n;
+        left -= n;
+        if ( conn.shared_offset == front.data->size() )
+        {
+            conn.shared_bytes -= front.data->size();
+            conn.shared_offset = 0;
+            conn.shared.pop_front();
+        }
+    }
+    conn.outgoing.erase(conn.outgoing.begin(), conn.outgoing.begin() + out_sent);
+    conn.outgoing_sent += out_sent;
+    return sent;
 }
 
 /* ============================================== Close ============================================== */
@@ -400,6 +853,42 @@ void Server<ISocketWrapperBase, IEpollWrapperBase>::handle_close_event(Connectio
 {
     int fd = conn.fd;
 
+    if ( auto it = shm_owners_.find(fd); it != shm_owners_.end() )
+        close_shm_channel(it->second);
+    unblock_client(fd);
+    pubsub_.remove(fd);
+    pubsub_over_soft_limit_.erase(fd);
+    tracking_clients_.erase(fd);
+    end_transaction(fd);
+    client_fds_.erase(fd);
+    if ( fd == takeover_fd_ )
+        cancel_takeover();
+
+    if ( fd == master_.fd )
+    {
+        spdlog::warn("[REPL] Lost the link to primary {}:{} at offset {}", master_.host, master_.port, master_.offset);
+        master_.fd = -1;
+        master_.state = ReplLinkState::DISCONNECTED;
+
+        // A partial snapshot cannot be continued from, the next sync has to start over
+        if ( master_.snapshot_remaining > 0 )
+        {
+            master_.replid = "?";
+            master_.offset = 0;
+            master_.snapshot_remaining = 0;
+        }
+    }
+    replicas_.erase(fd);
+
+    if ( migration_ && fd == migration_->fd )
+    {
+        // Unacknowledged keys are still here, the target keeps importing until the migration is restarted
+        spdlog::error("[MIGRATE] Lost the connection to {}, slot {} stays with us", migration_->target,
+                      migration_->slot);
+        migration_->fd = -1;
+        end_migration();
+    }
+
     spdlog::info("[CLOSE] Removing client {} from epoll", fd);
     epoll_.remove_conn(fd);
 
@@ -408,3 +897,3174 @@ void Server<ISocketWrapperBase, IEpollWrapperBase>::handle_close_event(Connectio
     else
         spdlog::info("[CLOSE] Successfully closed client {}", fd);
 }
+
+/* ============================================== Shared Memory ============================================== */
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::attach_shm_channel(Connection& conn)
+{
+    // Descriptors can only be passed over a unix socket, and the reply must not overtake queued responses
+    sockaddr_storage addr{};
+    socklen_t addrlen{ sizeof(addr) };
+    if ( getsockname(conn.fd, (sockaddr*)&addr, &addrlen) == -1 || addr.ss_family != AF_UNIX )
+    {
+        spdlog::error("[SHM] Client {} -> shmattach requires a unix socket connection", conn.fd);
+        return false;
+    }
+    if ( !conn.outgoing.empty() || shm_owners_.contains(conn.fd) )
+    {
+        spdlog::error("[SHM] Client {} -> shmattach with pending responses or an attached channel", conn.fd);
+        return false;
+    }
+
+    ShmChannel channel{};
+    int memfd{ -1 };
+    try
+    {
+        memfd = ShmSegment::create(channel.segment);
+    }
+    catch ( std::exception const& e )
+    {
+        spdlog::error("[SHM] Client {} -> Failed to create segment: {}", conn.fd, e.what());
+        return false;
+    }
+
+    channel.server_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    channel.client_efd = eventfd(0, EFD_CLOEXEC);
+    channel.owner_fd = conn.fd;
+
+    if ( channel.server_efd == -1 || channel.client_efd == -1 )
+    {
+        spdlog::error("[SHM] Client {} -> Failed to create eventfds. err: {}", conn.fd, std::strerror(errno));
+        close(memfd);
+        close(channel.server_efd);
+        close(channel.client_efd);
+        return false;
+    }
+
+    // Reply is a regular OK response with [memfd, client_efd, server_efd] attached
+    std::vector<uint8_t> reply;
+    Response resp{ ResponseStatus::RES_OK };
+    make_response(resp, reply);
+
+    iovec iov{ reply.data(), reply.size() };
+    int const fds[3]{ memfd, channel.client_efd, channel.server_efd };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))]{};
+
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    bool const sent = sendmsg(conn.fd, &msg, MSG_NOSIGNAL) == static_cast<ssize_t>(reply.size());
+    close(memfd);
+    if ( !sent )
+    {
+        spdlog::error("[SHM] Client {} -> Failed to send descriptors. err: {}", conn.fd, std::strerror(errno));
+        close(channel.server_efd);
+        close(channel.client_efd);
+        return false;
+    }
+
+    int const server_efd = channel.server_efd;
+    shm_owners_[conn.fd] = server_efd;
+    shm_channels_.emplace(server_efd, std::move(channel));
+    epoll_.add_conn(server_efd);
+
+    spdlog::info("[SHM] Client {} -> Attached shared-memory channel {}", conn.fd, server_efd);
+    return true;
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::handle_shm_event(ShmChannel& channel, Connection& conn)
+{
+    eventfd_drain(channel.server_efd);
+
+    auto& requests = channel.segment.requests();
+    auto& responses = channel.segment.responses();
+
+    for ( size_t round = 0; round < SHM_MAX_ROUNDS_PER_EVENT; round++ )
+    {
+        requests.unpark_reader();
+        responses.unpark_writer();
+
+        // 1. Pull everything the client has queued, exactly like a socket read into `conn.incoming`
+        size_t const n = requests.readable();
+        if ( n == SHM_RING_CORRUPT || responses.writable() == SHM_RING_CORRUPT )
+        {
+            spdlog::error("[SHM] Client {} -> Corrupt ring positions, disconnecting", channel.owner_fd);
+            ::shutdown(channel.owner_fd, SHUT_RDWR);
+            return;
+        }
+        if ( n > 0 )
+        {
+            // The client may move its head meanwhile, only what was actually copied counts
+            size_t const old_size = conn.incoming.size();
+            conn.incoming.resize(old_size + n);
+            conn.incoming.resize(old_size + requests.read(conn.incoming.data() + old_size, n));
+            if ( requests.take_parked_writer() )
+                eventfd_notify(channel.client_efd);
+        }
+
+        // 2. Parse requests and generate responses
+        while ( try_request(conn) )
+        {
+        }
+
+        if ( conn.want_close )
+        {
+            // Tear down through the owner socket so both sides go through the regular close path
+            ::shutdown(channel.owner_fd, SHUT_RDWR);
+            return;
+        }
+
+        // 3. Push as much of `conn.outgoing` as fits into the response ring
+        if ( !conn.outgoing.empty() )
+        {
+            size_t const written = responses.write(conn.outgoing.data(), conn.outgoing.size());
+            conn.outgoing.erase(conn.outgoing.begin(), conn.outgoing.begin() + written);
+            if ( written > 0 && responses.take_parked_reader() )
+                eventfd_notify(channel.client_efd);
+        }
+
+        // 4. Announce we are going to sleep, then re-check so a concurrent client update is not missed
+        requests.park_reader();
+        if ( !conn.outgoing.empty() )
+            responses.park_writer();
+
+        bool const more_requests = requests.readable() > 0;
+        bool const more_space = !conn.outgoing.empty() && responses.writable() > 0;
+        if ( !more_requests && !more_space )
+            return;
+    }
+
+    // Busy client, yield to the other connections and come back on the next epoll round
+    eventfd_notify(channel.server_efd);
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::close_shm_channel(int const server_efd)
+{
+    auto it = shm_channels_.find(server_efd);
+    if ( it == shm_channels_.end() )
+        return;
+
+    spdlog::info("[SHM] Detaching shared-memory channel {}", server_efd);
+    unblock_client(server_efd);
+    pubsub_.remove(server_efd);
+    pubsub_over_soft_limit_.erase(server_efd);
+    tracking_clients_.erase(server_efd);
+    epoll_.remove_conn(server_efd);
+    close(it->second.server_efd);
+    close(it->second.client_efd);
+    shm_owners_.erase(it->second.owner_fd);
+    shm_channels_.erase(it);
+}
+
+
+/* ============================================== Replication ============================================== */
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::is_replica() const noexcept
+{
+    return !master_.host.empty();
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::is_write_command(std::vector<std::string> const& cmd) noexcept
+{
+    return !cmd.empty() && (cmd[0] == "set" || cmd[0] == "del" || cmd[0] == "unlink" || cmd[0] == "mset" ||
+                            cmd[0] == "restore" ||
+                            cmd[0] == "zadd" || cmd[0] == "zrem" || cmd[0] == "hset" || cmd[0] == "hdel" ||
+                            cmd[0] == "hincrby" || cmd[0] == "lpush" || cmd[0] == "rpush" || cmd[0] == "lpop" ||
+                            cmd[0] == "rpop" || is_blocking_pop(cmd) || cmd[0] == "incr" || cmd[0] == "decr" ||
+                            cmd[0] == "incrby" || cmd[0] == "decrby" || cmd[0] == "bf.reserve" ||
+                            cmd[0] == "bf.add" || cmd[0] == "bf.madd" || cmd[0] == "pfadd" || cmd[0] == "pfmerge" ||
+                            (cmd[0] == "cluster" && cmd.size() > 1 && cmd[1] == "restore"));
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::propagate(uint8_t const* frame, size_t len)
+{
+    backlog_->append(frame, len);
+    repl_write_times_.record(backlog_->offset(), ReplClock::now());
+
+    for ( auto const& [fd, _] : replicas_ )
+    {
+        auto& replica = epoll_.get_connection(fd);
+        replica.outgoing.insert(replica.outgoing.end(), frame, frame + len);
+        epoll_.modify_conn(fd, EPOLLIN | EPOLLOUT);
+    }
+}
+
+// Encodes a request frame for the replicas, for writes that did not arrive as one
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::propagate_request(std::vector<std::string_view> const& args)
+{
+    std::vector<uint8_t> frame;
+    append_request_frame(frame, args);
+    propagate(frame.data(), frame.size());
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::handle_psync(Connection& conn, std::vector<std::string> const& cmd)
+{
+    if ( is_replica() )
+    {
+        std::string const err{ "replicas cannot serve replicas" };
+        Response resp{ ResponseStatus::RES_ERR, { err.begin(), err.end() } };
+        make_response(resp, conn.outgoing);
+        return;
+    }
+
+    if ( !backlog_ )
+        backlog_ = std::make_unique<ReplicationBacklog>(config_.repl_backlog_size);
+
+    uint64_t offset{};
+    auto const [_, ec] = std::from_chars(cmd[2].data(), cmd[2].data() + cmd[2].size(), offset);
+
+    std::vector<uint8_t> missed;
+    std::string reply;
+    if ( ec == std::errc{} && cmd[1] == replid_ && backlog_->copy_from(offset, missed) )
+    {
+        reply = "continue " + replid_;
+        spdlog::info("[REPL] Replica {} -> Partial resync from offset {}, {} bytes", conn.fd, offset, missed.size());
+    }
+    else
+    {
+        // The snapshot is a series of requests rebuilding the keyspace, applied like the stream that follows it
+        offset = backlog_->offset();
+        append_snapshot(missed);
+        reply = "fullresync " + replid_ + " " + std::to_string(offset) + " " + std::to_string(missed.size());
+        spdlog::info("[REPL] Replica {} -> Full resync at offset {}, {} snapshot bytes", conn.fd, offset,
+                     missed.size());
+    }
+
+    Response resp{ ResponseStatus::RES_OK, { reply.begin(), reply.end() } };
+    make_response(resp, conn.outgoing);
+    conn.outgoing.insert(conn.outgoing.end(), missed.begin(), missed.end());
+
+    ReplicaInfo replica{};
+    replica.ack_offset = offset;
+    replica.ack_time = ReplClock::now();
+
+    sockaddr_storage peer{};
+    socklen_t peerlen{ sizeof(peer) };
+    char ip[INET6_ADDRSTRLEN]{};
+    if ( getpeername(conn.fd, (sockaddr*)&peer, &peerlen) == 0 && peer.ss_family == AF_INET )
+        replica.ip = inet_ntop(AF_INET, &((sockaddr_in*)&peer)->sin_addr, ip, sizeof(ip));
+    replicas_[conn.fd] = std::move(replica);
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::handle_replconf(Connection& conn,
+                                                                    std::vector<std::string> const& cmd)
+{
+    uint64_t value{};
+    auto const [_, ec] = std::from_chars(cmd[2].data(), cmd[2].data() + cmd[2].size(), value);
+    if ( ec != std::errc{} || (cmd[1] != "ack" && cmd[1] != "listening-port") )
+    {
+        spdlog::error("[REPL] Replica {} -> Malformed replconf", conn.fd);
+        return;
+    }
+
+    auto& replica = replicas_[conn.fd];
+    if ( cmd[1] == "listening-port" )
+    {
+        replica.listening_port = static_cast<uint16_t>(value);
+        return;
+    }
+
+    replica.ack_offset = value;
+    replica.ack_time = ReplClock::now();
+
+    uint64_t min_ack{ UINT64_MAX };
+    for ( auto const& [fd, info] : replicas_ )
+        min_ack = std::min(min_ack, info.ack_offset);
+    repl_write_times_.trim(min_ack);
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::append_snapshot(std::vector<uint8_t>& out) const
+{
+    // Compressed strings go as they are stored, the replica keeps them compressed whatever its threshold
+    StringBuffer buf;
+    for ( auto const& [key, val] : g_data )
+    {
+        if ( auto const str = !value_as<CompressedString>(val) ? string_of(val, buf) : std::nullopt )
+            append_request_frame(out, { "set", key, *str });
+        else
+            append_request_frame(out, { "restore", key, encode_value(val) });
+    }
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::setup_replica()
+{
+    repl_timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if ( repl_timer_fd_ == -1 )
+        throw std::runtime_error("Failed to create the replication timer");
+
+    itimerspec interval{};
+    interval.it_interval.tv_nsec = REPL_TIMER_INTERVAL_MS * 1000 * 1000;
+    interval.it_value = interval.it_interval;
+    timerfd_settime(repl_timer_fd_, 0, &interval, nullptr);
+    epoll_.add_conn(repl_timer_fd_);
+
+    spdlog::info("Running as a replica of {}:{}", master_.host, master_.port);
+    connect_to_master();
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+int Server<ISocketWrapperBase, IEpollWrapperBase>::connect_to_peer(std::string const& host, uint16_t const port)
+{
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res{ nullptr };
+    if ( getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0 )
+    {
+        spdlog::error("Cannot resolve peer {}", host);
+        return -1;
+    }
+
+    // Blocking connect, peers are expected to be close by and a refused connection fails right away
+    int fd = ::socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    bool const connected = fd != -1 && ::connect(fd, res->ai_addr, res->ai_addrlen) == 0;
+    freeaddrinfo(res);
+    if ( !connected || !set_nonblocking(fd) )
+    {
+        spdlog::info("Cannot connect to peer {}:{}. err: {}", host, port, std::strerror(errno));
+        if ( fd != -1 )
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::connect_to_master()
+{
+    int const fd = connect_to_peer(master_.host, master_.port);
+    if ( fd == -1 )
+        return;
+
+    master_.fd = fd;
+    master_.state = ReplLinkState::WAIT_PSYNC_REPLY;
+    master_.last_io = ReplClock::now();
+    epoll_.add_conn(fd);
+
+    auto& link = epoll_.get_connection(fd);
+    append_request_frame(link.outgoing, { "psync", master_.replid, std::to_string(master_.offset) });
+    append_request_frame(link.outgoing, { "replconf", "listening-port", std::to_string(config_.port) });
+    epoll_.modify_conn(fd, EPOLLIN | EPOLLOUT);
+
+    spdlog::info("[REPL] Connected to primary {}:{}, requesting sync from offset {}", master_.host, master_.port,
+                 master_.offset);
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::handle_repl_timer()
+{
+    uint64_t expirations{};
+    [[maybe_unused]] auto ret = ::read(repl_timer_fd_, &expirations, sizeof(expirations));
+
+    if ( master_.fd == -1 )
+        connect_to_master();
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::handle_psync_reply(Connection& conn)
+{
+    if ( conn.incoming.size() < LEN_FIELD_SIZE )
+        return true;
+
+    uint32_t resp_len{};
+    std::memcpy(&resp_len, conn.incoming.data(), LEN_FIELD_SIZE);
+    if ( conn.incoming.size() < LEN_FIELD_SIZE + resp_len )
+        return true;
+
+    auto const status = static_cast<ResponseStatus>(conn.incoming[LEN_FIELD_SIZE]);
+    std::string const reply(conn.incoming.begin() + LEN_FIELD_SIZE + 1,
+                            conn.incoming.begin() + LEN_FIELD_SIZE + resp_len);
+    conn.incoming.erase(conn.incoming.begin(), conn.incoming.begin() + LEN_FIELD_SIZE + resp_len);
+
+    std::istringstream in(reply);
+    std::string kind;
+    in >> kind;
+
+    if ( status == ResponseStatus::RES_OK && kind == "fullresync" )
+    {
+        std::string replid;
+        uint64_t offset{}, snapshot_bytes{};
+        in >> replid >> offset >> snapshot_bytes;
+
+        g_data.clear();
+        watched_keys_.touch_all();
+        master_.replid = replid;
+        master_.offset = offset;
+        master_.snapshot_remaining = snapshot_bytes;
+        spdlog::info("[REPL] Full resync with {} at offset {}", replid, offset);
+    }
+    else if ( status == ResponseStatus::RES_OK && kind == "continue" )
+        spdlog::info("[REPL] Partial resync from offset {}", master_.offset);
+    else
+    {
+        spdlog::error("[REPL] Primary refused to sync: {}", reply);
+        handle_close_event(conn);
+        return false;
+    }
+
+    master_.state = ReplLinkState::STREAMING;
+    return true;
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::apply_replication_stream(Connection& conn)
+{
+    master_.last_io = ReplClock::now();
+
+    if ( master_.state == ReplLinkState::WAIT_PSYNC_REPLY && !handle_psync_reply(conn) )
+        return false;
+    if ( master_.state != ReplLinkState::STREAMING )
+        return true;
+
+    // Apply every complete request frame, the offset only ever covers fully applied requests
+    size_t consumed{ 0 };
+    while ( conn.incoming.size() - consumed >= LEN_FIELD_SIZE )
+    {
+        uint32_t data_len{};
+        std::memcpy(&data_len, conn.incoming.data() + consumed, LEN_FIELD_SIZE);
+        if ( data_len > MAX_MSG_SIZE_LIMIT )
+        {
+            spdlog::error("[REPL] Corrupt replication stream at offset {}", master_.offset);
+            handle_close_event(conn);
+            return false;
+        }
+        if ( conn.incoming.size() - consumed < LEN_FIELD_SIZE + data_len )
+            break;
+
+        size_t const frame_size = LEN_FIELD_SIZE + data_len;
+
+        std::vector<std::string> cmd;
+        if ( !parse_req(conn.incoming.data() + consumed + LEN_FIELD_SIZE, data_len, cmd) )
+        {
+            spdlog::error("[REPL] Unparsable request in replication stream at offset {}", master_.offset);
+            handle_close_event(conn);
+            return false;
+        }
+
+        // The writes of a transaction arrive between `multi` and `exec` and are applied once all of them are here,
+        // so clients of the replica never see half of one either
+        bool const multi = cmd.size() == 1 && cmd[0] == "multi";
+        if ( multi && !has_exec_frame(conn.incoming, consumed + frame_size) )
+            break;
+        if ( !multi && !(cmd.size() == 1 && cmd[0] == "exec") )
+        {
+            Response resp{};
+            do_request(cmd, resp);
+            after_request(conn, cmd, resp);
+        }
+
+        if ( master_.snapshot_remaining > 0 )
+            master_.snapshot_remaining -= std::min<uint64_t>(frame_size, master_.snapshot_remaining);
+        else
+            master_.offset += frame_size;
+        consumed += frame_size;
+    }
+    conn.incoming.erase(conn.incoming.begin(), conn.incoming.begin() + consumed);
+
+    // Pushes of the primary wake the clients parked on those lists here, as a local push would
+    if ( !ready_keys_.empty() )
+        serve_blocked_clients();
+
+    // One ack per read keeps the primary's lag figures current without a message per request
+    if ( consumed > 0 && master_.snapshot_remaining == 0 )
+    {
+        append_request_frame(conn.outgoing, { "replconf", "ack", std::to_string(master_.offset) });
+        epoll_.modify_conn(conn.fd, EPOLLIN | EPOLLOUT);
+    }
+    return true;
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+std::string Server<ISocketWrapperBase, IEpollWrapperBase>::replication_info() const
+{
+    std::string info;
+    auto line = [&info](std::string_view key, auto const& value)
+    {
+        info.append(key);
+        info += ':';
+        if constexpr ( std::is_convertible_v<decltype(value), std::string_view> )
+            info.append(value);
+        else
+            info.append(std::to_string(value));
+        info += '\n';
+    };
+
+    auto const now = ReplClock::now();
+    if ( is_replica() )
+    {
+        line("role", "replica");
+        line("master_host", master_.host);
+        line("master_port", master_.port);
+        line("master_link_status", master_.state == ReplLinkState::STREAMING ? "up" : "down");
+        line("master_replid", master_.replid);
+        line("repl_offset", master_.offset);
+        line("master_last_io_ms",
+             std::chrono::duration_cast<std::chrono::milliseconds>(now - master_.last_io).count());
+        return info;
+    }
+
+    uint64_t const offset = backlog_ ? backlog_->offset() : 0;
+    line("role", "primary");
+    line("replid", replid_);
+    line("repl_offset", offset);
+    line("repl_backlog_size", backlog_ ? backlog_->size() : 0);
+    line("connected_replicas", replicas_.size());
+
+    size_t i{ 0 };
+    for ( auto const& [fd, replica] : replicas_ )
+    {
+        std::string const lag = "ip=" + replica.ip + ",port=" + std::to_string(replica.listening_port) +
+                                ",offset=" + std::to_string(replica.ack_offset) +
+                                ",lag_bytes=" + std::to_string(offset - replica.ack_offset) + ",lag_ms=" +
+                                std::to_string(repl_write_times_.lag_ms(replica.ack_offset, offset, now));
+        line("replica" + std::to_string(i++), lag);
+    }
+    return info;
+}
+
+
+/* ============================================== Cluster ============================================== */
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+template <class Fn>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::for_each_key(std::vector<std::string> const& cmd, Fn&& fn)
+{
+    if ( cmd.size() < 2 )
+        return;
+
+    if ( cmd[0] == "get" || cmd[0] == "set" || cmd[0] == "del" || cmd[0] == "type" || cmd[0] == "restore" ||
+         cmd[0] == "incr" || cmd[0] == "decr" || cmd[0] == "incrby" || cmd[0] == "decrby" ||
+         cmd[0].starts_with('z') || cmd[0].starts_with('h') || cmd[0].starts_with('l') || cmd[0] == "rpush" ||
+         cmd[0] == "rpop" || cmd[0].starts_with("bf.") || cmd[0] == "pfadd" )
+        fn(cmd[1]);
+    else if ( is_blocking_pop(cmd) )
+    {
+        for ( size_t i = 1; i + 1 < cmd.size(); i++ )
+            fn(cmd[i]);
+    }
+    else if ( (cmd[0] == "object" || cmd[0] == "memory") && cmd.size() == 3 )
+        fn(cmd[2]);
+    else if ( cmd[0] == "mget" || cmd[0] == "unlink" || cmd[0] == "pfcount" || cmd[0] == "pfmerge" )
+    {
+        for ( size_t i = 1; i < cmd.size(); i++ )
+            fn(cmd[i]);
+    }
+    else if ( cmd[0] == "mset" )
+    {
+        for ( size_t i = 1; i < cmd.size(); i += 2 )
+            fn(cmd[i]);
+    }
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::route_to_slot(std::vector<std::string> const& cmd,
+                                                                  Response& resp, bool const asking) const
+{
+    if ( !cluster_.enabled() )
+        return true;
+
+    // Multi-key commands are only served when all their keys hash to one slot, the client splits them per slot
+    int slot{ -1 };
+    bool cross_slot{ false };
+    for_each_key(cmd,
+                 [&](std::string const& key)
+                 {
+                     int const key_slot = key_hash_slot(key);
+                     cross_slot |= slot != -1 && slot != key_slot;
+                     slot = key_slot;
+                 });
+
+    std::string err;
+    if ( slot == -1 )
+        return true;
+
+    if ( cross_slot )
+        err = "CROSSSLOT keys in request don't hash to the same slot";
+    else if ( cluster_.owns(slot) )
+    {
+        if ( !migration_ || migration_->slot != slot )
+            return true;
+
+        // Migrating slot: we serve the keys we still have, the target the ones already shipped
+        size_t total{ 0 }, local{ 0 };
+        for_each_key(cmd,
+                     [&](std::string const& key)
+                     {
+                         total++;
+                         local += g_data.contains(key) || migration_->in_flight.contains(key);
+                     });
+        if ( local == total )
+            return true;
+        if ( local == 0 )
+        {
+            std::string const ask{ std::to_string(slot) + " " + migration_->target };
+            resp.status = ResponseStatus::RES_ASK;
+            resp.data.assign(ask.begin(), ask.end());
+            return false;
+        }
+        err = "TRYAGAIN keys of a migrating slot are split between nodes";
+    }
+    else if ( cluster_.importing(slot) && asking )
+        return true;
+    else if ( !cluster_.assigned(slot) )
+        err = "CLUSTERDOWN hash slot " + std::to_string(slot) + " is not served";
+    else
+    {
+        std::string const moved{ std::to_string(slot) + " " + cluster_.owner(slot) };
+        resp.status = ResponseStatus::RES_MOVED;
+        resp.data.assign(moved.begin(), moved.end());
+        return false;
+    }
+
+    resp.status = ResponseStatus::RES_ERR;
+    resp.data.assign(err.begin(), err.end());
+    return false;
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::do_cluster_command(std::vector<std::string> const& cmd,
+                                                                       Response& resp)
+{
+    resp.status = ResponseStatus::RES_OK;
+
+    if ( cmd[1] == "slots" && cmd.size() == 2 )
+    {
+        // One "<first>-<last> <host:port>" element per contiguous range
+        std::vector<std::string> ranges;
+        cluster_.for_each_range([&ranges](uint16_t first, uint16_t last, std::string const& node)
+                                { ranges.push_back(std::to_string(first) + "-" + std::to_string(last) + " " + node); });
+
+        append_array_header(resp.data, ranges.size());
+        for ( auto const& range : ranges )
+            append_array_element(resp.data, range);
+    }
+    else if ( cmd[1] == "keyslot" && cmd.size() == 3 )
+    {
+        std::string const slot{ std::to_string(key_hash_slot(cmd[2])) };
+        resp.data.assign(slot.begin(), slot.end());
+    }
+    else if ( cmd[1] == "migrate" && (cmd.size() >= 4 && cmd.size() <= 6) )
+    {
+        std::string err;
+        if ( !start_migration(cmd, err) )
+        {
+            resp.status = ResponseStatus::RES_ERR;
+            resp.data.assign(err.begin(), err.end());
+        }
+    }
+    else if ( cmd[1] == "migration" && cmd.size() == 2 )
+    {
+        std::string const info{ migration_info() };
+        resp.data.assign(info.begin(), info.end());
+    }
+    else if ( cmd[1] == "importing" && cmd.size() == 4 && cluster_.enabled() )
+    {
+        uint16_t slot{};
+        auto const [p, ec] = std::from_chars(cmd[2].data(), cmd[2].data() + cmd[2].size(), slot);
+        if ( ec != std::errc{} || p != cmd[2].data() + cmd[2].size() || slot >= CLUSTER_SLOTS )
+        {
+            std::string const err{ "Invalid slot " + cmd[2] };
+            resp.status = ResponseStatus::RES_ERR;
+            resp.data.assign(err.begin(), err.end());
+            return;
+        }
+        cluster_.set_importing(slot);
+        spdlog::info("[MIGRATE] Importing slot {} from {}", slot, cmd[3]);
+    }
+    else if ( cmd[1] == "restore" && cmd.size() >= 4 && cluster_.enabled() )
+    {
+        // cluster restore <slot> <ndel> <del0> ... <key0> <val0> ..., values as encode_value() payloads
+        uint16_t slot{};
+        size_t ndel{};
+        auto const [p1, ec1] = std::from_chars(cmd[2].data(), cmd[2].data() + cmd[2].size(), slot);
+        auto const [p2, ec2] = std::from_chars(cmd[3].data(), cmd[3].data() + cmd[3].size(), ndel);
+        if ( ec1 != std::errc{} || p1 != cmd[2].data() + cmd[2].size() || slot >= CLUSTER_SLOTS ||
+             ec2 != std::errc{} || p2 != cmd[3].data() + cmd[3].size() || ndel > cmd.size() - 4 ||
+             (!cluster_.importing(slot) && !cluster_.owns(slot)) || (cmd.size() - 4 - ndel) % 2 != 0 )
+        {
+            std::string const err{ "Not importing slot " + cmd[2] };
+            resp.status = ResponseStatus::RES_ERR;
+            resp.data.assign(err.begin(), err.end());
+            return;
+        }
+        for ( size_t i = 4; i < 4 + ndel; i++ )
+            g_data.erase(cmd[i]);
+        for ( size_t i = 4 + ndel; i < cmd.size(); i += 2 )
+        {
+            Value value;
+            if ( !decode_value(cmd[i + 1], value) )
+            {
+                resp.status = ResponseStatus::RES_ERR;
+                return;
+            }
+            g_data.insert_or_assign(cmd[i], std::move(value));
+        }
+    }
+    else if ( cmd[1] == "setslot" && cmd.size() == 5 && cluster_.enabled() )
+    {
+        uint16_t first{};
+        uint16_t last{};
+        if ( !parse_int(cmd[2], first) || !parse_int(cmd[3], last) || first > last || last >= CLUSTER_SLOTS )
+        {
+            std::string const err{ "Invalid slot range " + cmd[2] + "-" + cmd[3] };
+            resp.status = ResponseStatus::RES_ERR;
+            resp.data.assign(err.begin(), err.end());
+        }
+        else
+            cluster_.assign(first, last, cmd[4]);
+    }
+    else
+    {
+        std::string const err{ cluster_.enabled() ? "Unknown cluster subcommand" : "Cluster mode is disabled" };
+        resp.status = ResponseStatus::RES_ERR;
+        resp.data.assign(err.begin(), err.end());
+    }
+}
+
+
+/* ============================================== Slot Migration ============================================== */
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::start_migration(std::vector<std::string> const& cmd,
+                                                                    std::string& err)
+{
+    // cluster migrate <slot> <host:port> [step budget us] [batch bytes]
+    uint16_t slot{};
+    uint16_t port{};
+    uint64_t step_budget{};
+    size_t batch_bytes{};
+    auto const colon = cmd[3].rfind(':');
+    if ( !cluster_.enabled() || !parse_int(cmd[2], slot) || slot >= CLUSTER_SLOTS || colon == std::string::npos ||
+         !parse_int(std::string_view(cmd[3]).substr(colon + 1), port) ||
+         (cmd.size() > 4 && !parse_int(cmd[4], step_budget)) || (cmd.size() > 5 && !parse_int(cmd[5], batch_bytes)) )
+        err = "Usage: cluster migrate <slot> <host:port> [step budget us] [batch bytes] in cluster mode";
+    else if ( !cluster_.owns(slot) || cmd[3] == cluster_.self() )
+        err = "Slot " + cmd[2] + " is not ours to migrate";
+    else if ( migration_ )
+        err = "Slot " + std::to_string(migration_->slot) + " is already being migrated";
+    if ( !err.empty() )
+        return false;
+
+    int const fd = connect_to_peer(cmd[3].substr(0, colon), port);
+    int const wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ( fd == -1 || wake_fd == -1 )
+    {
+        err = "Cannot connect to " + cmd[3];
+        if ( fd != -1 )
+            close(fd);
+        return false;
+    }
+
+    migration_ = std::make_unique<SlotMigration>();
+    migration_->slot = slot;
+    migration_->target = cmd[3];
+    migration_->fd = fd;
+    migration_->wake_fd = wake_fd;
+    if ( cmd.size() > 4 )
+        migration_->step_budget = std::chrono::microseconds(step_budget);
+    if ( cmd.size() > 5 )
+        migration_->batch_bytes = batch_bytes;
+    migration_->start_time = std::chrono::steady_clock::now();
+    epoll_.add_conn(fd);
+    epoll_.add_conn(wake_fd);
+
+    // The walk starts once the target acknowledged that it imports the slot
+    send_to_migration_target({ "cluster", "importing", cmd[2], cluster_.self() });
+    spdlog::info("[MIGRATE] Migrating slot {} to {}", slot, cmd[3]);
+    return true;
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::send_to_migration_target(std::vector<std::string_view> const& args)
+{
+    auto& conn = epoll_.get_connection(migration_->fd);
+    append_request_frame(conn.outgoing, args);
+    epoll_.modify_conn(conn.fd, EPOLLIN | EPOLLOUT);
+    migration_->awaiting_reply = true;
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::migration_step()
+{
+    if ( !migration_ || migration_->awaiting_reply )
+        return;
+
+    auto& m = *migration_;
+    std::string const slot{ std::to_string(m.slot) };
+    std::vector<std::string_view> deletes;
+    std::vector<std::string_view> pairs;
+    std::deque<std::string> encoded; // Backs the value views in `pairs`
+    size_t bytes{ 0 };
+    auto add_pair = [&](std::string const& key, Value const& value)
+    {
+        encoded.push_back(encode_value(value));
+        pairs.insert(pairs.end(), { key, encoded.back() });
+        bytes += key.size() + encoded.back().size();
+    };
+
+    // 1. Keys that changed while their batch was in flight go out again, as a delete if they are gone by now
+    for ( auto const& key : m.resend )
+    {
+        auto [it, _] = m.in_flight.insert(key);
+        if ( auto kv = g_data.find(key); kv != g_data.end() )
+            add_pair(kv->first, kv->second);
+        else
+            deletes.push_back(*it);
+    }
+    m.resend.clear();
+
+    // 2. Walk on until the batch is full or the step used up its time budget, checking the clock every few keys
+    if ( !m.walk_done )
+    {
+        auto const deadline = std::chrono::steady_clock::now() + m.step_budget;
+        auto it = m.started ? g_data.upper_bound(m.cursor) : g_data.begin();
+        m.started = true;
+
+        for ( size_t n = 1; it != g_data.end(); ++it, n++ )
+        {
+            m.keys_walked++;
+            if ( key_hash_slot(it->first) == m.slot && !m.in_flight.contains(it->first) )
+            {
+                m.in_flight.insert(it->first);
+                add_pair(it->first, it->second);
+            }
+
+            if ( bytes >= m.batch_bytes || (n % 64 == 0 && std::chrono::steady_clock::now() >= deadline) )
+                break;
+        }
+
+        if ( it == g_data.end() )
+            m.walk_done = true;
+        else
+            m.cursor = it->first;
+    }
+
+    // 3. Ship the batch, hand the slot over once everything made it, or come back for the next stretch of keys
+    if ( !m.in_flight.empty() )
+    {
+        std::string const ndel{ std::to_string(deletes.size()) };
+        std::vector<std::string_view> args{ "cluster", "restore", slot, ndel };
+        args.insert(args.end(), deletes.begin(), deletes.end());
+        args.insert(args.end(), pairs.begin(), pairs.end());
+        send_to_migration_target(args);
+        m.batches++;
+    }
+    else if ( m.walk_done )
+    {
+        send_to_migration_target({ "cluster", "setslot", slot, slot, m.target });
+        m.finalizing = true;
+    }
+    else
+        eventfd_notify(m.wake_fd);
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::handle_migration_reply(Connection& conn)
+{
+    auto& m = *migration_;
+    while ( conn.incoming.size() >= LEN_FIELD_SIZE )
+    {
+        uint32_t resp_len{};
+        std::memcpy(&resp_len, conn.incoming.data(), LEN_FIELD_SIZE);
+        if ( conn.incoming.size() < LEN_FIELD_SIZE + resp_len )
+            return true;
+
+        auto const status = static_cast<ResponseStatus>(conn.incoming[LEN_FIELD_SIZE]);
+        conn.incoming.erase(conn.incoming.begin(), conn.incoming.begin() + LEN_FIELD_SIZE + resp_len);
+        m.awaiting_reply = false;
+
+        if ( status != ResponseStatus::RES_OK )
+        {
+            spdlog::error("[MIGRATE] {} refused slot {}, aborting", m.target, m.slot);
+            end_migration();
+            return false;
+        }
+
+        if ( m.finalizing )
+        {
+            cluster_.assign(m.slot, m.slot, m.target);
+            spdlog::info("[MIGRATE] Slot {} now served by {}, {} keys moved", m.slot, m.target, m.keys_moved);
+            end_migration();
+            return false;
+        }
+
+        // The target has the batch, drop our copies unless they changed in the meantime
+        for ( auto const& key : m.in_flight )
+        {
+            if ( m.dirty.contains(key) )
+                m.resend.insert(key);
+            else if ( g_data.erase(key) > 0 )
+            {
+                m.keys_moved++;
+                if ( !watched_keys_.empty() )
+                    watched_keys_.touch(key);
+                if ( !tracking_.empty() )
+                    invalidate_key(key);
+                if ( backlog_ )
+                {
+                    std::vector<uint8_t> del;
+                    append_request_frame(del, { "del", key });
+                    propagate(del.data(), del.size());
+                }
+            }
+        }
+        m.in_flight.clear();
+        m.dirty.clear();
+
+        migration_step();
+    }
+    return true;
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::end_migration()
+{
+    if ( migration_->fd != -1 )
+    {
+        epoll_.remove_conn(migration_->fd);
+        close(migration_->fd);
+    }
+    epoll_.remove_conn(migration_->wake_fd);
+    close(migration_->wake_fd);
+    migration_.reset();
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+std::string Server<ISocketWrapperBase, IEpollWrapperBase>::migration_info() const
+{
+    if ( !migration_ )
+        return "none";
+
+    auto const elapsed = std::chrono::steady_clock::now() - migration_->start_time;
+    return "slot:" + std::to_string(migration_->slot) + "\ntarget:" + migration_->target +
+           "\nkeys_moved:" + std::to_string(migration_->keys_moved) +
+           "\nkeys_walked:" + std::to_string(migration_->keys_walked) +
+           "\nbatches:" + std::to_string(migration_->batches) + "\nelapsed_ms:" +
+           std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()) + "\n";
+}
+
+/* ============================================== Typed Values ============================================== */
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+template <class T>
+T* Server<ISocketWrapperBase, IEpollWrapperBase>::find_value(std::string const& key, Response& resp)
+{
+    auto it = g_data.find(key);
+    if ( it == g_data.end() )
+        return nullptr;
+
+    T* val = value_as<T>(it->second);
+    if ( !val )
+    {
+        resp.status = ResponseStatus::RES_ERR;
+        resp.data.assign(WRONGTYPE_ERR.begin(), WRONGTYPE_ERR.end());
+    }
+    return val;
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::do_zset_command(std::vector<std::string> const& cmd,
+                                                                    Response& resp)
+{
+    auto set_data = [&resp](std::string const& str) { resp.data.assign(str.begin(), str.end()); };
+    auto bad_request = [&](std::string const& err)
+    {
+        resp.status = ResponseStatus::RES_ERR;
+        set_data(err);
+    };
+
+    // Members (and their scores) produced by `walk`, the element count is patched in once it is known
+    auto range_reply = [&resp](bool with_scores, auto&& walk)
+    {
+        size_t const header = resp.data.size();
+        uint32_t count{ 0 };
+        std::array<char, 32> buf;
+        append_array_header(resp.data, 0);
+        walk(
+            [&](std::string_view member, double score)
+            {
+                append_array_element(resp.data, member);
+                if ( with_scores )
+                    append_array_element(resp.data, format_score(score, buf));
+                count += 1 + with_scores;
+            });
+        patch_array_header(resp.data, header, count);
+    };
+
+    std::string const& key = cmd[1];
+    resp.status = ResponseStatus::RES_OK;
+
+    if ( cmd[0] == "zadd" && cmd.size() >= 4 && cmd.size() % 2 == 0 )
+    {
+        // zadd <key> <score> <member> [<score> <member> ...], all scores are checked before anything is added
+        std::vector<double> scores;
+        for ( size_t i = 2; i < cmd.size(); i += 2 )
+        {
+            auto const score = ScoreBound::parse(cmd[i]);
+            if ( !score || cmd[i][0] == '(' )
+                return bad_request("ERR value is not a valid float");
+            scores.push_back(score->value);
+        }
+
+        SortedSet* zset = find_value<SortedSet>(key, resp);
+        if ( resp.status == ResponseStatus::RES_ERR )
+            return;
+        if ( !zset )
+            zset = value_as<SortedSet>(g_data.emplace(key, std::make_unique<SortedSet>()).first->second);
+
+        size_t added{ 0 };
+        for ( size_t i = 2; i < cmd.size(); i += 2 )
+            added += zset->add(scores[i / 2 - 1], cmd[i + 1]);
+        set_data(std::to_string(added));
+    }
+    else if ( cmd[0] == "zrem" && cmd.size() >= 3 )
+    {
+        size_t removed{ 0 };
+        if ( SortedSet* zset = find_value<SortedSet>(key, resp) )
+        {
+            for ( size_t i = 2; i < cmd.size(); i++ )
+                removed += zset->remove(cmd[i]);
+            if ( zset->size() == 0 )
+                g_data.erase(key);
+        }
+        if ( resp.status == ResponseStatus::RES_OK )
+            set_data(std::to_string(removed));
+    }
+    else if ( (cmd[0] == "zscore" || cmd[0] == "zrank") && cmd.size() == 3 )
+    {
+        SortedSet const* zset = find_value<SortedSet>(key, resp);
+        if ( resp.status == ResponseStatus::RES_ERR )
+            return;
+
+        std::optional<std::string> result;
+        if ( zset && cmd[0] == "zscore" )
+        {
+            if ( auto score = zset->score(cmd[2]) )
+                result = format_score(*score);
+        }
+        else if ( zset )
+        {
+            if ( auto rank = zset->rank(cmd[2]) )
+                result = std::to_string(*rank);
+        }
+
+        if ( result )
+            set_data(*result);
+        else
+            resp.status = ResponseStatus::RES_NX;
+    }
+    else if ( cmd[0] == "zcard" && cmd.size() == 2 )
+    {
+        SortedSet const* zset = find_value<SortedSet>(key, resp);
+        if ( resp.status == ResponseStatus::RES_OK )
+            set_data(std::to_string(zset ? zset->size() : 0));
+    }
+    else if ( cmd[0] == "zrange" && (cmd.size() == 4 || (cmd.size() == 5 && cmd[4] == "withscores")) )
+    {
+        // zrange <key> <start> <stop> [withscores], negative positions count from the end
+        long long start{}, stop{};
+        if ( !parse_int(cmd[2], start) || !parse_int(cmd[3], stop) )
+            return bad_request("ERR value is not an integer or out of range");
+
+        SortedSet const* zset = find_value<SortedSet>(key, resp);
+        if ( resp.status == ResponseStatus::RES_ERR )
+            return;
+
+        long long const len = zset ? static_cast<long long>(zset->size()) : 0;
+        start = std::max(start < 0 ? len + start : start, 0LL);
+        stop = stop < 0 ? len + stop : std::min(stop, len - 1);
+
+        range_reply(cmd.size() == 5,
+                    [&](auto&& emit)
+                    {
+                        if ( zset && start <= stop )
+                            zset->range_by_rank(start, stop, emit);
+                    });
+    }
+    else if ( cmd[0] == "zrangebyscore" && cmd.size() >= 4 )
+    {
+        // zrangebyscore <key> <min> <max> [withscores] [limit <offset> <count>]
+        auto const min = ScoreBound::parse(cmd[2]);
+        auto const max = ScoreBound::parse(cmd[3]);
+        bool with_scores{ false };
+        size_t offset{ 0 }, limit{ SIZE_MAX };
+        bool valid = min && max;
+        for ( size_t i = 4; valid && i < cmd.size(); i++ )
+        {
+            if ( cmd[i] == "withscores" )
+                with_scores = true;
+            else if ( cmd[i] == "limit" && i + 2 < cmd.size() )
+            {
+                long long off{}, cnt{};
+                valid = parse_int(cmd[i + 1], off) && parse_int(cmd[i + 2], cnt) && off >= 0;
+                offset = off;
+                limit = cnt < 0 ? SIZE_MAX : cnt;
+                i += 2;
+            }
+            else
+                valid = false;
+        }
+        if ( !valid )
+            return bad_request("ERR syntax error");
+
+        SortedSet const* zset = find_value<SortedSet>(key, resp);
+        if ( resp.status == ResponseStatus::RES_ERR )
+            return;
+
+        range_reply(with_scores,
+                    [&](auto&& emit)
+                    {
+                        if ( zset )
+                            zset->range_by_score(*min, *max, offset, limit, emit);
+                    });
+    }
+    else
+        bad_request("ERR unknown or malformed sorted set command");
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::do_hash_command(std::vector<std::string> const& cmd,
+                                                                    Response& resp)
+{
+    auto set_data = [&resp](std::string_view str) { resp.data.assign(str.begin(), str.end()); };
+    auto bad_request = [&](std::string_view err)
+    {
+        resp.status = ResponseStatus::RES_ERR;
+        set_data(err);
+    };
+
+    std::string const& key = cmd[1];
+    resp.status = ResponseStatus::RES_OK;
+
+    if ( cmd[0] == "hset" && cmd.size() >= 4 && cmd.size() % 2 == 0 )
+    {
+        // hset <key> <field> <value> [<field> <value> ...]
+        Hash* hash = find_value<Hash>(key, resp);
+        if ( resp.status == ResponseStatus::RES_ERR )
+            return;
+        if ( !hash )
+            hash = value_as<Hash>(g_data.emplace(key, std::make_unique<Hash>()).first->second);
+
+        size_t added{ 0 };
+        for ( size_t i = 2; i < cmd.size(); i += 2 )
+            added += hash->set(cmd[i], cmd[i + 1]);
+        set_data(std::to_string(added));
+    }
+    else if ( cmd[0] == "hget" && cmd.size() == 3 )
+    {
+        Hash const* hash = find_value<Hash>(key, resp);
+        if ( resp.status == ResponseStatus::RES_ERR )
+            return;
+
+        auto const value = hash ? hash->get(cmd[2]) : std::nullopt;
+        if ( value )
+            set_data(*value);
+        else
+            resp.status = ResponseStatus::RES_NX;
+    }
+    else if ( cmd[0] == "hdel" && cmd.size() >= 3 )
+    {
+        size_t removed{ 0 };
+        if ( Hash* hash = find_value<Hash>(key, resp) )
+        {
+            for ( size_t i = 2; i < cmd.size(); i++ )
+                removed += hash->remove(cmd[i]);
+            if ( hash->size() == 0 )
+                g_data.erase(key);
+        }
+        if ( resp.status == ResponseStatus::RES_OK )
+            set_data(std::to_string(removed));
+    }
+    else if ( cmd[0] == "hgetall" && cmd.size() == 2 )
+    {
+        Hash const* hash = find_value<Hash>(key, resp);
+        if ( resp.status == ResponseStatus::RES_ERR )
+            return;
+
+        append_array_header(resp.data, hash ? hash->size() * 2 : 0);
+        if ( hash )
+        {
+            hash->for_each(
+                [&resp](std::string_view field, std::string_view value)
+                {
+                    append_array_element(resp.data, field);
+                    append_array_element(resp.data, value);
+                });
+        }
+    }
+    else if ( cmd[0] == "hlen" && cmd.size() == 2 )
+    {
+        Hash const* hash = find_value<Hash>(key, resp);
+        if ( resp.status == ResponseStatus::RES_OK )
+            set_data(std::to_string(hash ? hash->size() : 0));
+    }
+    else if ( cmd[0] == "hincrby" && cmd.size() == 4 )
+    {
+        int64_t delta{};
+        auto const [p, ec] = std::from_chars(cmd[3].data(), cmd[3].data() + cmd[3].size(), delta);
+        if ( ec != std::errc{} || p != cmd[3].data() + cmd[3].size() )
+            return bad_request("ERR value is not an integer or out of range");
+
+        Hash* hash = find_value<Hash>(key, resp);
+        if ( resp.status == ResponseStatus::RES_ERR )
+            return;
+
+        int64_t current{ 0 };
+        if ( auto const value = hash ? hash->get(cmd[2]) : std::nullopt )
+        {
+            auto const [vp, vec] = std::from_chars(value->data(), value->data() + value->size(), current);
+            if ( vec != std::errc{} || vp != value->data() + value->size() )
+                return bad_request("ERR hash value is not an integer");
+        }
+        if ( __builtin_add_overflow(current, delta, &current) )
+            return bad_request("ERR increment or decrement would overflow");
+
+        if ( !hash )
+            hash = value_as<Hash>(g_data.emplace(key, std::make_unique<Hash>()).first->second);
+        std::string const result{ std::to_string(current) };
+        hash->set(cmd[2], result);
+        set_data(result);
+    }
+    else
+        bad_request("ERR unknown or malformed hash command");
+}
+
+// incr/decr <key>, incrby/decrby <key> <delta>. A missing key counts from 0, the result is stored as an integer.
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::do_counter_command(std::vector<std::string> const& cmd,
+                                                                       Response& resp)
+{
+    auto bad_request = [&resp](std::string_view err)
+    {
+        resp.status = ResponseStatus::RES_ERR;
+        resp.data.assign(err.begin(), err.end());
+    };
+
+    int64_t delta{ 1 };
+    if ( cmd.size() == 3 )
+    {
+        auto const [p, ec] = std::from_chars(cmd[2].data(), cmd[2].data() + cmd[2].size(), delta);
+        if ( ec != std::errc{} || p != cmd[2].data() + cmd[2].size() )
+            return bad_request("ERR value is not an integer or out of range");
+    }
+    if ( cmd[0].starts_with('d') && __builtin_sub_overflow(0, delta, &delta) )
+        return bad_request("ERR increment or decrement would overflow");
+
+    // Every integer string is stored as int64_t (make_string_value()), so a std::string here never holds a number, and
+    // neither does a compressed one (make_stored_string() leaves integer-sized strings alone)
+    auto it = g_data.try_emplace(cmd[1], int64_t{ 0 }).first;
+    int64_t* counter = value_as<int64_t>(it->second);
+    if ( !counter )
+        return bad_request(value_as<std::string>(it->second) || value_as<CompressedString>(it->second)
+                               ? "ERR value is not an integer or out of range"
+                               : WRONGTYPE_ERR);
+
+    int64_t result{};
+    if ( __builtin_add_overflow(*counter, delta, &result) )
+        return bad_request("ERR increment or decrement would overflow");
+    *counter = result;
+
+    std::array<char, MAX_INT_STR_SIZE> buf;
+    auto const end = std::to_chars(buf.data(), buf.data() + buf.size(), result).ptr;
+    resp.data.assign(buf.data(), end);
+    resp.status = ResponseStatus::RES_OK;
+}
+
+/* ============================================== Lists ============================================== */
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::do_list_command(std::vector<std::string> const& cmd,
+                                                                    Response& resp)
+{
+    auto set_data = [&resp](std::string_view str) { resp.data.assign(str.begin(), str.end()); };
+    auto bad_request = [&](std::string_view err)
+    {
+        resp.status = ResponseStatus::RES_ERR;
+        set_data(err);
+    };
+
+    std::string const& key = cmd[1];
+    resp.status = ResponseStatus::RES_OK;
+
+    if ( (cmd[0] == "lpush" || cmd[0] == "rpush") && cmd.size() >= 3 )
+    {
+        // lpush <key> <element> [<element> ...], every element goes to the head in turn, so they end up reversed
+        List* list = find_value<List>(key, resp);
+        if ( resp.status == ResponseStatus::RES_ERR )
+            return;
+        if ( !list )
+            list = value_as<List>(g_data.emplace(key, std::make_unique<List>()).first->second);
+
+        for ( size_t i = 2; i < cmd.size(); i++ )
+        {
+            if ( cmd[0] == "lpush" )
+                list->push_front(cmd[i]);
+            else
+                list->push_back(cmd[i]);
+        }
+        set_data(std::to_string(list->size()));
+        signal_list_ready(key);
+    }
+    else if ( (cmd[0] == "lpop" || cmd[0] == "rpop") && cmd.size() == 2 )
+    {
+        List* list = find_value<List>(key, resp);
+        if ( resp.status == ResponseStatus::RES_ERR )
+            return;
+        if ( !list )
+        {
+            resp.status = ResponseStatus::RES_NX;
+            return;
+        }
+
+        std::string const value{ *(cmd[0] == "lpop" ? list->pop_front() : list->pop_back()) };
+        if ( list->size() == 0 )
+            g_data.erase(key);
+        set_data(value);
+    }
+    else if ( cmd[0] == "llen" && cmd.size() == 2 )
+    {
+        List const* list = find_value<List>(key, resp);
+        if ( resp.status == ResponseStatus::RES_OK )
+            set_data(std::to_string(list ? list->size() : 0));
+    }
+    else if ( cmd[0] == "lrange" && cmd.size() == 4 )
+    {
+        // lrange <key> <start> <stop>, negative positions count from the end
+        long long start{}, stop{};
+        auto const [p1, ec1] = std::from_chars(cmd[2].data(), cmd[2].data() + cmd[2].size(), start);
+        auto const [p2, ec2] = std::from_chars(cmd[3].data(), cmd[3].data() + cmd[3].size(), stop);
+        if ( ec1 != std::errc{} || ec2 != std::errc{} )
+            return bad_request("ERR value is not an integer or out of range");
+
+        List const* list = find_value<List>(key, resp);
+        if ( resp.status == ResponseStatus::RES_ERR )
+            return;
+
+        long long const len = list ? static_cast<long long>(list->size()) : 0;
+        start = std::max(start < 0 ? len + start : start, 0LL);
+        stop = stop < 0 ? len + stop : std::min(stop, len - 1);
+
+        append_array_header(resp.data, start <= stop ? stop - start + 1 : 0);
+        if ( list && start <= stop )
+            list->range(start, stop, [&resp](std::string_view element) { append_array_element(resp.data, element); });
+    }
+    else
+        bad_request("ERR unknown or malformed list command");
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::is_blocking_pop(std::vector<std::string> const& cmd) noexcept
+{
+    return cmd.size() >= 3 && (cmd[0] == "blpop" || cmd[0] == "brpop");
+}
+
+// True if `resp` is ready, false if `conn` was parked. Parking costs no thread: the connection only stops being
+// served until serve_blocked_clients() or handle_block_timer() answers it from the event loop.
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::blocking_pop(Connection& conn, std::vector<std::string> const& cmd,
+                                                                 Response& resp)
+{
+    // blpop <key> [<key> ...] <timeout>, the timeout is in seconds and 0 blocks forever
+    std::string const& timeout_str = cmd.back();
+    char* end{ nullptr };
+    double const timeout = std::strtod(timeout_str.c_str(), &end);
+    if ( end == timeout_str.c_str() || *end != '\0' || !(timeout >= 0) || timeout > 1e9 )
+    {
+        std::string_view const err{ "ERR timeout is not a float or out of range" };
+        resp.status = ResponseStatus::RES_ERR;
+        resp.data.assign(err.begin(), err.end());
+        return true;
+    }
+
+    bool const front = cmd[0] == "blpop";
+    resp.status = ResponseStatus::RES_OK;
+    for ( size_t i = 1; i + 1 < cmd.size(); i++ )
+    {
+        List const* list = find_value<List>(cmd[i], resp);
+        if ( resp.status == ResponseStatus::RES_ERR )
+            return true;
+        if ( list )
+        {
+            pop_to_waiter(cmd[i], front, resp);
+            return true;
+        }
+    }
+
+    // Nothing to pop, park the connection behind everyone already waiting on these keys
+    BlockedClient client{ { cmd.begin() + 1, cmd.end() - 1 }, front, {} };
+    for ( auto const& key : client.keys )
+        blocked_keys_[key].push_back(conn.fd);
+
+    if ( timeout > 0 )
+    {
+        client.deadline = std::chrono::steady_clock::now() +
+                          std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                              std::chrono::duration<double>(timeout));
+        block_deadlines_.emplace(client.deadline, conn.fd);
+        arm_block_timer();
+    }
+    blocked_clients_.emplace(conn.fd, std::move(client));
+
+    spdlog::info("[BLOCK] Client {} -> Waiting on {} key(s)", conn.fd, cmd.size() - 2);
+    return false;
+}
+
+// Pops from the list at `key` (which must exist) into a `[key, element]` reply. Replicas and a running migration
+// see a plain pop, the blocking command itself is never forwarded.
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::pop_to_waiter(std::string const& key, bool const front,
+                                                                  Response& resp)
+{
+    auto it = g_data.find(key);
+    List* list = value_as<List>(it->second);
+    std::string const value{ *(front ? list->pop_front() : list->pop_back()) };
+    if ( list->size() == 0 )
+        g_data.erase(it);
+
+    resp.status = ResponseStatus::RES_OK;
+    append_array_header(resp.data, 2);
+    append_array_element(resp.data, key);
+    append_array_element(resp.data, value);
+
+    if ( migration_ && migration_->in_flight.contains(key) )
+        migration_->dirty.insert(key);
+    if ( !watched_keys_.empty() )
+        watched_keys_.touch(key);
+    if ( !tracking_.empty() )
+        invalidate_key(key);
+    if ( backlog_ )
+    {
+        std::vector<uint8_t> pop;
+        append_request_frame(pop, { front ? "lpop" : "rpop", key });
+        propagate(pop.data(), pop.size());
+    }
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::signal_list_ready(std::string const& key)
+{
+    if ( !blocked_keys_.empty() && blocked_keys_.contains(key) )
+        ready_keys_.push_back(key);
+}
+
+// Hands the elements pushed by the last request to the clients blocked on them, the longest waiting first
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::serve_blocked_clients()
+{
+    // Resumed clients run their pipelined requests from here, the outer loop picks up whatever they push
+    if ( serving_blocked_ )
+        return;
+    serving_blocked_ = true;
+
+    while ( !ready_keys_.empty() )
+    {
+        std::string const key{ std::move(ready_keys_.back()) };
+        ready_keys_.pop_back();
+
+        for ( auto waiters = blocked_keys_.find(key); waiters != blocked_keys_.end();
+              waiters = blocked_keys_.find(key) )
+        {
+            auto it = g_data.find(key);
+            if ( it == g_data.end() || !value_as<List>(it->second) )
+                break;
+
+            int const fd = waiters->second.front();
+            Response resp{};
+            pop_to_waiter(key, blocked_clients_.at(fd).front, resp);
+            unblock_client(fd);
+
+            auto& conn = epoll_.get_connection(fd);
+            make_response(resp, conn.outgoing);
+            resume_client(conn);
+        }
+    }
+    serving_blocked_ = false;
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::unblock_client(int const fd)
+{
+    auto it = blocked_clients_.find(fd);
+    if ( it == blocked_clients_.end() )
+        return;
+
+    for ( auto const& key : it->second.keys )
+    {
+        auto waiters = blocked_keys_.find(key);
+        if ( waiters == blocked_keys_.end() )
+            continue;
+        std::erase(waiters->second, fd);
+        if ( waiters->second.empty() )
+            blocked_keys_.erase(waiters);
+    }
+    block_deadlines_.erase({ it->second.deadline, fd });
+    blocked_clients_.erase(it);
+}
+
+// Flushes the answer to a blocking pop and serves the requests the client pipelined behind it
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::resume_client(Connection& conn)
+{
+    // A shared-memory channel drains `conn.outgoing` and `conn.incoming` on its own events
+    if ( shm_channels_.contains(conn.fd) )
+    {
+        eventfd_notify(conn.fd);
+        return;
+    }
+
+    while ( try_request(conn) )
+    {
+    }
+
+    if ( conn.want_close )
+        handle_close_event(conn);
+    else if ( !conn.outgoing.empty() )
+        epoll_.modify_conn(conn.fd, EPOLLIN | EPOLLOUT);
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::handle_block_timer()
+{
+    uint64_t expirations{};
+    [[maybe_unused]] auto ret = ::read(block_timer_fd_, &expirations, sizeof(expirations));
+
+    // A timed out pop answers RES_NX, like a pop from a missing key
+    auto const now = std::chrono::steady_clock::now();
+    while ( !block_deadlines_.empty() && block_deadlines_.begin()->first <= now )
+    {
+        int const fd = block_deadlines_.begin()->second;
+        unblock_client(fd);
+
+        auto& conn = epoll_.get_connection(fd);
+        Response resp{ ResponseStatus::RES_NX };
+        make_response(resp, conn.outgoing);
+        resume_client(conn);
+    }
+    arm_block_timer();
+}
+
+// Points the timer at the earliest deadline, a single timerfd covers every blocked client
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::arm_block_timer()
+{
+    if ( block_timer_fd_ == -1 )
+    {
+        block_timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if ( block_timer_fd_ == -1 )
+        {
+            spdlog::error("[BLOCK] Failed to create the timeout timer, blocking pops never time out. err: {}",
+                          std::strerror(errno));
+            return;
+        }
+        epoll_.add_conn(block_timer_fd_);
+    }
+
+    // steady_clock is CLOCK_MONOTONIC, a zero it_value disarms the timer
+    itimerspec spec{};
+    if ( !block_deadlines_.empty() )
+    {
+        auto const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            block_deadlines_.begin()->first.time_since_epoch())
+                            .count();
+        spec.it_value.tv_sec = ns / 1'000'000'000;
+        spec.it_value.tv_nsec = ns % 1'000'000'000;
+    }
+    timerfd_settime(block_timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+/* ============================================== Pub/Sub ============================================== */
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::is_subscription_command(std::vector<std::string> const& cmd) noexcept
+{
+    return !cmd.empty() && (cmd[0] == "subscribe" || cmd[0] == "unsubscribe" || cmd[0] == "psubscribe" ||
+                            cmd[0] == "punsubscribe");
+}
+
+// One reply for the whole command: `[kind, name, subscriptions left] ...`, one triple per channel or pattern
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::do_subscription_command(Connection& conn,
+                                                                            std::vector<std::string> const& cmd,
+                                                                            Response& resp)
+{
+    bool const pattern = cmd[0].starts_with('p');
+    bool const subscribing = !cmd[0].starts_with(pattern ? "pun" : "un");
+    if ( subscribing && cmd.size() < 2 )
+    {
+        std::string_view const err{ "ERR wrong number of arguments" };
+        resp.status = ResponseStatus::RES_ERR;
+        resp.data.assign(err.begin(), err.end());
+        return;
+    }
+
+    // Unsubscribing without arguments drops every channel (or pattern) of the connection
+    std::vector<std::string> names{ cmd.begin() + 1, cmd.end() };
+    if ( names.empty() )
+    {
+        if ( auto const* sub = pubsub_.find(conn.fd) )
+        {
+            auto const& all = pattern ? sub->patterns : sub->channels;
+            names.assign(all.begin(), all.end());
+        }
+    }
+
+    resp.status = ResponseStatus::RES_OK;
+    append_array_header(resp.data, names.size() * 3);
+    for ( auto const& name : names )
+    {
+        size_t count{};
+        if ( pattern )
+            count = subscribing ? pubsub_.psubscribe(conn.fd, name) : pubsub_.punsubscribe(conn.fd, name);
+        else
+            count = subscribing ? pubsub_.subscribe(conn.fd, name) : pubsub_.unsubscribe(conn.fd, name);
+        append_array_element(resp.data, cmd[0]);
+        append_array_element(resp.data, name);
+        append_array_element(resp.data, std::to_string(count));
+    }
+}
+
+// Encodes one frame per receiver group and queues a reference to it on every receiver, returns the receivers
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+size_t Server<ISocketWrapperBase, IEpollWrapperBase>::publish(std::string const& channel, std::string const& payload)
+{
+    size_t receivers{ 0 };
+    std::vector<int> over_limit;
+    pubsub_.for_each_receiver_group(
+        channel,
+        [&](std::string const* pattern, std::vector<int> const& fds)
+        {
+            Response msg{ ResponseStatus::RES_OK };
+            append_array_header(msg.data, pattern ? 4 : 3);
+            append_array_element(msg.data, pattern ? "pmessage" : "message");
+            if ( pattern )
+                append_array_element(msg.data, *pattern);
+            append_array_element(msg.data, channel);
+            append_array_element(msg.data, payload);
+
+            auto frame = std::make_shared<std::vector<uint8_t>>();
+            frame->reserve(LEN_FIELD_SIZE + sizeof(msg.status) + msg.data.size());
+            make_response(msg, *frame);
+            for ( int const fd : fds )
+                push_frame(fd, frame, over_limit);
+            receivers += fds.size();
+        });
+
+    // Unsubscribing changes the lists walked above, so subscribers over their limits are only dropped now
+    std::sort(over_limit.begin(), over_limit.end());
+    over_limit.erase(std::unique(over_limit.begin(), over_limit.end()), over_limit.end());
+    for ( int const fd : over_limit )
+        disconnect_slow_client(fd);
+    return receivers;
+}
+
+// Queues a frame that was not asked for (a message or an invalidation) on `fd`, which is added to `over_limit` once
+// its pending output passes the pub/sub limits
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::push_frame(
+    int const fd, std::shared_ptr<std::vector<uint8_t> const> const& frame, std::vector<int>& over_limit)
+{
+    auto& conn = epoll_.get_connection(fd);
+    if ( !shm_channels_.empty() && shm_channels_.contains(fd) )
+    {
+        // The response ring is shared memory, the frame has to be copied there anyway
+        conn.outgoing.insert(conn.outgoing.end(), frame->begin(), frame->end());
+        eventfd_notify(fd);
+    }
+    else
+    {
+        // An idle subscriber is written to right away, usually the frame is gone before anything is queued
+        bool const idle = conn.outgoing.empty() && conn.shared.empty();
+        size_t sent{ 0 };
+        if ( idle )
+            sent = std::max<ssize_t>(::send(fd, frame->data(), frame->size(), MSG_NOSIGNAL), 0);
+
+        if ( sent < frame->size() )
+        {
+            conn.shared.push_back({ frame, conn.outgoing_sent + conn.outgoing.size() });
+            conn.shared_bytes += frame->size();
+            if ( idle )
+            {
+                conn.shared_offset = sent;
+                epoll_.modify_conn(fd, EPOLLIN | EPOLLOUT);
+            }
+        }
+    }
+
+    size_t const pending = conn.outgoing.size() + conn.shared_bytes;
+    if ( pending <= config_.pubsub_limits.soft )
+    {
+        if ( !pubsub_over_soft_limit_.empty() )
+            pubsub_over_soft_limit_.erase(fd);
+        return;
+    }
+
+    auto const now = std::chrono::steady_clock::now();
+    auto const since = pubsub_over_soft_limit_.try_emplace(fd, now).first->second;
+    if ( pending > config_.pubsub_limits.hard || now - since >= config_.pubsub_limits.soft_seconds )
+        over_limit.push_back(fd);
+}
+
+// Drops the subscriptions, tracking and queued output and shuts the socket down, the event loop then closes it like any
+// hung up client. Closing it here could pull the connection from under a request that is being served.
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::disconnect_slow_client(int const fd)
+{
+    auto& conn = epoll_.get_connection(fd);
+    spdlog::warn("[PUBSUB] Client {} -> {} bytes of output pending, over the output limits, disconnecting", fd,
+                 conn.outgoing.size() + conn.shared_bytes);
+
+    pubsub_.remove(fd);
+    pubsub_over_soft_limit_.erase(fd);
+    tracking_clients_.erase(fd);
+    conn.shared.clear();
+    conn.shared_bytes = 0;
+    conn.shared_offset = 0;
+    conn.outgoing_sent += conn.outgoing.size();
+    conn.outgoing.clear();
+
+    auto it = shm_channels_.find(fd);
+    ::shutdown(it == shm_channels_.end() ? fd : it->second.owner_fd, SHUT_RDWR);
+}
+
+/* ============================================== Client Tracking ============================================== */
+// client tracking on|off
+// client compression on|off
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::do_client_command(Connection& conn,
+                                                                      std::vector<std::string> const& cmd,
+                                                                      Response& resp)
+{
+    if ( cmd.size() == 3 && cmd[1] == "compression" && (cmd[2] == "on" || cmd[2] == "off") )
+    {
+        conn.compressed_replies = cmd[2] == "on";
+        resp.status = ResponseStatus::RES_OK;
+        return;
+    }
+    if ( cmd.size() == 3 && cmd[1] == "tracking" && (cmd[2] == "on" || cmd[2] == "off") )
+    {
+        // A new generation on every `on`, keys read before `off` are not invalidated for the next session
+        if ( cmd[2] == "on" )
+            tracking_clients_.insert_or_assign(conn.fd, ++tracking_generation_);
+        else
+            tracking_clients_.erase(conn.fd);
+        resp.status = ResponseStatus::RES_OK;
+        return;
+    }
+
+    std::string_view const err{ "ERR unknown client subcommand or wrong number of arguments" };
+    resp.status = ResponseStatus::RES_ERR;
+    resp.data.assign(err.begin(), err.end());
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::track_reads(int const fd, std::vector<std::string> const& cmd)
+{
+    TrackedReader const reader{ fd, tracking_clients_[fd] };
+    for_each_key(cmd,
+                 [&](std::string const& key)
+                 {
+                     tracking_.remember(key, reader, [this](std::vector<TrackedReader> const& evicted)
+                                        { send_invalidation(evicted, nullptr); });
+                 });
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::invalidate_keys(std::vector<std::string> const& cmd)
+{
+    for_each_key(cmd, [this](std::string const& key) { invalidate_key(key); });
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::invalidate_key(std::string const& key)
+{
+    auto const readers = tracking_.take(key);
+    if ( !readers.empty() )
+        send_invalidation(readers, &key);
+}
+
+// Pushes `[invalidate, key]` (`[invalidate, nil]` without a key) to the readers still tracking, one shared frame
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::send_invalidation(std::vector<TrackedReader> const& readers,
+                                                                      std::string const* key)
+{
+    std::shared_ptr<std::vector<uint8_t>> frame;
+    std::vector<int> over_limit;
+    for ( auto const& reader : readers )
+    {
+        // Closed, stopped tracking or tracking again since the read: nothing of that session is cached
+        auto it = tracking_clients_.find(reader.fd);
+        if ( it == tracking_clients_.end() || it->second != reader.generation )
+            continue;
+
+        if ( !frame )
+        {
+            Response msg{ ResponseStatus::RES_PUSH };
+            append_array_header(msg.data, 2);
+            append_array_element(msg.data, "invalidate");
+            if ( key )
+                append_array_element(msg.data, *key);
+            else
+                append_array_nil(msg.data);
+
+            frame = std::make_shared<std::vector<uint8_t>>();
+            make_response(msg, *frame);
+        }
+        push_frame(reader.fd, frame, over_limit);
+    }
+
+    // A reader appears once per key
+    for ( int const fd : over_limit )
+        disconnect_slow_client(fd);
+}
+
+/* ============================================== Scan ============================================== */
+/**
+ * scan <cursor> [match <pattern>] [count <n>] [type <type>] -> [next cursor, key ...]
+ *
+ * g_data is ordered, so the cursor is simply the last key examined (`>key`, `0` to start and once the walk is done)
+ * and the next call resumes right after it. A key present for the whole scan is returned exactly once however the
+ * keyspace changes in between, and the cursor stays valid on a replica. Every call examines at most `count` keys
+ * (capped at SCAN_MAX_COUNT), so with a pattern that rarely matches a call may return no keys but a new cursor.
+ */
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::do_scan_command(std::vector<std::string> const& cmd,
+                                                                    Response& resp)
+{
+    auto fail = [&resp](std::string_view err)
+    {
+        resp.status = ResponseStatus::RES_ERR;
+        resp.data.assign(err.begin(), err.end());
+    };
+
+    std::string const& cursor = cmd[1];
+    if ( cursor != "0" && !cursor.starts_with(SCAN_CURSOR_PREFIX) )
+        return fail("ERR invalid cursor");
+
+    std::string_view pattern{ "*" };
+    std::string_view type{};
+    size_t count{ SCAN_DEFAULT_COUNT };
+    for ( size_t i = 2; i < cmd.size(); i += 2 )
+    {
+        if ( i + 1 == cmd.size() )
+            return fail("ERR syntax error");
+        if ( cmd[i] == "match" )
+            pattern = cmd[i + 1];
+        else if ( cmd[i] == "type" )
+            type = cmd[i + 1];
+        else if ( cmd[i] == "count" )
+        {
+            if ( !parse_int(cmd[i + 1], count) || count == 0 )
+                return fail("ERR count must be a positive integer");
+        }
+        else
+            return fail("ERR syntax error");
+    }
+
+    auto it = cursor == "0" ? g_data.begin() : g_data.upper_bound(cursor.substr(SCAN_CURSOR_PREFIX.size()));
+    size_t const budget = std::min(count, SCAN_MAX_COUNT);
+
+    std::vector<std::string const*> keys;
+    std::string const* last{ nullptr };
+    for ( size_t examined = 0; examined < budget && it != g_data.end(); examined++, ++it )
+    {
+        last = &it->first;
+        if ( (type.empty() || type_name(it->second) == type) && (pattern == "*" || glob_match(pattern, it->first)) )
+            keys.push_back(&it->first);
+    }
+
+    append_array_header(resp.data, keys.size() + 1);
+    append_array_element(resp.data, it == g_data.end() ? std::string("0") : std::string(SCAN_CURSOR_PREFIX) + *last);
+    for ( auto const* key : keys )
+        append_array_element(resp.data, *key);
+    resp.status = ResponseStatus::RES_OK;
+}
+
+/* ============================================== Prefix Queries ============================================== */
+/**
+ * prefix <prefix> [cursor <c>] [limit <n>] [withvalues]
+ * range <start> <end> [cursor <c>] [limit <n>] [withvalues]     keys in [start, end), an empty end has no bound
+ * -> [next cursor, key, (value,) ...]
+ *
+ * Keys are returned in order, at most `limit` (default RANGE_DEFAULT_LIMIT, capped at SCAN_MAX_COUNT) per call. The
+ * cursor works like scan's: `0` to start and once done, `>key` to resume after the last key returned. Values of other
+ * types than string come back as nil. With --prefix-index the walk goes through the adaptive radix tree, otherwise
+ * through the ordered map.
+ */
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::do_prefix_command(std::vector<std::string> const& cmd,
+                                                                      Response& resp)
+{
+    auto fail = [&resp](std::string_view err)
+    {
+        resp.status = ResponseStatus::RES_ERR;
+        resp.data.assign(err.begin(), err.end());
+    };
+
+    bool const is_prefix = cmd[0] == "prefix";
+    std::string const& start = cmd[1];
+    std::string_view const end{ is_prefix ? std::string_view() : std::string_view(cmd[2]) };
+
+    std::string lower{ start };
+    size_t limit{ RANGE_DEFAULT_LIMIT };
+    bool with_values{ false };
+    for ( size_t i = is_prefix ? 2 : 3; i < cmd.size(); i++ )
+    {
+        if ( cmd[i] == "withvalues" )
+            with_values = true;
+        else if ( i + 1 == cmd.size() )
+            return fail("ERR syntax error");
+        else if ( cmd[i] == "limit" )
+        {
+            if ( !parse_int(cmd[i + 1], limit) || limit == 0 )
+                return fail("ERR limit must be a positive integer");
+            i++;
+        }
+        else if ( cmd[i] == "cursor" )
+        {
+            std::string const& cursor = cmd[++i];
+            if ( cursor != "0" && !cursor.starts_with(SCAN_CURSOR_PREFIX) )
+                return fail("ERR invalid cursor");
+            // The smallest key after the cursor's is the cursor's with a 0 byte appended
+            if ( cursor != "0" )
+                lower = std::max(lower, cursor.substr(SCAN_CURSOR_PREFIX.size()) + '\0');
+        }
+        else
+            return fail("ERR syntax error");
+    }
+    limit = std::min(limit, SCAN_MAX_COUNT);
+
+    std::vector<Keyspace::Map::value_type const*> found;
+    bool more{ false };
+    auto visit = [&](Keyspace::Map::value_type const& entry)
+    {
+        if ( is_prefix ? !entry.first.starts_with(start) : (!end.empty() && entry.first >= end) )
+            return false;
+        if ( found.size() == limit )
+        {
+            more = true;
+            return false;
+        }
+        found.push_back(&entry);
+        return true;
+    };
+
+    if ( auto const* index = g_data.prefix_index() )
+        index->for_each_from(lower, visit);
+    else
+    {
+        for ( auto it = g_data.lower_bound(lower); it != g_data.end() && visit(*it); ++it )
+            ;
+    }
+
+    append_array_header(resp.data, 1 + found.size() * (with_values ? 2 : 1));
+    append_array_element(resp.data, more ? std::string(SCAN_CURSOR_PREFIX) + found.back()->first : std::string("0"));
+    StringBuffer buf;
+    for ( auto const* entry : found )
+    {
+        append_array_element(resp.data, entry->first);
+        if ( !with_values )
+            continue;
+        if ( auto const value = read_string(entry->second, buf) )
+            append_array_element(resp.data, *value);
+        else
+            append_array_nil(resp.data);
+    }
+    resp.status = ResponseStatus::RES_OK;
+}
+
+/* ============================================== Bloom Filters ============================================== */
+/**
+ * bf.reserve <key> <error rate> <capacity>     creates an empty filter, fails if the key exists
+ * bf.add <key> <item>                          1 if the item is new, 0 if it may have been added before
+ * bf.madd <key> <item> [<item> ...]            array of bf.add replies
+ * bf.exists <key> <item>                       1 if the item may have been added, 0 if it was not
+ * bf.mexists <key> <item> [<item> ...]         array of bf.exists replies
+ * bf.info <key>                                [capacity, n, error_rate, r, items, n, bytes, n, bytes_per_item, r,
+ *                                               estimated_fpr, r]
+ *
+ * bf.add/bf.madd on a missing key create a filter with BLOOM_DEFAULT_CAPACITY and BLOOM_DEFAULT_ERROR_RATE, like
+ * RedisBloom. bf.exists on a missing key answers 0. bytes_per_item divides by the capacity until more items than that
+ * were added, estimated_fpr is the false positive rate given the bits set so far.
+ */
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::do_bloom_command(std::vector<std::string> const& cmd,
+                                                                     Response& resp)
+{
+    auto set_data = [&resp](std::string_view str) { resp.data.assign(str.begin(), str.end()); };
+    auto bad_request = [&](std::string_view err)
+    {
+        resp.status = ResponseStatus::RES_ERR;
+        set_data(err);
+    };
+
+    std::string const& key = cmd[1];
+    resp.status = ResponseStatus::RES_OK;
+
+    if ( cmd[0] == "bf.reserve" && cmd.size() == 4 )
+    {
+        double error_rate{};
+        uint64_t capacity{};
+        auto const [p1, ec1] = std::from_chars(cmd[2].data(), cmd[2].data() + cmd[2].size(), error_rate);
+        auto const [p2, ec2] = std::from_chars(cmd[3].data(), cmd[3].data() + cmd[3].size(), capacity);
+        if ( ec1 != std::errc{} || p1 != cmd[2].data() + cmd[2].size() || ec2 != std::errc{} ||
+             p2 != cmd[3].data() + cmd[3].size() || !BloomFilter::valid_params(capacity, error_rate) )
+            return bad_request("ERR error rate must be in (0, 1) and capacity positive, within 4 GiB of filter");
+        if ( g_data.contains(key) )
+            return bad_request("ERR item exists");
+
+        g_data.emplace(key, std::make_unique<BloomFilter>(capacity, error_rate));
+    }
+    else if ( (cmd[0] == "bf.add" && cmd.size() == 3) || (cmd[0] == "bf.madd" && cmd.size() >= 3) )
+    {
+        BloomFilter* bloom = find_value<BloomFilter>(key, resp);
+        if ( resp.status == ResponseStatus::RES_ERR )
+            return;
+        if ( !bloom )
+        {
+            auto created = std::make_unique<BloomFilter>(BLOOM_DEFAULT_CAPACITY, BLOOM_DEFAULT_ERROR_RATE);
+            bloom = value_as<BloomFilter>(g_data.emplace(key, std::move(created)).first->second);
+        }
+
+        if ( cmd[0] == "bf.add" )
+            return set_data(bloom->add(cmd[2]) ? "1" : "0");
+        append_array_header(resp.data, cmd.size() - 2);
+        for ( size_t i = 2; i < cmd.size(); i++ )
+            append_array_element(resp.data, bloom->add(cmd[i]) ? "1" : "0");
+    }
+    else if ( (cmd[0] == "bf.exists" && cmd.size() == 3) || (cmd[0] == "bf.mexists" && cmd.size() >= 3) )
+    {
+        BloomFilter const* bloom = find_value<BloomFilter>(key, resp);
+        if ( resp.status == ResponseStatus::RES_ERR )
+            return;
+
+        if ( cmd[0] == "bf.exists" )
+            return set_data(bloom && bloom->contains(cmd[2]) ? "1" : "0");
+        append_array_header(resp.data, cmd.size() - 2);
+        for ( size_t i = 2; i < cmd.size(); i++ )
+            append_array_element(resp.data, bloom && bloom->contains(cmd[i]) ? "1" : "0");
+    }
+    else if ( cmd[0] == "bf.info" && cmd.size() == 2 )
+    {
+        BloomFilter const* bloom = find_value<BloomFilter>(key, resp);
+        if ( resp.status == ResponseStatus::RES_ERR )
+            return;
+        if ( !bloom )
+        {
+            resp.status = ResponseStatus::RES_NX;
+            return;
+        }
+
+        double const per_item = static_cast<double>(bloom->bytes()) / std::max(bloom->capacity(), bloom->items());
+        std::pair<std::string_view, std::string> const fields[]{
+            { "capacity", std::to_string(bloom->capacity()) },
+            { "error_rate", format_score(bloom->error_rate()) },
+            { "items", std::to_string(bloom->items()) },
+            { "bytes", std::to_string(bloom->bytes()) },
+            { "bytes_per_item", format_score(per_item) },
+            { "estimated_fpr", format_score(bloom->estimated_fpr()) },
+        };
+        append_array_header(resp.data, std::size(fields) * 2);
+        for ( auto const& [name, value] : fields )
+        {
+            append_array_element(resp.data, name);
+            append_array_element(resp.data, value);
+        }
+    }
+    else
+        bad_request("ERR unknown or malformed bloom filter command");
+}
+
+/* ============================================== HyperLogLog ============================================== */
+/**
+ * pfadd <key> [<item> ...]              1 if the sketch was created or a register changed, 0 otherwise
+ * pfcount <key> [<key> ...]             estimated distinct items, of the union when given several keys
+ * pfmerge <dest> <key> [<key> ...]      dest becomes the union of itself and the keys
+ *
+ * Missing keys count as empty sketches. pfcount of one key is cached in the sketch until it changes, a union is
+ * merged into a scratch register array on every call.
+ */
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::do_hll_command(std::vector<std::string> const& cmd,
+                                                                   Response& resp)
+{
+    auto set_data = [&resp](std::string_view str) { resp.data.assign(str.begin(), str.end()); };
+
+    std::string const& key = cmd[1];
+    resp.status = ResponseStatus::RES_OK;
+
+    // Folds the sketches of keys [first, end) into `regs`, false after a WRONGTYPE
+    auto merge_keys = [&](size_t first, HyperLogLog::Registers& regs)
+    {
+        for ( size_t i = first; i < cmd.size(); i++ )
+        {
+            if ( HyperLogLog const* hll = find_value<HyperLogLog>(cmd[i], resp) )
+                hll->max_into(regs);
+            if ( resp.status == ResponseStatus::RES_ERR )
+                return false;
+        }
+        return true;
+    };
+
+    if ( cmd[0] == "pfadd" )
+    {
+        HyperLogLog* hll = find_value<HyperLogLog>(key, resp);
+        if ( resp.status == ResponseStatus::RES_ERR )
+            return;
+
+        bool changed{ !hll };
+        if ( !hll )
+            hll = value_as<HyperLogLog>(g_data.emplace(key, std::make_unique<HyperLogLog>()).first->second);
+        for ( size_t i = 2; i < cmd.size(); i++ )
+            changed |= hll->add(cmd[i]);
+        set_data(changed ? "1" : "0");
+    }
+    else if ( cmd[0] == "pfcount" && cmd.size() == 2 )
+    {
+        HyperLogLog const* hll = find_value<HyperLogLog>(key, resp);
+        if ( resp.status == ResponseStatus::RES_OK )
+            set_data(std::to_string(hll ? hll->count() : 0));
+    }
+    else if ( cmd[0] == "pfcount" )
+    {
+        auto regs = std::make_unique<HyperLogLog::Registers>();
+        if ( !merge_keys(1, *regs) )
+            return;
+        set_data(std::to_string(HyperLogLog::count(*regs)));
+    }
+    else if ( cmd[0] == "pfmerge" && cmd.size() >= 3 )
+    {
+        auto regs = std::make_unique<HyperLogLog::Registers>();
+        if ( !merge_keys(1, *regs) )
+            return;
+        HyperLogLog* dest = find_value<HyperLogLog>(key, resp);
+        if ( !dest )
+            dest = value_as<HyperLogLog>(g_data.emplace(key, std::make_unique<HyperLogLog>()).first->second);
+        dest->assign(*regs);
+    }
+    else
+    {
+        resp.status = ResponseStatus::RES_ERR;
+        set_data("ERR unknown or malformed hyperloglog command");
+    }
+}
+
+/* ============================================== Compression ============================================== */
+/**
+ * get <key>
+ * A compressed value is inflated straight into the reply, or sent as it is stored (RES_COMPRESSED) to a client that
+ * negotiated it, which saves the inflating here and the bandwidth.
+ */
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::do_get(std::string const& key, Response& resp,
+                                                           bool const compressed_reply)
+{
+    auto it = g_data.find(key);
+    if ( it == g_data.end() )
+    {
+        resp.status = ResponseStatus::RES_NX;
+        return;
+    }
+
+    if ( auto const* packed = value_as<CompressedString>(it->second) )
+    {
+        if ( compressed_reply )
+        {
+            uint32_t const raw_size = packed->raw_size();
+            std::string_view const block = packed->block();
+            resp.data.resize(sizeof(raw_size) + block.size());
+            std::memcpy(resp.data.data(), &raw_size, sizeof(raw_size));
+            std::memcpy(resp.data.data() + sizeof(raw_size), block.data(), block.size());
+            resp.status = ResponseStatus::RES_COMPRESSED;
+            compression_stats_.compressed_replies++;
+            compression_stats_.reply_bytes_saved += raw_size - block.size();
+            return;
+        }
+        resp.data.resize(packed->raw_size());
+        inflate(*packed, reinterpret_cast<char*>(resp.data.data()));
+        resp.status = ResponseStatus::RES_OK;
+        return;
+    }
+
+    StringBuffer buf;
+    if ( auto const val = string_of(it->second, buf) )
+    {
+        resp.data.assign(val->begin(), val->end());
+        resp.status = ResponseStatus::RES_OK;
+    }
+    else
+    {
+        resp.status = ResponseStatus::RES_ERR;
+        resp.data.assign(WRONGTYPE_ERR.begin(), WRONGTYPE_ERR.end());
+    }
+}
+
+// `str` as `set`/`mset` store it: compressed if it reaches the threshold and compresses well enough
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+Value Server<ISocketWrapperBase, IEpollWrapperBase>::make_stored_string(std::string const& str)
+{
+    // Integers keep their int64_t encoding, `incr` must find them
+    if ( config_.compress_threshold == 0 || str.size() < config_.compress_threshold || str.size() <= MAX_INT_STR_SIZE )
+        return make_string_value(str);
+
+    auto const start = std::chrono::steady_clock::now();
+    auto packed = compress_string(str);
+    compression_stats_.compress_ns +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    compression_stats_.attempted_bytes += str.size();
+    if ( !packed )
+    {
+        compression_stats_.incompressible++;
+        return str;
+    }
+
+    compression_stats_.compressed++;
+    compression_stats_.raw_bytes += str.size();
+    compression_stats_.compressed_bytes += packed->block().size();
+    return packed;
+}
+
+// string_of() that accounts for the compressed strings it inflates
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+std::optional<std::string_view> Server<ISocketWrapperBase, IEpollWrapperBase>::read_string(Value const& value,
+                                                                                          StringBuffer& buf)
+{
+    if ( auto const* packed = value_as<CompressedString>(value) )
+    {
+        buf.inflated.resize(packed->raw_size());
+        inflate(*packed, buf.inflated.data());
+        return std::string_view(buf.inflated);
+    }
+    return string_of(value, buf);
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::inflate(CompressedString const& packed, char* out)
+{
+    auto const start = std::chrono::steady_clock::now();
+    packed.inflate(out);
+    compression_stats_.inflate_ns +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    compression_stats_.inflated++;
+    compression_stats_.inflated_bytes += packed.raw_size();
+}
+
+/**
+ * `info compression`: what compression saved (ratio, bytes) and what it cost in CPU time, with throughputs in MB of
+ * raw data per second of CPU. A low ratio or a high incompressible share says the threshold is too low.
+ */
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+std::string Server<ISocketWrapperBase, IEpollWrapperBase>::compression_info() const
+{
+    std::string info;
+    auto line = [&info](std::string_view key, auto const& value)
+    {
+        info.append(key);
+        info += ':';
+        if constexpr ( std::is_convertible_v<decltype(value), std::string_view> )
+            info.append(value);
+        else if constexpr ( std::is_floating_point_v<std::remove_cvref_t<decltype(value)>> )
+            info.append(format_score(std::round(value * 100) / 100));
+        else
+            info.append(std::to_string(value));
+        info += '\n';
+    };
+    auto ratio = [](uint64_t num, uint64_t den) { return den ? static_cast<double>(num) / den : 0.0; };
+
+    CompressionStats const& s = compression_stats_;
+    line("compression_threshold", config_.compress_threshold);
+    line("compressed_writes", s.compressed);
+    line("incompressible_writes", s.incompressible);
+    line("compressed_raw_bytes", s.raw_bytes);
+    line("compressed_bytes", s.compressed_bytes);
+    line("compression_ratio", ratio(s.raw_bytes, s.compressed_bytes));
+    line("compress_cpu_us", s.compress_ns / 1000);
+    line("compress_mb_per_sec", ratio(s.attempted_bytes * 1000, s.compress_ns));
+    line("inflated_reads", s.inflated);
+    line("inflated_bytes", s.inflated_bytes);
+    line("inflate_cpu_us", s.inflate_ns / 1000);
+    line("inflate_mb_per_sec", ratio(s.inflated_bytes * 1000, s.inflate_ns));
+    line("compressed_replies", s.compressed_replies);
+    line("reply_bytes_saved", s.reply_bytes_saved);
+    return info;
+}
+
+/* ============================================== Transactions ============================================== */
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::is_transaction_command(std::vector<std::string> const& cmd) noexcept
+{
+    return !cmd.empty() && (cmd[0] == "multi" || cmd[0] == "exec" || cmd[0] == "discard" || cmd[0] == "watch" ||
+                            cmd[0] == "unwatch");
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::is_queuing(int const fd) const noexcept
+{
+    auto it = transactions_.find(fd);
+    return it != transactions_.end() && it->second.queuing;
+}
+
+// multi | exec | discard | watch <key> [<key> ...] | unwatch, and every other request between `multi` and `exec`
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::do_transaction_command(Connection& conn,
+                                                                           std::vector<std::string>&& cmd,
+                                                                           Response& resp)
+{
+    bool const queuing = is_queuing(conn.fd);
+    std::string_view err{};
+    resp.status = ResponseStatus::RES_OK;
+
+    if ( cmd.empty() )
+        err = "ERR empty command";
+    else if ( cmd[0] == "multi" && cmd.size() == 1 )
+    {
+        if ( queuing )
+            err = "ERR multi calls can not be nested";
+        else
+            transactions_[conn.fd].queuing = true;
+    }
+    else if ( cmd[0] == "exec" && cmd.size() == 1 )
+    {
+        if ( !queuing )
+            err = "ERR exec without multi";
+        else
+            exec_transaction(conn, resp);
+    }
+    else if ( cmd[0] == "discard" && cmd.size() == 1 )
+    {
+        if ( !queuing )
+            err = "ERR discard without multi";
+        else
+            end_transaction(conn.fd);
+    }
+    else if ( cmd[0] == "watch" && cmd.size() >= 2 )
+    {
+        if ( queuing )
+            err = "ERR watch inside multi is not allowed";
+        else
+        {
+            auto& txn = transactions_[conn.fd];
+            for ( size_t i = 1; i < cmd.size(); i++ )
+                txn.watched.emplace_back(cmd[i], watched_keys_.watch(cmd[i]));
+        }
+    }
+    else if ( cmd[0] == "unwatch" && cmd.size() == 1 )
+    {
+        // Inside `multi` the watches stay until `exec`, which drops them anyway
+        if ( !queuing )
+            end_transaction(conn.fd);
+    }
+    else if ( is_transaction_command(cmd) )
+        err = "ERR wrong number of arguments";
+    else
+    {
+        // Refused requests fail the whole transaction at `exec`. Anything else is queued without a look at its
+        // arguments and fails on its own when it runs, like it would outside a transaction.
+        auto& txn = transactions_.at(conn.fd);
+        if ( is_replica() && is_write_command(cmd) )
+            err = "READONLY writes must go to the primary";
+        else if ( is_subscription_command(cmd) || is_script_command(cmd) || cmd[0] == "client" )
+            err = "ERR command not allowed inside a transaction";
+
+        if ( err.empty() )
+        {
+            txn.queued.push_back(std::move(cmd));
+            std::string_view const queued{ "QUEUED" };
+            resp.data.assign(queued.begin(), queued.end());
+        }
+        else
+            txn.aborted = true;
+    }
+
+    if ( !err.empty() )
+    {
+        resp.status = ResponseStatus::RES_ERR;
+        resp.data.assign(err.begin(), err.end());
+    }
+}
+
+// Runs the queued requests back-to-back. The reply is an array of their response frames, or RES_NX if a watched key
+// was written since `watch`.
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::exec_transaction(Connection& conn, Response& resp)
+{
+    auto& txn = transactions_.at(conn.fd);
+    bool const aborted = txn.aborted;
+    bool const watched_changed =
+        std::ranges::any_of(txn.watched, [this](auto const& watched)
+                            { return watched_keys_.version(watched.first) != watched.second; });
+    std::vector<std::vector<std::string>> const queued{ std::move(txn.queued) };
+    end_transaction(conn.fd);
+
+    if ( aborted )
+    {
+        std::string_view const err{ "EXECABORT transaction discarded because of previous errors" };
+        resp.status = ResponseStatus::RES_ERR;
+        resp.data.assign(err.begin(), err.end());
+        return;
+    }
+    if ( watched_changed )
+    {
+        resp.status = ResponseStatus::RES_NX;
+        return;
+    }
+
+    // In cluster mode the keys of the whole transaction must live in one slot served here, like those of an `mget`
+    if ( cluster_.enabled() )
+    {
+        std::vector<std::string> keys{ "mget" };
+        for ( auto const& cmd : queued )
+            for_each_key(cmd, [&keys](std::string const& key) { keys.push_back(key); });
+        if ( !route_to_slot(keys, resp, conn.asking) )
+            return;
+    }
+
+    // Replicas get the writes between `multi` and `exec` and apply them together as well
+    bool const propagated = backlog_ && std::ranges::any_of(queued, &Server::is_write_command);
+    if ( propagated )
+        propagate_request({ "multi" });
+
+    resp.status = ResponseStatus::RES_OK;
+    append_array_header(resp.data, queued.size());
+    for ( auto const& cmd : queued )
+    {
+        Response reply{};
+        if ( !is_blocking_pop(cmd) )
+            do_request(cmd, reply);
+        else
+        {
+            // Nothing may wait inside a transaction, a blocking pop of empty lists answers RES_NX right away
+            reply.status = ResponseStatus::RES_NX;
+            for ( size_t i = 1; i + 1 < cmd.size() && reply.status == ResponseStatus::RES_NX; i++ )
+            {
+                if ( find_value<List>(cmd[i], reply) )
+                    pop_to_waiter(cmd[i], cmd[0] == "blpop", reply);
+            }
+        }
+        after_request(conn, cmd, reply);
+
+        if ( backlog_ && reply.status == ResponseStatus::RES_OK && is_write_command(cmd) && !is_blocking_pop(cmd) )
+            propagate_request(std::vector<std::string_view>(cmd.begin(), cmd.end()));
+
+        // The element is the response frame, written in place behind its length
+        size_t const len_pos = resp.data.size();
+        append_u32(resp.data, 0);
+        make_response(reply, resp.data);
+        uint32_t const len = resp.data.size() - len_pos - sizeof(len);
+        std::memcpy(resp.data.data() + len_pos, &len, sizeof(len));
+    }
+
+    if ( propagated )
+        propagate_request({ "exec" });
+}
+
+// Forgets the queue and the watches of `fd`
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::end_transaction(int const fd)
+{
+    if ( transactions_.empty() )
+        return;
+    auto it = transactions_.find(fd);
+    if ( it == transactions_.end() )
+        return;
+
+    for ( auto const& [key, _] : it->second.watched )
+        watched_keys_.unwatch(key);
+    transactions_.erase(it);
+}
+
+// True if the request frames from `pos` on include an `exec`, the end of the transaction they belong to
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::has_exec_frame(std::vector<uint8_t> const& stream, size_t pos)
+{
+    std::vector<uint8_t> exec;
+    append_request_frame(exec, { "exec" });
+
+    while ( stream.size() - pos >= LEN_FIELD_SIZE )
+    {
+        uint32_t data_len{};
+        std::memcpy(&data_len, stream.data() + pos, LEN_FIELD_SIZE);
+        if ( data_len > MAX_MSG_SIZE_LIMIT )
+            return true; // Corrupt, the caller's loop reaches the frame and drops the link
+        if ( stream.size() - pos < LEN_FIELD_SIZE + data_len )
+            return false;
+        if ( LEN_FIELD_SIZE + data_len == exec.size() && std::equal(exec.begin(), exec.end(), stream.begin() + pos) )
+            return true;
+        pos += LEN_FIELD_SIZE + data_len;
+    }
+    return false;
+}
+
+/* ============================================== Scripting ============================================== */
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::is_script_command(std::vector<std::string> const& cmd) noexcept
+{
+    return !cmd.empty() && (cmd[0] == "eval" || cmd[0] == "evalsha" || cmd[0] == "script");
+}
+
+// eval <source> <numkeys> [<key> ...] [<arg> ...] | evalsha <sha1> <numkeys> ... | script load <source> |
+// script exists <sha1> [<sha1> ...] | script flush
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::do_script_command(Connection& conn,
+                                                                      std::vector<std::string> const& cmd,
+                                                                      Response& resp)
+{
+    std::string err;
+    resp.status = ResponseStatus::RES_OK;
+
+    // The cached script of `source`, compiled on first use
+    auto load = [&](std::string const& source, std::string const& sha) -> Script const*
+    {
+        auto it = scripts_.find(sha);
+        if ( it != scripts_.end() )
+            return it->second.get();
+        auto script = compile_script(source, err);
+        return script ? scripts_.emplace(sha, std::move(script)).first->second.get() : nullptr;
+    };
+
+    if ( cmd[0] == "script" && cmd.size() == 3 && cmd[1] == "load" )
+    {
+        std::string const sha{ sha1_hex(cmd[2]) };
+        if ( load(cmd[2], sha) )
+            resp.data.assign(sha.begin(), sha.end());
+    }
+    else if ( cmd[0] == "script" && cmd.size() >= 3 && cmd[1] == "exists" )
+    {
+        append_array_header(resp.data, cmd.size() - 2);
+        for ( size_t i = 2; i < cmd.size(); i++ )
+            append_array_element(resp.data, scripts_.contains(cmd[i]) ? "1" : "0");
+    }
+    else if ( cmd[0] == "script" && cmd.size() == 2 && cmd[1] == "flush" )
+        scripts_.clear();
+    else if ( cmd[0] != "script" && cmd.size() >= 3 )
+    {
+        size_t num_keys{};
+        auto const [end, ec] = std::from_chars(cmd[2].data(), cmd[2].data() + cmd[2].size(), num_keys);
+        if ( ec != std::errc{} || end != cmd[2].data() + cmd[2].size() || num_keys > cmd.size() - 3 )
+            err = "ERR number of keys is not an integer or greater than the number of arguments";
+        else
+        {
+            Script const* script{ nullptr };
+            if ( cmd[0] == "eval" )
+                script = load(cmd[1], sha1_hex(cmd[1]));
+            else if ( auto it = scripts_.find(cmd[1]); it != scripts_.end() )
+                script = it->second.get();
+            else
+                err = "NOSCRIPT no script with this SHA-1, use `script load` or `eval`";
+
+            if ( script )
+                return eval_script(conn, *script, cmd, num_keys, resp);
+        }
+    }
+    else
+        err = "ERR unknown script subcommand or wrong number of arguments";
+
+    if ( !err.empty() )
+    {
+        resp.status = ResponseStatus::RES_ERR;
+        resp.data.assign(err.begin(), err.end());
+    }
+}
+
+// Runs `script` as one request: nothing else is served until it returns, fails or runs out of time. Replicas get the
+// writes it made between `multi` and `exec`, not the script, so they never run it themselves.
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::eval_script(Connection& conn, Script const& script,
+                                                                std::vector<std::string> const& cmd,
+                                                                size_t const num_keys, Response& resp)
+{
+    std::span<std::string const> const keys{ cmd.data() + 3, num_keys };
+    std::span<std::string const> const args{ cmd.data() + 3 + num_keys, cmd.size() - 3 - num_keys };
+
+    // In cluster mode the declared keys must live in one slot served here, like those of an `mget`
+    if ( cluster_.enabled() && num_keys > 0 )
+    {
+        std::vector<std::string> route{ "mget" };
+        route.insert(route.end(), keys.begin(), keys.end());
+        if ( !route_to_slot(route, resp, conn.asking) )
+            return;
+    }
+
+    bool propagated{ false };
+    auto call = [&](std::vector<std::string> const& call_cmd, ScriptValue& reply, std::string& err)
+    {
+        Response call_resp{};
+        if ( is_transaction_command(call_cmd) || is_script_command(call_cmd) || is_subscription_command(call_cmd) ||
+             is_blocking_pop(call_cmd) || call_cmd[0] == "client" || call_cmd[0] == "cluster" ||
+             call_cmd[0] == "config" )
+        {
+            err = "ERR " + call_cmd[0] + " cannot be called from a script";
+            return false;
+        }
+        if ( is_replica() && is_write_command(call_cmd) )
+        {
+            err = "READONLY writes must go to the primary";
+            return false;
+        }
+        if ( route_to_slot(call_cmd, call_resp, conn.asking) )
+        {
+            do_request(call_cmd, call_resp);
+            after_request(conn, call_cmd, call_resp);
+        }
+
+        if ( backlog_ && call_resp.status == ResponseStatus::RES_OK && is_write_command(call_cmd) )
+        {
+            if ( !std::exchange(propagated, true) )
+                propagate_request({ "multi" });
+            propagate_request(std::vector<std::string_view>(call_cmd.begin(), call_cmd.end()));
+        }
+
+        std::string data(call_resp.data.begin(), call_resp.data.end());
+        if ( call_resp.status == ResponseStatus::RES_OK )
+            reply = std::move(data);
+        else if ( call_resp.status == ResponseStatus::RES_NX )
+            reply = std::monostate{};
+        else
+        {
+            // Redirections keep their kind, they carry no prefix of their own on the wire
+            if ( call_resp.status == ResponseStatus::RES_MOVED || call_resp.status == ResponseStatus::RES_ASK )
+                data = (call_resp.status == ResponseStatus::RES_MOVED ? "MOVED " : "ASK ") + data;
+            err = data.empty() ? "ERR " + call_cmd[0] + " failed" : std::move(data);
+            return false;
+        }
+        return true;
+    };
+
+    auto const result =
+        run_script(script, keys, args, std::chrono::steady_clock::now() + config_.script_time_limit, call);
+    if ( propagated )
+        propagate_request({ "exec" });
+
+    // nil and false are RES_NX, true is 1
+    std::string data;
+    if ( !result.ok )
+    {
+        spdlog::info("[SCRIPT] Client {} -> {}", conn.fd, result.error);
+        resp.status = ResponseStatus::RES_ERR;
+        data = result.error;
+    }
+    else if ( std::holds_alternative<std::monostate>(result.value) ||
+              (std::holds_alternative<bool>(result.value) && !std::get<bool>(result.value)) )
+        resp.status = ResponseStatus::RES_NX;
+    else
+        data = std::holds_alternative<bool>(result.value) ? "1" : script_detail::to_string(result.value);
+    resp.data.assign(data.begin(), data.end());
+}
+
+/* ============================================== Configuration ============================================== */
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::configure(ServerConfig const& config)
+{
+    uint16_t const port = config_.port;
+    uint8_t const max_clients = config_.max_clients;
+    config_ = config;
+    config_.port = port;
+    config_.max_clients = max_clients;
+
+    if ( config_.prefix_index )
+        g_data.enable_prefix_index();
+    if ( !config_.cluster_config.empty() )
+    {
+        // Serve only the hash slots assigned to us in the slot map, see cluster.h
+        std::ifstream file(config_.cluster_config);
+        if ( !file )
+            throw std::runtime_error("Cannot open cluster config " + config_.cluster_config);
+        if ( config_.cluster_self.empty() )
+            config_.cluster_self = "127.0.0.1:" + std::to_string(port);
+        cluster_.load(file);
+        cluster_.enable(config_.cluster_self);
+    }
+    if ( !config_.replica_of.empty() )
+    {
+        // Run as a read-only replica, see replication.h. Checked by the same parser as `--replicaof`, which throws
+        // std::invalid_argument on anything but HOST:PORT.
+        set_config_param(config_, "replicaof", std::string(config_.replica_of), "configure");
+        auto const colon = config_.replica_of.rfind(':');
+        master_.host = config_.replica_of.substr(0, colon);
+        master_.port = static_cast<uint16_t>(std::stoi(config_.replica_of.substr(colon + 1)));
+    }
+    apply_runtime_config();
+}
+
+// The parts that keep a copy of their parameter, everything else reads config_ where it is used
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::apply_runtime_config()
+{
+    tracking_.set_max_keys(config_.tracking_max_keys);
+    g_data.set_lazy_free(config_.lazy_free);
+    spdlog::set_level(config_.log_level);
+}
+
+/**
+ * config get <pattern>        -> [name, value, ...] of every parameter matching the glob
+ * config set <name> <value>   only parameters marked runtime in config.h, the others answer RES_ERR
+ */
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::do_config_command(std::vector<std::string> const& cmd,
+                                                                      Response& resp)
+{
+    std::string err;
+    if ( cmd.size() == 3 && cmd[1] == "get" )
+    {
+        uint32_t count{ 0 };
+        append_array_header(resp.data, 0);
+        for ( ConfigParam const& param : CONFIG_PARAMS )
+        {
+            if ( !glob_match(cmd[2], param.name) )
+                continue;
+            append_array_element(resp.data, param.name);
+            append_array_element(resp.data, param.get(config_));
+            count += 2;
+        }
+        patch_array_header(resp.data, 0, count);
+        resp.status = ResponseStatus::RES_OK;
+        return;
+    }
+
+    if ( cmd.size() == 4 && cmd[1] == "set" )
+    {
+        ConfigParam const* param = find_config_param(cmd[2]);
+        if ( param == nullptr )
+            err = "ERR unknown parameter " + cmd[2];
+        else if ( !param->runtime )
+            err = "ERR " + cmd[2] + " can only be set at startup";
+        else if ( param->set(config_, cmd[3], err) )
+        {
+            spdlog::info("[CONFIG] {} set to {}", cmd[2], cmd[3]);
+            apply_runtime_config();
+            resp.status = ResponseStatus::RES_OK;
+            return;
+        }
+        else
+            err = "ERR " + cmd[2] + " " + err;
+    }
+    else
+        err = "ERR usage: config get <pattern> | config set <name> <value>";
+
+    resp.status = ResponseStatus::RES_ERR;
+    resp.data.assign(err.begin(), err.end());
+}
+
+/* ============================================== Shutdown ============================================== */
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::shutdown_on_signals()
+{
+    sigset_t mask{};
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    if ( pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0 )
+        throw std::runtime_error("Failed to block SIGTERM and SIGINT");
+
+    signal_fd_ = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if ( signal_fd_ == -1 )
+        throw std::runtime_error("Failed to create the signal fd");
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::shutdown()
+{
+    if ( !draining_ )
+        begin_shutdown();
+    finish_shutdown_if_drained();
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::handle_signal()
+{
+    signalfd_siginfo info{};
+    [[maybe_unused]] auto ret = ::read(signal_fd_, &info, sizeof(info));
+
+    if ( draining_ )
+    {
+        spdlog::warn("[SHUTDOWN] {} again, disconnecting the {} clients left", strsignal(info.ssi_signo),
+                     client_fds_.size());
+        cut_clients();
+        return;
+    }
+    spdlog::warn("[SHUTDOWN] {}, shutting down", strsignal(info.ssi_signo));
+    shutdown();
+}
+
+// Never finishes the shutdown itself, it runs while a connection is being handled
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::begin_shutdown()
+{
+    draining_ = true;
+
+    // The listeners leave the epoll set but stay open: new connections wait in their backlog, for a new process
+    // taking over or until we exit
+    if ( server_fd_ != -1 )
+        epoll_.remove_conn(server_fd_);
+    if ( unix_fd_ != -1 )
+        epoll_.remove_conn(unix_fd_);
+
+    // Links we opened ourselves go, the replication timer would reconnect to the primary
+    if ( repl_timer_fd_ != -1 )
+        epoll_.remove_conn(repl_timer_fd_);
+    if ( master_.fd != -1 )
+        ::shutdown(master_.fd, SHUT_RDWR);
+    if ( migration_ && migration_->fd != -1 )
+        ::shutdown(migration_->fd, SHUT_RDWR);
+
+    // Idle clients are disconnected, the others keep their connection until they have read their replies. Closing
+    // is left to the event loop, which still holds events of these connections.
+    for ( int const fd : client_fds_ )
+    {
+        auto const& conn = epoll_.get_connection(fd);
+        if ( conn.outgoing.empty() && conn.shared.empty() )
+            ::shutdown(fd, SHUT_RDWR);
+        else
+            epoll_.modify_conn(fd, EPOLLOUT);
+    }
+    spdlog::info("[SHUTDOWN] Stopped accepting, {} clients have replies pending", client_fds_.size());
+    if ( client_fds_.empty() )
+        return;
+
+    if ( config_.shutdown_timeout.count() == 0 )
+    {
+        cut_clients();
+        return;
+    }
+    if ( shutdown_timer_fd_ == -1 )
+    {
+        shutdown_timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if ( shutdown_timer_fd_ == -1 )
+        {
+            spdlog::error("[SHUTDOWN] Failed to create the shutdown timer, not waiting for clients. err: {}",
+                          std::strerror(errno));
+            cut_clients();
+            return;
+        }
+        epoll_.add_conn(shutdown_timer_fd_);
+    }
+    auto const timeout = std::chrono::duration_cast<std::chrono::nanoseconds>(config_.shutdown_timeout);
+    itimerspec spec{};
+    spec.it_value.tv_sec = timeout.count() / 1000000000;
+    spec.it_value.tv_nsec = timeout.count() % 1000000000;
+    timerfd_settime(shutdown_timer_fd_, 0, &spec, nullptr);
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::handle_shutdown_timer()
+{
+    uint64_t expirations{};
+    [[maybe_unused]] auto ret = ::read(shutdown_timer_fd_, &expirations, sizeof(expirations));
+
+    if ( !draining_ )
+        return;
+    spdlog::warn("[SHUTDOWN] {} clients did not read their replies within {} ms, disconnecting them",
+                 client_fds_.size(), config_.shutdown_timeout.count());
+    cut_clients();
+}
+
+// The event loop sees the hangups and closes the connections
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::cut_clients() noexcept
+{
+    for ( int const fd : client_fds_ )
+        ::shutdown(fd, SHUT_RDWR);
+}
+
+// Called by the event loop between events, once the last client is gone
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::finish_shutdown_if_drained()
+{
+    if ( !draining_ || !running_ || !client_fds_.empty() )
+        return;
+
+    if ( takeover_fd_ != -1 )
+    {
+        if ( !hand_over() )
+        {
+            int const fd = takeover_fd_;
+            cancel_takeover();
+            ::shutdown(fd, SHUT_RDWR);
+            return;
+        }
+    }
+    else if ( !config_.snapshot_file.empty() )
+        save_snapshot(config_.snapshot_file);
+
+    spdlog::info("[SHUTDOWN] Done");
+    running_ = false;
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::write_all(int const fd, uint8_t const* data, size_t size) noexcept
+{
+    while ( size > 0 )
+    {
+        ssize_t const n = ::write(fd, data, size);
+        if ( n == -1 && errno == EINTR )
+            continue;
+        if ( n <= 0 )
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::save_snapshot(std::string const& path) const
+{
+    std::vector<uint8_t> snapshot;
+    append_snapshot(snapshot);
+
+    // Written beside the previous snapshot and renamed over it, a crash midway leaves that one intact
+    std::string const tmp{ path + ".tmp" };
+    int const fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool const saved = fd != -1 && write_all(fd, snapshot.data(), snapshot.size()) && ::fsync(fd) == 0;
+    if ( fd != -1 )
+        close(fd);
+    if ( !saved || std::rename(tmp.c_str(), path.c_str()) != 0 )
+    {
+        spdlog::error("[SHUTDOWN] Failed to save the snapshot to {}. err: {}", path, std::strerror(errno));
+        ::unlink(tmp.c_str());
+        return;
+    }
+    spdlog::info("[SHUTDOWN] Saved {} keys to {}", g_data.size(), path);
+}
+
+// Applies the request frames of a snapshot written by append_snapshot(), closes `fd`
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::load_snapshot(int const fd, std::string const& source)
+{
+    struct stat st{};
+    size_t const size = ::fstat(fd, &st) == 0 ? st.st_size : 0;
+    void* const map = size > 0 ? ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+    close(fd);
+    if ( map == MAP_FAILED )
+        throw std::runtime_error("Cannot map the snapshot from " + source);
+
+    auto const* data = static_cast<uint8_t const*>(map);
+    size_t pos{ 0 };
+    std::vector<std::string> cmd;
+    while ( pos < size )
+    {
+        uint32_t data_len{};
+        if ( size - pos < LEN_FIELD_SIZE )
+            break;
+        std::memcpy(&data_len, data + pos, LEN_FIELD_SIZE);
+        cmd.clear();
+        if ( size - pos - LEN_FIELD_SIZE < data_len || !parse_req(data + pos + LEN_FIELD_SIZE, data_len, cmd) )
+            break;
+
+        Response resp{};
+        do_request(cmd, resp);
+        pos += LEN_FIELD_SIZE + data_len;
+    }
+    if ( map != nullptr )
+        ::munmap(map, size);
+    if ( pos != size )
+        throw std::runtime_error("Corrupt snapshot from " + source + " at byte " + std::to_string(pos));
+    spdlog::info("[SNAPSHOT] Loaded {} keys from {}", g_data.size(), source);
+}
+
+// takeover: the old process of a hot restart, `conn` is the new one
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::start_takeover(Connection& conn)
+{
+    sockaddr_storage addr{};
+    socklen_t addrlen{ sizeof(addr) };
+    if ( getsockname(conn.fd, (sockaddr*)&addr, &addrlen) == -1 || addr.ss_family != AF_UNIX )
+    {
+        spdlog::error("[RESTART] Client {} -> takeover requires a unix socket connection", conn.fd);
+        return false;
+    }
+    if ( draining_ )
+    {
+        spdlog::error("[RESTART] Client {} -> takeover while shutting down", conn.fd);
+        return false;
+    }
+
+    spdlog::warn("[RESTART] Client {} is taking over, draining the other clients", conn.fd);
+    takeover_fd_ = conn.fd;
+    client_fds_.erase(conn.fd);
+    begin_shutdown();
+    return true;
+}
+
+// The new process went away before the handoff: we still own the listeners, so we go on serving
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+void Server<ISocketWrapperBase, IEpollWrapperBase>::cancel_takeover()
+{
+    spdlog::error("[RESTART] Client {} went away before taking over, serving again", takeover_fd_);
+    takeover_fd_ = -1;
+    draining_ = false;
+
+    if ( server_fd_ != -1 )
+        epoll_.add_conn(server_fd_);
+    if ( unix_fd_ != -1 )
+        epoll_.add_conn(unix_fd_);
+    if ( repl_timer_fd_ != -1 )
+        epoll_.add_conn(repl_timer_fd_);
+    if ( shutdown_timer_fd_ != -1 )
+    {
+        itimerspec const disarm{};
+        timerfd_settime(shutdown_timer_fd_, 0, &disarm, nullptr);
+    }
+}
+
+// Replies to `takeover` with [names] of the descriptors attached: the listeners and a memfd holding a snapshot
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::hand_over()
+{
+    std::vector<uint8_t> snapshot;
+    append_snapshot(snapshot);
+    int const memfd = memfd_create("kv-snapshot", MFD_CLOEXEC);
+    if ( memfd == -1 || !write_all(memfd, snapshot.data(), snapshot.size()) )
+    {
+        spdlog::error("[RESTART] Failed to write the snapshot. err: {}", std::strerror(errno));
+        if ( memfd != -1 )
+            close(memfd);
+        return false;
+    }
+
+    std::vector<std::string_view> names;
+    std::vector<int> fds;
+    if ( server_fd_ != -1 )
+    {
+        names.push_back("tcp");
+        fds.push_back(server_fd_);
+    }
+    if ( unix_fd_ != -1 )
+    {
+        names.push_back("unix");
+        fds.push_back(unix_fd_);
+    }
+    names.push_back("snapshot");
+    fds.push_back(memfd);
+
+    Response resp{ ResponseStatus::RES_OK };
+    append_array_header(resp.data, names.size());
+    for ( auto const name : names )
+        append_array_element(resp.data, name);
+    std::vector<uint8_t> reply;
+    make_response(resp, reply);
+
+    iovec iov{ reply.data(), reply.size() };
+    alignas(cmsghdr) char control[CMSG_SPACE(TAKEOVER_MAX_FDS * sizeof(int))]{};
+
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(fds.size() * sizeof(int));
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(fds.size() * sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), fds.data(), fds.size() * sizeof(int));
+
+    bool const sent = sendmsg(takeover_fd_, &msg, MSG_NOSIGNAL) == static_cast<ssize_t>(reply.size());
+    close(memfd);
+    if ( !sent )
+    {
+        spdlog::error("[RESTART] Failed to hand over to client {}. err: {}", takeover_fd_, std::strerror(errno));
+        return false;
+    }
+    spdlog::warn("[RESTART] Handed the listeners and {} keys over to client {}", g_data.size(), takeover_fd_);
+
+    // The listeners belong to the new process now, and so does the unix socket path, which must not be unlinked
+    if ( server_fd_ != -1 )
+        sockwrapper_.close(std::exchange(server_fd_, -1));
+    if ( unix_fd_ != -1 )
+        sockwrapper_.close(std::exchange(unix_fd_, -1));
+    handle_close_event(epoll_.get_connection(std::exchange(takeover_fd_, -1)));
+    return true;
+}
+
+// The new process of a hot restart, false if no server runs on our unix socket
+template <class ISocketWrapperBase, class IEpollWrapperBase>
+bool Server<ISocketWrapperBase, IEpollWrapperBase>::take_over()
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if ( config_.unix_socket.empty() || config_.unix_socket.size() >= sizeof(addr.sun_path) )
+        throw std::runtime_error("takeover needs the unix socket path of the running server");
+    std::memcpy(addr.sun_path, config_.unix_socket.c_str(), config_.unix_socket.size() + 1);
+
+    int const fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ( fd == -1 )
+        throw std::runtime_error("Failed to create socket");
+    if ( ::connect(fd, (sockaddr const*)&addr, sizeof(addr)) == -1 )
+    {
+        spdlog::warn("[RESTART] No server to take over on {}, starting afresh", config_.unix_socket);
+        close(fd);
+        return false;
+    }
+
+    // The reply comes once the old process has drained its clients
+    auto const wait =
+        std::chrono::duration_cast<std::chrono::microseconds>(config_.shutdown_timeout + TAKEOVER_REPLY_MARGIN);
+    timeval const timeout{ wait.count() / 1000000, wait.count() % 1000000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::vector<uint8_t> request;
+    append_request_frame(request, { "takeover" });
+    bool const sent = ::send(fd, request.data(), request.size(), MSG_NOSIGNAL) == ssize_t(request.size());
+
+    // A few dozen bytes, they arrive with the descriptors
+    uint8_t buf[256]{};
+    iovec iov{ buf, sizeof(buf) };
+    alignas(cmsghdr) char control[CMSG_SPACE(TAKEOVER_MAX_FDS * sizeof(int))]{};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t const n = sent ? ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) : -1;
+    close(fd);
+
+    std::vector<int> fds;
+    for ( cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); n > 0 && cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg) )
+    {
+        if ( cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS )
+            continue;
+        size_t const count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        fds.resize(fds.size() + count);
+        std::memcpy(fds.data() + fds.size() - count, CMSG_DATA(cmsg), count * sizeof(int));
+    }
+
+    uint32_t resp_len{};
+    if ( n >= LEN_FIELD_SIZE )
+        std::memcpy(&resp_len, buf, LEN_FIELD_SIZE);
+    std::vector<std::optional<std::string>> names;
+    if ( n < LEN_FIELD_SIZE + 1 || LEN_FIELD_SIZE + resp_len != size_t(n) ||
+         buf[LEN_FIELD_SIZE] != static_cast<uint8_t>(ResponseStatus::RES_OK) ||
+         !parse_array(buf + LEN_FIELD_SIZE + 1, resp_len - 1, names) || names.size() != fds.size() )
+    {
+        for ( int const received : fds )
+            close(received);
+        throw std::runtime_error("The server on " + config_.unix_socket + " did not hand over");
+    }
+
+    for ( size_t i = 0; i < fds.size(); i++ )
+    {
+        if ( names[i] == "tcp" )
+            server_fd_ = fds[i];
+        else if ( names[i] == "unix" )
+            unix_fd_ = fds[i];
+        else if ( names[i] == "snapshot" )
+            load_snapshot(fds[i], "the old process");
+        else
+            close(fds[i]);
+    }
+    spdlog::warn("[RESTART] Took over from the server on {}", config_.unix_socket);
+    return true;
+}
@@ -0,0 +1,328 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h> // F_ADD_SEALS
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <sys/eventfd.h> // eventfd()
+#include <sys/mman.h>    // memfd_create(), mmap(), munmap()
+#include <unistd.h>      // close(), ftruncate(), read(), write()
+#include <utility>
+
+/**
+ * Shared-memory transport for clients on the same host.
+ *
+ * A segment holds two single-producer/single-consumer byte rings: requests (client -> server) and responses
+ * (server -> client). Both carry exactly the bytes that would otherwise go over the socket, so the server parses them
+ * with the same `try_request` path. Each side owns an eventfd which the peer only writes to after that side announced
+ * it is about to sleep (`reader_parked` / `writer_parked`), so a busy pair exchanges messages without any syscalls.
+ *
+ * +----------------+-------------------+--------------------+----------------+-----------------+
+ * | SegmentHeader  | RingHeader (req)  | RingHeader (resp)  | req data (cap) | resp data (cap) |
+ * +----------------+-------------------+--------------------+----------------+-----------------+
+ *
+ * The peer can write anything into the segment, so positions are never trusted: a distance between head and tail
+ * larger than the capacity reads as SHM_RING_CORRUPT and moves no bytes. The memfd is sealed against resizing, a
+ * truncated mapping would fault in the server.
+ */
+
+inline constexpr uint32_t SHM_MAGIC{ 0x42594F52 }; // "BYOR"
+inline constexpr uint32_t SHM_VERSION{ 1 };
+inline constexpr size_t SHM_DEFAULT_RING_CAPACITY{ 1 << 20 };
+inline constexpr size_t CACHE_LINE_SIZE{ 64 };
+inline constexpr size_t SHM_RING_CORRUPT{ SIZE_MAX }; // readable()/writable() of a ring whose positions make no sense
+
+struct RingHeader
+{
+    // Producer and consumer positions live on separate cache lines to avoid false sharing
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head{ 0 }; // Bytes ever written, owned by the producer
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail{ 0 }; // Bytes ever read, owned by the consumer
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> reader_parked{ 0 };
+    std::atomic<uint32_t> writer_parked{ 0 };
+};
+
+struct SegmentHeader
+{
+    uint32_t magic{ SHM_MAGIC };
+    uint32_t version{ SHM_VERSION };
+    uint64_t ring_capacity{ 0 };
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared rings need address-free atomics");
+
+class SpscByteRing
+{
+public:
+    SpscByteRing() = default;
+    SpscByteRing(RingHeader* header, uint8_t* data, uint64_t capacity)
+        : header_(header), data_(data), capacity_(capacity), mask_(capacity - 1)
+    {
+    }
+
+    [[nodiscard]] size_t readable() const noexcept
+    {
+        return used(header_->head.load(std::memory_order_acquire), header_->tail.load(std::memory_order_relaxed));
+    }
+
+    [[nodiscard]] size_t writable() const noexcept
+    {
+        size_t const n = used(header_->head.load(std::memory_order_relaxed),
+                              header_->tail.load(std::memory_order_acquire));
+        return n == SHM_RING_CORRUPT ? SHM_RING_CORRUPT : capacity_ - n;
+    }
+
+    // Copies up to `len` bytes in, returns how many fit
+    size_t write(uint8_t const* src, size_t len) noexcept
+    {
+        uint64_t const head = header_->head.load(std::memory_order_relaxed);
+        size_t const n = used(head, header_->tail.load(std::memory_order_acquire));
+        if ( n == SHM_RING_CORRUPT )
+            return 0;
+        size_t const count = std::min(len, capacity_ - n);
+        copy_in(head, src, count);
+        header_->head.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    // Copies up to `len` bytes out, returns how many were available
+    size_t read(uint8_t* dst, size_t len) noexcept
+    {
+        uint64_t const tail = header_->tail.load(std::memory_order_relaxed);
+        size_t const n = used(header_->head.load(std::memory_order_acquire), tail);
+        if ( n == SHM_RING_CORRUPT )
+            return 0;
+        size_t const count = std::min(len, n);
+        copy_out(tail, dst, count);
+        header_->tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    // Copies `len` bytes out without consuming them, the caller must check readable() first
+    void peek(uint8_t* dst, size_t len) const noexcept
+    {
+        copy_out(header_->tail.load(std::memory_order_relaxed), dst, len);
+    }
+
+    /**
+     * Sleep/wake handshake. The sleeper sets its parked flag and re-checks the ring before blocking, the peer makes
+     * its update visible and then checks the flag. The seq_cst fences order the two steps on each side, so one of
+     * them always sees the other and no wakeup is lost.
+     */
+    void park_reader() noexcept
+    {
+        header_->reader_parked.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void park_writer() noexcept
+    {
+        header_->writer_parked.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void unpark_reader() noexcept
+    {
+        header_->reader_parked.store(0, std::memory_order_relaxed);
+    }
+
+    void unpark_writer() noexcept
+    {
+        header_->writer_parked.store(0, std::memory_order_relaxed);
+    }
+
+    // Called by the producer after write(): true if the consumer is asleep and must be signalled
+    [[nodiscard]] bool take_parked_reader() noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return header_->reader_parked.load(std::memory_order_relaxed) &&
+               header_->reader_parked.exchange(0, std::memory_order_relaxed);
+    }
+
+    // Called by the consumer after read(): true if the producer is waiting for space
+    [[nodiscard]] bool take_parked_writer() noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return header_->writer_parked.load(std::memory_order_relaxed) &&
+               header_->writer_parked.exchange(0, std::memory_order_relaxed);
+    }
+
+private:
+    RingHeader* header_{ nullptr };
+    uint8_t* data_{ nullptr };
+    uint64_t capacity_{ 0 };
+    uint64_t mask_{ 0 };
+
+    // Each position is loaded once by the caller, the peer may change it meanwhile
+    [[nodiscard]] size_t used(uint64_t const head, uint64_t const tail) const noexcept
+    {
+        uint64_t const n = head - tail;
+        return n > capacity_ ? SHM_RING_CORRUPT : n;
+    }
+
+    void copy_in(uint64_t pos, uint8_t const* src, size_t n) const noexcept
+    {
+        size_t const off = pos & mask_;
+        size_t const first = std::min(n, capacity_ - off);
+        std::memcpy(data_ + off, src, first);
+        std::memcpy(data_, src + first, n - first);
+    }
+
+    void copy_out(uint64_t pos, uint8_t* dst, size_t n) const noexcept
+    {
+        size_t const off = pos & mask_;
+        size_t const first = std::min(n, capacity_ - off);
+        std::memcpy(dst, data_ + off, first);
+        std::memcpy(dst + first, data_, n - first);
+    }
+};
+
+class ShmSegment
+{
+public:
+    ShmSegment() = default;
+    ShmSegment(ShmSegment const& other) = delete;
+    ShmSegment& operator=(ShmSegment const& other) = delete;
+
+    ShmSegment(ShmSegment&& other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    ShmSegment& operator=(ShmSegment&& other) noexcept
+    {
+        std::swap(base_, other.base_);
+        std::swap(size_, other.size_);
+        std::swap(requests_, other.requests_);
+        std::swap(responses_, other.responses_);
+        return *this;
+    }
+
+    ~ShmSegment()
+    {
+        if ( base_ )
+            munmap(base_, size_);
+    }
+
+    // Creates and maps a new segment, returns its memfd which the caller must pass on and close
+    static int create(ShmSegment& segment, size_t ring_capacity = SHM_DEFAULT_RING_CAPACITY)
+    {
+        if ( ring_capacity == 0 || (ring_capacity & (ring_capacity - 1)) != 0 )
+            throw std::invalid_argument("Ring capacity must be a power of two");
+
+        int fd = memfd_create("byor-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if ( fd == -1 )
+            throw std::runtime_error(std::string("memfd_create failed: ") + std::strerror(errno));
+
+        size_t const size = segment_size(ring_capacity);
+        if ( ftruncate(fd, size) == -1 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1 )
+        {
+            close(fd);
+            throw std::runtime_error(std::string("Sizing the segment failed: ") + std::strerror(errno));
+        }
+
+        try
+        {
+            segment.map(fd, size);
+        }
+        catch ( ... )
+        {
+            close(fd);
+            throw;
+        }
+
+        auto* hdr = new (segment.base_) SegmentHeader{};
+        hdr->ring_capacity = ring_capacity;
+        new (segment.base_ + request_header_offset()) RingHeader{};
+        new (segment.base_ + response_header_offset()) RingHeader{};
+        segment.bind_rings(ring_capacity);
+
+        // The server is idle until told otherwise, so the first request must wake it up
+        segment.requests_.park_reader();
+        return fd;
+    }
+
+    // Maps a segment received from the peer, `fd` can be closed afterwards
+    static void attach(ShmSegment& segment, int fd)
+    {
+        SegmentHeader hdr{};
+        if ( pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || hdr.magic != SHM_MAGIC || hdr.version != SHM_VERSION )
+            throw std::runtime_error("Not a shared-memory ring segment");
+
+        segment.map(fd, segment_size(hdr.ring_capacity));
+        segment.bind_rings(hdr.ring_capacity);
+    }
+
+    [[nodiscard]] SpscByteRing& requests() noexcept
+    {
+        return requests_;
+    }
+
+    [[nodiscard]] SpscByteRing& responses() noexcept
+    {
+        return responses_;
+    }
+
+private:
+    uint8_t* base_{ nullptr };
+    size_t size_{ 0 };
+    SpscByteRing requests_{};
+    SpscByteRing responses_{};
+
+    static constexpr size_t request_header_offset() noexcept
+    {
+        return CACHE_LINE_SIZE;
+    }
+
+    static constexpr size_t response_header_offset() noexcept
+    {
+        return request_header_offset() + sizeof(RingHeader);
+    }
+
+    static constexpr size_t data_offset() noexcept
+    {
+        return response_header_offset() + sizeof(RingHeader);
+    }
+
+    static size_t segment_size(size_t ring_capacity) noexcept
+    {
+        return data_offset() + 2 * ring_capacity;
+    }
+
+    void map(int fd, size_t size)
+    {
+        void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if ( base == MAP_FAILED )
+            throw std::runtime_error(std::string("mmap failed: ") + std::strerror(errno));
+        base_ = static_cast<uint8_t*>(base);
+        size_ = size;
+    }
+
+    void bind_rings(size_t ring_capacity) noexcept
+    {
+        auto* req_hdr = reinterpret_cast<RingHeader*>(base_ + request_header_offset());
+        auto* resp_hdr = reinterpret_cast<RingHeader*>(base_ + response_header_offset());
+        requests_ = SpscByteRing(req_hdr, base_ + data_offset(), ring_capacity);
+        responses_ = SpscByteRing(resp_hdr, base_ + data_offset() + ring_capacity, ring_capacity);
+    }
+};
+
+inline void eventfd_notify(int const efd) noexcept
+{
+    uint64_t one{ 1 };
+    [[maybe_unused]] auto ret = ::write(efd, &one, sizeof(one));
+}
+
+// Blocks on a blocking eventfd, returns immediately on a non-blocking one with no pending signal
+inline void eventfd_drain(int const efd) noexcept
+{
+    uint64_t count{};
+    [[maybe_unused]] auto ret = ::read(efd, &count, sizeof(count));
+}
+
+#endif
@@ -0,0 +1,408 @@
+#ifndef SORTED_SET_H
+#define SORTED_SET_H
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * Sorted set: unique members ordered by (score, member).
+ *
+ * Members live in a skip list whose forward pointers also store their span, the number of level 0 steps they skip.
+ * Summing spans on the way down gives a member's rank, so rank lookups and range-by-rank are O(log n) like
+ * range-by-score. Every node is a single allocation holding score, member and its level array, a range scan therefore
+ * touches one node per member and walks plain level 0 pointers. A hash index from member to node serves score lookups
+ * in O(1) and finds the node to unlink on removal.
+ */
+
+inline constexpr int ZSET_MAX_LEVEL{ 32 };
+
+// One end of a score range, `(1.5` excludes the score itself
+struct ScoreBound
+{
+    double value{ 0 };
+    bool exclusive{ false };
+
+    // Accepts a number, -inf/+inf, optionally prefixed with `(`
+    static std::optional<ScoreBound> parse(std::string const& str)
+    {
+        ScoreBound bound{};
+        size_t const start = !str.empty() && str[0] == '(';
+        bound.exclusive = start == 1;
+
+        char* end{ nullptr };
+        bound.value = std::strtod(str.c_str() + start, &end);
+        if ( end == str.c_str() + start || *end != '\0' || std::isnan(bound.value) )
+            return std::nullopt;
+        return bound;
+    }
+};
+
+// Shortest representation that parses back to the same double, written to `buf`
+inline std::string_view format_score(double score, std::array<char, 32>& buf)
+{
+    // Integral scores (ranks, points, timestamps) are the common case and integer formatting is several times faster
+    char* end{ nullptr };
+    if ( std::trunc(score) == score && std::fabs(score) < 0x1p53 )
+        end = std::to_chars(buf.data(), buf.data() + buf.size(), static_cast<int64_t>(score)).ptr;
+    else
+        end = std::to_chars(buf.data(), buf.data() + buf.size(), score).ptr;
+    return std::string_view(buf.data(), end - buf.data());
+}
+
+inline std::string format_score(double score)
+{
+    std::array<char, 32> buf;
+    return std::string(format_score(score, buf));
+}
+
+class SortedSet
+{
+public:
+    SortedSet() : header_(create_node(ZSET_MAX_LEVEL, 0, {}))
+    {
+    }
+
+    SortedSet(SortedSet const& other) = delete;
+    SortedSet& operator=(SortedSet const& other) = delete;
+
+    SortedSet(SortedSet&& other) noexcept
+        : header_(other.header_), length_(other.length_), level_(other.level_), index_(std::move(other.index_))
+    {
+        other.header_ = nullptr;
+    }
+
+    SortedSet& operator=(SortedSet&& other) noexcept
+    {
+        if ( this != &other )
+        {
+            destroy();
+            header_ = other.header_;
+            length_ = other.length_;
+            level_ = other.level_;
+            index_ = std::move(other.index_);
+            other.header_ = nullptr;
+        }
+        return *this;
+    }
+
+    ~SortedSet()
+    {
+        destroy();
+    }
+
+    // Adds `member` or moves it to `score`, true if it was not in the set before
+    bool add(double score, std::string_view member)
+    {
+        if ( auto it = index_.find(member); it != index_.end() )
+        {
+            if ( Node* node = it->second; node->score != score )
+            {
+                std::string owned{ member };
+                index_.erase(it);
+                unlink(node);
+                index_.emplace(insert(score, std::move(owned)));
+            }
+            return false;
+        }
+
+        index_.emplace(insert(score, std::string(member)));
+        return true;
+    }
+
+    bool remove(std::string_view member)
+    {
+        auto it = index_.find(member);
+        if ( it == index_.end() )
+            return false;
+
+        Node* node = it->second;
+        index_.erase(it);
+        unlink(node);
+        return true;
+    }
+
+    [[nodiscard]] std::optional<double> score(std::string_view member) const
+    {
+        auto it = index_.find(member);
+        if ( it == index_.end() )
+            return std::nullopt;
+        return it->second->score;
+    }
+
+    // 0-based position in ascending order
+    [[nodiscard]] std::optional<size_t> rank(std::string_view member) const
+    {
+        auto it = index_.find(member);
+        if ( it == index_.end() )
+            return std::nullopt;
+
+        Node const* target = it->second;
+        Node const* x = header_;
+        size_t traversed{ 0 };
+        for ( int i = level_ - 1; i >= 0; i-- )
+        {
+            for ( Node const* next = x->levels()[i].forward;
+                  next && (next == target || before(next, target->score, target->member));
+                  next = x->levels()[i].forward )
+            {
+                traversed += x->levels()[i].span;
+                x = next;
+            }
+            if ( x == target )
+                return traversed - 1;
+        }
+        return std::nullopt;
+    }
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return length_;
+    }
+
+    // Calls fn(member, score) for ranks start..stop (inclusive, 0-based, clamped to the set)
+    template <class Fn>
+    void range_by_rank(size_t start, size_t stop, Fn&& fn) const
+    {
+        if ( start >= length_ || start > stop )
+            return;
+        stop = std::min(stop, length_ - 1);
+
+        for ( Node const* x = node_at_rank(start + 1); x && start <= stop; x = x->levels()[0].forward, start++ )
+            fn(std::string_view(x->member), x->score);
+    }
+
+    // Calls fn(member, score) for the members within [min, max], skipping `offset` of them and stopping after `count`
+    template <class Fn>
+    void range_by_score(ScoreBound min, ScoreBound max, size_t offset, size_t count, Fn&& fn) const
+    {
+        Node const* x = header_;
+        for ( int i = level_ - 1; i >= 0; i-- )
+        {
+            while ( x->levels()[i].forward && !above_min(x->levels()[i].forward->score, min) )
+                x = x->levels()[i].forward;
+        }
+
+        for ( x = x->levels()[0].forward; x && count > 0 && below_max(x->score, max); x = x->levels()[0].forward )
+        {
+            if ( offset > 0 )
+            {
+                offset--;
+                continue;
+            }
+            fn(std::string_view(x->member), x->score);
+            count--;
+        }
+    }
+
+    // Nodes are counted with the expected 4/3 levels each, their actual heights are not stored
+    [[nodiscard]] size_t memory_usage() const noexcept
+    {
+        constexpr size_t sso_capacity{ std::string().capacity() };
+        size_t bytes = sizeof(SortedSet) + sizeof(Node) + ZSET_MAX_LEVEL * sizeof(Level);
+        bytes += index_.bucket_count() * sizeof(void*);
+        for ( Node const* x = header_->levels()[0].forward; x; x = x->levels()[0].forward )
+        {
+            bytes += sizeof(Node) + sizeof(Level) * 4 / 3;
+            bytes += x->member.capacity() > sso_capacity ? x->member.capacity() + 1 : 0;
+            bytes += sizeof(void*) + sizeof(std::pair<std::string_view const, Node*>) + sizeof(size_t);
+        }
+        return bytes;
+    }
+
+    template <class Fn>
+    void for_each(Fn&& fn) const
+    {
+        for ( Node const* x = header_->levels()[0].forward; x; x = x->levels()[0].forward )
+            fn(std::string_view(x->member), x->score);
+    }
+
+private:
+    struct Node;
+
+    struct Level
+    {
+        Node* forward{ nullptr };
+        size_t span{ 0 };
+    };
+
+    // Allocated together with its `height` levels, which follow the node in memory
+    struct Node
+    {
+        double score;
+        std::string member;
+
+        Level* levels() noexcept
+        {
+            return reinterpret_cast<Level*>(this + 1);
+        }
+
+        Level const* levels() const noexcept
+        {
+            return reinterpret_cast<Level const*>(this + 1);
+        }
+    };
+
+    static_assert(alignof(Level) <= alignof(Node));
+
+    Node* header_;
+    size_t length_{ 0 };
+    int level_{ 1 };
+    std::unordered_map<std::string_view, Node*> index_{}; // Keys view the node's member
+
+    static Node* create_node(int height, double score, std::string member)
+    {
+        void* mem = ::operator new(sizeof(Node) + height * sizeof(Level));
+        Node* node = new (mem) Node{ score, std::move(member) };
+        for ( int i = 0; i < height; i++ )
+            new (node->levels() + i) Level{};
+        return node;
+    }
+
+    static void destroy_node(Node* node) noexcept
+    {
+        node->~Node();
+        ::operator delete(node);
+    }
+
+    void destroy() noexcept
+    {
+        if ( !header_ )
+            return;
+        for ( Node* x = header_; x; )
+        {
+            Node* next = x->levels()[0].forward;
+            destroy_node(x);
+            x = next;
+        }
+        header_ = nullptr;
+    }
+
+    // `node` sorts before (score, member)
+    static bool before(Node const* node, double score, std::string_view member) noexcept
+    {
+        return node->score < score || (node->score == score && node->member < member);
+    }
+
+    static bool above_min(double score, ScoreBound const& min) noexcept
+    {
+        return min.exclusive ? score > min.value : score >= min.value;
+    }
+
+    static bool below_max(double score, ScoreBound const& max) noexcept
+    {
+        return max.exclusive ? score < max.value : score <= max.value;
+    }
+
+    // Geometric with p = 1/4, the usual choice for skip lists keyed by rank
+    static int random_level()
+    {
+        static thread_local std::minstd_rand rng{ 0x5eed };
+        int level{ 1 };
+        while ( level < ZSET_MAX_LEVEL && (rng() & 3) == 0 )
+            level++;
+        return level;
+    }
+
+    // `member` must not be in the list yet, returns the index entry for the new node
+    std::pair<std::string_view, Node*> insert(double score, std::string member)
+    {
+        Node* update[ZSET_MAX_LEVEL];
+        size_t rank[ZSET_MAX_LEVEL];
+
+        Node* x = header_;
+        for ( int i = level_ - 1; i >= 0; i-- )
+        {
+            rank[i] = i == level_ - 1 ? 0 : rank[i + 1];
+            while ( x->levels()[i].forward && before(x->levels()[i].forward, score, member) )
+            {
+                rank[i] += x->levels()[i].span;
+                x = x->levels()[i].forward;
+            }
+            update[i] = x;
+        }
+
+        int const height = random_level();
+        if ( height > level_ )
+        {
+            for ( int i = level_; i < height; i++ )
+            {
+                rank[i] = 0;
+                update[i] = header_;
+                header_->levels()[i].span = length_;
+            }
+            level_ = height;
+        }
+
+        x = create_node(height, score, std::move(member));
+        for ( int i = 0; i < height; i++ )
+        {
+            x->levels()[i].forward = update[i]->levels()[i].forward;
+            update[i]->levels()[i].forward = x;
+            x->levels()[i].span = update[i]->levels()[i].span - (rank[0] - rank[i]);
+            update[i]->levels()[i].span = rank[0] - rank[i] + 1;
+        }
+        for ( int i = height; i < level_; i++ )
+            update[i]->levels()[i].span++;
+
+        length_++;
+        return { std::string_view(x->member), x };
+    }
+
+    void unlink(Node* node)
+    {
+        Node* update[ZSET_MAX_LEVEL];
+        Node* x = header_;
+        for ( int i = level_ - 1; i >= 0; i-- )
+        {
+            while ( x->levels()[i].forward && before(x->levels()[i].forward, node->score, node->member) )
+                x = x->levels()[i].forward;
+            update[i] = x;
+        }
+
+        for ( int i = 0; i < level_; i++ )
+        {
+            if ( update[i]->levels()[i].forward == node )
+            {
+                update[i]->levels()[i].span += node->levels()[i].span - 1;
+                update[i]->levels()[i].forward = node->levels()[i].forward;
+            }
+            else
+                update[i]->levels()[i].span--;
+        }
+
+        while ( level_ > 1 && !header_->levels()[level_ - 1].forward )
+            level_--;
+        length_--;
+        destroy_node(node);
+    }
+
+    // 1-based, nullptr if out of range
+    Node const* node_at_rank(size_t rank) const
+    {
+        Node const* x = header_;
+        size_t traversed{ 0 };
+        for ( int i = level_ - 1; i >= 0; i-- )
+        {
+            while ( x->levels()[i].forward && traversed + x->levels()[i].span <= rank )
+            {
+                traversed += x->levels()[i].span;
+                x = x->levels()[i].forward;
+            }
+            if ( traversed == rank )
+                return x;
+        }
+        return nullptr;
+    }
+};
+
+#endif
@@ -0,0 +1,277 @@
+#ifndef TOPOLOGY_CLIENT_H
+#define TOPOLOGY_CLIENT_H
+
+#include "client.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Replication-aware client: writes go to the primary, reads are spread over the replicas the primary reports in
+ * `info replication`. A replica only serves reads while its lag is within the configured bounds, otherwise (and when
+ * its connection fails) reads fall back to the primary. Every node gets a small pool of connections so several
+ * threads can share one client.
+ *
+ * TopologyClient<TcpTransport, RedisSerializer, RedisDeserializer> client(serializer, deserializer);
+ * client.connect("127.0.0.1", 1234);
+ * client.send_request(cmd);
+ */
+
+struct TopologyOptions
+{
+    size_t pool_size{ 4 };                              // Connections per node
+    int64_t max_lag_ms{ 100 };                          // Staleness bound for replica reads
+    uint64_t max_lag_bytes{ 1 << 20 };                  // Same bound in replication stream bytes
+    std::chrono::milliseconds refresh_interval{ 1000 }; // How often the primary is asked for replica lag
+};
+
+// Only these commands may be answered by a replica
+inline bool is_read_command(std::vector<std::string> const& cmd)
+{
+    return !cmd.empty() && (cmd[0] == "get" || cmd[0] == "type" || cmd[0] == "zscore" || cmd[0] == "zrank" ||
+                            cmd[0] == "zcard" || cmd[0] == "zrange" || cmd[0] == "zrangebyscore" ||
+                            cmd[0] == "hget" || cmd[0] == "hgetall" || cmd[0] == "hlen" || cmd[0] == "llen" ||
+                            cmd[0] == "lrange" || cmd[0] == "scan" || cmd[0] == "prefix" || cmd[0] == "range" ||
+                            cmd[0] == "bf.exists" || cmd[0] == "bf.mexists" || cmd[0] == "bf.info" ||
+                            cmd[0] == "pfcount");
+}
+
+template <class Transport, class Serializer, class Deserializer>
+    requires Transportable<Transport> && Serializable<Serializer> && Deserializable<Deserializer>
+class TopologyClient
+{
+public:
+    TopologyClient(Serializer& serializer, Deserializer& deserializer, TopologyOptions options = {})
+        : serializer_(serializer), deserializer_(deserializer), options_(options)
+    {
+    }
+
+    // Connects to the primary and discovers its replicas
+    void connect(std::string const& address, int const port)
+    {
+        std::unique_lock lock(topology_mutex_);
+        nodes_.clear();
+        nodes_.push_back(make_node(address, port));
+        nodes_.front()->eligible = true;
+        refresh_locked();
+    }
+
+    std::string send_request(std::vector<std::string>& message)
+    {
+        maybe_refresh();
+
+        auto const data = serializer_.serialize(message);
+        std::shared_lock lock(topology_mutex_);
+
+        if ( is_read_command(message) )
+        {
+            if ( Node* replica = pick_replica() )
+            {
+                auto frame = roundtrip(*replica, data);
+                if ( !frame.empty() )
+                    return deserializer_.deserialize(frame);
+
+                // Connection failed, take the replica out of rotation until the next refresh reconnects it
+                replica->eligible = false;
+                replica->failed = true;
+                replica_reads_failed_++;
+            }
+        }
+
+        return deserializer_.deserialize(roundtrip(*nodes_.front(), data));
+    }
+
+    // Re-reads the replica list and lag figures from the primary
+    void refresh_topology()
+    {
+        std::unique_lock lock(topology_mutex_);
+        refresh_locked();
+    }
+
+    [[nodiscard]] size_t num_eligible_replicas() const
+    {
+        std::shared_lock lock(topology_mutex_);
+        size_t n{ 0 };
+        for ( size_t i = 1; i < nodes_.size(); i++ )
+            n += nodes_[i]->eligible;
+        return n;
+    }
+
+    [[nodiscard]] uint64_t replica_reads_failed() const noexcept
+    {
+        return replica_reads_failed_;
+    }
+
+private:
+    struct PooledConnection
+    {
+        std::mutex mutex{};
+        Transport transport{};
+    };
+
+    struct Node
+    {
+        std::string host{};
+        int port{ 0 };
+        std::vector<std::unique_ptr<PooledConnection>> pool{};
+        std::atomic<size_t> next{ 0 };
+        std::atomic<bool> eligible{ false };
+        std::atomic<bool> failed{ false };
+    };
+
+    Serializer& serializer_;
+    Deserializer& deserializer_;
+    TopologyOptions const options_;
+
+    mutable std::shared_mutex topology_mutex_;
+    std::vector<std::unique_ptr<Node>> nodes_; // Primary first
+    std::atomic<size_t> next_replica_{ 0 };
+    std::atomic<int64_t> last_refresh_ns_{ 0 };
+    std::atomic<uint64_t> replica_reads_failed_{ 0 };
+
+    std::unique_ptr<Node> make_node(std::string const& host, int const port)
+    {
+        auto node = std::make_unique<Node>();
+        node->host = host;
+        node->port = port;
+        for ( size_t i = 0; i < std::max<size_t>(options_.pool_size, 1); i++ )
+        {
+            node->pool.push_back(std::make_unique<PooledConnection>());
+            node->pool.back()->transport.connect(host, port);
+        }
+        return node;
+    }
+
+    Node* pick_replica()
+    {
+        size_t const num_replicas = nodes_.size() - 1;
+        for ( size_t tries = 0; tries < num_replicas; tries++ )
+        {
+            Node* node = nodes_[1 + next_replica_++ % num_replicas].get();
+            if ( node->eligible )
+                return node;
+        }
+        return nullptr;
+    }
+
+    // Sends one request on a free pooled connection and returns its response frame, empty if the connection failed
+    std::vector<uint8_t> roundtrip(Node& node, std::vector<uint8_t> const& data)
+    {
+        size_t const start = node.next++;
+        for ( size_t i = 0; i < node.pool.size(); i++ )
+        {
+            auto& conn = *node.pool[(start + i) % node.pool.size()];
+            std::unique_lock lock(conn.mutex, std::try_to_lock);
+            if ( lock.owns_lock() )
+                return exchange(conn, data);
+        }
+
+        // All busy, wait for the one we were assigned
+        auto& conn = *node.pool[start % node.pool.size()];
+        std::lock_guard lock(conn.mutex);
+        return exchange(conn, data);
+    }
+
+    static std::vector<uint8_t> exchange(PooledConnection& conn, std::vector<uint8_t> const& data)
+    {
+        conn.transport.send(data);
+        return conn.transport.receive();
+    }
+
+    void maybe_refresh()
+    {
+        auto const now = std::chrono::steady_clock::now().time_since_epoch();
+        int64_t const now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+        int64_t last = last_refresh_ns_.load(std::memory_order_relaxed);
+        int64_t const interval_ns =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(options_.refresh_interval).count();
+
+        // Only the thread that wins the exchange refreshes, the others keep routing with the current view
+        if ( now_ns - last >= interval_ns && last_refresh_ns_.compare_exchange_strong(last, now_ns) )
+            refresh_topology();
+    }
+
+    void refresh_locked()
+    {
+        last_refresh_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               std::chrono::steady_clock::now().time_since_epoch())
+                               .count();
+
+        std::vector<std::string> cmd{ "info", "replication" };
+        auto const frame = roundtrip(*nodes_.front(), serializer_.serialize(cmd));
+        if ( frame.size() <= sizeof(uint32_t) + 1 || frame[sizeof(uint32_t)] != 0 )
+        {
+            spdlog::error("Failed to read the replication topology from {}:{}", nodes_.front()->host,
+                          nodes_.front()->port);
+            return;
+        }
+
+        for ( size_t i = 1; i < nodes_.size(); i++ )
+            nodes_[i]->eligible = false;
+
+        // replicaN:ip=127.0.0.1,port=1235,offset=..,lag_bytes=..,lag_ms=..
+        std::istringstream in(std::string(frame.begin() + sizeof(uint32_t) + 1, frame.end()));
+        for ( std::string line; std::getline(in, line); )
+        {
+            if ( line.rfind("replica", 0) != 0 || line.find(':') == std::string::npos )
+                continue;
+
+            std::string ip;
+            int port{ 0 };
+            uint64_t lag_bytes{ 0 };
+            int64_t lag_ms{ 0 };
+            std::istringstream fields(line.substr(line.find(':') + 1));
+            for ( std::string field; std::getline(fields, field, ','); )
+            {
+                auto const eq = field.find('=');
+                if ( eq == std::string::npos )
+                    continue;
+                std::string const key = field.substr(0, eq);
+                std::string const value = field.substr(eq + 1);
+                if ( key == "ip" )
+                    ip = value;
+                else if ( key == "port" )
+                    port = std::stoi(value);
+                else if ( key == "lag_bytes" )
+                    lag_bytes = std::stoull(value);
+                else if ( key == "lag_ms" )
+                    lag_ms = std::stoll(value);
+            }
+            if ( ip.empty() || port == 0 )
+                continue;
+
+            // A replica whose connections failed gets a fresh pool, it may have restarted in the meantime
+            size_t idx = find_replica(ip, port);
+            if ( idx == 0 )
+            {
+                nodes_.push_back(make_node(ip, port));
+                idx = nodes_.size() - 1;
+            }
+            else if ( nodes_[idx]->failed )
+                nodes_[idx] = make_node(ip, port);
+
+            Node* node = nodes_[idx].get();
+            node->eligible = lag_ms <= options_.max_lag_ms && lag_bytes <= options_.max_lag_bytes;
+        }
+    }
+
+    // Index into `nodes_`, 0 (the primary) if the replica is not known yet
+    size_t find_replica(std::string const& host, int const port) const
+    {
+        for ( size_t i = 1; i < nodes_.size(); i++ )
+        {
+            if ( nodes_[i]->host == host && nodes_[i]->port == port )
+                return i;
+        }
+        return 0;
+    }
+};
+
+#endif
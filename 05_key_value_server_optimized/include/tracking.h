@@ -0,0 +1,123 @@
+#ifndef TRACKING_H
+#define TRACKING_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Server-assisted client-side caching (`client tracking on|off`), Redis' default tracking mode.
+ *
+ * The keys read by a tracking connection are remembered, and the first write to one of them sends every connection
+ * that read it an `[invalidate, key]` push (status RES_PUSH) and forgets the readers, until the key is read again.
+ * The table stores the 64-bit hash of a key instead of the key itself, so an entry costs the same whatever the size
+ * of the key. A collision only invalidates a key that did not change.
+ *
+ * At most max_keys hashes are tracked. Remembering one more evicts a random entry, whose readers cannot be told
+ * which key they lost (only its hash is known) and get `[invalidate, nil]`: drop the whole cache.
+ */
+
+inline constexpr size_t DEFAULT_TRACKING_MAX_KEYS{ 1 << 20 };
+
+// A connection that read a key. The generation tells it apart from a later connection reusing the fd.
+struct TrackedReader
+{
+    int fd{ -1 };
+    uint32_t generation{ 0 };
+};
+
+class TrackingTable
+{
+public:
+    explicit TrackingTable(size_t max_keys = DEFAULT_TRACKING_MAX_KEYS) : max_keys_(max_keys)
+    {
+    }
+
+    void set_max_keys(size_t max_keys) noexcept
+    {
+        max_keys_ = std::max<size_t>(max_keys, 1);
+    }
+
+    // Remembers that `reader` read `key`, calls evicted(readers) for an entry dropped to make room
+    template <class Fn>
+    void remember(std::string_view key, TrackedReader reader, Fn&& evicted)
+    {
+        auto [it, inserted] = table_.try_emplace(hash(key));
+        for ( auto& known : it->second )
+        {
+            // One slot per fd, an entry of a closed connection is taken over by the fd's next user
+            if ( known.fd == reader.fd )
+            {
+                known.generation = reader.generation;
+                return;
+            }
+        }
+        it->second.push_back(reader);
+
+        if ( inserted && table_.size() > max_keys_ )
+            evict_one(it->first, evicted);
+    }
+
+    // The readers of `key`, which is forgotten
+    std::vector<TrackedReader> take(std::string_view key)
+    {
+        auto node = table_.extract(hash(key));
+        return node ? std::move(node.mapped()) : std::vector<TrackedReader>{};
+    }
+
+    [[nodiscard]] bool empty() const noexcept
+    {
+        return table_.empty();
+    }
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return table_.size();
+    }
+
+    static uint64_t hash(std::string_view key) noexcept
+    {
+        return std::hash<std::string_view>{}(key);
+    }
+
+private:
+    // The hash is already well mixed
+    struct Identity
+    {
+        size_t operator()(uint64_t h) const noexcept
+        {
+            return h;
+        }
+    };
+
+    std::unordered_map<uint64_t, std::vector<TrackedReader>, Identity> table_{};
+    size_t max_keys_;
+    std::minstd_rand rng_{};
+
+    // Starts at a random bucket and evicts the first entry found that is not `keep`
+    template <class Fn>
+    void evict_one(uint64_t keep, Fn&& evicted)
+    {
+        size_t bucket = rng_() % table_.bucket_count();
+        while ( true )
+        {
+            for ( auto it = table_.begin(bucket); it != table_.end(bucket); ++it )
+            {
+                if ( it->first != keep )
+                {
+                    auto node = table_.extract(it->first);
+                    evicted(node.mapped());
+                    return;
+                }
+            }
+            bucket = (bucket + 1) % table_.bucket_count();
+        }
+    }
+};
+
+#endif
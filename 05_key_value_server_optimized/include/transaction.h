@@ -0,0 +1,82 @@
+#ifndef TRANSACTION_H
+#define TRANSACTION_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Transactions: `multi` starts queuing a connection's requests, `exec` runs the queue back-to-back and `discard`
+ * drops it. Nothing else runs between two commands of an `exec`, which replies with an array holding the response
+ * frame of each command, exactly as it would have been sent on its own. A command that fails does not stop the others.
+ *
+ * `watch key [key ...]` makes the next `exec` of the connection conditional: if any watched key was written since,
+ * the transaction is not run and `exec` answers RES_NX. Every watched key has a version counter that writes bump, a
+ * watcher remembers the version it saw. Only watched keys have one, so writes cost a lookup in an empty table until
+ * somebody watches.
+ */
+
+class WatchedKeys
+{
+public:
+    [[nodiscard]] bool empty() const noexcept
+    {
+        return keys_.empty();
+    }
+
+    // The version of `key` to compare against at `exec`
+    uint64_t watch(std::string const& key)
+    {
+        auto& entry = keys_[key];
+        entry.watchers++;
+        return entry.version;
+    }
+
+    void unwatch(std::string const& key)
+    {
+        auto it = keys_.find(key);
+        if ( it != keys_.end() && --it->second.watchers == 0 )
+            keys_.erase(it);
+    }
+
+    [[nodiscard]] uint64_t version(std::string const& key) const
+    {
+        auto it = keys_.find(key);
+        return it == keys_.end() ? 0 : it->second.version;
+    }
+
+    // `key` was written
+    void touch(std::string const& key)
+    {
+        if ( auto it = keys_.find(key); it != keys_.end() )
+            it->second.version++;
+    }
+
+    // Every key may have changed (the keyspace was replaced)
+    void touch_all() noexcept
+    {
+        for ( auto& [_, entry] : keys_ )
+            entry.version++;
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t version{ 0 };
+        size_t watchers{ 0 };
+    };
+    std::unordered_map<std::string, Entry> keys_{};
+};
+
+// A connection that sent `multi` or `watch`
+struct Transaction
+{
+    bool queuing{ false }; // Between `multi` and `exec`/`discard`
+    bool aborted{ false }; // A request was refused while queuing, `exec` discards the transaction
+    std::vector<std::vector<std::string>> queued{};           // Requests as parsed, moved in
+    std::vector<std::pair<std::string, uint64_t>> watched{}; // key -> version when watched
+};
+
+#endif
@@ -1,14 +1,81 @@
 #include "client.h"
+#include "clusterclient.h"
+#include "topologyclient.h"
 
-int main(int argc, char** argv)
+template <class Transport>
+void run_cli(int argc, char** argv)
 {
-    TcpTransport transport;
+    Transport transport;
     RedisSerializer serializer;
     RedisDeserializer deserializer;
 
-    SocketClient<TcpTransport, RedisSerializer, RedisDeserializer> client(transport, serializer, deserializer);
+    SocketClient<Transport, RedisSerializer, RedisDeserializer> client(transport, serializer, deserializer);
     CLIHandler cli(client);
     cli.process_args(argc, argv);
+}
+
+// ./client --topology 127.0.0.1 1234 get key1 sends reads to an up to date replica of that primary
+void run_topology_cli(int argc, char** argv)
+{
+    if ( argc < 5 )
+        return;
+
+    RedisSerializer serializer;
+    RedisDeserializer deserializer;
+    TopologyClient<TcpTransport, RedisSerializer, RedisDeserializer> client(serializer, deserializer,
+                                                                           TopologyOptions{ .pool_size = 1 });
+    client.connect(argv[2], std::stoi(argv[3]));
+
+    std::vector<std::string> cmds(argv + 4, argv + argc);
+    spdlog::info("Eligible replicas: {}", client.num_eligible_replicas());
+    spdlog::info(client.send_request(cmds));
+}
+
+// ./client --cluster 127.0.0.1 7001 mget k1 k2 k3 routes every key to the node owning its hash slot
+void run_cluster_cli(int argc, char** argv)
+{
+    if ( argc < 5 )
+        return;
+
+    RedisSerializer serializer;
+    RedisDeserializer deserializer;
+    ClusterClient<TcpTransport, RedisSerializer, RedisDeserializer> client(serializer, deserializer);
+    client.connect(argv[2], std::stoi(argv[3]));
+
+    std::vector<std::string> cmds(argv + 4, argv + argc);
+    if ( cmds[0] == "mget" )
+    {
+        auto const values = client.mget({ cmds.begin() + 1, cmds.end() });
+        for ( size_t i = 0; i < values.size(); i++ )
+            spdlog::info("{}: {}", cmds[i + 1], values[i].value_or("(nil)"));
+    }
+    else if ( cmds[0] == "mset" )
+        spdlog::info("mset {}", client.mset({ cmds.begin() + 1, cmds.end() }) ? "OK" : "failed");
+    else
+        spdlog::info(client.send_request(cmds));
+    spdlog::info("Redirects: {}", client.redirects());
+}
+
+int main(int argc, char** argv)
+{
+    if ( argc > 1 && std::string(argv[1]) == "--topology" )
+    {
+        run_topology_cli(argc, argv);
+        return 0;
+    }
+    if ( argc > 1 && std::string(argv[1]) == "--cluster" )
+    {
+        run_cluster_cli(argc, argv);
+        return 0;
+    }
+
+    // ./client /tmp/byor.sock 0 get key1 talks to the server's unix socket, shm:/tmp/byor.sock through shared memory
+    if ( argc > 1 && is_shm_address(argv[1]) )
+        run_cli<ShmTransport>(argc, argv);
+    else if ( argc > 1 && is_unix_socket_address(argv[1]) )
+        run_cli<UnixTransport>(argc, argv);
+    else
+        run_cli<TcpTransport>(argc, argv);
 
     return 0;
 }
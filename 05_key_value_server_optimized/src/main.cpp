@@ -1,17 +1,36 @@
 #include "server.h"
 
-int main()
+#include <exception>
+
+int main(int argc, char** argv)
 {
     spdlog::set_level(static_cast<spdlog::level::level_enum>(SPDLOG_LEVEL));
 
-    constexpr uint16_t port{ 1234 };
-    constexpr uint8_t max_clients{ 100 };
+    // ./server [--config FILE] [--NAME VALUE ...], every parameter of config.h can be given either way:
+    //          --port PORT (0 serves the unix socket only), --unixsocket PATH, --max-clients N,
+    //          --replicaof HOST:PORT, --repl-backlog-size BYTES, --cluster-self HOST:PORT --cluster-config FILE,
+    //          --prefix-index yes|no, --read-buffer-size BYTES, --max-msg-size BYTES, --max-cmd-args N,
+    //          --pubsub-output-limit HARD:SOFT:SECONDS, --tracking-table-max-keys N, --compress-threshold BYTES,
+    //          --lazyfree yes|no, --script-time-limit MS, --loglevel LEVEL, --snapshot-file FILE,
+    //          --shutdown-timeout MS, --takeover yes|no (hot restart in place of the server on --unixsocket)
+    ServerConfig config{};
+    try
+    {
+        config = parse_config_args(argc, argv);
+    }
+    catch ( std::exception const& e )
+    {
+        spdlog::error("{}", e.what());
+        return 1;
+    }
 
     SocketWrapper socket_wrapper;
-    EpollWrapper epoll_wrapper(max_clients);
+    EpollWrapper epoll_wrapper(config.max_clients);
 
-    Server<SocketWrapper, EpollWrapper> server(port, socket_wrapper, epoll_wrapper, max_clients);
+    Server<SocketWrapper, EpollWrapper> server(config.port, socket_wrapper, epoll_wrapper, config.max_clients);
+    server.shutdown_on_signals(); // SIGTERM/SIGINT drain the clients, before any thread inherits the signal mask
+    server.configure(config);
     server.start();
 
     return 0;
-}
\ No newline at end of file
+}
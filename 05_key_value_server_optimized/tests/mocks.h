@@ -0,0 +1,35 @@
+#ifndef MOCKS_H
+#define MOCKS_H
+
+#include "epollwrapper.h"
+#include "socketwrapper.h"
+
+#include <gmock/gmock.h>
+
+// ======================================== Mocks ========================================
+
+class MockEpollWrapper : public IEpollWrapperBase<MockEpollWrapper>
+{
+public:
+    MOCK_METHOD(void, add_conn_impl, (int), (noexcept));
+    MOCK_METHOD(void, remove_conn_impl, (int), (noexcept));
+    MOCK_METHOD(void, modify_conn_impl, (int, uint32_t), (const, noexcept));
+    MOCK_METHOD(int, wait_impl, (), (noexcept));
+    MOCK_METHOD(epoll_event&, get_event_impl, (int), ());
+    MOCK_METHOD(Connection&, get_connection_impl, (int), ());
+};
+
+class MockSocketWrapper : public ISocketWrapperBase<MockSocketWrapper>
+{
+public:
+    MOCK_METHOD(int, socket_impl, (int, int, int), (const));
+    MOCK_METHOD(int, bind_impl, (int, const sockaddr*, socklen_t), (const));
+    MOCK_METHOD(int, listen_impl, (int, int), (const));
+    MOCK_METHOD(int, accept_impl, (int, sockaddr*, socklen_t*), (const));
+    MOCK_METHOD(int, close_impl, (int), (const));
+    MOCK_METHOD(int, setsockopt_impl, (int), (const));
+    MOCK_METHOD(int, fcntl_impl, (int, int), (const));
+    MOCK_METHOD(int, fcntl_impl, (int, int, int), (const));
+};
+
+#endif
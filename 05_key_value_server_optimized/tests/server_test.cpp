@@ -1,33 +1,11 @@
+#include "mocks.h"
 #include "server.h"
 
+#include <fstream>
+#include <random>
+#include <thread>
 #include <gmock/gmock.h>
 
-// ======================================== Mocks ========================================
-
-class MockEpollWrapper : public IEpollWrapperBase<MockEpollWrapper>
-{
-public:
-    MOCK_METHOD(void, add_conn_impl, (int), (noexcept));
-    MOCK_METHOD(void, remove_conn_impl, (int), (noexcept));
-    MOCK_METHOD(void, modify_conn_impl, (int, uint32_t), (const, noexcept));
-    MOCK_METHOD(int, wait_impl, (), (noexcept));
-    MOCK_METHOD(epoll_event&, get_event_impl, (int), ());
-    MOCK_METHOD(Connection&, get_connection_impl, (int), ());
-};
-
-class MockSocketWrapper : public ISocketWrapperBase<MockSocketWrapper>
-{
-public:
-    MOCK_METHOD(int, socket_impl, (int, int, int), (const));
-    MOCK_METHOD(int, bind_impl, (int, const sockaddr*, socklen_t), (const));
-    MOCK_METHOD(int, listen_impl, (int, int), (const));
-    MOCK_METHOD(int, accept_impl, (int, sockaddr*, socklen_t*), (const));
-    MOCK_METHOD(int, close_impl, (int), (const));
-    MOCK_METHOD(int, setsockopt_impl, (int), (const));
-    MOCK_METHOD(int, fcntl_impl, (int, int), (const));
-    MOCK_METHOD(int, fcntl_impl, (int, int, int), (const));
-};
-
 // ======================================== Util ========================================
 
 #define AnyValue ::testing::_
@@ -44,6 +22,20 @@ auto ReturnRef(T& val)
     return ::testing::ReturnRef(val);
 }
 
+// Runs one request through the server the way a socket read would, returns the response status and data
+std::pair<ResponseStatus, std::string> send_request(Server<MockSocketWrapper, MockEpollWrapper>& server,
+                                                    Connection& conn, std::initializer_list<std::string_view> args)
+{
+    size_t const old_size = conn.outgoing.size();
+    append_request_frame(conn.incoming, args);
+    server.try_request(conn);
+
+    uint32_t resp_len{};
+    std::memcpy(&resp_len, conn.outgoing.data() + old_size, sizeof(resp_len));
+    auto const* resp = conn.outgoing.data() + old_size + sizeof(resp_len);
+    return { static_cast<ResponseStatus>(resp[0]), std::string(resp + 1, resp + resp_len) };
+}
+
 // ======================================== Test Fixture ========================================
 
 class ServerTest : public ::testing::Test
@@ -111,4 +103,1355 @@ TEST_F(ServerTest, ServerHandlesNewClientConnection)
     server.start();
 }
 
+TEST_F(ServerTest, ServerListensOnUnixSocketOnly)
+{
+    // Arrange
+    MockEpollWrapper epoll;
+    Server<MockSocketWrapper, MockEpollWrapper> unix_server(0, mock_sock, epoll);
+    unix_server.configure({ .unix_socket = "/tmp/byor_test.sock" });
+
+    EXPECT_CALL(mock_sock, socket_impl(AF_UNIX, SOCK_STREAM, AnyValue))
+        .Times(1);
+    EXPECT_CALL(mock_sock, socket_impl(AF_INET, AnyValue, AnyValue))
+        .Times(0);
+
+    // Act/Assert
+    EXPECT_CALL(epoll, add_conn_impl(EXPECTED_SERVER_FD))
+        .Times(1)
+        .WillOnce([&unix_server]() { unix_server.stop(); });
+    unix_server.start();
+}
+
+TEST_F(ServerTest, ShmChannelIsDroppedWhenTheClientCorruptsTheRing)
+{
+    // Arrange: attach a channel over a unix socket and pick up its descriptors like SocketClient does
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    Connection owner{};
+    owner.fd = fds[0];
+    int shm_efd{ -1 };
+    EXPECT_CALL(mock_epoll, add_conn_impl(AnyValue)).WillOnce([&shm_efd](int fd) { shm_efd = fd; });
+    append_request_frame(owner.incoming, { "shmattach" });
+    EXPECT_TRUE(server.try_request(owner));
+
+    uint8_t reply[64];
+    int received[3]{ -1, -1, -1 }; // memfd, client eventfd, server eventfd
+    iovec iov{ reply, sizeof(reply) };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(received))]{};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ASSERT_GT(recvmsg(fds[1], &msg, 0), 0);
+    ASSERT_NE(CMSG_FIRSTHDR(&msg), nullptr);
+    std::memcpy(received, CMSG_DATA(CMSG_FIRSTHDR(&msg)), sizeof(received));
+
+    // The segment cannot be resized under the server's mapping
+    EXPECT_EQ(ftruncate(received[0], 0), -1);
+
+    // The request ring's header follows the segment header, a head far past the tail claims more than the ring holds
+    void* const base = mmap(nullptr, CACHE_LINE_SIZE + sizeof(RingHeader), PROT_READ | PROT_WRITE, MAP_SHARED,
+                            received[0], 0);
+    ASSERT_NE(base, MAP_FAILED);
+    reinterpret_cast<RingHeader*>(static_cast<uint8_t*>(base) + CACHE_LINE_SIZE)->head.store(uint64_t{ 1 } << 40);
+
+    Connection shm_conn{};
+    shm_conn.fd = shm_efd;
+    epoll_event shm_event{};
+    shm_event.events = EPOLLIN;
+    shm_event.data.fd = shm_efd;
+    EXPECT_CALL(mock_epoll, add_conn_impl(EXPECTED_SERVER_FD)).Times(1);
+    ON_CALL(mock_epoll, get_event_impl(AnyValue)).WillByDefault(ReturnRef(shm_event));
+    ON_CALL(mock_epoll, get_connection_impl(shm_efd)).WillByDefault(ReturnRef(shm_conn));
+    EXPECT_CALL(mock_epoll, wait_impl())
+        .WillOnce(Return(1))
+        .WillOnce(
+            [this]()
+            {
+                server.stop();
+                return 0;
+            });
+
+    // Act
+    server.start();
+
+    // Assert: nothing was read from the ring and the owner socket was shut down
+    EXPECT_TRUE(shm_conn.incoming.empty());
+    char byte{};
+    EXPECT_EQ(recv(fds[1], &byte, 1, 0), 0);
+
+    munmap(base, CACHE_LINE_SIZE + sizeof(RingHeader));
+    for ( int fd : { fds[0], fds[1], received[0], received[1], received[2] } )
+        close(fd);
+}
+
+TEST(ShmRingTest, WrapsAroundAndRefusesCorruptPositions)
+{
+    // Arrange: a 64-byte ring, and a raw view of its header as the peer has it
+    ShmSegment segment;
+    int const fd = ShmSegment::create(segment, 64);
+    void* const base = mmap(nullptr, CACHE_LINE_SIZE + sizeof(RingHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ASSERT_NE(base, MAP_FAILED);
+    close(fd);
+    auto* header = reinterpret_cast<RingHeader*>(static_cast<uint8_t*>(base) + CACHE_LINE_SIZE);
+    auto& ring = segment.requests();
+    auto const bytes = [](std::string const& str) { return reinterpret_cast<uint8_t const*>(str.data()); };
+
+    // Act/Assert: writes and reads across the end of the buffer keep their bytes in order
+    std::string out(64, '\0');
+    for ( int i = 0; i < 10; i++ )
+    {
+        std::string const in(40, static_cast<char>('a' + i));
+        ASSERT_EQ(ring.write(bytes(in), in.size()), 40u);
+        EXPECT_EQ(ring.writable(), 24u);
+        ASSERT_EQ(ring.read(reinterpret_cast<uint8_t*>(out.data()), out.size()), 40u);
+        EXPECT_EQ(out.substr(0, 40), in);
+    }
+    std::string const large(100, 'x');
+    EXPECT_EQ(ring.write(bytes(large), large.size()), 64u);
+    EXPECT_EQ(ring.read(reinterpret_cast<uint8_t*>(out.data()), out.size()), 64u);
+    EXPECT_EQ(out, large.substr(0, 64));
+
+    // A head more than the capacity ahead of the tail, or behind it, moves no bytes either way
+    uint64_t const tail = header->tail.load();
+    header->head.store(tail + 1000);
+    EXPECT_EQ(ring.readable(), SHM_RING_CORRUPT);
+    EXPECT_EQ(ring.read(reinterpret_cast<uint8_t*>(out.data()), out.size()), 0u);
+    EXPECT_EQ(header->tail.load(), tail);
+    header->head.store(tail - 1);
+    EXPECT_EQ(ring.writable(), SHM_RING_CORRUPT);
+    EXPECT_EQ(ring.write(bytes(large), large.size()), 0u);
+    EXPECT_EQ(header->head.load(), tail - 1);
+
+    munmap(base, CACHE_LINE_SIZE + sizeof(RingHeader));
+}
+
+TEST(SharedOutputQueueTest, StaysInOrderWhileNeverDrainingFully)
+{
+    // A subscriber that always has a frame left behind never empties its queue
+    SharedOutputQueue queue{};
+    uint64_t next_push{ 0 }, next_pop{ 0 };
+    queue.push_back({ .data = {}, .at = next_push++ });
+    for ( int round = 0; round < 1000; ++round )
+    {
+        queue.push_back({ .data = {}, .at = next_push++ });
+        queue.push_back({ .data = {}, .at = next_push++ });
+        ASSERT_EQ(queue.front().at, next_pop++);
+        queue.pop_front();
+        ASSERT_EQ(queue.front().at, next_pop++);
+        queue.pop_front();
+        ASSERT_EQ(queue.size(), 1);
+    }
+    EXPECT_EQ(std::distance(queue.begin(), queue.end()), 1);
+    EXPECT_EQ(queue.front().at, next_pop);
+}
+
+TEST_F(ServerTest, ReplicaRejectsClientWrites)
+{
+    // Arrange: a master address that is not HOST:PORT is refused like on the command line
+    EXPECT_THROW(server.configure({ .replica_of = "127.0.0.1" }), std::invalid_argument);
+    EXPECT_THROW(server.configure({ .replica_of = "127.0.0.1:70000" }), std::invalid_argument);
+    server.configure({ .replica_of = "127.0.0.1:" + std::to_string(DUMMY_PORT) });
+    Connection conn{};
+    conn.fd = EXPECTED_CLIENT_FD;
+
+    // Act/Assert
+    EXPECT_EQ(send_request(server, conn, { "set", "key", "val" }).first, ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "get", "key" }).first, ResponseStatus::RES_NX);
+}
+
+TEST_F(ServerTest, PrimaryResumesReplicaFromBacklog)
+{
+    // Arrange
+    Connection replica{};
+    replica.fd = EXPECTED_CLIENT_FD;
+    Connection client{};
+    client.fd = EXPECTED_CLIENT_FD + 1;
+    ON_CALL(mock_epoll, get_connection_impl(EXPECTED_CLIENT_FD))
+        .WillByDefault(ReturnRef(replica));
+
+    auto const [status, reply] = send_request(server, replica, { "psync", "?", "0" });
+    ASSERT_EQ(status, ResponseStatus::RES_OK);
+    ASSERT_EQ(reply.rfind("fullresync ", 0), 0);
+    std::string const replid = reply.substr(11, REPL_ID_SIZE);
+
+    // Act: a write is forwarded to the replica as the original request frame
+    std::vector<uint8_t> frame;
+    append_request_frame(frame, { "set", "key", "val" });
+    replica.outgoing.clear();
+    send_request(server, client, { "set", "key", "val" });
+    EXPECT_EQ(replica.outgoing, frame);
+
+    // Assert: reconnecting from offset 0 with the same replid only replays the missed write
+    Connection resumed{};
+    resumed.fd = EXPECTED_CLIENT_FD + 2;
+    auto const [resumed_status, resumed_reply] = send_request(server, resumed, { "psync", replid, "0" });
+    EXPECT_EQ(resumed_status, ResponseStatus::RES_OK);
+    EXPECT_EQ(resumed_reply, "continue " + replid);
+    EXPECT_TRUE(std::equal(frame.rbegin(), frame.rend(), resumed.outgoing.rbegin()));
+}
+
+TEST(ReplicationBacklogTest, KeepsOnlyTheTailOfTheStream)
+{
+    // Arrange
+    ReplicationBacklog backlog(8);
+    std::vector<uint8_t> const data{ 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+    // Act
+    backlog.append(data.data(), 5);
+    backlog.append(data.data() + 5, 6);
+
+    // Assert
+    std::vector<uint8_t> out;
+    EXPECT_FALSE(backlog.copy_from(2, out));
+    EXPECT_TRUE(backlog.copy_from(3, out));
+    EXPECT_EQ(out, std::vector<uint8_t>(data.begin() + 3, data.end()));
+    EXPECT_FALSE(backlog.copy_from(12, out));
+}
+
+TEST_F(ServerTest, ClusterRedirectsKeysOfOtherNodes)
+{
+    // Arrange
+    std::string const config{ "/tmp/byor_test_cluster.conf" };
+    std::ofstream(config) << "0-8191 127.0.0.1:7001\n8192-16383 127.0.0.1:7002\n";
+    server.configure({ .cluster_self = "127.0.0.1:7001", .cluster_config = config });
+    Connection conn{};
+    conn.fd = EXPECTED_CLIENT_FD;
+
+    // Act/Assert: "foo" hashes to 12182 like in Redis Cluster, hash tags pin keys to one slot
+    EXPECT_EQ(key_hash_slot("foo"), 12182);
+    EXPECT_EQ(key_hash_slot("{user1}.a"), key_hash_slot("user1"));
+    EXPECT_EQ(send_request(server, conn, { "set", "foo", "1" }),
+              std::make_pair(ResponseStatus::RES_MOVED, std::string("12182 127.0.0.1:7002")));
+    EXPECT_EQ(send_request(server, conn, { "set", "bar", "1" }).first, ResponseStatus::RES_OK);
+    EXPECT_EQ(send_request(server, conn, { "mget", "bar", "foo" }).first, ResponseStatus::RES_ERR);
+}
+
+TEST_F(ServerTest, ImportingSlotIsOnlyServedAfterAsking)
+{
+    // Arrange
+    std::string const config{ "/tmp/byor_test_cluster.conf" };
+    std::ofstream(config) << "0-8191 127.0.0.1:7001\n8192-16383 127.0.0.1:7002\n";
+    server.configure({ .cluster_self = "127.0.0.1:7002", .cluster_config = config });
+    Connection conn{};
+    conn.fd = EXPECTED_CLIENT_FD;
+    std::string const slot{ std::to_string(key_hash_slot("{bar}.moving")) };
+    std::string const value{ encode_value(std::string("1")) };
+
+    // Act/Assert: restored keys stay hidden from clients that were not sent here by an ASK
+    EXPECT_EQ(send_request(server, conn, { "cluster", "restore", slot, "0", "{bar}.moving", value }).first,
+              ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "cluster", "importing", slot, "127.0.0.1:7001" }).first,
+              ResponseStatus::RES_OK);
+    EXPECT_EQ(send_request(server, conn, { "cluster", "restore", slot, "0", "{bar}.moving", value }).first,
+              ResponseStatus::RES_OK);
+    EXPECT_EQ(send_request(server, conn, { "get", "{bar}.moving" }).first, ResponseStatus::RES_MOVED);
+    EXPECT_EQ(send_request(server, conn, { "asking" }).first, ResponseStatus::RES_OK);
+    EXPECT_EQ(send_request(server, conn, { "get", "{bar}.moving" }),
+              std::make_pair(ResponseStatus::RES_OK, std::string("1")));
+    EXPECT_EQ(send_request(server, conn, { "get", "{bar}.moving" }).first, ResponseStatus::RES_MOVED);
+
+    // Malformed numbers are refused
+    EXPECT_EQ(send_request(server, conn, { "cluster", "importing", "x", "127.0.0.1:7001" }).first,
+              ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "cluster", "restore", slot, "-1", "{bar}.moving", value }).first,
+              ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "cluster", "migrate", "x", "127.0.0.1:7001" }).first,
+              ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "cluster", "migrate", "9000", "127.0.0.1:port" }).first,
+              ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "cluster", "setslot", "70000", "70000", "127.0.0.1:7001" }).first,
+              ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "cluster", "setslot", "12abc", "12abc", "127.0.0.1:7001" }).first,
+              ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "cluster", "setslot", "8192", "16384", "127.0.0.1:7001" }).first,
+              ResponseStatus::RES_ERR);
+}
+
+TEST_F(ServerTest, SortedSetRangesAndTypeChecks)
+{
+    // Arrange
+    Connection conn{};
+    conn.fd = EXPECTED_CLIENT_FD;
+    send_request(server, conn, { "zadd", "board", "30", "carol", "10", "alice", "20", "bob", "20", "bea" });
+    auto members = [](std::string const& data)
+    {
+        std::vector<std::optional<std::string>> out;
+        parse_array(reinterpret_cast<uint8_t const*>(data.data()), data.size(), out);
+        return out;
+    };
+    using Members = std::vector<std::optional<std::string>>;
+
+    // Act/Assert
+    EXPECT_EQ(send_request(server, conn, { "zadd", "board", "5", "bob" }).second, "0");
+    EXPECT_EQ(send_request(server, conn, { "zrank", "board", "bob" }).second, "0");
+    EXPECT_EQ(send_request(server, conn, { "zscore", "board", "bea" }).second, "20");
+    EXPECT_EQ(members(send_request(server, conn, { "zrange", "board", "1", "-1" }).second),
+              (Members{ "alice", "bea", "carol" }));
+    EXPECT_EQ(members(send_request(server, conn, { "zrangebyscore", "board", "(10", "+inf", "withscores" }).second),
+              (Members{ "bea", "20", "carol", "30" }));
+    EXPECT_EQ(send_request(server, conn, { "zrange", "board", "0", "1x" }).first, ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "zrangebyscore", "board", "0", "9", "limit", "0", "2abc" }).first,
+              ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "get", "board" }).first, ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "type", "board" }).second, "zset");
+    send_request(server, conn, { "set", "board", "plain" });
+    EXPECT_EQ(send_request(server, conn, { "zcard", "board" }).first, ResponseStatus::RES_ERR);
+
+    // A restored sorted set cannot smuggle in a NaN score either
+    std::string payload{ encode_value(Value{ std::make_unique<SortedSet>() }) };
+    payload[1] = 1; // One member
+    double const nan{ std::nan("") };
+    uint32_t const len{ 1 };
+    payload.append(reinterpret_cast<char const*>(&nan), sizeof(nan));
+    payload.append(reinterpret_cast<char const*>(&len), sizeof(len));
+    payload += 'm';
+    EXPECT_EQ(send_request(server, conn, { "restore", "nan", payload }).first, ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "type", "nan" }).second, "none");
+}
+
+TEST_F(ServerTest, HashStaysPackedUntilItGrows)
+{
+    // Arrange
+    Connection conn{};
+    conn.fd = EXPECTED_CLIENT_FD;
+    send_request(server, conn, { "hset", "user:1", "name", "ada", "visits", "41" });
+
+    // Act/Assert
+    EXPECT_EQ(send_request(server, conn, { "hincrby", "user:1", "visits", "1" }).second, "42");
+    EXPECT_EQ(send_request(server, conn, { "hincrby", "user:1", "name", "1" }).first, ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "hget", "user:1", "visits" }).second, "42");
+    EXPECT_EQ(send_request(server, conn, { "object", "encoding", "user:1" }).second, "packed");
+
+    for ( size_t i = 0; i < HASH_MAX_PACKED_ENTRIES; i++ )
+        send_request(server, conn, { "hset", "user:1", "field" + std::to_string(i), "v" });
+    EXPECT_EQ(send_request(server, conn, { "object", "encoding", "user:1" }).second, "hashtable");
+    EXPECT_EQ(send_request(server, conn, { "hget", "user:1", "name" }).second, "ada");
+    EXPECT_EQ(send_request(server, conn, { "hdel", "user:1", "name", "missing" }).second, "1");
+    EXPECT_EQ(send_request(server, conn, { "hlen", "user:1" }).second, std::to_string(HASH_MAX_PACKED_ENTRIES + 1));
+}
+
+TEST(SortedSetTest, RanksMatchSortedOrder)
+{
+    // Arrange
+    SortedSet zset;
+    std::vector<std::pair<double, std::string>> expected;
+    for ( int i = 0; i < 1000; i++ )
+    {
+        std::string const member{ "m" + std::to_string(i) };
+        zset.add((i * 7919) % 101, member);
+        if ( i % 3 == 0 )
+            zset.remove(member);
+        else
+            expected.emplace_back((i * 7919) % 101, member);
+    }
+    std::sort(expected.begin(), expected.end());
+
+    // Act/Assert
+    ASSERT_EQ(zset.size(), expected.size());
+    for ( size_t i = 0; i < expected.size(); i += 37 )
+        EXPECT_EQ(zset.rank(expected[i].second), i);
+
+    std::vector<std::string> range;
+    zset.range_by_rank(100, 109, [&range](std::string_view member, double) { range.emplace_back(member); });
+    for ( size_t i = 0; i < range.size(); i++ )
+        EXPECT_EQ(range[i], expected[100 + i].second);
+}
+
+TEST_F(ServerTest, BlockedPopsAreServedInArrivalOrder)
+{
+    // Arrange: two clients block on an empty list, the first one pipelines another request behind its pop
+    Connection first{};
+    first.fd = EXPECTED_CLIENT_FD;
+    Connection second{};
+    second.fd = EXPECTED_CLIENT_FD + 1;
+    Connection producer{};
+    producer.fd = EXPECTED_CLIENT_FD + 2;
+    ON_CALL(mock_epoll, get_connection_impl(first.fd)).WillByDefault(ReturnRef(first));
+    ON_CALL(mock_epoll, get_connection_impl(second.fd)).WillByDefault(ReturnRef(second));
+
+    append_request_frame(first.incoming, { "blpop", "jobs", "0" });
+    append_request_frame(first.incoming, { "llen", "jobs" });
+    append_request_frame(second.incoming, { "blpop", "other", "jobs", "0" });
+    EXPECT_FALSE(server.try_request(first));
+    EXPECT_FALSE(server.try_request(first));
+    EXPECT_FALSE(server.try_request(second));
+    EXPECT_TRUE(first.outgoing.empty());
+
+    // Act
+    EXPECT_EQ(send_request(server, producer, { "rpush", "jobs", "a", "b", "c" }).second, "3");
+
+    // Assert: each waiter got one element in the order it blocked, the pipelined llen ran after the pop
+    Connection expected{};
+    Response popped{ ResponseStatus::RES_OK };
+    append_array_header(popped.data, 2);
+    append_array_element(popped.data, "jobs");
+    append_array_element(popped.data, "a");
+    server.make_response(popped, expected.outgoing);
+    Response len{ ResponseStatus::RES_OK, { '2' } };
+    server.make_response(len, expected.outgoing);
+    EXPECT_EQ(first.outgoing, expected.outgoing);
+
+    std::vector<std::optional<std::string>> reply;
+    ASSERT_TRUE(parse_array(second.outgoing.data() + 5, second.outgoing.size() - 5, reply));
+    EXPECT_EQ(reply, (std::vector<std::optional<std::string>>{ "jobs", "b" }));
+    EXPECT_EQ(send_request(server, producer, { "rpop", "jobs" }).second, "c");
+    EXPECT_EQ(send_request(server, producer, { "type", "jobs" }).second, "none");
+}
+
+TEST_F(ServerTest, CountersAreStoredAsIntegers)
+{
+    // Arrange
+    Connection conn{};
+    conn.fd = EXPECTED_CLIENT_FD;
+    send_request(server, conn, { "set", "hits", "10" });
+    send_request(server, conn, { "set", "padded", "007" });
+
+    // Act/Assert
+    EXPECT_EQ(send_request(server, conn, { "object", "encoding", "hits" }).second, "int");
+    EXPECT_EQ(send_request(server, conn, { "object", "encoding", "padded" }).second, "embstr");
+    EXPECT_EQ(send_request(server, conn, { "incr", "hits" }).second, "11");
+    EXPECT_EQ(send_request(server, conn, { "decrby", "hits", "20" }).second, "-9");
+    EXPECT_EQ(send_request(server, conn, { "get", "hits" }).second, "-9");
+    EXPECT_EQ(send_request(server, conn, { "type", "hits" }).second, "string");
+    EXPECT_EQ(send_request(server, conn, { "incr", "missing" }).second, "1");
+    EXPECT_EQ(send_request(server, conn, { "incr", "padded" }).first, ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "incrby", "hits", "9223372036854775807" }).second, "9223372036854775798");
+    EXPECT_EQ(send_request(server, conn, { "incrby", "hits", "10" }).first, ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "get", "hits" }).second, "9223372036854775798");
+}
+
+TEST_F(ServerTest, PublishSharesOneFramePerReceiverGroup)
+{
+    // Arrange: two channel subscribers with their subscribe replies still queued, one idle pattern subscriber
+    int a_fds[2], b_fds[2], c_fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, a_fds), 0);
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, b_fds), 0);
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, c_fds), 0);
+    Connection a{}, b{}, c{}, producer{};
+    a.fd = a_fds[0];
+    b.fd = b_fds[0];
+    c.fd = c_fds[0];
+    producer.fd = EXPECTED_CLIENT_FD;
+    for ( Connection* conn : { &a, &b, &c } )
+        ON_CALL(mock_epoll, get_connection_impl(conn->fd)).WillByDefault(ReturnRef(*conn));
+
+    send_request(server, a, { "subscribe", "news" });
+    send_request(server, b, { "subscribe", "news", "sports" });
+    send_request(server, c, { "psubscribe", "n[aeiou]w*" });
+    c.outgoing.clear();
+
+    // Act
+    EXPECT_EQ(send_request(server, producer, { "publish", "news", "hello" }).second, "3");
+
+    // Assert: the channel subscribers hold the same buffer, queued behind their replies
+    ASSERT_EQ(a.shared.size(), 1);
+    ASSERT_EQ(b.shared.size(), 1);
+    EXPECT_EQ(a.shared.front().data, b.shared.front().data);
+    EXPECT_EQ(a.shared.front().at, a.outgoing.size());
+
+    // The idle subscriber was written to directly
+    EXPECT_TRUE(c.shared.empty());
+    std::vector<uint8_t> received(256);
+    received.resize(std::max<ssize_t>(::read(c_fds[1], received.data(), received.size()), 0));
+    std::vector<std::optional<std::string>> message;
+    ASSERT_GT(received.size(), 5);
+    ASSERT_TRUE(parse_array(received.data() + 5, received.size() - 5, message));
+    EXPECT_EQ(message, (std::vector<std::optional<std::string>>{ "pmessage", "n[aeiou]w*", "news", "hello" }));
+
+    // A subscriber over its output limit is cut off instead of buffering without bound
+    server.configure({ .pubsub_limits = { .hard = 64, .soft = 64, .soft_seconds = std::chrono::seconds(60) } });
+    EXPECT_EQ(send_request(server, producer, { "publish", "sports", std::string(100, 'x') }).second, "1");
+    EXPECT_TRUE(b.shared.empty());
+    EXPECT_EQ(send_request(server, producer, { "publish", "sports", "more" }).second, "0");
+
+    for ( int fd : { a_fds[0], a_fds[1], b_fds[0], b_fds[1], c_fds[0], c_fds[1] } )
+        close(fd);
+}
+
+TEST_F(ServerTest, TrackingClientsAreToldWhenKeysTheyReadChange)
+{
+    // Arrange: a tracking reader with nothing queued, so pushes go straight to its socket
+    int a_fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, a_fds), 0);
+    Connection reader{}, writer{};
+    reader.fd = a_fds[0];
+    writer.fd = EXPECTED_CLIENT_FD;
+    ON_CALL(mock_epoll, get_connection_impl(reader.fd)).WillByDefault(ReturnRef(reader));
+
+    auto next_push = [&a_fds]()
+    {
+        std::vector<uint8_t> received(256);
+        received.resize(std::max<ssize_t>(::recv(a_fds[1], received.data(), received.size(), MSG_DONTWAIT), 0));
+        std::vector<std::optional<std::string>> message;
+        if ( received.size() > 5 && received[4] == static_cast<uint8_t>(ResponseStatus::RES_PUSH) )
+            parse_array(received.data() + 5, received.size() - 5, message);
+        return message;
+    };
+    using Message = std::vector<std::optional<std::string>>;
+
+    EXPECT_EQ(send_request(server, reader, { "client", "tracking", "on" }).first, ResponseStatus::RES_OK);
+    EXPECT_EQ(send_request(server, reader, { "get", "k1" }).first, ResponseStatus::RES_NX);
+    send_request(server, reader, { "mget", "k1", "k2" });
+    reader.outgoing.clear();
+
+    // Act/Assert: the first write of a read key is pushed once, the next one was not read since
+    send_request(server, writer, { "set", "k1", "v" });
+    EXPECT_EQ(next_push(), (Message{ "invalidate", "k1" }));
+    send_request(server, writer, { "set", "k1", "w" });
+    EXPECT_TRUE(next_push().empty());
+
+    // Nothing read while tracking was on is reported after it is turned off
+    send_request(server, reader, { "client", "tracking", "off" });
+    reader.outgoing.clear();
+    send_request(server, writer, { "set", "k2", "v" });
+    EXPECT_TRUE(next_push().empty());
+
+    // Past the table's capacity a reader loses track of which key was evicted and must drop everything
+    server.configure({ .tracking_max_keys = 1 });
+    send_request(server, reader, { "client", "tracking", "on" });
+    send_request(server, reader, { "get", "k1" });
+    reader.outgoing.clear();
+    send_request(server, reader, { "get", "k2" });
+    reader.outgoing.clear();
+    EXPECT_EQ(next_push(), (Message{ "invalidate", std::nullopt }));
+
+    // A request of zero strings never reaches the command dispatch
+    EXPECT_EQ(send_request(server, writer, {}),
+              std::make_pair(ResponseStatus::RES_ERR, std::string("ERR empty command")));
+
+    close(a_fds[0]);
+    close(a_fds[1]);
+}
+
+TEST_F(ServerTest, ScanReturnsEveryKeyOnceWhileTheKeyspaceChanges)
+{
+    // Arrange
+    Connection conn{};
+    conn.fd = EXPECTED_CLIENT_FD;
+    std::set<std::string> expected;
+    for ( int i = 0; i < 100; i++ )
+    {
+        std::string const key = "user:" + std::to_string(i);
+        send_request(server, conn, { "set", key, "v" });
+        expected.insert(key);
+    }
+    send_request(server, conn, { "zadd", "user:z", "1", "m" });
+
+    // Act: keys come and go between the calls of one walk
+    std::multiset<std::string> seen;
+    std::string cursor{ "0" };
+    int calls{ 0 };
+    do
+    {
+        auto const [status, data] = send_request(server, conn, { "scan", cursor, "match", "user:*", "count", "7" });
+        ASSERT_EQ(status, ResponseStatus::RES_OK);
+        std::vector<std::optional<std::string>> reply;
+        ASSERT_TRUE(parse_array(reinterpret_cast<uint8_t const*>(data.data()), data.size(), reply));
+        ASSERT_LE(reply.size(), 8);
+        cursor = *reply[0];
+        for ( size_t i = 1; i < reply.size(); i++ )
+            seen.insert(*reply[i]);
+
+        send_request(server, conn, { "set", "user:new" + std::to_string(calls), "v" });
+        send_request(server, conn, { "del", "user:new" + std::to_string(calls - 1) });
+        send_request(server, conn, { "set", "other:" + std::to_string(calls), "v" });
+        calls++;
+    } while ( cursor != "0" );
+
+    // Assert: every key that existed throughout was returned exactly once, nothing outside the pattern
+    for ( auto const& key : expected )
+        EXPECT_EQ(seen.count(key), 1) << key;
+    EXPECT_EQ(seen.count("user:z"), 1);
+    EXPECT_TRUE(std::all_of(seen.begin(), seen.end(), [](auto const& key) { return key.starts_with("user:"); }));
+    EXPECT_GE(calls, 101 / 7);
+
+    auto const [status, data] = send_request(server, conn, { "scan", "0", "type", "zset", "count", "1000" });
+    std::vector<std::optional<std::string>> reply;
+    ASSERT_TRUE(parse_array(reinterpret_cast<uint8_t const*>(data.data()), data.size(), reply));
+    EXPECT_EQ(reply, (std::vector<std::optional<std::string>>{ "0", "user:z" }));
+    EXPECT_EQ(send_request(server, conn, { "scan", "17" }).first, ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "scan", "0", "count", "10abc" }).first, ResponseStatus::RES_ERR);
+}
+
+TEST_F(ServerTest, PrefixQueriesPageThroughKeysWithAndWithoutTheIndex)
+{
+    Connection conn{};
+    conn.fd = EXPECTED_CLIENT_FD;
+    for ( std::string const key : { "t1:a", "t1:b", "t1:b:x", "t1:c", "t10:a", "t2:a" } )
+        send_request(server, conn, { "set", key, "v:" + key });
+    send_request(server, conn, { "hset", "t1:h", "f", "1" });
+
+    auto query = [&](std::initializer_list<std::string_view> args)
+    {
+        auto const [status, data] = send_request(server, conn, args);
+        std::vector<std::optional<std::string>> reply;
+        EXPECT_EQ(status, ResponseStatus::RES_OK);
+        EXPECT_TRUE(parse_array(reinterpret_cast<uint8_t const*>(data.data()), data.size(), reply));
+        return reply;
+    };
+    using Reply = std::vector<std::optional<std::string>>;
+
+    for ( bool const indexed : { false, true } )
+    {
+        if ( indexed )
+            server.configure({ .prefix_index = true });
+
+        // Act/Assert: pages of two keys, continued from the returned cursor
+        Reply const first = query({ "prefix", "t1:", "limit", "2" });
+        EXPECT_EQ(first, (Reply{ ">t1:b", "t1:a", "t1:b" }));
+        Reply const second = query({ "prefix", "t1:", "cursor", *first[0], "limit", "2", "withvalues" });
+        EXPECT_EQ(second, (Reply{ ">t1:c", "t1:b:x", "v:t1:b:x", "t1:c", "v:t1:c" }));
+        EXPECT_EQ(query({ "prefix", "t1:", "cursor", *second[0], "withvalues" }), (Reply{ "0", "t1:h", std::nullopt }));
+
+        EXPECT_EQ(query({ "range", "t1:b", "t2" }), (Reply{ "0", "t1:b", "t1:b:x", "t1:c", "t1:h" }));
+        EXPECT_EQ(query({ "range", "t1:c", "" }), (Reply{ "0", "t1:c", "t1:h", "t2:a" }));
+        EXPECT_EQ(query({ "prefix", "t3" }), (Reply{ "0" }));
+    }
+
+    // The index follows writes made after it was built
+    send_request(server, conn, { "del", "t1:b" });
+    send_request(server, conn, { "set", "t1:0", "v" });
+    EXPECT_EQ(query({ "prefix", "t1:", "limit", "3" }), (Reply{ ">t1:b:x", "t1:0", "t1:a", "t1:b:x" }));
+    EXPECT_EQ(send_request(server, conn, { "prefix", "t1:", "limit", "3x" }).first, ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "range", "t1:", "t2", "limit", "2.5" }).first, ResponseStatus::RES_ERR);
+}
+
+TEST(ArtTest, MatchesAnOrderedSetUnderRandomInsertsAndErases)
+{
+    // Arrange: short keys over a small alphabet share long prefixes and end inside each other, long ones exceed the
+    // inline prefix
+    using Entry = std::pair<std::string const, int>;
+    struct KeyOf
+    {
+        std::string_view operator()(Entry const& e) const noexcept
+        {
+            return e.first;
+        }
+    };
+    AdaptiveRadixTree<Entry, KeyOf> tree;
+    std::map<std::string, int> expected;
+    std::mt19937 rng{ 7 };
+
+    auto random_key = [&rng]()
+    {
+        std::string key(rng() % 2 ? std::string(rng() % 20, 'p') : std::string());
+        size_t const len = rng() % 6;
+        for ( size_t i = 0; i < len; i++ )
+            key += static_cast<char>(rng() % 3 == 0 ? rng() % 256 : 'a' + rng() % 3);
+        return key;
+    };
+
+    // Act
+    for ( int i = 0; i < 20000; i++ )
+    {
+        std::string const key = random_key();
+        if ( rng() % 3 == 0 )
+        {
+            // The tree points into `expected`, so it lets go of the element first
+            bool const erased = tree.erase(key);
+            EXPECT_EQ(erased, expected.erase(key) == 1);
+            continue;
+        }
+        auto [it, inserted] = expected.try_emplace(key, i);
+        if ( inserted )
+            tree.insert(&*it);
+    }
+
+    // Assert
+    ASSERT_EQ(tree.size(), expected.size());
+    for ( int i = 0; i < 200; i++ )
+    {
+        std::string const lower = random_key();
+        std::vector<std::string> walked;
+        tree.for_each_from(lower,
+                           [&](Entry const& e)
+                           {
+                               walked.push_back(e.first);
+                               return walked.size() < 50;
+                           });
+
+        std::vector<std::string> want;
+        for ( auto it = expected.lower_bound(lower); it != expected.end() && want.size() < 50; ++it )
+            want.push_back(it->first);
+        ASSERT_EQ(walked, want) << "from " << lower;
+
+        auto const* found = tree.find(lower);
+        EXPECT_EQ(found != nullptr, expected.contains(lower));
+    }
+}
+
+TEST_F(ServerTest, BloomFiltersAnswerMembershipAndReportTheirStats)
+{
+    Connection conn{};
+    conn.fd = EXPECTED_CLIENT_FD;
+    auto info = [&](std::string_view key)
+    {
+        auto const [status, data] = send_request(server, conn, { "bf.info", key });
+        std::vector<std::optional<std::string>> fields;
+        EXPECT_EQ(status, ResponseStatus::RES_OK);
+        EXPECT_TRUE(parse_array(reinterpret_cast<uint8_t const*>(data.data()), data.size(), fields));
+        std::map<std::string, std::string> by_name;
+        for ( size_t i = 0; i + 1 < fields.size(); i += 2 )
+            by_name[*fields[i]] = *fields[i + 1];
+        return by_name;
+    };
+
+    // Act/Assert
+    EXPECT_EQ(send_request(server, conn, { "bf.reserve", "seen", "0.001", "1000" }).first, ResponseStatus::RES_OK);
+    EXPECT_EQ(send_request(server, conn, { "bf.reserve", "seen", "0.01", "10" }).first, ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "bf.reserve", "bad", "1.5", "10" }).first, ResponseStatus::RES_ERR);
+
+    EXPECT_EQ(send_request(server, conn, { "bf.add", "seen", "a" }).second, "1");
+    EXPECT_EQ(send_request(server, conn, { "bf.add", "seen", "a" }).second, "0");
+    std::string const added{ send_request(server, conn, { "bf.madd", "seen", "b", "a", "c" }).second };
+    std::vector<std::optional<std::string>> replies;
+    ASSERT_TRUE(parse_array(reinterpret_cast<uint8_t const*>(added.data()), added.size(), replies));
+    EXPECT_EQ(replies, (std::vector<std::optional<std::string>>{ "1", "0", "1" }));
+    EXPECT_EQ(send_request(server, conn, { "bf.exists", "seen", "c" }).second, "1");
+    EXPECT_EQ(send_request(server, conn, { "bf.exists", "seen", "never" }).second, "0");
+    EXPECT_EQ(send_request(server, conn, { "bf.exists", "missing", "a" }).second, "0");
+    EXPECT_EQ(send_request(server, conn, { "type", "seen" }).second, "bloom");
+
+    auto const stats = info("seen");
+    EXPECT_EQ(stats.at("capacity"), "1000");
+    EXPECT_EQ(stats.at("error_rate"), "0.001");
+    EXPECT_EQ(stats.at("items"), "3");
+    EXPECT_GT(std::stod(stats.at("bytes_per_item")), 1.0);
+    EXPECT_LT(std::stod(stats.at("estimated_fpr")), 0.001);
+
+    // bf.add creates a default filter, other types are refused
+    EXPECT_EQ(send_request(server, conn, { "bf.add", "fresh", "x" }).second, "1");
+    EXPECT_EQ(info("fresh").at("capacity"), "100");
+    send_request(server, conn, { "set", "str", "v" });
+    EXPECT_EQ(send_request(server, conn, { "bf.add", "str", "x" }).first, ResponseStatus::RES_ERR);
+}
+
+TEST(BloomFilterTest, StaysNearItsErrorRateAndSurvivesEncoding)
+{
+    // Arrange
+    constexpr size_t CAPACITY{ 20000 };
+    BloomFilter bloom{ CAPACITY, 0.01 };
+    for ( size_t i = 0; i < CAPACITY; i++ )
+        bloom.add("member:" + std::to_string(i));
+
+    // Act
+    size_t false_positives{ 0 };
+    for ( size_t i = 0; i < 100000; i++ )
+        false_positives += bloom.contains("other:" + std::to_string(i));
+
+    Value decoded;
+    ASSERT_TRUE(decode_value(encode_value(std::make_unique<BloomFilter>(CAPACITY, 0.01)), decoded));
+    std::string const encoded{ encode_value(Value{ std::make_unique<BloomFilter>(std::move(bloom)) }) };
+    ASSERT_TRUE(decode_value(encoded, decoded));
+    auto const* copy = value_as<BloomFilter>(decoded);
+
+    // Assert: no false negatives, and the measured rate is close to both the target and the filter's own estimate
+    ASSERT_NE(copy, nullptr);
+    for ( size_t i = 0; i < CAPACITY; i++ )
+        ASSERT_TRUE(copy->contains("member:" + std::to_string(i)));
+    double const measured = false_positives / 100000.0;
+    EXPECT_LT(measured, 0.013);
+    EXPECT_NEAR(measured, copy->estimated_fpr(), 0.003);
+    EXPECT_LE(copy->items(), CAPACITY);
+    EXPECT_FALSE(decode_value(encoded.substr(0, encoded.size() - 1), decoded));
+
+    // A header that asks for a huge filter without carrying its bytes is refused before anything is allocated
+    std::string huge{ encoded.substr(0, 1 + 3 * sizeof(uint64_t)) };
+    uint64_t const huge_capacity{ uint64_t{ 1 } << 28 };
+    std::memcpy(huge.data() + 1, &huge_capacity, sizeof(huge_capacity));
+    ASSERT_TRUE(BloomFilter::valid_params(huge_capacity, 0.01));
+    EXPECT_FALSE(decode_value(huge, decoded));
+}
+
+TEST_F(ServerTest, HyperLogLogCountsMergesAndTurnsDense)
+{
+    Connection conn{};
+    conn.fd = EXPECTED_CLIENT_FD;
+    auto count = [&](std::initializer_list<std::string_view> keys)
+    {
+        std::vector<std::string_view> args{ "pfcount" };
+        args.insert(args.end(), keys.begin(), keys.end());
+        append_request_frame(conn.incoming, args);
+        size_t const old_size = conn.outgoing.size();
+        server.try_request(conn);
+        return std::stoull(std::string(conn.outgoing.begin() + old_size + 5, conn.outgoing.end()));
+    };
+
+    // Act/Assert: a handful of items stays sparse and is counted exactly
+    EXPECT_EQ(send_request(server, conn, { "pfadd", "day1", "a", "b", "c" }).second, "1");
+    EXPECT_EQ(send_request(server, conn, { "pfadd", "day1", "a" }).second, "0");
+    EXPECT_EQ(count({ "day1" }), 3u);
+    EXPECT_EQ(send_request(server, conn, { "object", "encoding", "day1" }).second, "sparse");
+
+    for ( int i = 0; i < 5000; i++ )
+    {
+        std::string const item{ "user:" + std::to_string(i) };
+        send_request(server, conn, { "pfadd", i % 2 ? "day1" : "day2", item });
+    }
+    EXPECT_EQ(send_request(server, conn, { "object", "encoding", "day1" }).second, "dense");
+    EXPECT_NEAR(static_cast<double>(count({ "day1", "day2" })), 5003, 5003 * 0.03);
+    EXPECT_EQ(count({ "day1", "missing" }), count({ "day1" }));
+
+    EXPECT_EQ(send_request(server, conn, { "pfmerge", "week", "day1", "day2" }).first, ResponseStatus::RES_OK);
+    EXPECT_EQ(count({ "week" }), count({ "day1", "day2" }));
+    EXPECT_LE(std::stoul(send_request(server, conn, { "memory", "usage", "week" }).second), 13u << 10);
+
+    send_request(server, conn, { "set", "str", "v" });
+    EXPECT_EQ(send_request(server, conn, { "pfcount", "day1", "str" }).first, ResponseStatus::RES_ERR);
+}
+
+TEST(HyperLogLogTest, StaysWithinItsErrorAndSurvivesEncoding)
+{
+    // Arrange: sketches of several sizes, each a prefix of the next one's items
+    std::vector<size_t> const sizes{ 10, 100, 700, 1000, 10000, 100000, 1000000 };
+    HyperLogLog hll;
+    size_t added{ 0 };
+    for ( size_t const size : sizes )
+    {
+        // Act
+        for ( ; added < size; added++ )
+            hll.add("visitor:" + std::to_string(added));
+
+        Value decoded;
+        ASSERT_TRUE(decode_value(encode_value(Value{ std::make_unique<HyperLogLog>() }), decoded));
+        HyperLogLog::Registers regs{};
+        hll.max_into(regs);
+        auto copy = std::make_unique<HyperLogLog>();
+        copy->assign(regs);
+        ASSERT_TRUE(decode_value(encode_value(Value{ std::move(copy) }), decoded));
+
+        // Assert: within 4 standard errors (0.81%) or one item
+        EXPECT_NEAR(static_cast<double>(hll.count()), size, std::max(1.0, 4 * 0.0081 * size)) << size;
+        EXPECT_EQ(hll.dense(), size > HLL_SPARSE_MAX_ENTRIES) << size;
+        EXPECT_EQ(value_as<HyperLogLog>(decoded)->count(), hll.count()) << size;
+    }
+}
+
+TEST_F(ServerTest, LargeValuesAreStoredCompressedAndReadBackWhole)
+{
+    // Arrange: a JSON document over the threshold, random bytes over it and a small value under it
+    server.configure({ .compress_threshold = 1024 });
+    Connection conn{};
+    conn.fd = EXPECTED_CLIENT_FD;
+    std::string doc{ "[" };
+    for ( int i = 0; doc.size() < 8192; i++ )
+        doc += R"({"id": )" + std::to_string(i) + R"(, "name": "user)" + std::to_string(i * 7) +
+               R"(", "active": true},)";
+    std::string noise(4096, '\0');
+    std::mt19937 rng{ 7 };
+    for ( char& c : noise )
+        c = static_cast<char>(rng());
+
+    // Act
+    send_request(server, conn, { "set", "doc", doc });
+    send_request(server, conn, { "mset", "noise", noise, "small", "v" });
+
+    // Assert: only the document is kept compressed, and every read gets it back whole
+    EXPECT_EQ(send_request(server, conn, { "object", "encoding", "doc" }).second, "lz4");
+    EXPECT_EQ(send_request(server, conn, { "object", "encoding", "noise" }).second, "raw");
+    EXPECT_EQ(send_request(server, conn, { "type", "doc" }).second, "string");
+    EXPECT_LT(std::stoul(send_request(server, conn, { "memory", "usage", "doc" }).second), doc.size() / 2);
+    EXPECT_EQ(send_request(server, conn, { "get", "doc" }), std::make_pair(ResponseStatus::RES_OK, doc));
+    std::vector<std::optional<std::string>> values;
+    std::string const mget = send_request(server, conn, { "mget", "small", "doc" }).second;
+    ASSERT_TRUE(parse_array(reinterpret_cast<uint8_t const*>(mget.data()), mget.size(), values));
+    EXPECT_EQ(values, (std::vector<std::optional<std::string>>{ "v", doc }));
+    EXPECT_EQ(send_request(server, conn, { "incr", "doc" }).second, "ERR value is not an integer or out of range");
+
+    // Restored (migrated, replicated) compressed strings stay compressed
+    send_request(server, conn, { "restore", "copy", encode_value(Value{ compress_string(doc) }) });
+    EXPECT_EQ(send_request(server, conn, { "object", "encoding", "copy" }).second, "lz4");
+    EXPECT_EQ(send_request(server, conn, { "get", "copy" }).second, doc);
+
+    // A client that negotiated it gets the stored block and inflates it itself
+    send_request(server, conn, { "client", "compression", "on" });
+    auto const [status, reply] = send_request(server, conn, { "get", "doc" });
+    ASSERT_EQ(status, ResponseStatus::RES_COMPRESSED);
+    uint32_t raw_size{};
+    std::memcpy(&raw_size, reply.data(), sizeof(raw_size));
+    std::string inflated(raw_size, '\0');
+    ASSERT_TRUE(lz4_decompress(std::string_view(reply).substr(sizeof(raw_size)), inflated.data(), raw_size));
+    EXPECT_EQ(inflated, doc);
+    EXPECT_EQ(send_request(server, conn, { "get", "small" }), std::make_pair(ResponseStatus::RES_OK, std::string("v")));
+
+    std::string const info = send_request(server, conn, { "info", "compression" }).second;
+    EXPECT_THAT(info, ::testing::HasSubstr("compressed_writes:1\n"));
+    EXPECT_THAT(info, ::testing::HasSubstr("incompressible_writes:1\n"));
+    EXPECT_THAT(info, ::testing::HasSubstr("inflated_reads:3\n"));
+    EXPECT_THAT(info, ::testing::HasSubstr("compressed_replies:1\n"));
+}
+
+TEST(CompressionTest, RoundTripsAnyInputAndReadsReferenceBlocks)
+{
+    // Arrange: a block written by liblz4 1.9.4 (LZ4_compress_default)
+    std::string const text{ R"({"id": 1, "tags": ["a", "b"]}, {"id": 2, "tags": ["a", "b"]}, )"
+                            R"({"id": 3, "tags": ["a", "b"]})" };
+    std::string const reference{ "\xf3\x10\x7b\x22\x69\x64\x22\x3a\x20\x31\x2c\x20\x22\x74\x61\x67\x73\x22\x3a\x20\x5b"
+                                 "\x22\x61\x22\x2c\x20\x22\x62\x22\x5d\x7d\x2c\x20\x1f\x00\x1f\x32\x1f\x00\x0b\x1c\x33"
+                                 "\x1f\x00\x50\x22\x62\x22\x5d\x7d",
+                                 50 };
+    std::string out(text.size(), '\0');
+    EXPECT_TRUE(lz4_decompress(reference, out.data(), out.size()));
+    EXPECT_EQ(out, text);
+    EXPECT_FALSE(lz4_decompress(reference, out.data(), out.size() - 1));
+    EXPECT_FALSE(lz4_decompress(std::string_view(reference).substr(0, 40), out.data(), out.size()));
+    EXPECT_TRUE(lz4_validate(reference, text.size()));
+    EXPECT_FALSE(lz4_validate(reference, text.size() - 1));
+    EXPECT_FALSE(lz4_validate(std::string_view(reference).substr(0, 40), text.size()));
+
+    // Act/Assert: empty, short, repetitive, text-like and random inputs of many sizes come back unchanged
+    std::mt19937 rng{ 42 };
+    for ( size_t size : { 0, 1, 12, 13, 17, 100, 4096, 65536, 70000, 300000 } )
+    {
+        for ( int kind = 0; kind < 3; kind++ )
+        {
+            std::string raw(size, 'x');
+            for ( char& c : raw )
+                c = kind == 0 ? static_cast<char>(rng()) : kind == 1 ? static_cast<char>('a' + rng() % 4) : c;
+            std::string block(lz4_compress_bound(size), '\0');
+            block.resize(lz4_compress(raw, block.data()));
+
+            std::string back(size, '\0');
+            ASSERT_TRUE(lz4_decompress(block, back.data(), size)) << size << " " << kind;
+            ASSERT_TRUE(lz4_validate(block, size)) << size << " " << kind;
+            EXPECT_EQ(back, raw) << size << " " << kind;
+            if ( kind == 2 && size > 1000 )
+            {
+                EXPECT_LT(block.size(), size / 100) << size;
+            }
+        }
+    }
+
+    // A restored block is refused when it does not inflate to its recorded size, or records more than a value can be
+    std::string encoded{ encode_value(Value{ compress_string(std::string(100000, 'z')) }) };
+    Value decoded;
+    EXPECT_TRUE(decode_value(encoded, decoded));
+    for ( uint32_t const raw_size : { 100001U, 99999U, static_cast<uint32_t>(MAX_MSG_SIZE_LIMIT) + 1 } )
+    {
+        std::memcpy(encoded.data() + 1, &raw_size, sizeof(raw_size));
+        EXPECT_FALSE(decode_value(encoded, decoded)) << raw_size;
+    }
+}
+
+TEST_F(ServerTest, LargeValuesAreFreedInTheBackground)
+{
+    // Arrange
+    Connection conn{};
+    conn.fd = EXPECTED_CLIENT_FD;
+    std::string const big(1 << 20, 'v');
+    auto freed_after_drain = [&]()
+    {
+        std::string info;
+        for ( int i = 0; i < 1000; i++ )
+        {
+            info = send_request(server, conn, { "info", "lazyfree" }).second;
+            if ( info.starts_with("lazyfree_pending_objects:0\n") )
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        auto const pos = info.find("lazyfreed_objects:") + std::string_view("lazyfreed_objects:").size();
+        return std::stoul(info.substr(pos));
+    };
+
+    // Act/Assert: `unlink` hands a large value over, a small one is freed inline
+    send_request(server, conn, { "mset", "big", big, "small", "v" });
+    EXPECT_EQ(send_request(server, conn, { "unlink", "big", "small", "missing" }).second, "2");
+    EXPECT_EQ(send_request(server, conn, { "get", "big" }).first, ResponseStatus::RES_NX);
+    EXPECT_EQ(freed_after_drain(), 1u);
+
+    // `del` and overwrites only do so in lazy-free mode
+    send_request(server, conn, { "set", "big", big });
+    send_request(server, conn, { "del", "big" });
+    EXPECT_EQ(freed_after_drain(), 1u);
+
+    server.configure({ .lazy_free = true });
+    send_request(server, conn, { "set", "big", big });
+    send_request(server, conn, { "set", "big", "small now" });
+    EXPECT_EQ(send_request(server, conn, { "get", "big" }).second, "small now");
+    for ( int i = 0; i < 100; i++ )
+        send_request(server, conn, { "zadd", "board", std::to_string(i), "player" + std::to_string(i) });
+    send_request(server, conn, { "del", "board" });
+    send_request(server, conn, { "del", "big" });
+    EXPECT_EQ(freed_after_drain(), 3u);
+}
+
+TEST_F(ServerTest, TransactionsRunTheirQueueUnlessAWatchedKeyChanged)
+{
+    // Arrange: an attached replica, transactions are forwarded to it
+    Connection replica{}, a{}, b{};
+    replica.fd = EXPECTED_CLIENT_FD;
+    a.fd = EXPECTED_CLIENT_FD + 1;
+    b.fd = EXPECTED_CLIENT_FD + 2;
+    ON_CALL(mock_epoll, get_connection_impl(EXPECTED_CLIENT_FD)).WillByDefault(ReturnRef(replica));
+    send_request(server, replica, { "psync", "?", "0" });
+    replica.outgoing.clear();
+
+    auto exec = [&]()
+    {
+        auto const [status, reply] = send_request(server, a, { "exec" });
+        std::vector<std::optional<std::string>> frames;
+        std::vector<std::pair<ResponseStatus, std::string>> replies;
+        if ( status == ResponseStatus::RES_OK &&
+             parse_array(reinterpret_cast<uint8_t const*>(reply.data()), reply.size(), frames) )
+        {
+            for ( auto const& frame : frames )
+                replies.emplace_back(static_cast<ResponseStatus>((*frame)[4]), frame->substr(5));
+        }
+        return std::pair{ status, replies };
+    };
+    using Replies = std::vector<std::pair<ResponseStatus, std::string>>;
+
+    // Act/Assert: queued requests only run at `exec`, which answers with each of their response frames
+    EXPECT_EQ(send_request(server, a, { "multi" }).first, ResponseStatus::RES_OK);
+    EXPECT_EQ(send_request(server, a, { "set", "k", "1" }).second, "QUEUED");
+    send_request(server, a, { "incr", "k" });
+    send_request(server, a, { "get", "missing" });
+    EXPECT_EQ(send_request(server, b, { "get", "k" }).first, ResponseStatus::RES_NX);
+    EXPECT_EQ(exec(), (std::pair{ ResponseStatus::RES_OK, Replies{ { ResponseStatus::RES_OK, "k set to 1" },
+                                                                   { ResponseStatus::RES_OK, "2" },
+                                                                   { ResponseStatus::RES_NX, "" } } }));
+
+    // The replica gets the writes between `multi` and `exec`
+    std::vector<uint8_t> forwarded;
+    append_request_frame(forwarded, { "multi" });
+    append_request_frame(forwarded, { "set", "k", "1" });
+    append_request_frame(forwarded, { "incr", "k" });
+    append_request_frame(forwarded, { "exec" });
+    EXPECT_EQ(replica.outgoing, forwarded);
+
+    // A write to a watched key by anyone else makes `exec` fail, an untouched one lets it run
+    send_request(server, a, { "watch", "k" });
+    send_request(server, b, { "set", "k", "b" });
+    send_request(server, a, { "multi" });
+    send_request(server, a, { "set", "k", "a" });
+    EXPECT_EQ(exec().first, ResponseStatus::RES_NX);
+    EXPECT_EQ(send_request(server, b, { "get", "k" }).second, "b");
+
+    send_request(server, a, { "watch", "k" });
+    send_request(server, b, { "set", "other", "b" });
+    send_request(server, a, { "multi" });
+    send_request(server, a, { "set", "k", "a" });
+    EXPECT_EQ(exec().first, ResponseStatus::RES_OK);
+    EXPECT_EQ(send_request(server, b, { "get", "k" }).second, "a");
+
+    // A refused request discards the whole transaction
+    send_request(server, a, { "multi" });
+    send_request(server, a, { "set", "k", "c" });
+    EXPECT_EQ(send_request(server, a, { "subscribe", "news" }).first, ResponseStatus::RES_ERR);
+    EXPECT_EQ(exec().first, ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, b, { "get", "k" }).second, "a");
+    EXPECT_EQ(send_request(server, a, { "discard" }).first, ResponseStatus::RES_ERR);
+}
+
+TEST_F(ServerTest, ScriptsRunReadComputeWriteSequencesAsOneRequest)
+{
+    // Arrange: an attached replica, it gets the writes of a script instead of the script
+    Connection replica{}, conn{};
+    replica.fd = EXPECTED_CLIENT_FD;
+    conn.fd = EXPECTED_CLIENT_FD + 1;
+    ON_CALL(mock_epoll, get_connection_impl(EXPECTED_CLIENT_FD)).WillByDefault(ReturnRef(replica));
+    send_request(server, replica, { "psync", "?", "0" });
+    replica.outgoing.clear();
+
+    std::string const check_and_set{ "if call('get', KEYS[1]) == ARGV[1] then\n"
+                                     "    return call('set', KEYS[1], ARGV[2])\n"
+                                     "end\n"
+                                     "return false" };
+    std::string const capped_incr{ "local n = tonumber(call('get', KEYS[1])) or 0\n"
+                                   "if n + ARGV[1] > tonumber(ARGV[2]) then return nil end\n"
+                                   "return call('incrby', KEYS[1], ARGV[1])" };
+
+    // Act/Assert: scripts are known by the SHA-1 of their source
+    EXPECT_EQ(send_request(server, conn, { "script", "load", "return 1" }).second,
+              "e0e1f9fabfc9d4800c877a703b823ac0578ff8db");
+    EXPECT_EQ(send_request(server, conn, { "evalsha", "e0e1f9fabfc9d4800c877a703b823ac0578ff8db", "0" }).second, "1");
+    EXPECT_EQ(send_request(server, conn, { "evalsha", std::string(40, '0'), "0" }).first, ResponseStatus::RES_ERR);
+
+    send_request(server, conn, { "set", "k", "old" });
+    EXPECT_EQ(send_request(server, conn, { "eval", check_and_set, "1", "k", "other", "new" }).first,
+              ResponseStatus::RES_NX);
+    EXPECT_EQ(send_request(server, conn, { "eval", check_and_set, "1", "k", "old", "new" }).second, "k set to new");
+    EXPECT_EQ(send_request(server, conn, { "get", "k" }).second, "new");
+
+    for ( int i = 0; i < 3; i++ )
+        send_request(server, conn, { "eval", capped_incr, "1", "hits", "4", "10" });
+    EXPECT_EQ(send_request(server, conn, { "get", "hits" }).second, "8");
+
+    // Only the writes reach the replica, between `multi` and `exec`
+    std::vector<uint8_t> forwarded;
+    append_request_frame(forwarded, { "set", "k", "old" });
+    append_request_frame(forwarded, { "multi" });
+    append_request_frame(forwarded, { "set", "k", "new" });
+    append_request_frame(forwarded, { "exec" });
+    for ( int i = 0; i < 2; i++ )
+    {
+        append_request_frame(forwarded, { "multi" });
+        append_request_frame(forwarded, { "incrby", "hits", "4" });
+        append_request_frame(forwarded, { "exec" });
+    }
+    EXPECT_EQ(replica.outgoing, forwarded);
+
+    // Syntax errors, failed calls and scripts over their time limit are errors
+    EXPECT_EQ(send_request(server, conn, { "eval", "return (", "0" }).first, ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "eval", "return call('zadd', KEYS[1], 1, 'm')", "1", "k" }).first,
+              ResponseStatus::RES_ERR);
+    server.configure({ .script_time_limit = std::chrono::milliseconds(10) });
+    EXPECT_EQ(send_request(server, conn, { "eval", "while true do end", "0" }).first, ResponseStatus::RES_ERR);
+}
+
+TEST(ScriptTest, BytecodeFollowsTheLanguageRules)
+{
+    auto eval = [](std::string_view source)
+    {
+        std::string err;
+        auto const script = compile_script(source, err);
+        if ( !script )
+            return err;
+        std::vector<std::string> const keys{ "key" }, args{ "7", "x" };
+        auto const result = run_script(*script, keys, args, std::chrono::steady_clock::time_point::max(),
+                                       [](auto const&, ScriptValue& reply, std::string&)
+                                       {
+                                           reply = std::string("reply");
+                                           return true;
+                                       });
+        return result.ok ? script_detail::to_string(result.value) : result.error;
+    };
+
+    EXPECT_EQ(eval("return 1 + 2 * 3 - 4 / 2 % 3"), "5");
+    EXPECT_EQ(eval("return ARGV[1] + 1 .. KEYS[1] .. #ARGV .. #KEYS[1]"), "8key23");
+    EXPECT_EQ(eval("return nil or false or 'x'"), "x");
+    EXPECT_EQ(eval("return 1 and nil"), "nil");
+    EXPECT_EQ(eval("return 1 == '1'"), "false");
+    EXPECT_EQ(eval("return KEYS[2]"), "nil");
+    EXPECT_EQ(eval("return call('get', KEYS[1])"), "reply");
+    EXPECT_EQ(eval("local i = 0 local sum = 0\n"
+                   "while true do\n"
+                   "    i = i + 1 -- comment\n"
+                   "    if i > 10 then break elseif i % 2 == 0 then sum = sum + i end\n"
+                   "end\n"
+                   "return sum"),
+              "30");
+    EXPECT_EQ(eval("if true then local x = 1 end return x"), "ERR script line 1: undeclared variable 'x'");
+    EXPECT_EQ(eval("return 9223372036854775807 + 1"), "ERR integer overflow");
+    EXPECT_EQ(eval("return 1 < 'a'"),
+              "ERR comparison of two values that are not both integers or both strings");
+}
+
+TEST_F(ServerTest, ConfigSetChangesRuntimeParametersForTheNextRequest)
+{
+    // Arrange
+    Connection conn{};
+    conn.fd = EXPECTED_CLIENT_FD;
+    auto config_get = [&](std::string_view pattern)
+    {
+        auto const reply = send_request(server, conn, { "config", "get", pattern }).second;
+        std::vector<std::optional<std::string>> items;
+        EXPECT_TRUE(parse_array(reinterpret_cast<uint8_t const*>(reply.data()), reply.size(), items));
+        std::vector<std::string> out;
+        for ( auto const& item : items )
+            out.push_back(item.value_or("nil"));
+        return out;
+    };
+
+    // Act/Assert: the defaults, configure() shows up in `config get`
+    EXPECT_EQ(config_get("max-*"), (std::vector<std::string>{ "max-clients", "100", "max-msg-size", "33554432",
+                                                               "max-cmd-args", "200000" }));
+    server.configure({ .compress_threshold = 4096 });
+    EXPECT_EQ(config_get("compress-threshold"), (std::vector<std::string>{ "compress-threshold", "4096" }));
+    EXPECT_EQ(config_get("port"), (std::vector<std::string>{ "port", std::to_string(DUMMY_PORT) }));
+    EXPECT_TRUE(config_get("no-such-*").empty());
+
+    // Runtime parameters apply from the next request on
+    EXPECT_EQ(send_request(server, conn, { "config", "set", "max-cmd-args", "4" }).first, ResponseStatus::RES_OK);
+    EXPECT_EQ(send_request(server, conn, { "set", "k", "v" }).first, ResponseStatus::RES_OK);
+    append_request_frame(conn.incoming, { "mset", "a", "1", "b", "2" });
+    size_t const sent = conn.outgoing.size();
+    EXPECT_FALSE(server.try_request(conn));
+    EXPECT_EQ(conn.outgoing.size(), sent);
+    conn.incoming.clear();
+    EXPECT_EQ(send_request(server, conn, { "config", "set", "max-cmd-args", "200000" }).first, ResponseStatus::RES_OK);
+
+    EXPECT_EQ(send_request(server, conn, { "config", "set", "max-msg-size", "1kb" }).first, ResponseStatus::RES_OK);
+    EXPECT_EQ(config_get("max-msg-size"), (std::vector<std::string>{ "max-msg-size", "1024" }));
+    append_request_frame(conn.incoming, { "set", "big", std::string(2048, 'v') });
+    EXPECT_FALSE(server.try_request(conn));
+    EXPECT_TRUE(conn.want_close);
+
+    conn = Connection{}; // Reconnected
+    conn.fd = EXPECTED_CLIENT_FD;
+    EXPECT_EQ(send_request(server, conn, { "config", "set", "loglevel", "error" }).first, ResponseStatus::RES_OK);
+    EXPECT_EQ(spdlog::get_level(), spdlog::level::err);
+    EXPECT_EQ(send_request(server, conn, { "config", "set", "lazyfree", "yes" }).first, ResponseStatus::RES_OK);
+    EXPECT_EQ(config_get("lazyfree"), (std::vector<std::string>{ "lazyfree", "yes" }));
+
+    // Startup parameters, unknown names and bad values are refused and change nothing
+    EXPECT_EQ(send_request(server, conn, { "config", "set", "port", "7000" }),
+              std::make_pair(ResponseStatus::RES_ERR, std::string("ERR port can only be set at startup")));
+    EXPECT_EQ(send_request(server, conn, { "config", "set", "snapshot-file", "/etc/cron.d/kv" }),
+              std::make_pair(ResponseStatus::RES_ERR, std::string("ERR snapshot-file can only be set at startup")));
+    EXPECT_EQ(send_request(server, conn, { "config", "set", "maxmemory", "1gb" }),
+              std::make_pair(ResponseStatus::RES_ERR, std::string("ERR unknown parameter maxmemory")));
+    EXPECT_EQ(send_request(server, conn, { "config", "set", "max-msg-size", "lots" }).first,
+              ResponseStatus::RES_ERR);
+    EXPECT_EQ(send_request(server, conn, { "config", "set", "pubsub-output-limit", "1mb:64kb" }).first,
+              ResponseStatus::RES_ERR);
+    EXPECT_EQ(config_get("max-msg-size"), (std::vector<std::string>{ "max-msg-size", "1024" }));
+    spdlog::set_level(spdlog::level::info);
+}
+
+TEST(ConfigTest, FlagsOverrideTheFileAndBadValuesAreReported)
+{
+    std::string const path{ testing::TempDir() + "config_test.conf" };
+    {
+        std::ofstream file(path);
+        file << "# tuning\n"
+             << "port 7000\n"
+             << "  read-buffer-size   16kb  # per read\n"
+             << "\n"
+             << "pubsub-output-limit 64mb:16MB:30\n"
+             << "lazyfree yes\n";
+    }
+
+    char const* argv[]{ "server", "--port", "7001", "--config", path.c_str(), "--max-msg-size", "1g" };
+    ServerConfig const config = parse_config_args(std::size(argv), argv);
+    EXPECT_EQ(config.port, 7001);
+    EXPECT_EQ(config.read_buffer_size, 16u << 10);
+    EXPECT_EQ(config.max_msg_size, 1u << 30);
+    EXPECT_EQ(config.pubsub_limits.hard, 64u << 20);
+    EXPECT_EQ(config.pubsub_limits.soft, 16u << 20);
+    EXPECT_EQ(config.pubsub_limits.soft_seconds, std::chrono::seconds(30));
+    EXPECT_TRUE(config.lazy_free);
+    EXPECT_EQ(config.max_cmd_args, DEFAULT_MAX_CMD_ARGS);
+
+    // Every parameter reads back what it was set to
+    ServerConfig copy{};
+    for ( ConfigParam const& param : CONFIG_PARAMS )
+    {
+        std::string err;
+        EXPECT_TRUE(param.set(copy, param.get(config), err)) << param.name << ": " << err;
+        EXPECT_EQ(param.get(copy), param.get(config)) << param.name;
+    }
+
+    {
+        std::ofstream file(path);
+        file << "port 7000\nmax-clients 300\n";
+    }
+    char const* bad_file[]{ "server", "--config", path.c_str() };
+    try
+    {
+        parse_config_args(std::size(bad_file), bad_file);
+        ADD_FAILURE() << "max-clients 300 was accepted";
+    }
+    catch ( std::invalid_argument const& e )
+    {
+        EXPECT_EQ(std::string(e.what()), path + ":2: max-clients expects a number between 1 and 255");
+    }
+    char const* unknown[]{ "server", "--eviction-policy", "lru" };
+    EXPECT_THROW(parse_config_args(std::size(unknown), unknown), std::invalid_argument);
+    char const* missing[]{ "server", "--port" };
+    EXPECT_THROW(parse_config_args(std::size(missing), missing), std::invalid_argument);
+    std::remove(path.c_str());
+}
+
+TEST_F(ServerTest, GracefulShutdownSavesTheKeyspaceAndStartupLoadsIt)
+{
+    // Arrange
+    std::string const path{ testing::TempDir() + "shutdown_test.snapshot" };
+    std::remove(path.c_str());
+    ServerConfig config{};
+    config.port = DUMMY_PORT;
+    config.snapshot_file = path;
+    server.configure(config);
+
+    Connection conn{};
+    conn.fd = EXPECTED_CLIENT_FD;
+    send_request(server, conn, { "set", "greeting", "hello" });
+    send_request(server, conn, { "zadd", "board", "10", "alice", "20", "bob" });
+    send_request(server, conn, { "rpush", "jobs", "a", "b" });
+
+    // Act: no clients to wait for, the snapshot is written at once
+    server.shutdown();
+    ASSERT_TRUE(std::ifstream(path).good());
+
+    MockEpollWrapper epoll;
+    Server<MockSocketWrapper, MockEpollWrapper> restarted(DUMMY_PORT, mock_sock, epoll);
+    restarted.configure(config);
+    EXPECT_CALL(epoll, add_conn_impl(EXPECTED_SERVER_FD))
+        .Times(1)
+        .WillOnce([&restarted]() { restarted.stop(); });
+    restarted.start();
+
+    // Assert
+    Connection client{};
+    client.fd = EXPECTED_CLIENT_FD;
+    EXPECT_EQ(send_request(restarted, client, { "get", "greeting" }).second, "hello");
+    EXPECT_EQ(send_request(restarted, client, { "zscore", "board", "bob" }).second, "20");
+    EXPECT_EQ(send_request(restarted, client, { "llen", "jobs" }).second, "2");
+
+    // A corrupt snapshot stops the startup rather than serving a partial keyspace
+    {
+        std::ofstream file(path, std::ios::app);
+        file << "garbage";
+    }
+    Server<MockSocketWrapper, MockEpollWrapper> corrupt(DUMMY_PORT, mock_sock, epoll);
+    corrupt.configure(config);
+    EXPECT_THROW(corrupt.start(), std::runtime_error);
+    std::remove(path.c_str());
+}
+
+TEST(PubSubTest, GlobMatchesLikeRedis)
+{
+    EXPECT_TRUE(glob_match("news.*", "news.sports"));
+    EXPECT_TRUE(glob_match("*", ""));
+    EXPECT_TRUE(glob_match("h?llo", "hello"));
+    EXPECT_TRUE(glob_match("h[^e]llo", "hallo"));
+    EXPECT_FALSE(glob_match("h[^e]llo", "hello"));
+    EXPECT_TRUE(glob_match("h[a-c]llo", "hbllo"));
+    EXPECT_TRUE(glob_match("a*b*c", "axxbyyc"));
+    EXPECT_FALSE(glob_match("a*b*c", "axxbyy"));
+    EXPECT_TRUE(glob_match("literal\\*", "literal*"));
+    EXPECT_FALSE(glob_match("literal\\*", "literalx"));
+}
+
+TEST(ListTest, KeepsOrderAcrossChunksAndEnds)
+{
+    // Arrange: long elements need two-byte lengths and fill chunks quickly
+    List list;
+    std::deque<std::string> expected;
+    for ( int i = 0; i < 2000; i++ )
+    {
+        std::string const value(i % 300, static_cast<char>('a' + i % 26));
+        if ( i % 3 == 0 )
+        {
+            list.push_front(value);
+            expected.push_front(value);
+        }
+        else
+        {
+            list.push_back(value);
+            expected.push_back(value);
+        }
+    }
+
+    // Act/Assert
+    EXPECT_GT(list.num_chunks(), 1);
+    std::vector<std::string> range;
+    list.range(500, 520, [&range](std::string_view value) { range.emplace_back(value); });
+    EXPECT_TRUE(std::equal(range.begin(), range.end(), expected.begin() + 500, expected.begin() + 521));
+
+    while ( !expected.empty() )
+    {
+        ASSERT_EQ(list.pop_back(), expected.back());
+        expected.pop_back();
+        if ( expected.empty() )
+            break;
+        ASSERT_EQ(list.pop_front(), expected.front());
+        expected.pop_front();
+    }
+    EXPECT_EQ(list.size(), 0);
+    EXPECT_EQ(list.pop_front(), std::nullopt);
+}
+
 // clang-format on